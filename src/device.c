@@ -2,7 +2,12 @@
 #include "device_vtable.h"
 #include "config.h"
 #include "window.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #if 0
 # include <stdio.h>
@@ -11,6 +16,52 @@
 # define DEV_DEBUG
 #endif
 
+typedef struct memory_counter_s
+{
+	_Atomic(uint64_t) bytes;
+	_Atomic(uint64_t) peak;
+	_Atomic(uint32_t) count;
+} memory_counter_t;
+
+struct gfx_memory_counters_s
+{
+	memory_counter_t categories[GFX_MEMORY_CATEGORIES];
+	memory_counter_t tags[GFX_MEMORY_TAGS];
+};
+
+struct gfx_residency_s
+{
+	gfx_residency_t *next_added;
+	gfx_residency_t *next_deleted;
+	atomic_flag lock; /* held by the eviction, and by the deletion which waits for it */
+	atomic_bool deleted;
+	gfx_texture_t *texture;
+	gfx_buffer_t *buffer;
+	gfx_texture_reload_fn_t texture_reload;
+	gfx_buffer_reload_fn_t buffer_reload;
+	void *userdata;
+	uint8_t **shadows; /* CPU copy of each level, or of the buffer, uploaded on restore without a reload function */
+	uint32_t shadows_count;
+	uint64_t last_use;
+	bool evicted;
+};
+
+/* the array is only used by the device thread, the other threads push their changes, applied on tick */
+struct gfx_residencies_s
+{
+	gfx_residency_t **array;
+	uint32_t count;
+	_Atomic(gfx_residency_t*) added;
+	_Atomic(gfx_residency_t*) deleted;
+};
+
+static void init_memory_counter(memory_counter_t *counter)
+{
+	atomic_init(&counter->bytes, 0);
+	atomic_init(&counter->peak, 0);
+	atomic_init(&counter->count, 0);
+}
+
 void gfx_device_delete(gfx_device_t *device)
 {
 	if (!device)
@@ -19,6 +70,31 @@ void gfx_device_delete(gfx_device_t *device)
 	GFX_FREE(device);
 }
 
+/* the uncompressed and s3tc formats, for the backends without a query */
+static const enum gfx_format default_formats[] =
+{
+	GFX_DEPTH24_STENCIL8,
+	GFX_BGRA32F,
+	GFX_BGRA16F,
+	GFX_RGB32F,
+	GFX_B8G8R8A8,
+	GFX_B5G5R5A1,
+	GFX_B4G4R4A4,
+	GFX_B5G6R5,
+	GFX_R8G8,
+	GFX_R8,
+	GFX_BC1_RGB,
+	GFX_BC1_RGBA,
+	GFX_BC2_RGBA,
+	GFX_BC3_RGBA,
+	GFX_R11G11B10F,
+	GFX_R16G16F,
+	GFX_R16F,
+	GFX_R32F,
+	GFX_D16,
+	GFX_D32F,
+};
+
 static bool ctr(gfx_device_t *device, gfx_window_t *window)
 {
 	device->window = window;
@@ -26,13 +102,55 @@ static bool ctr(gfx_device_t *device, gfx_window_t *window)
 	device->triangles_count = 0;
 	device->points_count = 0;
 	device->lines_count = 0;
+	device->skipped_calls_count = 0;
 	device->max_samplers = 0;
+	/* the limits every backend supports, raised by the ones querying them */
+	device->max_texture_size = 8192;
+	device->max_texture_3d_size = 2048;
+	device->max_texture_layers = 2048;
+	device->formats = 0;
+	for (size_t i = 0; i < sizeof(default_formats) / sizeof(*default_formats); ++i)
+		device->formats |= UINT64_C(1) << default_formats[i];
+	device->shader_cache = NULL;
+	device->async_shaders = false;
+	device->buffer_shadow = false;
+	device->render_pass_target = NULL;
+	device->render_pass = false;
+	device->memory_tag = 0;
+	device->memory_budget = 0;
+	device->driver_memory_budget = 0;
+	device->residencies = NULL;
+	device->frame = 0;
+	device->memory_counters = GFX_MALLOC(sizeof(*device->memory_counters));
+	if (!device->memory_counters)
+	{
+		GFX_ERROR_CALLBACK("memory counters allocation failed: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	for (uint32_t i = 0; i < GFX_MEMORY_CATEGORIES; ++i)
+		init_memory_counter(&device->memory_counters->categories[i]);
+	for (uint32_t i = 0; i < GFX_MEMORY_TAGS; ++i)
+		init_memory_counter(&device->memory_counters->tags[i]);
+	device->residencies = GFX_MALLOC(sizeof(*device->residencies));
+	if (!device->residencies)
+	{
+		GFX_ERROR_CALLBACK("residencies allocation failed: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	device->residencies->array = NULL;
+	device->residencies->count = 0;
+	atomic_init(&device->residencies->added, NULL);
+	atomic_init(&device->residencies->deleted, NULL);
 	return true;
 }
 
+static void free_residencies(gfx_device_t *device);
+
 static void dtr(gfx_device_t *device)
 {
-	(void)device;
+	GFX_FREE(device->shader_cache);
+	free_residencies(device);
+	GFX_FREE(device->memory_counters);
 }
 
 static void tick(gfx_device_t *device)
@@ -41,6 +159,538 @@ static void tick(gfx_device_t *device)
 	device->triangles_count = 0;
 	device->points_count = 0;
 	device->lines_count = 0;
+	device->skipped_calls_count = 0;
+	device->frame++;
+}
+
+static void update_memory_usage(memory_counter_t *counter, uint64_t size, bool add)
+{
+	if (add)
+	{
+		uint64_t bytes = atomic_fetch_add(&counter->bytes, size) + size;
+		atomic_fetch_add(&counter->count, 1);
+		uint64_t peak = atomic_load(&counter->peak);
+		while (bytes > peak && !atomic_compare_exchange_weak(&counter->peak, &peak, bytes))
+			;
+	}
+	else
+	{
+		atomic_fetch_sub(&counter->bytes, size);
+		atomic_fetch_sub(&counter->count, 1);
+	}
+}
+
+static void account_memory(gfx_device_t *device, enum gfx_memory_category category, uint32_t tag, uint64_t size, bool add)
+{
+	update_memory_usage(&device->memory_counters->categories[category], size, add);
+	update_memory_usage(&device->memory_counters->tags[tag], size, add);
+}
+
+void gfx_device_set_memory_usage(gfx_device_t *device, enum gfx_memory_category category, uint64_t bytes, uint64_t peak, uint32_t count)
+{
+	memory_counter_t *counter = &device->memory_counters->categories[category];
+	atomic_store(&counter->bytes, bytes);
+	atomic_store(&counter->peak, peak);
+	atomic_store(&counter->count, count);
+}
+
+/* multisample textures have their samples count as lod */
+static void account_texture(gfx_device_t *device, const gfx_texture_t *texture, bool add)
+{
+	enum gfx_memory_category category = GFX_MEMORY_TEXTURE;
+	uint64_t size = 0;
+	switch (texture->type)
+	{
+		case GFX_TEXTURE_2D_MS:
+			size = gfx_texture_level_size(texture->format, texture->width, texture->height, 1) * texture->lod;
+			category = GFX_MEMORY_RENDER_TARGET;
+			break;
+		case GFX_TEXTURE_2D_ARRAY_MS:
+			size = gfx_texture_level_size(texture->format, texture->width, texture->height, texture->depth) * texture->lod;
+			category = GFX_MEMORY_RENDER_TARGET;
+			break;
+		case GFX_TEXTURE_2D:
+		case GFX_TEXTURE_2D_ARRAY:
+		case GFX_TEXTURE_3D:
+		{
+			uint32_t width = texture->width;
+			uint32_t height = texture->height;
+			uint32_t depth = texture->type == GFX_TEXTURE_2D ? 1 : texture->depth;
+			for (uint8_t i = 0; i < texture->lod; ++i)
+			{
+				size += gfx_texture_level_size(texture->format, width, height, depth);
+				width = width > 1 ? width / 2 : 1;
+				height = height > 1 ? height / 2 : 1;
+				if (texture->type == GFX_TEXTURE_3D)
+					depth = depth > 1 ? depth / 2 : 1;
+			}
+			break;
+		}
+	}
+	if (gfx_format_has_depth(texture->format))
+		category = GFX_MEMORY_RENDER_TARGET;
+	account_memory(device, category, texture->memory_tag, size, add);
+}
+
+void gfx_device_set_memory_tag(gfx_device_t *device, uint32_t tag)
+{
+	if (tag >= GFX_MEMORY_TAGS)
+	{
+		GFX_ERROR_CALLBACK("invalid memory tag: %" PRIu32, tag);
+		return;
+	}
+	device->memory_tag = tag;
+}
+
+static void load_memory_usage(memory_counter_t *counter, gfx_memory_usage_t *usage)
+{
+	usage->bytes = atomic_load(&counter->bytes);
+	usage->peak = atomic_load(&counter->peak);
+	usage->count = atomic_load(&counter->count);
+}
+
+/* each counter is read atomically, but not the whole stats at once */
+void gfx_device_get_memory_stats(const gfx_device_t *device, gfx_memory_stats_t *stats)
+{
+	for (uint32_t i = 0; i < GFX_MEMORY_CATEGORIES; ++i)
+		load_memory_usage(&device->memory_counters->categories[i], &stats->categories[i]);
+	for (uint32_t i = 0; i < GFX_MEMORY_TAGS; ++i)
+		load_memory_usage(&device->memory_counters->tags[i], &stats->tags[i]);
+}
+
+bool gfx_device_supports_format(const gfx_device_t *device, enum gfx_format format)
+{
+	return (device->formats >> format) & 1;
+}
+
+/* bytes per texel, or per 4x4 block for compressed formats */
+static const uint8_t format_block_sizes[] =
+{
+	4,
+	16,
+	8,
+	12,
+	4,
+	2,
+	2,
+	2,
+	2,
+	1,
+	8,
+	8,
+	16,
+	16,
+	8,
+	16,
+	16,
+	16,
+	8,
+	16,
+	8,
+	16,
+	4,
+	4,
+	2,
+	4,
+	2,
+	4,
+};
+
+static const uint8_t format_block_dims[] =
+{
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+};
+
+void gfx_device_set_memory_budget(gfx_device_t *device, uint64_t budget)
+{
+	device->memory_budget = budget;
+}
+
+static gfx_residency_t *new_residency(gfx_device_t *device, uint32_t shadows_count)
+{
+	gfx_residency_t *residency = GFX_MALLOC(sizeof(*residency) + sizeof(*residency->shadows) * shadows_count);
+	if (!residency)
+	{
+		GFX_ERROR_CALLBACK("residency allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	residency->next_added = NULL;
+	residency->next_deleted = NULL;
+	atomic_flag_clear(&residency->lock);
+	atomic_init(&residency->deleted, false);
+	residency->shadows = (uint8_t**)(residency + 1);
+	residency->shadows_count = shadows_count;
+	for (uint32_t i = 0; i < shadows_count; ++i)
+		residency->shadows[i] = NULL;
+	residency->texture = NULL;
+	residency->buffer = NULL;
+	residency->texture_reload = NULL;
+	residency->buffer_reload = NULL;
+	residency->userdata = NULL;
+	residency->last_use = device->frame;
+	residency->evicted = false;
+	return residency;
+}
+
+static void add_residency(gfx_device_t *device, gfx_residency_t *residency)
+{
+	_Atomic(gfx_residency_t*) *added = &device->residencies->added;
+	residency->next_added = atomic_load_explicit(added, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(added, &residency->next_added, residency, memory_order_release, memory_order_relaxed))
+		;
+}
+
+static void free_shadows(gfx_residency_t *residency)
+{
+	for (uint32_t i = 0; i < residency->shadows_count; ++i)
+		GFX_FREE(residency->shadows[i]);
+}
+
+/* waits for the eviction of the resource, which is left alone from then on, and freed by the device thread */
+static void delete_residency(gfx_device_t *device, gfx_residency_t *residency)
+{
+	while (atomic_flag_test_and_set_explicit(&residency->lock, memory_order_acquire))
+		;
+	atomic_store(&residency->deleted, true);
+	atomic_flag_clear_explicit(&residency->lock, memory_order_release);
+	_Atomic(gfx_residency_t*) *deleted = &device->residencies->deleted;
+	residency->next_deleted = atomic_load_explicit(deleted, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(deleted, &residency->next_deleted, residency, memory_order_release, memory_order_relaxed))
+		;
+}
+
+/* the deletions are taken first, so that the additions of the deleted residencies are already pushed */
+static void update_residencies(gfx_device_t *device)
+{
+	gfx_residencies_t *residencies = device->residencies;
+	gfx_residency_t *deleted = atomic_exchange_explicit(&residencies->deleted, NULL, memory_order_acquire);
+	gfx_residency_t *added = atomic_exchange_explicit(&residencies->added, NULL, memory_order_acquire);
+	for (gfx_residency_t *residency = added; residency; residency = residency->next_added)
+	{
+		gfx_residency_t **array = GFX_REALLOC(residencies->array, sizeof(*array) * (residencies->count + 1));
+		if (!array)
+		{
+			/* left out of the eviction, the resource stays resident */
+			GFX_ERROR_CALLBACK("residency allocation failed: %s (%d)", strerror(errno), errno);
+			continue;
+		}
+		residencies->array = array;
+		array[residencies->count++] = residency;
+	}
+	while (deleted)
+	{
+		gfx_residency_t *residency = deleted;
+		deleted = residency->next_deleted;
+		for (uint32_t i = 0; i < residencies->count; ++i)
+		{
+			if (residencies->array[i] != residency)
+				continue;
+			residencies->array[i] = residencies->array[--residencies->count];
+			break;
+		}
+		free_shadows(residency);
+		GFX_FREE(residency);
+	}
+}
+
+static void free_residencies(gfx_device_t *device)
+{
+	if (!device->residencies)
+		return;
+	update_residencies(device);
+	gfx_residencies_t *residencies = device->residencies;
+	for (uint32_t i = 0; i < residencies->count; ++i)
+	{
+		gfx_residency_t *residency = residencies->array[i];
+		if (residency->texture)
+			residency->texture->residency = NULL;
+		else
+			residency->buffer->residency = NULL;
+		free_shadows(residency);
+		GFX_FREE(residency);
+	}
+	GFX_FREE(residencies->array);
+	GFX_FREE(residencies);
+}
+
+static uint8_t *get_shadow(gfx_residency_t *residency, uint32_t index, uint64_t size)
+{
+	if (residency->shadows[index])
+		return residency->shadows[index];
+	uint8_t *shadow = GFX_MALLOC(size);
+	if (!shadow)
+	{
+		GFX_ERROR_CALLBACK("residency shadow allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	memset(shadow, 0, size);
+	residency->shadows[index] = shadow;
+	return shadow;
+}
+
+static void level_dims(const gfx_texture_t *texture, uint8_t lod, uint32_t *width, uint32_t *height, uint32_t *depth)
+{
+	*width = texture->width >> lod ? texture->width >> lod : 1;
+	*height = texture->height >> lod ? texture->height >> lod : 1;
+	*depth = texture->type == GFX_TEXTURE_2D ? 1 : texture->depth;
+	if (texture->type == GFX_TEXTURE_3D && !(*depth >>= lod))
+		*depth = 1;
+}
+
+/* the offset is the first row of 2d textures, and the first layer of the others */
+static void write_texture_shadow(gfx_texture_t *texture, uint8_t lod, uint32_t offset, uint32_t width, uint32_t height, uint32_t depth, const void *data)
+{
+	uint32_t level_width;
+	uint32_t level_height;
+	uint32_t level_depth;
+	level_dims(texture, lod, &level_width, &level_height, &level_depth);
+	uint32_t row = texture->type == GFX_TEXTURE_2D ? offset : 0;
+	uint32_t layer = texture->type == GFX_TEXTURE_2D ? 0 : offset;
+	uint32_t layers = texture->type == GFX_TEXTURE_2D ? 1 : depth;
+	if (lod >= texture->residency->shadows_count
+	 || width > level_width
+	 || row + height > level_height
+	 || layer + layers > level_depth)
+		return;
+	uint8_t *shadow = get_shadow(texture->residency, lod, gfx_texture_level_size(texture->format, level_width, level_height, level_depth));
+	if (!shadow)
+		return;
+	uint32_t block_dim = format_block_dims[texture->format];
+	uint64_t src_pitch = gfx_texture_level_size(texture->format, width, 1, 1);
+	uint64_t dst_pitch = gfx_texture_level_size(texture->format, level_width, 1, 1);
+	uint64_t src_layer = gfx_texture_level_size(texture->format, width, height, 1);
+	uint64_t dst_layer = gfx_texture_level_size(texture->format, level_width, level_height, 1);
+	uint32_t rows = (height + block_dim - 1) / block_dim;
+	const uint8_t *src = data;
+	uint8_t *dst = shadow + layer * dst_layer + (row / block_dim) * dst_pitch;
+	for (uint32_t z = 0; z < layers; ++z)
+	{
+		for (uint32_t y = 0; y < rows; ++y)
+			memcpy(&dst[z * dst_layer + y * dst_pitch], &src[z * src_layer + y * src_pitch], src_pitch);
+	}
+}
+
+static void write_buffer_shadow(gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset)
+{
+	if (offset > buffer->size || size > buffer->size - offset)
+		return;
+	uint8_t *shadow = get_shadow(buffer->residency, 0, buffer->size);
+	if (shadow)
+		memcpy(&shadow[offset], data, size);
+}
+
+bool gfx_set_texture_evictable(gfx_texture_t *texture, gfx_texture_reload_fn_t reload, void *userdata)
+{
+	if (texture->residency)
+		return true;
+	gfx_residency_t *residency = new_residency(texture->device, reload ? 0 : texture->lod);
+	if (!residency)
+		return false;
+	residency->texture = texture;
+	residency->texture_reload = reload;
+	residency->userdata = userdata;
+	texture->residency = residency;
+	add_residency(texture->device, residency);
+	return true;
+}
+
+bool gfx_set_buffer_evictable(gfx_buffer_t *buffer, gfx_buffer_reload_fn_t reload, void *userdata)
+{
+	if (buffer->residency)
+		return true;
+	gfx_residency_t *residency = new_residency(buffer->device, reload ? 0 : 1);
+	if (!residency)
+		return false;
+	residency->buffer = buffer;
+	residency->buffer_reload = reload;
+	residency->userdata = userdata;
+	buffer->residency = residency;
+	add_residency(buffer->device, residency);
+	return true;
+}
+
+/* the writes through the mapping of a buffer are kept from it, the buffer staying resident if they can't be */
+static bool evict(gfx_device_t *device, gfx_residency_t *residency)
+{
+	if (residency->texture)
+	{
+		account_texture(device, residency->texture, false);
+		device->vtable->delete_texture(device, residency->texture);
+	}
+	else
+	{
+		gfx_buffer_t *buffer = residency->buffer;
+		if (buffer->map && !residency->buffer_reload)
+		{
+			uint8_t *shadow = get_shadow(residency, 0, buffer->size);
+			if (!shadow)
+				return false;
+			memcpy(shadow, buffer->map, buffer->size);
+		}
+		account_memory(device, GFX_MEMORY_BUFFER, residency->buffer->memory_tag, residency->buffer->size, false);
+		device->vtable->delete_buffer(device, residency->buffer);
+	}
+	residency->evicted = true;
+	return true;
+}
+
+/* the deleted objects keep their description, from which they are created again */
+static bool restore_texture(gfx_device_t *device, gfx_residency_t *residency)
+{
+	gfx_texture_t *texture = residency->texture;
+	gfx_texture_t desc = *texture;
+	if (!device->vtable->create_texture(device, texture, desc.type, desc.format, desc.lod, desc.width, desc.height, desc.depth))
+		return false;
+	account_texture(device, texture, true);
+	gfx_set_texture_addressing(texture, desc.addressing_s, desc.addressing_t, desc.addressing_r);
+	gfx_set_texture_filtering(texture, desc.min_filtering, desc.mag_filtering, desc.mip_filtering);
+	gfx_set_texture_anisotropy(texture, desc.anisotropy);
+	gfx_set_texture_levels(texture, desc.min_level, desc.max_level);
+	if (residency->texture_reload)
+		return residency->texture_reload(texture, residency->userdata);
+	for (uint32_t i = 0; i < residency->shadows_count; ++i)
+	{
+		if (!residency->shadows[i])
+			continue;
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;
+		level_dims(texture, i, &width, &height, &depth);
+		uint64_t size = gfx_texture_level_size(texture->format, width, height, depth);
+		device->vtable->set_texture_data(device, texture, i, 0, width, height, depth, size, residency->shadows[i]);
+	}
+	return true;
+}
+
+static bool restore_buffer(gfx_device_t *device, gfx_residency_t *residency)
+{
+	gfx_buffer_t *buffer = residency->buffer;
+	if (!device->vtable->create_buffer(device, buffer, buffer->type, NULL, buffer->size, buffer->usage))
+		return false;
+	account_memory(device, GFX_MEMORY_BUFFER, buffer->memory_tag, buffer->size, true);
+	if (residency->buffer_reload)
+		return residency->buffer_reload(buffer, residency->userdata);
+	if (residency->shadows_count && residency->shadows[0])
+		device->vtable->set_buffer_data(device, buffer, residency->shadows[0], buffer->size, 0);
+	return true;
+}
+
+static void use_residency(gfx_device_t *device, gfx_residency_t *residency)
+{
+	if (!residency)
+		return;
+	residency->last_use = device->frame;
+	if (!residency->evicted)
+		return;
+	residency->evicted = false;
+	if (!(residency->texture ? restore_texture(device, residency) : restore_buffer(device, residency)))
+		GFX_ERROR_CALLBACK("failed to restore evicted resource");
+}
+
+static uint64_t resources_memory(const gfx_device_t *device)
+{
+	memory_counter_t *categories = device->memory_counters->categories;
+	return atomic_load(&categories[GFX_MEMORY_BUFFER].bytes) + atomic_load(&categories[GFX_MEMORY_TEXTURE].bytes) + atomic_load(&categories[GFX_MEMORY_RENDER_TARGET].bytes);
+}
+
+static void enforce_memory_budget(gfx_device_t *device)
+{
+	uint64_t budget = device->memory_budget ? device->memory_budget : device->driver_memory_budget;
+	if (!budget)
+		return;
+	while (resources_memory(device) > budget)
+	{
+		gfx_residency_t *lru = NULL;
+		for (uint32_t i = 0; i < device->residencies->count; ++i)
+		{
+			gfx_residency_t *residency = device->residencies->array[i];
+			if (residency->evicted || atomic_load(&residency->deleted) || device->frame - residency->last_use < GFX_MEMORY_EVICTION_FRAMES)
+				continue;
+			if (!lru || residency->last_use < lru->last_use)
+				lru = residency;
+		}
+		if (!lru)
+			break;
+		/* the resources deleted meanwhile are skipped by the next lookup */
+		while (atomic_flag_test_and_set_explicit(&lru->lock, memory_order_acquire))
+			;
+		bool evicted = atomic_load(&lru->deleted) || evict(device, lru);
+		atomic_flag_clear_explicit(&lru->lock, memory_order_release);
+		if (!evicted)
+			break;
+	}
+}
+
+static uint32_t render_pass_colors(const gfx_render_target_t *render_target)
+{
+	return render_target ? render_target->draw_buffers_nb : 1;
+}
+
+/* backends without load actions clear the attachments, the others being loaded */
+static void begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	assert(!device->render_pass);
+	device->vtable->bind_render_target(device, render_target);
+	device->render_pass_target = render_target;
+	device->render_pass = true;
+	if (!load_actions)
+		return;
+	for (uint32_t i = 0; i < render_pass_colors(render_target); ++i)
+	{
+		if (load_actions[i] == GFX_LOAD_ACTION_CLEAR)
+			device->vtable->clear_color(device, render_target, GFX_RENDERTARGET_ATTACHMENT_COLOR0 + i, clear_values[i].color);
+	}
+	if (load_actions[GFX_RENDER_PASS_DEPTH_STENCIL] == GFX_LOAD_ACTION_CLEAR)
+		device->vtable->clear_depth_stencil(device, render_target, clear_values[GFX_RENDER_PASS_DEPTH_STENCIL].depth, clear_values[GFX_RENDER_PASS_DEPTH_STENCIL].stencil);
+}
+
+/* backends without store actions keep every attachment */
+static void end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target)
+{
+	(void)store_actions;
+	assert(device->render_pass);
+	const gfx_render_target_t *render_target = device->render_pass_target;
+	device->render_pass_target = NULL;
+	device->render_pass = false;
+	if (!resolve_target || !render_target)
+		return;
+	for (uint32_t i = 0; i < render_target->draw_buffers_nb && i < resolve_target->draw_buffers_nb; ++i)
+	{
+		uint8_t src = render_target->draw_buffers[i];
+		uint8_t dst = resolve_target->draw_buffers[i];
+		if (src < GFX_RENDERTARGET_ATTACHMENT_COLOR0 || dst < GFX_RENDERTARGET_ATTACHMENT_COLOR0)
+			continue;
+		device->vtable->resolve_render_target(device, render_target, resolve_target, GFX_BUFFER_COLOR_BIT, src - GFX_RENDERTARGET_ATTACHMENT_COLOR0, dst - GFX_RENDERTARGET_ATTACHMENT_COLOR0);
+	}
+	if (render_target->depth_stencil.texture && resolve_target->depth_stencil.texture)
+		device->vtable->resolve_render_target(device, render_target, resolve_target, GFX_BUFFER_DEPTH_BIT | GFX_BUFFER_STENCIL_BIT, 0, 0);
 }
 
 const gfx_device_vtable_t gfx_device_vtable =
@@ -48,12 +698,16 @@ const gfx_device_vtable_t gfx_device_vtable =
 	.ctr  = ctr,
 	.dtr  = dtr,
 	.tick = tick,
+	.begin_render_pass = begin_render_pass,
+	.end_render_pass   = end_render_pass,
 };
 
 void gfx_device_tick(gfx_device_t *device)
 {
 	DEV_DEBUG;
 	device->vtable->tick(device);
+	update_residencies(device);
+	enforce_memory_budget(device);
 	DEV_DEBUG;
 }
 
@@ -64,6 +718,33 @@ uint32_t gfx_get_uniform_buffer_size(gfx_device_t *device, uint32_t buffer_size)
 	return buffer_size;
 }
 
+bool gfx_device_set_shader_cache(gfx_device_t *device, const char *path)
+{
+	GFX_FREE(device->shader_cache);
+	device->shader_cache = NULL;
+	if (!path)
+		return true;
+	size_t len = strlen(path);
+	device->shader_cache = GFX_MALLOC(len + 1);
+	if (!device->shader_cache)
+	{
+		GFX_ERROR_CALLBACK("shader cache path allocation failed");
+		return false;
+	}
+	memcpy(device->shader_cache, path, len + 1);
+	return true;
+}
+
+void gfx_device_set_async_shaders(gfx_device_t *device, bool async_shaders)
+{
+	device->async_shaders = async_shaders;
+}
+
+void gfx_device_set_buffer_shadow(gfx_device_t *device, bool buffer_shadow)
+{
+	device->buffer_shadow = buffer_shadow;
+}
+
 void gfx_clear_color(gfx_device_t *device, const gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, vec4f_t color)
 {
 	DEV_DEBUG;
@@ -155,6 +836,12 @@ bool gfx_create_buffer(gfx_device_t *device, gfx_buffer_t *buffer, enum gfx_buff
 {
 	DEV_DEBUG;
 	bool ret = device->vtable->create_buffer(device, buffer, type, data, size, usage);
+	if (ret)
+	{
+		buffer->residency = NULL;
+		buffer->memory_tag = device->memory_tag;
+		account_memory(device, GFX_MEMORY_BUFFER, buffer->memory_tag, buffer->size, true);
+	}
 	DEV_DEBUG;
 	return ret;
 }
@@ -162,6 +849,12 @@ bool gfx_create_buffer(gfx_device_t *device, gfx_buffer_t *buffer, enum gfx_buff
 void gfx_set_buffer_data(gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset)
 {
 	DEV_DEBUG;
+	if (buffer->residency)
+	{
+		use_residency(buffer->device, buffer->residency);
+		if (!buffer->residency->buffer_reload)
+			write_buffer_shadow(buffer, data, size, offset);
+	}
 	buffer->device->vtable->set_buffer_data(buffer->device, buffer, data, size, offset);
 	DEV_DEBUG;
 }
@@ -169,6 +862,14 @@ void gfx_set_buffer_data(gfx_buffer_t *buffer, const void *data, uint32_t size,
 void gfx_delete_buffer(gfx_device_t *device, gfx_buffer_t *buffer)
 {
 	DEV_DEBUG;
+	/* an evicted buffer has no handle, and was unaccounted by its eviction */
+	if (buffer && buffer->residency)
+	{
+		delete_residency(device, buffer->residency);
+		buffer->residency = NULL;
+	}
+	if (buffer && buffer->handle.u64)
+		account_memory(device, GFX_MEMORY_BUFFER, buffer->memory_tag, buffer->size, false);
 	device->vtable->delete_buffer(device, buffer);
 	DEV_DEBUG;
 }
@@ -184,6 +885,16 @@ bool gfx_create_attributes_state(gfx_device_t *device, gfx_attributes_state_t *s
 void gfx_bind_attributes_state(gfx_device_t *device, const gfx_attributes_state_t *state, const gfx_input_layout_t *input_layout)
 {
 	DEV_DEBUG;
+	if (state)
+	{
+		for (uint32_t i = 0; i < state->count; ++i)
+		{
+			if (state->binds[i].buffer)
+				use_residency(device, state->binds[i].buffer->residency);
+		}
+		if (state->index_buffer)
+			use_residency(device, state->index_buffer->residency);
+	}
 	device->vtable->bind_attributes_state(device, state, input_layout);
 	DEV_DEBUG;
 }
@@ -213,7 +924,18 @@ void gfx_delete_input_layout(gfx_device_t *device, gfx_input_layout_t *input_lay
 bool gfx_create_texture(gfx_device_t *device, gfx_texture_t *texture, enum gfx_texture_type type, enum gfx_format format, uint8_t lod, uint32_t width, uint32_t height, uint32_t depth)
 {
 	DEV_DEBUG;
+	if (!gfx_device_supports_format(device, format))
+	{
+		GFX_ERROR_CALLBACK("unsupported texture format: %d", (int)format);
+		return false;
+	}
 	bool ret = device->vtable->create_texture(device, texture, type, format, lod, width, height, depth);
+	if (ret)
+	{
+		texture->residency = NULL;
+		texture->memory_tag = device->memory_tag;
+		account_texture(device, texture, true);
+	}
 	DEV_DEBUG;
 	return ret;
 }
@@ -221,6 +943,12 @@ bool gfx_create_texture(gfx_device_t *device, gfx_texture_t *texture, enum gfx_t
 void gfx_set_texture_data(gfx_texture_t *texture, uint8_t lod, uint32_t offset, uint32_t width, uint32_t height, uint32_t depth, uint32_t size, const void *data)
 {
 	DEV_DEBUG;
+	if (texture->residency)
+	{
+		use_residency(texture->device, texture->residency);
+		if (!texture->residency->texture_reload)
+			write_texture_shadow(texture, lod, offset, width, height, depth, data);
+	}
 	texture->device->vtable->set_texture_data(texture->device, texture, lod, offset, width, height, depth, size, data);
 	DEV_DEBUG;
 }
@@ -228,6 +956,7 @@ void gfx_set_texture_data(gfx_texture_t *texture, uint8_t lod, uint32_t offset,
 void gfx_set_texture_addressing(gfx_texture_t *texture, enum gfx_texture_addressing addressing_s, enum gfx_texture_addressing addressing_t, enum gfx_texture_addressing addressing_r)
 {
 	DEV_DEBUG;
+	use_residency(texture->device, texture->residency);
 	texture->device->vtable->set_texture_addressing(texture->device, texture, addressing_s, addressing_t, addressing_r);
 	DEV_DEBUG;
 }
@@ -235,6 +964,7 @@ void gfx_set_texture_addressing(gfx_texture_t *texture, enum gfx_texture_address
 void gfx_set_texture_filtering(gfx_texture_t *texture, enum gfx_filtering min_filtering, enum gfx_filtering mag_filtering, enum gfx_filtering mip_filtering)
 {
 	DEV_DEBUG;
+	use_residency(texture->device, texture->residency);
 	texture->device->vtable->set_texture_filtering(texture->device, texture, min_filtering, mag_filtering, mip_filtering);
 	DEV_DEBUG;
 }
@@ -242,6 +972,7 @@ void gfx_set_texture_filtering(gfx_texture_t *texture, enum gfx_filtering min_fi
 void gfx_set_texture_anisotropy(gfx_texture_t *texture, uint32_t anisotropy)
 {
 	DEV_DEBUG;
+	use_residency(texture->device, texture->residency);
 	texture->device->vtable->set_texture_anisotropy(texture->device, texture, anisotropy);
 	DEV_DEBUG;
 }
@@ -249,6 +980,7 @@ void gfx_set_texture_anisotropy(gfx_texture_t *texture, uint32_t anisotropy)
 void gfx_set_texture_levels(gfx_texture_t *texture, uint32_t min_level, uint32_t max_level)
 {
 	DEV_DEBUG;
+	use_residency(texture->device, texture->residency);
 	texture->device->vtable->set_texture_levels(texture->device, texture, min_level, max_level);
 	DEV_DEBUG;
 }
@@ -256,10 +988,41 @@ void gfx_set_texture_levels(gfx_texture_t *texture, uint32_t min_level, uint32_t
 void gfx_delete_texture(gfx_device_t *device, gfx_texture_t *texture)
 {
 	DEV_DEBUG;
+	if (texture && texture->residency)
+	{
+		delete_residency(device, texture->residency);
+		texture->residency = NULL;
+	}
+	if (texture && texture->handle.u64)
+		account_texture(device, texture, false);
 	device->vtable->delete_texture(device, texture);
 	DEV_DEBUG;
 }
 
+uint64_t gfx_texture_level_size(enum gfx_format format, uint32_t width, uint32_t height, uint32_t depth)
+{
+	uint64_t block_dim = format_block_dims[format];
+	return ((width + block_dim - 1) / block_dim) * ((height + block_dim - 1) / block_dim) * depth * format_block_sizes[format];
+}
+
+bool gfx_format_has_depth(enum gfx_format format)
+{
+	switch (format)
+	{
+		case GFX_DEPTH24_STENCIL8:
+		case GFX_D16:
+		case GFX_D32F:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool gfx_format_has_stencil(enum gfx_format format)
+{
+	return format == GFX_DEPTH24_STENCIL8;
+}
+
 bool gfx_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gfx_shader_type type, const uint8_t *data, uint32_t len)
 {
 	DEV_DEBUG;
@@ -290,9 +1053,19 @@ void gfx_delete_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_st
 	DEV_DEBUG;
 }
 
+bool gfx_shader_state_ready(gfx_device_t *device, const gfx_shader_state_t *shader_state)
+{
+	DEV_DEBUG;
+	bool ret = device->vtable->shader_state_ready(device, shader_state);
+	DEV_DEBUG;
+	return ret;
+}
+
 void gfx_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset)
 {
 	DEV_DEBUG;
+	if (buffer)
+		use_residency(device, buffer->residency);
 	device->vtable->bind_constant(device, bind, buffer, size, offset);
 	DEV_DEBUG;
 }
@@ -300,6 +1073,11 @@ void gfx_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *
 void gfx_bind_samplers(gfx_device_t *device, uint32_t start, uint32_t count, const gfx_texture_t **textures)
 {
 	DEV_DEBUG;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (textures[i])
+			use_residency(device, textures[i]->residency);
+	}
 	device->vtable->bind_samplers(device, start, count, textures);
 	DEV_DEBUG;
 }
@@ -347,6 +1125,20 @@ void gfx_resolve_render_target(const gfx_render_target_t *src, const gfx_render_
 	DEV_DEBUG;
 }
 
+void gfx_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	DEV_DEBUG;
+	device->vtable->begin_render_pass(device, render_target, load_actions, clear_values);
+	DEV_DEBUG;
+}
+
+void gfx_end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target)
+{
+	DEV_DEBUG;
+	device->vtable->end_render_pass(device, store_actions, resolve_target);
+	DEV_DEBUG;
+}
+
 
 bool gfx_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive)
 {
@@ -370,6 +1162,14 @@ void gfx_bind_pipeline_state(gfx_device_t *device, const gfx_pipeline_state_t *s
 	DEV_DEBUG;
 }
 
+bool gfx_pipeline_state_ready(gfx_device_t *device, const gfx_pipeline_state_t *state)
+{
+	DEV_DEBUG;
+	bool ret = device->vtable->pipeline_state_ready(device, state);
+	DEV_DEBUG;
+	return ret;
+}
+
 void gfx_set_viewport(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
 	DEV_DEBUG;
@@ -397,3 +1197,40 @@ void gfx_set_point_size(gfx_device_t *device, float point_size)
 	device->vtable->set_point_size(device, point_size);
 	DEV_DEBUG;
 }
+
+bool gfx_create_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	DEV_DEBUG;
+	bool ret = device->vtable->create_command_list(device, list);
+	DEV_DEBUG;
+	return ret;
+}
+
+void gfx_delete_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	DEV_DEBUG;
+	device->vtable->delete_command_list(device, list);
+	DEV_DEBUG;
+}
+
+bool gfx_begin_command_list(gfx_command_list_t *list, const gfx_render_target_t *render_target)
+{
+	DEV_DEBUG;
+	bool ret = list->device->vtable->begin_command_list(list->device, list, render_target);
+	DEV_DEBUG;
+	return ret;
+}
+
+void gfx_end_command_list(gfx_command_list_t *list)
+{
+	DEV_DEBUG;
+	list->device->vtable->end_command_list(list->device, list);
+	DEV_DEBUG;
+}
+
+void gfx_execute_command_lists(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count)
+{
+	DEV_DEBUG;
+	device->vtable->execute_command_lists(device, lists, count);
+	DEV_DEBUG;
+}
@@ -13,6 +13,35 @@ extern "C" {
 typedef struct gfx_device_vtable_s gfx_device_vtable_t;
 typedef struct gfx_device_s gfx_device_t;
 typedef struct gfx_window_s gfx_window_t;
+typedef struct gfx_memory_counters_s gfx_memory_counters_t;
+typedef struct gfx_residencies_s gfx_residencies_t;
+
+#define GFX_MEMORY_TAGS 16
+
+typedef struct gfx_memory_usage_s
+{
+	uint64_t bytes;
+	uint64_t peak;
+	uint32_t count;
+} gfx_memory_usage_t;
+
+typedef struct gfx_memory_stats_s
+{
+	gfx_memory_usage_t categories[GFX_MEMORY_CATEGORIES];
+	gfx_memory_usage_t tags[GFX_MEMORY_TAGS];
+} gfx_memory_stats_t;
+
+#define GFX_MEMORY_EVICTION_FRAMES 4 /* resources used more recently are never evicted */
+
+typedef bool (*gfx_texture_reload_fn_t)(gfx_texture_t *texture, void *userdata);
+typedef bool (*gfx_buffer_reload_fn_t)(gfx_buffer_t *buffer, void *userdata);
+
+typedef struct gfx_clear_value_s
+{
+	vec4f_t color;
+	float depth;
+	uint8_t stencil;
+} gfx_clear_value_t;
 
 struct gfx_device_s
 {
@@ -22,14 +51,52 @@ struct gfx_device_s
 	uint32_t triangles_count;
 	uint32_t points_count;
 	uint32_t lines_count;
+	uint32_t skipped_calls_count;
 	uint32_t constant_alignment;
 	uint32_t max_samplers;
 	uint32_t max_msaa;
+	uint32_t max_texture_size;
+	uint32_t max_texture_3d_size;
+	uint32_t max_texture_layers;
+	uint64_t formats; /* bit per supported format, set by the backends */
+	char *shader_cache;
+	bool async_shaders;
+	bool buffer_shadow;
+	const gfx_render_target_t *render_pass_target;
+	bool render_pass;
+	gfx_memory_counters_t *memory_counters; /* atomic, as the resources may be created and deleted by any thread */
+	uint32_t memory_tag;
+	uint64_t memory_budget;
+	uint64_t driver_memory_budget; /* set by the backends knowing it, used without a memory budget */
+	gfx_residencies_t *residencies; /* evictable resources, made evictable and deleted by any thread */
+	uint64_t frame;
 };
 
 void gfx_device_delete(gfx_device_t *device);
 void gfx_device_tick(gfx_device_t *device);
 uint32_t gfx_get_uniform_buffer_size(gfx_device_t *device, uint32_t buffer_size);
+bool gfx_device_set_shader_cache(gfx_device_t *device, const char *path);
+void gfx_device_set_async_shaders(gfx_device_t *device, bool async_shaders);
+void gfx_device_set_buffer_shadow(gfx_device_t *device, bool buffer_shadow);
+
+/* textures can only be created with the formats the device samples */
+bool gfx_device_supports_format(const gfx_device_t *device, enum gfx_format format);
+
+/* buffers and textures are accounted to the tag set when they are created, 0 by default,
+ * with the size of their whole mip chain, layers and samples
+ */
+void gfx_device_set_memory_tag(gfx_device_t *device, uint32_t tag);
+void gfx_device_get_memory_stats(const gfx_device_t *device, gfx_memory_stats_t *stats);
+
+/* while the buffers and textures are over the budget, the evictable ones unused for the longest are deleted on tick,
+ * to be created again when bound or written, and filled by their reload function, or when they have none by a copy
+ * of the data written to them, or through their mapping, since they were made evictable, evictable textures can't
+ * be attached to render targets and command lists must not bind evictable resources, the resources may be made
+ * evictable and deleted by any thread, and only take part in the eviction from the next tick
+ */
+void gfx_device_set_memory_budget(gfx_device_t *device, uint64_t budget);
+bool gfx_set_texture_evictable(gfx_texture_t *texture, gfx_texture_reload_fn_t reload, void *userdata);
+bool gfx_set_buffer_evictable(gfx_buffer_t *buffer, gfx_buffer_reload_fn_t reload, void *userdata);
 
 void gfx_clear_color(gfx_device_t *device, const gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, vec4f_t color);
 void gfx_clear_depth_stencil(gfx_device_t *device, const gfx_render_target_t *render_target, float depth, uint8_t stencil);
@@ -49,6 +116,9 @@ bool gfx_create_rasterizer_state(gfx_device_t *device, gfx_rasterizer_state_t *s
 void gfx_delete_rasterizer_state(gfx_device_t *device, gfx_rasterizer_state_t *state);
 
 bool gfx_create_buffer(gfx_device_t *device, gfx_buffer_t *buffer, enum gfx_buffer_type type, const void *data, uint32_t size, enum gfx_buffer_usage usage);
+/* the draws recorded before the call keep the previous data, except on vulkan for the textures and the buffers
+ * without host visible memory, uploaded ahead of the frame: their data can't change once a draw of the frame used it
+ */
 void gfx_set_buffer_data(gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset);
 void gfx_delete_buffer(gfx_device_t *device, gfx_buffer_t *buffer);
 
@@ -67,10 +137,18 @@ void gfx_set_texture_anisotropy(gfx_texture_t *texture, uint32_t anisotropy);
 void gfx_set_texture_levels(gfx_texture_t *texture, uint32_t min_level, uint32_t max_level);
 void gfx_delete_texture(gfx_device_t *device, gfx_texture_t *texture);
 
+/* the tightly packed size of a level, as given to gfx_set_texture_data */
+uint64_t gfx_texture_level_size(enum gfx_format format, uint32_t width, uint32_t height, uint32_t depth);
+
+/* depth formats are attached as the depth stencil of render targets, with or without stencil */
+bool gfx_format_has_depth(enum gfx_format format);
+bool gfx_format_has_stencil(enum gfx_format format);
+
 bool gfx_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gfx_shader_type type, const uint8_t *data, uint32_t len);
 void gfx_delete_shader(gfx_device_t *device, gfx_shader_t *shader);
 bool gfx_create_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers);
 void gfx_delete_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_state);
+bool gfx_shader_state_ready(gfx_device_t *device, const gfx_shader_state_t *shader_state);
 void gfx_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset);
 void gfx_bind_samplers(gfx_device_t *device, uint32_t start, uint32_t count, const gfx_texture_t **textures);
 
@@ -81,15 +159,34 @@ void gfx_set_render_target_texture(gfx_render_target_t *render_target, enum gfx_
 void gfx_set_render_target_draw_buffers(gfx_render_target_t *render_target, uint32_t *draw_buffers, uint32_t draw_buffers_count);
 void gfx_resolve_render_target(const gfx_render_target_t *src, const gfx_render_target_t *dst, uint32_t buffers, uint32_t src_color, uint32_t dst_color);
 
+/* a render pass binds the render target with an action per draw buffer, NULL actions loading and storing everything,
+ * the attachments stored as don't care are undefined after the pass, and each draw buffer is resolved into the same
+ * draw buffer of the resolve target
+ */
+void gfx_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values);
+void gfx_end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target);
+
 bool gfx_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive);
 void gfx_delete_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state);
 void gfx_bind_pipeline_state(gfx_device_t *device, const gfx_pipeline_state_t *pipeline);
+bool gfx_pipeline_state_ready(gfx_device_t *device, const gfx_pipeline_state_t *pipeline);
 
 void gfx_set_viewport(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height);
 void gfx_set_scissor(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height);
 void gfx_set_line_width(gfx_device_t *device, float line_width);
 void gfx_set_point_size(gfx_device_t *device, float point_size);
 
+/* a command list records the gfx calls of the thread that began it until it is ended,
+ * it starts with no state bound and must be executed in the frame it was recorded for,
+ * while the render target it was begun with (NULL for the window) is bound,
+ * after which the pipeline state must be bound again
+ */
+bool gfx_create_command_list(gfx_device_t *device, gfx_command_list_t *list);
+void gfx_delete_command_list(gfx_device_t *device, gfx_command_list_t *list);
+bool gfx_begin_command_list(gfx_command_list_t *list, const gfx_render_target_t *render_target);
+void gfx_end_command_list(gfx_command_list_t *list);
+void gfx_execute_command_lists(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count);
+
 #ifdef __cplusplus
 }
 #endif
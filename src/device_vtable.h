@@ -47,6 +47,7 @@ typedef struct gfx_device_vtable_s
 	void (*delete_shader)(gfx_device_t *device, gfx_shader_t *shader);
 	bool (*create_shader_state)(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers);
 	void (*delete_shader_state)(gfx_device_t *device, gfx_shader_state_t *shader_state);
+	bool (*shader_state_ready)(gfx_device_t *device, const gfx_shader_state_t *shader_state);
 	void (*bind_constant)(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset);
 	void (*bind_samplers)(gfx_device_t *device, uint32_t start, uint32_t count, const gfx_texture_t **textures);
 
@@ -56,19 +57,31 @@ typedef struct gfx_device_vtable_s
 	void (*set_render_target_texture)(gfx_device_t *device, gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, const gfx_texture_t *texture);
 	void (*set_render_target_draw_buffers)(gfx_device_t *device, gfx_render_target_t *render_target, uint32_t *draw_buffers, uint32_t draw_buffers_count);
 	void (*resolve_render_target)(gfx_device_t *device, const gfx_render_target_t *src, const gfx_render_target_t *dst, uint32_t buffers, uint32_t src_color, uint32_t dst_color);
+	void (*begin_render_pass)(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values);
+	void (*end_render_pass)(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target);
 
 	bool (*create_pipeline_state)(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive);
 	void (*delete_pipeline_state)(gfx_device_t *device, gfx_pipeline_state_t *state);
 	void (*bind_pipeline_state)(gfx_device_t *device, const gfx_pipeline_state_t *state);
+	bool (*pipeline_state_ready)(gfx_device_t *device, const gfx_pipeline_state_t *state);
 
 	void (*set_viewport)(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height);
 	void (*set_scissor)(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height);
 	void (*set_line_width)(gfx_device_t *device, float line_width);
 	void (*set_point_size)(gfx_device_t *device, float point_size);
+
+	bool (*create_command_list)(gfx_device_t *device, gfx_command_list_t *list);
+	void (*delete_command_list)(gfx_device_t *device, gfx_command_list_t *list);
+	bool (*begin_command_list)(gfx_device_t *device, gfx_command_list_t *list, const gfx_render_target_t *render_target);
+	void (*end_command_list)(gfx_device_t *device, gfx_command_list_t *list);
+	void (*execute_command_lists)(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count);
 } gfx_device_vtable_t;
 
 extern const gfx_device_vtable_t gfx_device_vtable;
 
+/* for the categories the backends count themselves */
+void gfx_device_set_memory_usage(gfx_device_t *device, enum gfx_memory_category category, uint64_t bytes, uint64_t peak, uint32_t count);
+
 #define GFX_DEVICE_VTABLE_DEF(prefix) \
 	.ctr  = prefix##_ctr, \
 	.dtr  = prefix##_dtr, \
@@ -104,6 +117,7 @@ extern const gfx_device_vtable_t gfx_device_vtable;
 	.delete_shader       = prefix##_delete_shader, \
 	.create_shader_state = prefix##_create_shader_state, \
 	.delete_shader_state = prefix##_delete_shader_state, \
+	.shader_state_ready  = prefix##_shader_state_ready, \
 	.bind_constant       = prefix##_bind_constant, \
 	.bind_samplers       = prefix##_bind_samplers, \
 	.create_render_target            = prefix##_create_render_target, \
@@ -112,12 +126,20 @@ extern const gfx_device_vtable_t gfx_device_vtable;
 	.set_render_target_texture       = prefix##_set_render_target_texture, \
 	.set_render_target_draw_buffers  = prefix##_set_render_target_draw_buffers, \
 	.resolve_render_target           = prefix##_resolve_render_target, \
+	.begin_render_pass               = prefix##_begin_render_pass, \
+	.end_render_pass                 = prefix##_end_render_pass, \
 	.create_pipeline_state = prefix##_create_pipeline_state, \
 	.delete_pipeline_state = prefix##_delete_pipeline_state, \
 	.bind_pipeline_state   = prefix##_bind_pipeline_state, \
+	.pipeline_state_ready  = prefix##_pipeline_state_ready, \
 	.set_viewport   = prefix##_set_viewport, \
 	.set_scissor    = prefix##_set_scissor, \
 	.set_line_width = prefix##_set_line_width, \
-	.set_point_size = prefix##_set_point_size,
+	.set_point_size = prefix##_set_point_size, \
+	.create_command_list   = prefix##_create_command_list, \
+	.delete_command_list   = prefix##_delete_command_list, \
+	.begin_command_list    = prefix##_begin_command_list, \
+	.end_command_list      = prefix##_end_command_list, \
+	.execute_command_lists = prefix##_execute_command_lists,
 
 #endif
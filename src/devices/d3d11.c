@@ -158,6 +158,20 @@ static const DXGI_FORMAT formats[] =
 	DXGI_FORMAT_BC1_UNORM,
 	DXGI_FORMAT_BC2_UNORM,
 	DXGI_FORMAT_BC3_UNORM,
+	DXGI_FORMAT_BC4_UNORM,
+	DXGI_FORMAT_BC5_UNORM,
+	DXGI_FORMAT_BC6H_UF16,
+	DXGI_FORMAT_BC7_UNORM,
+	DXGI_FORMAT_UNKNOWN,
+	DXGI_FORMAT_UNKNOWN,
+	DXGI_FORMAT_UNKNOWN,
+	DXGI_FORMAT_UNKNOWN,
+	DXGI_FORMAT_R11G11B10_FLOAT,
+	DXGI_FORMAT_R16G16_FLOAT,
+	DXGI_FORMAT_R16_FLOAT,
+	DXGI_FORMAT_R32_FLOAT,
+	DXGI_FORMAT_D16_UNORM,
+	DXGI_FORMAT_D32_FLOAT,
 };
 
 static const D3D11_TEXTURE_ADDRESS_MODE texture_addressings[] =
@@ -242,6 +256,20 @@ static UINT row_pitches[] =
 	2,
 	4,
 	4,
+	2,
+	4,
+	4,
+	4,
+	2,
+	4,
+	2,
+	4,
+	4,
+	4,
+	2,
+	4,
+	2,
+	4,
 };
 
 static inline const char *d3d11_err2str(HRESULT result)
@@ -388,6 +416,16 @@ static bool d3d11_ctr(gfx_device_t *device, gfx_window_t *window)
 {
 	if (!gfx_device_vtable.ctr(device, window))
 		return false;
+	/* bc formats are all required by the 11_1 feature level, etc2 has no dxgi format */
+	device->formats = 0;
+	for (uint32_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i)
+	{
+		if (formats[i] != DXGI_FORMAT_UNKNOWN)
+			device->formats |= UINT64_C(1) << i;
+	}
+	device->max_texture_size = D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION;
+	device->max_texture_3d_size = D3D11_REQ_TEXTURE3D_U_V_OR_W_DIMENSION;
+	device->max_texture_layers = D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION;
 	D3D11_DEVICE->default_depth_stencil_view = NULL;
 	D3D11_DEVICE->default_render_target_view = NULL;
 	D3D11_DEVICE->primitive = (enum gfx_primitive_type)-1;
@@ -795,6 +833,29 @@ static void d3d11_delete_input_layout(gfx_device_t *device, gfx_input_layout_t *
 	ID3D11InputLayout_Release((ID3D11InputLayout*)input_layout->handle.ptr);
 }
 
+static bool format_renderable(enum gfx_format format)
+{
+	switch (format)
+	{
+		case GFX_B4G4R4A4:
+		case GFX_BC1_RGB:
+		case GFX_BC1_RGBA:
+		case GFX_BC2_RGBA:
+		case GFX_BC3_RGBA:
+		case GFX_BC4_R:
+		case GFX_BC5_RG:
+		case GFX_BC6H_RGB_UFLOAT:
+		case GFX_BC7_RGBA:
+		case GFX_ETC2_RGB:
+		case GFX_ETC2_RGBA:
+		case GFX_EAC_R:
+		case GFX_EAC_RG:
+			return false;
+		default:
+			return true;
+	}
+}
+
 static bool d3d11_create_texture(gfx_device_t *device, gfx_texture_t *texture, enum gfx_texture_type type, enum gfx_format format, uint8_t lod, uint32_t width, uint32_t height, uint32_t depth)
 {
 	assert(!texture->handle.ptr);
@@ -850,7 +911,7 @@ static bool d3d11_create_texture(gfx_device_t *device, gfx_texture_t *texture, e
 			desc.SampleDesc.Count = (type == GFX_TEXTURE_2D || type == GFX_TEXTURE_2D_ARRAY) ? 1 : lod;
 			desc.SampleDesc.Quality = 0;
 			desc.Usage = D3D11_USAGE_DEFAULT;
-			if (format == GFX_DEPTH24_STENCIL8)
+			if (gfx_format_has_depth(format))
 			{
 				desc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
 				desc.CPUAccessFlags = 0;
@@ -858,7 +919,7 @@ static bool d3d11_create_texture(gfx_device_t *device, gfx_texture_t *texture, e
 			else
 			{
 				desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-				if (format != GFX_BC1_RGB && format != GFX_BC1_RGBA && format != GFX_BC2_RGBA && format != GFX_BC3_RGBA && format != GFX_B4G4R4A4)
+				if (format_renderable(format))
 					desc.BindFlags |= D3D11_BIND_RENDER_TARGET;
 				if (type == GFX_TEXTURE_2D_MS || type == GFX_TEXTURE_2D_ARRAY_MS)
 					desc.CPUAccessFlags = 0;
@@ -1125,6 +1186,13 @@ static void d3d11_delete_shader_state(gfx_device_t *device, gfx_shader_state_t *
 	GFX_FREE(shader_state->code);
 }
 
+static bool d3d11_shader_state_ready(gfx_device_t *device, const gfx_shader_state_t *shader_state)
+{
+	(void)device;
+	(void)shader_state;
+	return true;
+}
+
 static void d3d11_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset)
 {
 	assert(offset % 16 == 0);
@@ -1311,6 +1379,16 @@ static void d3d11_resolve_render_target(gfx_device_t *device, const gfx_render_t
 	//ID3D11DeviceContext_ResolveSubresource(D3D11_DEVICE->d3ddev, dst_res, 0, src_res, 0, formats[src_res->format]);
 }
 
+static void d3d11_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	gfx_device_vtable.begin_render_pass(device, render_target, load_actions, clear_values);
+}
+
+static void d3d11_end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target)
+{
+	gfx_device_vtable.end_render_pass(device, store_actions, resolve_target);
+}
+
 static bool d3d11_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive)
 {
 	assert(!state->handle.u64);
@@ -1350,6 +1428,13 @@ static void d3d11_bind_pipeline_state(gfx_device_t *device, const gfx_pipeline_s
 	}
 }
 
+static bool d3d11_pipeline_state_ready(gfx_device_t *device, const gfx_pipeline_state_t *state)
+{
+	(void)device;
+	(void)state;
+	return true;
+}
+
 static void d3d11_set_viewport(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
 	D3D11_VIEWPORT viewport;
@@ -1385,6 +1470,42 @@ static void d3d11_set_point_size(gfx_device_t *device, float point_size)
 	(void)point_size;
 }
 
+/* deferred contexts aren't used, recording from other threads isn't supported */
+static bool d3d11_create_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+	GFX_ERROR_CALLBACK("command lists aren't supported");
+	return false;
+}
+
+static void d3d11_delete_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+}
+
+static bool d3d11_begin_command_list(gfx_device_t *device, gfx_command_list_t *list, const gfx_render_target_t *render_target)
+{
+	(void)device;
+	(void)list;
+	(void)render_target;
+	return false;
+}
+
+static void d3d11_end_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+}
+
+static void d3d11_execute_command_lists(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count)
+{
+	(void)device;
+	(void)lists;
+	(void)count;
+}
+
 void gfx_d3d11_resize(gfx_device_t *device)
 {
 	ID3D11RenderTargetView *views[8];
@@ -2,11 +2,13 @@
 #include "../device_vtable.h"
 #include "../window.h"
 #include <inttypes.h>
-#include <pthread.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
 
 #define GL_DEVICE ((gfx_gl_device_t*)device)
 #define GL3_DEVICE ((gfx_gl3_device_t*)device)
@@ -183,6 +185,20 @@ const GLenum gfx_gl_internal_formats[] =
 	GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
 	GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
 	GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+	GL_COMPRESSED_RED_RGTC1,
+	GL_COMPRESSED_RG_RGTC2,
+	GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,
+	GL_COMPRESSED_RGBA_BPTC_UNORM,
+	GL_COMPRESSED_RGB8_ETC2,
+	GL_COMPRESSED_RGBA8_ETC2_EAC,
+	GL_COMPRESSED_R11_EAC,
+	GL_COMPRESSED_RG11_EAC,
+	GL_R11F_G11F_B10F,
+	GL_RG16F,
+	GL_R16F,
+	GL_R32F,
+	GL_DEPTH_COMPONENT16,
+	GL_DEPTH_COMPONENT32F,
 };
 
 const GLenum gfx_gl_formats[] =
@@ -197,6 +213,25 @@ const GLenum gfx_gl_formats[] =
 	GL_RGB,
 	GL_RG,
 	GL_RED,
+	/* compressed formats, uploaded with their internal format */
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_RGB,
+	GL_RG,
+	GL_RED,
+	GL_RED,
+	GL_DEPTH_COMPONENT,
+	GL_DEPTH_COMPONENT,
 };
 
 const GLenum gfx_gl_format_types[] =
@@ -211,6 +246,25 @@ const GLenum gfx_gl_format_types[] =
 	GL_UNSIGNED_SHORT_5_6_5_REV,
 	GL_UNSIGNED_BYTE,
 	GL_UNSIGNED_BYTE,
+	/* compressed formats, uploaded with their internal format */
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_NONE,
+	GL_UNSIGNED_INT_10F_11F_11F_REV,
+	GL_HALF_FLOAT,
+	GL_HALF_FLOAT,
+	GL_FLOAT,
+	GL_UNSIGNED_SHORT,
+	GL_FLOAT,
 };
 
 const GLint gfx_gl_index_sizes[] =
@@ -293,6 +347,612 @@ static const jks_array_memory_fn_t array_memory_fn =
 	.free = mem_free,
 };
 
+#define PROGRAM_CACHE_MAGIC 0x50584647 /* GFXP */
+#define PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t driver_hash;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+uint64_t gfx_gl_hash(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static uint64_t hash_binds(uint64_t hash, const char *name, uint32_t bind)
+{
+	hash = gfx_gl_hash(hash, name, strlen(name) + 1);
+	return gfx_gl_hash(hash, &bind, sizeof(bind));
+}
+
+uint64_t gfx_gl_program_key(gfx_device_t *device, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	uint64_t hash = gfx_gl_hash(GFX_GL_HASH_INIT, &GL_DEVICE->driver_hash, sizeof(GL_DEVICE->driver_hash));
+	for (uint32_t i = 0; i < shaders_count; ++i)
+	{
+		if (!shaders[i])
+			continue;
+		if (!shaders[i]->code)
+			return 0;
+		hash = gfx_gl_hash(hash, &shaders[i]->type, sizeof(shaders[i]->type));
+		hash = gfx_gl_hash(hash, &shaders[i]->code_size, sizeof(shaders[i]->code_size));
+		hash = gfx_gl_hash(hash, shaders[i]->code, shaders[i]->code_size);
+	}
+	for (uint32_t i = 0; attributes && attributes[i].name; ++i)
+		hash = hash_binds(hash, attributes[i].name, attributes[i].bind);
+	hash = gfx_gl_hash(hash, "", 1);
+	for (uint32_t i = 0; constants && constants[i].name; ++i)
+		hash = hash_binds(hash, constants[i].name, constants[i].bind);
+	hash = gfx_gl_hash(hash, "", 1);
+	for (uint32_t i = 0; samplers && samplers[i].name; ++i)
+		hash = hash_binds(hash, samplers[i].name, samplers[i].bind);
+	return hash ? hash : 1;
+}
+
+static void program_cache_path(gfx_device_t *device, uint64_t key, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016" PRIx64 ".glp", device->shader_cache, key);
+}
+
+void *gfx_gl_program_cache_read(gfx_device_t *device, uint64_t key, GLenum *format, GLsizei *length)
+{
+	char path[4096];
+	struct program_cache_header header;
+	void *data;
+	FILE *fp;
+
+	program_cache_path(device, key, path, sizeof(path));
+	fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	if (fread(&header, sizeof(header), 1, fp) != 1
+	 || header.magic != PROGRAM_CACHE_MAGIC
+	 || header.version != PROGRAM_CACHE_VERSION
+	 || header.driver_hash != GL_DEVICE->driver_hash
+	 || header.key != key
+	 || !header.length)
+	{
+		fclose(fp);
+		return NULL;
+	}
+	data = GFX_MALLOC(header.length);
+	if (!data)
+	{
+		fclose(fp);
+		return NULL;
+	}
+	if (fread(data, 1, header.length, fp) != header.length)
+	{
+		GFX_FREE(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	*format = header.format;
+	*length = header.length;
+	return data;
+}
+
+/* the keys hash the driver, so the blobs of the previous drivers are never read again */
+static void prune_program_cache(gfx_device_t *device)
+{
+	char path[4096];
+	struct program_cache_header header;
+	struct dirent *entry;
+	DIR *dir;
+	FILE *fp;
+
+	dir = opendir(device->shader_cache);
+	if (!dir)
+		return;
+	while ((entry = readdir(dir)))
+	{
+		size_t len = strlen(entry->d_name);
+		if (len != 20 || strcmp(&entry->d_name[16], ".glp"))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", device->shader_cache, entry->d_name);
+		fp = fopen(path, "rb");
+		if (!fp)
+			continue;
+		bool stale = fread(&header, sizeof(header), 1, fp) != 1
+		          || header.magic != PROGRAM_CACHE_MAGIC
+		          || header.version != PROGRAM_CACHE_VERSION
+		          || header.driver_hash != GL_DEVICE->driver_hash;
+		fclose(fp);
+		if (stale)
+			remove(path);
+	}
+	closedir(dir);
+}
+
+void gfx_gl_program_cache_write(gfx_device_t *device, uint64_t key, GLenum format, const void *data, GLsizei length)
+{
+	char path[4096];
+	char tmp[4096 + 8];
+	struct program_cache_header header;
+	FILE *fp;
+
+	/* on the first miss, which follows a driver change */
+	if (!GL_DEVICE->program_cache_pruned)
+	{
+		GL_DEVICE->program_cache_pruned = true;
+		prune_program_cache(device);
+	}
+	program_cache_path(device, key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		return;
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.driver_hash = GL_DEVICE->driver_hash;
+	header.key = key;
+	header.format = format;
+	header.length = length;
+	if (fwrite(&header, sizeof(header), 1, fp) != 1
+	 || fwrite(data, 1, length, fp) != (size_t)length)
+	{
+		fclose(fp);
+		remove(tmp);
+		return;
+	}
+	if (fclose(fp))
+	{
+		remove(tmp);
+		return;
+	}
+	/* write then rename so a concurrent reader never sees a partial blob */
+	if (rename(tmp, path))
+		remove(tmp);
+}
+
+gfx_gl_pending_program_t *gfx_gl_pending_program_add(gfx_device_t *device, GLuint program, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	uint32_t constants_count = 0;
+	uint32_t samplers_count = 0;
+	size_t names_size = 0;
+	while (constants && constants[constants_count].name)
+		names_size += strlen(constants[constants_count++].name) + 1;
+	while (samplers && samplers[samplers_count].name)
+		names_size += strlen(samplers[samplers_count++].name) + 1;
+	/* single allocation: header, NULL-terminated tables, then the names */
+	size_t size = sizeof(gfx_gl_pending_program_t)
+	            + sizeof(gfx_shader_constant_t) * (constants_count + 1)
+	            + sizeof(gfx_shader_sampler_t) * (samplers_count + 1)
+	            + names_size;
+	gfx_gl_pending_program_t *pending = GFX_MALLOC(size);
+	if (!pending)
+	{
+		GFX_ERROR_CALLBACK("pending program allocation failed");
+		return NULL;
+	}
+	pending->program = program;
+	pending->shaders[0] = 0;
+	pending->shaders[1] = 0;
+	pending->shaders[2] = 0;
+	pending->cache_key = 0;
+	pending->layout_key = 0;
+	pending->constants = (gfx_shader_constant_t*)&pending[1];
+	pending->samplers = (gfx_shader_sampler_t*)&pending->constants[constants_count + 1];
+	char *names = (char*)&pending->samplers[samplers_count + 1];
+	for (uint32_t i = 0; i < constants_count; ++i)
+	{
+		size_t len = strlen(constants[i].name) + 1;
+		memcpy(names, constants[i].name, len);
+		pending->constants[i].name = names;
+		pending->constants[i].bind = constants[i].bind;
+		names += len;
+	}
+	pending->constants[constants_count].name = NULL;
+	for (uint32_t i = 0; i < samplers_count; ++i)
+	{
+		size_t len = strlen(samplers[i].name) + 1;
+		memcpy(names, samplers[i].name, len);
+		pending->samplers[i].name = names;
+		pending->samplers[i].bind = samplers[i].bind;
+		names += len;
+	}
+	pending->samplers[samplers_count].name = NULL;
+	if (!jks_array_push_back(&GL_DEVICE->pending_programs, &pending))
+	{
+		GFX_ERROR_CALLBACK("failed to queue pending program");
+		GFX_FREE(pending);
+		return NULL;
+	}
+	return pending;
+}
+
+gfx_gl_pending_program_t *gfx_gl_pending_program_get(gfx_device_t *device, GLuint program)
+{
+	for (uint32_t i = 0; i < GL_DEVICE->pending_programs.size; ++i)
+	{
+		gfx_gl_pending_program_t *pending = *JKS_ARRAY_GET(&GL_DEVICE->pending_programs, i, gfx_gl_pending_program_t*);
+		if (pending->program == program)
+			return pending;
+	}
+	return NULL;
+}
+
+void gfx_gl_pending_program_remove(gfx_device_t *device, GLuint program)
+{
+	for (uint32_t i = 0; i < GL_DEVICE->pending_programs.size; ++i)
+	{
+		gfx_gl_pending_program_t **pending = JKS_ARRAY_GET(&GL_DEVICE->pending_programs, i, gfx_gl_pending_program_t*);
+		if ((*pending)->program != program)
+			continue;
+		GFX_FREE(*pending);
+		*pending = *JKS_ARRAY_GET(&GL_DEVICE->pending_programs, GL_DEVICE->pending_programs.size - 1, gfx_gl_pending_program_t*);
+		jks_array_resize(&GL_DEVICE->pending_programs, GL_DEVICE->pending_programs.size - 1);
+		return;
+	}
+}
+
+/* the programs of a same key, linked from the same code by the same driver, resolve to the same slots */
+const gfx_gl_program_layout_t *gfx_gl_program_layout_get(gfx_device_t *device, uint64_t key)
+{
+	for (uint32_t i = 0; i < GL_DEVICE->program_layouts.size; ++i)
+	{
+		const gfx_gl_program_layout_t *layout = *JKS_ARRAY_GET(&GL_DEVICE->program_layouts, i, gfx_gl_program_layout_t*);
+		if (layout->key == key)
+			return layout;
+	}
+	return NULL;
+}
+
+const gfx_gl_program_layout_t *gfx_gl_program_layout_add(gfx_device_t *device, uint64_t key, const gfx_gl_program_slot_t *slots, uint32_t blocks_count, uint32_t samplers_count)
+{
+	uint32_t count = blocks_count + samplers_count;
+	gfx_gl_program_layout_t *layout = GFX_MALLOC(sizeof(*layout) + sizeof(*slots) * count);
+	if (!layout)
+	{
+		GFX_ERROR_CALLBACK("program layout allocation failed");
+		return NULL;
+	}
+	layout->key = key;
+	layout->blocks_count = blocks_count;
+	layout->samplers_count = samplers_count;
+	memcpy(layout->slots, slots, sizeof(*slots) * count);
+	if (!jks_array_push_back(&GL_DEVICE->program_layouts, &layout))
+	{
+		GFX_ERROR_CALLBACK("failed to add program layout");
+		GFX_FREE(layout);
+		return NULL;
+	}
+	return layout;
+}
+
+bool gfx_gl_buffer_shadow_create(gfx_device_t *device, gfx_buffer_t *buffer, const void *data)
+{
+	(void)device;
+	gfx_gl_buffer_shadow_t *shadow = GFX_MALLOC(sizeof(*shadow) + buffer->size);
+	if (!shadow)
+	{
+		GFX_ERROR_CALLBACK("can't allocate buffer shadow: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	shadow->buffer = buffer->handle.u32[0];
+	shadow->dirty = false;
+	shadow->ranges_count = 0;
+	shadow->size = buffer->size;
+	if (data)
+		memcpy(shadow->data, data, buffer->size);
+	else
+		memset(shadow->data, 0, buffer->size);
+	buffer->shadow.ptr = shadow;
+	return true;
+}
+
+void gfx_gl_buffer_shadow_write(gfx_device_t *device, gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset)
+{
+	gfx_gl_buffer_shadow_t *shadow = buffer->shadow.ptr;
+	assert(offset + size <= shadow->size);
+	memcpy(&shadow->data[offset], data, size);
+	uint32_t start = offset;
+	uint32_t end = offset + size;
+	/* absorb every range touching (or close enough to) the written one */
+	for (uint32_t i = 0; i < shadow->ranges_count;)
+	{
+		gfx_gl_buffer_range_t *range = &shadow->ranges[i];
+		if (range->start > end + GFX_GL_SHADOW_MERGE_GAP
+		 || start > range->end + GFX_GL_SHADOW_MERGE_GAP)
+		{
+			++i;
+			continue;
+		}
+		if (range->start < start)
+			start = range->start;
+		if (range->end > end)
+			end = range->end;
+		*range = shadow->ranges[--shadow->ranges_count];
+	}
+	if (shadow->ranges_count == GFX_GL_SHADOW_RANGES)
+	{
+		for (uint32_t i = 0; i < shadow->ranges_count; ++i)
+		{
+			if (shadow->ranges[i].start < start)
+				start = shadow->ranges[i].start;
+			if (shadow->ranges[i].end > end)
+				end = shadow->ranges[i].end;
+		}
+		shadow->ranges_count = 0;
+	}
+	shadow->ranges[shadow->ranges_count].start = start;
+	shadow->ranges[shadow->ranges_count].end = end;
+	shadow->ranges_count++;
+	if (shadow->dirty)
+		return;
+	if (!jks_array_push_back(&GL_DEVICE->dirty_buffers, &shadow))
+		assert(!"failed to queue dirty buffer");
+	shadow->dirty = true;
+}
+
+/* the shadow may be queued for upload, it is unlinked by the deletions of the device thread, before the deletion of its buffer */
+void gfx_gl_buffer_shadow_delete(gfx_device_t *device, gfx_buffer_t *buffer)
+{
+	gfx_gl_delete_shadow(device, buffer->shadow.ptr);
+	buffer->shadow.ptr = NULL;
+}
+
+static void free_shadow(gfx_device_t *device, gfx_gl_buffer_shadow_t *shadow)
+{
+	if (shadow->dirty)
+	{
+		for (uint32_t i = 0; i < GL_DEVICE->dirty_buffers.size; ++i)
+		{
+			gfx_gl_buffer_shadow_t **it = JKS_ARRAY_GET(&GL_DEVICE->dirty_buffers, i, gfx_gl_buffer_shadow_t*);
+			if (*it != shadow)
+				continue;
+			*it = *JKS_ARRAY_GET(&GL_DEVICE->dirty_buffers, GL_DEVICE->dirty_buffers.size - 1, gfx_gl_buffer_shadow_t*);
+			jks_array_resize(&GL_DEVICE->dirty_buffers, GL_DEVICE->dirty_buffers.size - 1);
+			break;
+		}
+	}
+	GFX_FREE(shadow);
+}
+
+void gfx_gl_vao_key(gfx_gl_vao_key_t *key, const gfx_attributes_state_t *state, const gfx_input_layout_t *input_layout)
+{
+	memset(key, 0, sizeof(*key));
+	for (size_t i = 0; i < sizeof(state->binds) / sizeof(*state->binds); ++i)
+	{
+		if (!state->binds[i].buffer)
+			continue;
+		key->binds[i].buffer = state->binds[i].buffer->handle.u32[0];
+		key->binds[i].stride = state->binds[i].stride;
+		key->binds[i].offset = state->binds[i].offset;
+		key->binds[i].type = input_layout->binds[i].type;
+	}
+	if (state->index_buffer)
+		key->index_buffer = state->index_buffer->handle.u32[0];
+}
+
+/* the hint is the slot the attributes state hit last time, which avoids hashing in the common case */
+gfx_gl_vao_t *gfx_gl_vao_find(gfx_device_t *device, const gfx_gl_vao_key_t *key, uint32_t hint)
+{
+	gfx_gl_vao_t *vao;
+	if (hint < GL_DEVICE->vaos_count)
+	{
+		vao = &GL_DEVICE->vaos[hint];
+		if (!memcmp(&vao->key, key, sizeof(*key)))
+			goto found;
+	}
+	uint64_t hash = gfx_gl_hash(GFX_GL_HASH_INIT, key, sizeof(*key));
+	for (uint32_t i = 0; i < GL_DEVICE->vaos_count; ++i)
+	{
+		vao = &GL_DEVICE->vaos[i];
+		if (vao->hash == hash && !memcmp(&vao->key, key, sizeof(*key)))
+			goto found;
+	}
+	return NULL;
+
+found:
+	vao->last_use = ++GL_DEVICE->vaos_clock;
+	return vao;
+}
+
+static void evict_vao(gfx_device_t *device, uint32_t slot)
+{
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_VERTEX_ARRAY, GL_DEVICE->vaos[slot].vao);
+	GL_DEVICE->vaos[slot] = GL_DEVICE->vaos[--GL_DEVICE->vaos_count];
+}
+
+/* returns a slot with the key set and no vertex array, evicting the least recently used one if full */
+gfx_gl_vao_t *gfx_gl_vao_alloc(gfx_device_t *device, const gfx_gl_vao_key_t *key)
+{
+	if (GL_DEVICE->vaos_count == GFX_GL_VAO_CACHE_SIZE)
+	{
+		uint32_t lru = 0;
+		for (uint32_t i = 1; i < GL_DEVICE->vaos_count; ++i)
+		{
+			if (GL_DEVICE->vaos[i].last_use < GL_DEVICE->vaos[lru].last_use)
+				lru = i;
+		}
+		evict_vao(device, lru);
+	}
+	gfx_gl_vao_t *vao = &GL_DEVICE->vaos[GL_DEVICE->vaos_count++];
+	vao->key = *key;
+	vao->hash = gfx_gl_hash(GFX_GL_HASH_INIT, key, sizeof(*key));
+	vao->last_use = ++GL_DEVICE->vaos_clock;
+	vao->vao = 0;
+	return vao;
+}
+
+void gfx_gl_fbo_key(gfx_gl_fbo_key_t *key, const gfx_render_target_t *render_target)
+{
+	memset(key, 0, sizeof(*key));
+	for (size_t i = 0; i < sizeof(render_target->colors) / sizeof(*render_target->colors); ++i)
+	{
+		if (render_target->colors[i].texture)
+			key->colors[i] = render_target->colors[i].texture->handle.u32[0];
+	}
+	if (render_target->depth_stencil.texture)
+		key->depth_stencil = render_target->depth_stencil.texture->handle.u32[0];
+	for (uint32_t i = 0; i < render_target->draw_buffers_nb; ++i)
+		key->draw_buffers[i] = render_target->draw_buffers[i];
+	key->draw_buffers_nb = render_target->draw_buffers_nb;
+}
+
+/* the hint is the slot the render target hit last time, which avoids hashing in the common case */
+gfx_gl_fbo_t *gfx_gl_fbo_find(gfx_device_t *device, const gfx_gl_fbo_key_t *key, uint32_t hint)
+{
+	gfx_gl_fbo_t *fbo;
+	if (hint < GL_DEVICE->fbos_count)
+	{
+		fbo = &GL_DEVICE->fbos[hint];
+		if (!memcmp(&fbo->key, key, sizeof(*key)))
+			goto found;
+	}
+	uint64_t hash = gfx_gl_hash(GFX_GL_HASH_INIT, key, sizeof(*key));
+	for (uint32_t i = 0; i < GL_DEVICE->fbos_count; ++i)
+	{
+		fbo = &GL_DEVICE->fbos[i];
+		if (fbo->hash == hash && !memcmp(&fbo->key, key, sizeof(*key)))
+			goto found;
+	}
+	return NULL;
+
+found:
+	fbo->last_use = ++GL_DEVICE->fbos_clock;
+	return fbo;
+}
+
+static void evict_fbo(gfx_device_t *device, uint32_t slot)
+{
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_FRAME_BUFFER, GL_DEVICE->fbos[slot].fbo);
+	GL_DEVICE->fbos[slot] = GL_DEVICE->fbos[--GL_DEVICE->fbos_count];
+}
+
+/* returns a slot with the key set and no framebuffer, evicting the least recently used one if full */
+gfx_gl_fbo_t *gfx_gl_fbo_alloc(gfx_device_t *device, const gfx_gl_fbo_key_t *key)
+{
+	if (GL_DEVICE->fbos_count == GFX_GL_FBO_CACHE_SIZE)
+	{
+		uint32_t lru = 0;
+		for (uint32_t i = 1; i < GL_DEVICE->fbos_count; ++i)
+		{
+			if (GL_DEVICE->fbos[i].last_use < GL_DEVICE->fbos[lru].last_use)
+				lru = i;
+		}
+		evict_fbo(device, lru);
+	}
+	gfx_gl_fbo_t *fbo = &GL_DEVICE->fbos[GL_DEVICE->fbos_count++];
+	fbo->key = *key;
+	fbo->hash = gfx_gl_hash(GFX_GL_HASH_INIT, key, sizeof(*key));
+	fbo->last_use = ++GL_DEVICE->fbos_clock;
+	fbo->fbo = 0;
+	return fbo;
+}
+
+/* compare a reflected resource name with a user one, "tex[0]" matching "tex" */
+static bool resource_name_match(const char *reflected, const char *name)
+{
+	size_t len = strlen(name);
+	if (strncmp(reflected, name, len))
+		return false;
+	return !reflected[len] || !strcmp(&reflected[len], "[0]");
+}
+
+bool gfx_gl_constant_bind(const gfx_shader_constant_t *constants, const char *name, uint32_t *bind)
+{
+	for (uint32_t i = 0; constants && constants[i].name; ++i)
+	{
+		if (resource_name_match(name, constants[i].name))
+		{
+			*bind = constants[i].bind;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool gfx_gl_sampler_bind(const gfx_shader_sampler_t *samplers, const char *name, uint32_t *bind)
+{
+	for (uint32_t i = 0; samplers && samplers[i].name; ++i)
+	{
+		if (resource_name_match(name, samplers[i].name))
+		{
+			*bind = samplers[i].bind;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool gfx_gl_sampler_type(GLenum type)
+{
+	switch (type)
+	{
+		case GL_SAMPLER_1D:
+		case GL_SAMPLER_2D:
+		case GL_SAMPLER_3D:
+		case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_1D_SHADOW:
+		case GL_SAMPLER_2D_SHADOW:
+		case GL_SAMPLER_1D_ARRAY:
+		case GL_SAMPLER_2D_ARRAY:
+		case GL_SAMPLER_1D_ARRAY_SHADOW:
+		case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_2D_MULTISAMPLE:
+		case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_SAMPLER_CUBE_SHADOW:
+		case GL_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW:
+		case GL_SAMPLER_BUFFER:
+		case GL_SAMPLER_2D_RECT:
+		case GL_SAMPLER_2D_RECT_SHADOW:
+		case GL_INT_SAMPLER_1D:
+		case GL_INT_SAMPLER_2D:
+		case GL_INT_SAMPLER_3D:
+		case GL_INT_SAMPLER_CUBE:
+		case GL_INT_SAMPLER_1D_ARRAY:
+		case GL_INT_SAMPLER_2D_ARRAY:
+		case GL_INT_SAMPLER_2D_MULTISAMPLE:
+		case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_INT_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_INT_SAMPLER_BUFFER:
+		case GL_INT_SAMPLER_2D_RECT:
+		case GL_UNSIGNED_INT_SAMPLER_1D:
+		case GL_UNSIGNED_INT_SAMPLER_2D:
+		case GL_UNSIGNED_INT_SAMPLER_3D:
+		case GL_UNSIGNED_INT_SAMPLER_CUBE:
+		case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE:
+		case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+		case GL_UNSIGNED_INT_SAMPLER_2D_RECT:
+			return true;
+	}
+	return false;
+}
+
+bool gfx_gl_has_extension(gfx_device_t *device, const char *name)
+{
+	GLint count = 0;
+	GL_CALL(GL_DEVICE, GetIntegerv, GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		const GLubyte *extension;
+		GL_CALL_RET(extension, GL_DEVICE, GetStringi, GL_EXTENSIONS, i);
+		if (extension && !strcmp((const char*)extension, name))
+			return true;
+	}
+	return false;
+}
+
 void gfx_gl_errors(uint32_t err, const char *fn, const char *file, int line)
 {
 #define TEST_ERR(code) \
@@ -359,6 +1019,98 @@ void gfx_gl_disable(gfx_device_t *device, uint32_t value)
 #endif
 }
 
+/* the area starts at the viewport, the clears of the pass covering the whole attachments */
+void gfx_gl_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	GL_DEVICE->pass_area = GL_DEVICE->viewport;
+	gfx_device_vtable.begin_render_pass(device, render_target, load_actions, clear_values);
+}
+
+void gfx_gl_render_pass_viewport(gfx_device_t *device)
+{
+	gfx_gl_rect_t *area = &GL_DEVICE->pass_area;
+	const gfx_gl_rect_t *viewport = &GL_DEVICE->viewport;
+	if (!device->render_pass || area->width == UINT32_MAX)
+		return;
+	if (viewport->width == UINT32_MAX)
+	{
+		area->width = UINT32_MAX;
+		return;
+	}
+	int64_t x1 = (int64_t)area->x + area->width;
+	int64_t y1 = (int64_t)area->y + area->height;
+	if ((int64_t)viewport->x + viewport->width > x1)
+		x1 = (int64_t)viewport->x + viewport->width;
+	if ((int64_t)viewport->y + viewport->height > y1)
+		y1 = (int64_t)viewport->y + viewport->height;
+	if (viewport->x < area->x)
+		area->x = viewport->x;
+	if (viewport->y < area->y)
+		area->y = viewport->y;
+	area->width = x1 - area->x;
+	area->height = y1 - area->y;
+}
+
+void gfx_gl_render_pass_clear(gfx_device_t *device, const gfx_render_target_t *render_target)
+{
+	if (device->render_pass && device->render_pass_target == render_target)
+		GL_DEVICE->pass_area.width = UINT32_MAX;
+}
+
+/* the area of the pass clamped to the given attachments size, false when nothing was rendered in it */
+bool gfx_gl_render_pass_area(gfx_device_t *device, uint32_t width, uint32_t height, gfx_gl_rect_t *area)
+{
+	*area = GL_DEVICE->pass_area;
+	if (area->width == UINT32_MAX)
+	{
+		area->x = 0;
+		area->y = 0;
+		area->width = width;
+		area->height = height;
+		return width && height;
+	}
+	int64_t x0 = area->x < 0 ? 0 : area->x;
+	int64_t y0 = area->y < 0 ? 0 : area->y;
+	int64_t x1 = (int64_t)area->x + area->width;
+	int64_t y1 = (int64_t)area->y + area->height;
+	if (x1 > width)
+		x1 = width;
+	if (y1 > height)
+		y1 = height;
+	if (x1 <= x0 || y1 <= y0)
+		return false;
+	area->x = x0;
+	area->y = y0;
+	area->width = x1 - x0;
+	area->height = y1 - y0;
+	return true;
+}
+
+/* attachments of the discarded draw buffers and depth stencil, with the default framebuffer names without render target */
+uint32_t gfx_gl_render_pass_attachments(const gfx_render_target_t *render_target, const bool *discarded, GLenum *attachments)
+{
+	uint32_t count = 0;
+	if (!render_target)
+	{
+		if (discarded[0])
+			attachments[count++] = GL_COLOR;
+		if (discarded[GFX_RENDER_PASS_DEPTH_STENCIL])
+		{
+			attachments[count++] = GL_DEPTH;
+			attachments[count++] = GL_STENCIL;
+		}
+		return count;
+	}
+	for (uint32_t i = 0; i < render_target->draw_buffers_nb; ++i)
+	{
+		if (discarded[i] && render_target->draw_buffers[i] >= GFX_RENDERTARGET_ATTACHMENT_COLOR0)
+			attachments[count++] = gfx_gl_render_target_attachments[render_target->draw_buffers[i]];
+	}
+	if (discarded[GFX_RENDER_PASS_DEPTH_STENCIL] && render_target->depth_stencil.texture)
+		attachments[count++] = gfx_format_has_stencil(render_target->depth_stencil.texture->format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+	return count;
+}
+
 //#define DEBUG_MESSAGE
 
 #ifdef DEBUG_MESSAGE
@@ -446,6 +1198,31 @@ static void message_callback(GLenum source, GLenum type, GLuint id, GLenum sever
 }
 #endif
 
+static void set_formats(gfx_device_t *device, enum gfx_format first, enum gfx_format last, bool supported)
+{
+	for (uint32_t i = first; i <= last; ++i)
+	{
+		if (supported)
+			device->formats |= UINT64_C(1) << i;
+		else
+			device->formats &= ~(UINT64_C(1) << i);
+	}
+}
+
+/* rgtc is core since 3.0, bptc since 4.2 and etc2 since 4.3 */
+static void gl_query_formats(gfx_device_t *device)
+{
+	GLint major = 0;
+	GLint minor = 0;
+	GL_CALL(GL_DEVICE, GetIntegerv, GL_MAJOR_VERSION, &major);
+	GL_CALL(GL_DEVICE, GetIntegerv, GL_MINOR_VERSION, &minor);
+	GLint version = major * 10 + minor;
+	set_formats(device, GFX_BC1_RGB, GFX_BC3_RGBA, gfx_gl_has_extension(device, "GL_EXT_texture_compression_s3tc"));
+	set_formats(device, GFX_BC4_R, GFX_BC5_RG, true);
+	set_formats(device, GFX_BC6H_RGB_UFLOAT, GFX_BC7_RGBA, version >= 42 || gfx_gl_has_extension(device, "GL_ARB_texture_compression_bptc"));
+	set_formats(device, GFX_ETC2_RGB, GFX_EAC_RG, version >= 43 || gfx_gl_has_extension(device, "GL_ARB_ES3_compatibility"));
+}
+
 static bool gl_ctr(gfx_device_t *device, gfx_window_t *window)
 {
 #ifdef DEBUG_MESSAGE
@@ -466,14 +1243,25 @@ static bool gl_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL_LOAD_PROC(GL_DEVICE, Enable);
 	GL_LOAD_PROC(GL_DEVICE, Disable);
 	GL_LOAD_PROC(GL_DEVICE, GetError);
+	GL_LOAD_PROC(GL_DEVICE, GetString);
+	GL_LOAD_PROC(GL_DEVICE, GetStringi);
+	gl_load_proc(device, "glFenceSync", (void**)&GL_DEVICE->FenceSync);
+	gl_load_proc(device, "glGetSynciv", (void**)&GL_DEVICE->GetSynciv);
+	gl_load_proc(device, "glClientWaitSync", (void**)&GL_DEVICE->ClientWaitSync);
+	gl_load_proc(device, "glDeleteSync", (void**)&GL_DEVICE->DeleteSync);
+	if (!GL_DEVICE->GetSynciv || !GL_DEVICE->ClientWaitSync || !GL_DEVICE->DeleteSync)
+		GL_DEVICE->FenceSync = NULL;
 	memset(GL_DEVICE->states, 0, sizeof(GL_DEVICE->states));
-	jks_array_init(&GL_DEVICE->delete_render_buffers, sizeof(uint32_t), NULL, &array_memory_fn);
-	jks_array_init(&GL_DEVICE->delete_frame_buffers, sizeof(uint32_t), NULL, &array_memory_fn);
-	jks_array_init(&GL_DEVICE->delete_vertex_arrays, sizeof(uint32_t), NULL, &array_memory_fn);
-	jks_array_init(&GL_DEVICE->delete_programs, sizeof(uint32_t), NULL, &array_memory_fn);
-	jks_array_init(&GL_DEVICE->delete_buffers, sizeof(uint32_t), NULL, &array_memory_fn);
-	jks_array_init(&GL_DEVICE->delete_shaders, sizeof(uint32_t), NULL, &array_memory_fn);
-	jks_array_init(&GL_DEVICE->delete_textures, sizeof(uint32_t), NULL, &array_memory_fn);
+	atomic_init(&GL_DEVICE->deletions, NULL);
+	atomic_init(&GL_DEVICE->frame, 1);
+	GL_DEVICE->deletions_head = NULL;
+	GL_DEVICE->deletions_tail = NULL;
+	GL_DEVICE->completed_frame = 0;
+	GL_DEVICE->fences_head = 0;
+	GL_DEVICE->fences_count = 0;
+	jks_array_init(&GL_DEVICE->pending_programs, sizeof(gfx_gl_pending_program_t*), NULL, &array_memory_fn);
+	jks_array_init(&GL_DEVICE->program_layouts, sizeof(gfx_gl_program_layout_t*), NULL, &array_memory_fn);
+	jks_array_init(&GL_DEVICE->dirty_buffers, sizeof(gfx_gl_buffer_shadow_t*), NULL, &array_memory_fn);
 	memset(GL_DEVICE->textures, 0, sizeof(GL_DEVICE->textures));
 	GL_DEVICE->blend_equation_c = GFX_EQUATION_ADD;
 	GL_DEVICE->blend_equation_a = GFX_EQUATION_ADD;
@@ -497,6 +1285,25 @@ static bool gl_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL_DEVICE->active_texture = 0;
 	GL_DEVICE->vertex_array = 0;
 	GL_DEVICE->program = 0;
+	GL_DEVICE->vaos_count = 0;
+	GL_DEVICE->vaos_clock = 0;
+	GL_DEVICE->fbos_count = 0;
+	GL_DEVICE->fbos_clock = 0;
+	GL_DEVICE->vertex_buffers_valid = false;
+	for (uint32_t i = 0; i < GFX_GL_BUFFER_SLOTS; ++i)
+		GL_DEVICE->buffers[i] = 0;
+	for (uint32_t i = 0; i < GFX_GL_UNIFORM_BINDINGS; ++i)
+	{
+		GL_DEVICE->uniform_ranges[i].buffer = 0;
+		GL_DEVICE->uniform_ranges[i].offset = 0;
+		GL_DEVICE->uniform_ranges[i].size = 0;
+	}
+	GL_DEVICE->draw_framebuffer = 0;
+	GL_DEVICE->read_framebuffer = 0;
+	/* unknown until the first call */
+	GL_DEVICE->viewport.width = UINT32_MAX;
+	GL_DEVICE->scissor_box.width = UINT32_MAX;
+	GL_DEVICE->pass_area.width = UINT32_MAX;
 	GL_DEVICE->line_width = 1;
 	GL_DEVICE->point_size = 1;
 	GL_DEVICE->scissor = false;
@@ -507,10 +1314,42 @@ static bool gl_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL_DEVICE->rasterizer_state = 0;
 	GL_DEVICE->attributes_state = NULL;
 	GL_DEVICE->pipeline_state = 0;
-	pthread_mutex_init(&GL_DEVICE->delete_mutex, NULL);
+	GL_DEVICE->driver_hash = GFX_GL_HASH_INIT;
+	GL_DEVICE->program_cache_pruned = false;
+	static const GLenum driver_strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+	for (size_t i = 0; i < sizeof(driver_strings) / sizeof(*driver_strings); ++i)
+	{
+		const GLubyte *str;
+		GL_CALL_RET(str, GL_DEVICE, GetString, driver_strings[i]);
+		if (str)
+			GL_DEVICE->driver_hash = gfx_gl_hash(GL_DEVICE->driver_hash, str, strlen((const char*)str) + 1);
+	}
+	/* GL_NUM_PROGRAM_BINARY_FORMATS is unknown without ARB_get_program_binary, drain the error */
+	GLint binary_formats = 0;
+	GL_DEVICE->GetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binary_formats);
+	while (GL_DEVICE->GetError())
+		binary_formats = 0;
+	GL_DEVICE->program_binary = binary_formats > 0;
+	GL_DEVICE->parallel_shader_compile = false;
+	if (gfx_gl_has_extension(device, "GL_KHR_parallel_shader_compile"))
+		gl_load_proc(device, "glMaxShaderCompilerThreadsKHR", (void**)&GL_DEVICE->MaxShaderCompilerThreadsKHR);
+	else if (gfx_gl_has_extension(device, "GL_ARB_parallel_shader_compile"))
+		gl_load_proc(device, "glMaxShaderCompilerThreadsARB", (void**)&GL_DEVICE->MaxShaderCompilerThreadsKHR);
+	else
+		GL_DEVICE->MaxShaderCompilerThreadsKHR = NULL;
+	if (GL_DEVICE->MaxShaderCompilerThreadsKHR)
+	{
+		/* let the driver pick its own thread count */
+		GL_CALL(GL_DEVICE, MaxShaderCompilerThreadsKHR, 0xFFFFFFFF);
+		GL_DEVICE->parallel_shader_compile = true;
+	}
 	GL_CALL(GL_DEVICE, GetIntegerv, GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, (int32_t*)&device->constant_alignment);
+	gl_query_formats(device);
 	GL_CALL(GL_DEVICE, GetIntegerv, GL_MAX_TEXTURE_IMAGE_UNITS, (int32_t*)&device->max_samplers);
 	GL_CALL(GL_DEVICE, GetIntegerv, GL_MAX_COLOR_TEXTURE_SAMPLES, (int32_t*)&device->max_msaa);
+	GL_CALL(GL_DEVICE, GetIntegerv, GL_MAX_TEXTURE_SIZE, (int32_t*)&device->max_texture_size);
+	GL_CALL(GL_DEVICE, GetIntegerv, GL_MAX_3D_TEXTURE_SIZE, (int32_t*)&device->max_texture_3d_size);
+	GL_CALL(GL_DEVICE, GetIntegerv, GL_MAX_ARRAY_TEXTURE_LAYERS, (int32_t*)&device->max_texture_layers);
 #ifndef NDEBUG
 	for (uint32_t i = 1; i <= device->max_msaa; i *= 2)
 		printf("MSAA %" PRIu32 "\n", i);
@@ -526,56 +1365,288 @@ static bool gl_ctr(gfx_device_t *device, gfx_window_t *window)
 	return true;
 }
 
+static void collect_deletions(gfx_device_t *device);
+static void run_deletions(gfx_device_t *device, uint64_t frame, uint64_t budget);
+
 static void gl_dtr(gfx_device_t *device)
 {
-	jks_array_destroy(&GL_DEVICE->delete_render_buffers);
-	jks_array_destroy(&GL_DEVICE->delete_frame_buffers);
-	jks_array_destroy(&GL_DEVICE->delete_vertex_arrays);
-	jks_array_destroy(&GL_DEVICE->delete_programs);
-	jks_array_destroy(&GL_DEVICE->delete_buffers);
-	jks_array_destroy(&GL_DEVICE->delete_shaders);
-	jks_array_destroy(&GL_DEVICE->delete_textures);
+	collect_deletions(device);
+	run_deletions(device, UINT64_MAX, UINT64_MAX);
+	for (uint32_t i = 0; i < GL_DEVICE->fences_count; ++i)
+		GL_CALL(GL_DEVICE, DeleteSync, GL_DEVICE->fences[(GL_DEVICE->fences_head + i) % GFX_GL_FRAME_LATENCY]);
+	for (uint32_t i = 0; i < GL_DEVICE->pending_programs.size; ++i)
+		GFX_FREE(*JKS_ARRAY_GET(&GL_DEVICE->pending_programs, i, gfx_gl_pending_program_t*));
+	jks_array_destroy(&GL_DEVICE->pending_programs);
+	for (uint32_t i = 0; i < GL_DEVICE->program_layouts.size; ++i)
+		GFX_FREE(*JKS_ARRAY_GET(&GL_DEVICE->program_layouts, i, gfx_gl_program_layout_t*));
+	jks_array_destroy(&GL_DEVICE->program_layouts);
+	jks_array_destroy(&GL_DEVICE->dirty_buffers);
 	gfx_device_vtable.dtr(device);
 }
 
-static void gl_tick(gfx_device_t *device)
+/* deleted names are unbound by GL and may be handed out again */
+static void forget_buffers(gfx_device_t *device, const GLuint *buffers, uint32_t count)
 {
-	gfx_device_vtable.tick(device);
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (GL_DEVICE->delete_buffers.size)
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		for (uint32_t j = 0; j < GFX_GL_BUFFER_SLOTS; ++j)
+		{
+			if (GL_DEVICE->buffers[j] == buffers[i])
+				GL_DEVICE->buffers[j] = 0;
+		}
+		for (uint32_t j = 0; j < GFX_GL_UNIFORM_BINDINGS; ++j)
+		{
+			if (GL_DEVICE->uniform_ranges[j].buffer == buffers[i])
+				GL_DEVICE->uniform_ranges[j].buffer = 0;
+		}
+		if (GL_DEVICE->element_buffer == buffers[i])
+			GL_DEVICE->vertex_buffers_valid = false;
+		for (size_t j = 0; j < sizeof(GL_DEVICE->vertex_buffers) / sizeof(*GL_DEVICE->vertex_buffers); ++j)
+		{
+			if (GL_DEVICE->vertex_buffers[j] == buffers[i])
+				GL_DEVICE->vertex_buffers_valid = false;
+		}
+		/* a cached vertex array would keep the old storage alive under a recycled name */
+		for (uint32_t j = 0; j < GL_DEVICE->vaos_count;)
+		{
+			const gfx_gl_vao_key_t *key = &GL_DEVICE->vaos[j].key;
+			bool used = key->index_buffer == buffers[i];
+			for (size_t k = 0; !used && k < sizeof(key->binds) / sizeof(*key->binds); ++k)
+				used = key->binds[k].buffer == buffers[i];
+			if (used)
+				evict_vao(device, j);
+			else
+				++j;
+		}
+	}
+}
+
+static void push_deletion(gfx_device_t *device, gfx_gl_deletion_t *deletion)
+{
+	deletion->frame = atomic_load_explicit(&GL_DEVICE->frame, memory_order_relaxed);
+	deletion->next = atomic_load_explicit(&GL_DEVICE->deletions, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&GL_DEVICE->deletions, &deletion->next, deletion, memory_order_release, memory_order_relaxed))
+		;
+}
+
+void gfx_gl_delete_object(gfx_device_t *device, enum gfx_gl_object_type type, GLuint name)
+{
+	gfx_gl_deletion_t *deletion = GFX_MALLOC(sizeof(*deletion));
+	if (!deletion)
+	{
+		assert(!"failed to queue object gc");
+		return;
+	}
+	deletion->type = type;
+	deletion->name = name;
+	deletion->shadow = NULL;
+	push_deletion(device, deletion);
+}
+
+void gfx_gl_delete_shadow(gfx_device_t *device, gfx_gl_buffer_shadow_t *shadow)
+{
+	gfx_gl_deletion_t *deletion = GFX_MALLOC(sizeof(*deletion));
+	if (!deletion)
 	{
-		GL_CALL(GL_DEVICE, DeleteBuffers, GL_DEVICE->delete_buffers.size, (const GLuint*)GL_DEVICE->delete_buffers.data);
-		jks_array_resize(&GL_DEVICE->delete_buffers, 0);
+		assert(!"failed to queue object gc");
+		return;
 	}
-	if (GL_DEVICE->delete_render_buffers.size)
+	deletion->type = GFX_GL_OBJECT_BUFFER_SHADOW;
+	deletion->name = 0;
+	deletion->shadow = shadow;
+	push_deletion(device, deletion);
+}
+
+/* move the pushed deletions to the tick-owned list, in submission order */
+static void collect_deletions(gfx_device_t *device)
+{
+	gfx_gl_deletion_t *stack = atomic_exchange_explicit(&GL_DEVICE->deletions, NULL, memory_order_acquire);
+	gfx_gl_deletion_t *list = NULL;
+	while (stack)
+	{
+		gfx_gl_deletion_t *next = stack->next;
+		stack->next = list;
+		list = stack;
+		stack = next;
+	}
+	if (!list)
+		return;
+	if (GL_DEVICE->deletions_tail)
+		GL_DEVICE->deletions_tail->next = list;
+	else
+		GL_DEVICE->deletions_head = list;
+	while (list->next)
+		list = list->next;
+	GL_DEVICE->deletions_tail = list;
+}
+
+static void delete_objects(gfx_device_t *device, enum gfx_gl_object_type type, const GLuint *names, uint32_t count)
+{
+	switch (type)
+	{
+		case GFX_GL_OBJECT_BUFFER:
+			GL_CALL(GL_DEVICE, DeleteBuffers, count, names);
+			forget_buffers(device, names, count);
+			break;
+		case GFX_GL_OBJECT_RENDER_BUFFER:
+			GL_CALL(GL_DEVICE, DeleteRenderbuffers, count, names);
+			break;
+		case GFX_GL_OBJECT_FRAME_BUFFER:
+			GL_CALL(GL_DEVICE, DeleteFramebuffers, count, names);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (GL_DEVICE->draw_framebuffer == names[i])
+					GL_DEVICE->draw_framebuffer = 0;
+				if (GL_DEVICE->read_framebuffer == names[i])
+					GL_DEVICE->read_framebuffer = 0;
+			}
+			break;
+		case GFX_GL_OBJECT_VERTEX_ARRAY:
+			GL_CALL(GL_DEVICE, DeleteVertexArrays, count, names);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (GL_DEVICE->vertex_array == names[i])
+					GL_DEVICE->vertex_array = 0;
+			}
+			break;
+		case GFX_GL_OBJECT_PROGRAM:
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (GL_DEVICE->pending_programs.size)
+					gfx_gl_pending_program_remove(device, names[i]);
+				if (GL_DEVICE->program == names[i])
+					GL_DEVICE->program = 0;
+				GL_CALL(GL_DEVICE, DeleteProgram, names[i]);
+			}
+			break;
+		case GFX_GL_OBJECT_SHADER:
+			for (uint32_t i = 0; i < count; ++i)
+				GL_CALL(GL_DEVICE, DeleteShader, names[i]);
+			break;
+		case GFX_GL_OBJECT_TEXTURE:
+			GL_CALL(GL_DEVICE, DeleteTextures, count, names);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				for (size_t j = 0; j < sizeof(GL_DEVICE->textures) / sizeof(*GL_DEVICE->textures); ++j)
+				{
+					if (GL_DEVICE->textures[j] == names[i])
+						GL_DEVICE->textures[j] = 0;
+				}
+				/* a cached framebuffer would keep the old storage attached under a recycled name */
+				for (uint32_t j = 0; j < GL_DEVICE->fbos_count;)
+				{
+					const gfx_gl_fbo_key_t *key = &GL_DEVICE->fbos[j].key;
+					bool used = key->depth_stencil == names[i];
+					for (size_t k = 0; !used && k < sizeof(key->colors) / sizeof(*key->colors); ++k)
+						used = key->colors[k] == names[i];
+					if (used)
+						evict_fbo(device, j);
+					else
+						++j;
+				}
+			}
+			break;
+		default:
+			assert(!"unknown object type");
+			break;
+	}
+}
+
+static uint64_t nanotime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* delete the objects released up to the given frame, batched by type, until the budget runs out */
+static void run_deletions(gfx_device_t *device, uint64_t frame, uint64_t budget)
+{
+	GLuint names[GFX_GL_OBJECT_TYPES][64];
+	uint32_t counts[GFX_GL_OBJECT_TYPES] = {0};
+	uint64_t started = budget != UINT64_MAX ? nanotime() : 0;
+	uint32_t done = 0;
+	while (GL_DEVICE->deletions_head && GL_DEVICE->deletions_head->frame <= frame)
+	{
+		if (budget != UINT64_MAX && done && !(done % 32) && nanotime() - started > budget)
+			break;
+		gfx_gl_deletion_t *deletion = GL_DEVICE->deletions_head;
+		GL_DEVICE->deletions_head = deletion->next;
+		if (!GL_DEVICE->deletions_head)
+			GL_DEVICE->deletions_tail = NULL;
+		enum gfx_gl_object_type type = deletion->type;
+		if (type == GFX_GL_OBJECT_BUFFER_SHADOW)
+		{
+			free_shadow(device, deletion->shadow);
+		}
+		else
+		{
+			names[type][counts[type]++] = deletion->name;
+			if (counts[type] == sizeof(*names) / sizeof(**names))
+			{
+				delete_objects(device, type, names[type], counts[type]);
+				counts[type] = 0;
+			}
+		}
+		GFX_FREE(deletion);
+		done++;
+	}
+	for (uint32_t i = 0; i < GFX_GL_OBJECT_TYPES; ++i)
 	{
-		GL_CALL(GL_DEVICE, DeleteRenderbuffers, GL_DEVICE->delete_render_buffers.size, (const GLuint*)GL_DEVICE->delete_render_buffers.data);
-		jks_array_resize(&GL_DEVICE->delete_render_buffers, 0);
+		if (counts[i])
+			delete_objects(device, i, names[i], counts[i]);
 	}
-	if (GL_DEVICE->delete_frame_buffers.size)
+}
+
+/* retire the signaled frames and fence the one which just ended */
+static void end_frame(gfx_device_t *device)
+{
+	uint64_t frame = atomic_load_explicit(&GL_DEVICE->frame, memory_order_relaxed);
+	if (!GL_DEVICE->FenceSync)
 	{
-		GL_CALL(GL_DEVICE, DeleteFramebuffers, GL_DEVICE->delete_frame_buffers.size, (const GLuint*)GL_DEVICE->delete_frame_buffers.data);
-		jks_array_resize(&GL_DEVICE->delete_frame_buffers, 0);
+		/* without sync objects, assume the driver never queues more than the frame latency */
+		if (frame > GFX_GL_FRAME_LATENCY)
+			GL_DEVICE->completed_frame = frame - GFX_GL_FRAME_LATENCY;
+		atomic_store_explicit(&GL_DEVICE->frame, frame + 1, memory_order_relaxed);
+		return;
 	}
-	if (GL_DEVICE->delete_vertex_arrays.size)
+	while (GL_DEVICE->fences_count)
 	{
-		GL_CALL(GL_DEVICE, DeleteVertexArrays, GL_DEVICE->delete_vertex_arrays.size, (const GLuint*)GL_DEVICE->delete_vertex_arrays.data);
-		jks_array_resize(&GL_DEVICE->delete_vertex_arrays, 0);
+		GLsync fence = GL_DEVICE->fences[GL_DEVICE->fences_head];
+		GLint status = GL_UNSIGNALED;
+		GL_CALL(GL_DEVICE, GetSynciv, fence, GL_SYNC_STATUS, 1, NULL, &status);
+		if (status != GL_SIGNALED)
+		{
+			if (GL_DEVICE->fences_count < GFX_GL_FRAME_LATENCY)
+				break;
+			GLenum ret;
+			GL_CALL_RET(ret, GL_DEVICE, ClientWaitSync, fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+			(void)ret;
+		}
+		GL_DEVICE->completed_frame = GL_DEVICE->fences_frames[GL_DEVICE->fences_head];
+		GL_CALL(GL_DEVICE, DeleteSync, fence);
+		GL_DEVICE->fences_head = (GL_DEVICE->fences_head + 1) % GFX_GL_FRAME_LATENCY;
+		GL_DEVICE->fences_count--;
 	}
-	for (uint32_t i = 0; i < GL_DEVICE->delete_programs.size; ++i)
-		GL_CALL(GL_DEVICE, DeleteProgram, *JKS_ARRAY_GET(&GL_DEVICE->delete_programs, i, uint32_t));
-	jks_array_resize(&GL_DEVICE->delete_programs, 0);
-	for (uint32_t i = 0; i < GL_DEVICE->delete_shaders.size; ++i)
-		GL_CALL(GL_DEVICE, DeleteShader, *JKS_ARRAY_GET(&GL_DEVICE->delete_shaders, i, uint32_t));
-	jks_array_resize(&GL_DEVICE->delete_shaders, 0);
-	if (GL_DEVICE->delete_textures.size)
+	GLsync fence;
+	GL_CALL_RET(fence, GL_DEVICE, FenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	if (fence)
 	{
-		GL_CALL(GL_DEVICE, DeleteTextures, GL_DEVICE->delete_textures.size, (const GLuint*)GL_DEVICE->delete_textures.data);
-		jks_array_resize(&GL_DEVICE->delete_textures, 0);
+		uint32_t slot = (GL_DEVICE->fences_head + GL_DEVICE->fences_count) % GFX_GL_FRAME_LATENCY;
+		GL_DEVICE->fences[slot] = fence;
+		GL_DEVICE->fences_frames[slot] = frame;
+		GL_DEVICE->fences_count++;
 	}
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	atomic_store_explicit(&GL_DEVICE->frame, frame + 1, memory_order_relaxed);
 }
 
+static void gl_tick(gfx_device_t *device)
+{
+	gfx_device_vtable.tick(device);
+	end_frame(device);
+	collect_deletions(device);
+	run_deletions(device, GL_DEVICE->completed_frame, GFX_GL_DELETE_BUDGET_NS);
+}
 const gfx_device_vtable_t gfx_gl_device_vtable =
 {
 	.ctr = gl_ctr,
@@ -4,24 +4,167 @@
 #include "../device.h"
 #include <GL/glcorearb.h>
 #include <jks/array.h>
-#include <pthread.h>
+#include <stdatomic.h>
 #include <limits.h>
 
 typedef void *(gfx_gl_load_addr_t)(const char *name);
 
+typedef struct gfx_gl_pending_program_s
+{
+	GLuint program;
+	GLuint shaders[3];
+	uint64_t cache_key;
+	uint64_t layout_key;
+	gfx_shader_constant_t *constants;
+	gfx_shader_sampler_t *samplers;
+} gfx_gl_pending_program_t;
+
+typedef struct gfx_gl_program_slot_s
+{
+	GLint index; /* block index, or sampler location */
+	uint32_t bind;
+} gfx_gl_program_slot_t;
+
+/* the blocks and samplers of a program bound by the user tables, the blocks slots being first */
+typedef struct gfx_gl_program_layout_s
+{
+	uint64_t key;
+	uint32_t blocks_count;
+	uint32_t samplers_count;
+	gfx_gl_program_slot_t slots[];
+} gfx_gl_program_layout_t;
+
+#define GFX_GL_SHADOW_RANGES 8
+#define GFX_GL_SHADOW_MERGE_GAP 256
+
+typedef struct gfx_gl_buffer_range_s
+{
+	uint32_t start;
+	uint32_t end;
+} gfx_gl_buffer_range_t;
+
+/* CPU copy of a dynamic buffer, uploaded by dirty ranges before the next draw */
+typedef struct gfx_gl_buffer_shadow_s
+{
+	GLuint buffer;
+	bool dirty;
+	uint32_t ranges_count;
+	gfx_gl_buffer_range_t ranges[GFX_GL_SHADOW_RANGES];
+	uint32_t size;
+	uint8_t data[];
+} gfx_gl_buffer_shadow_t;
+
+#define GFX_GL_UNIFORM_BINDINGS 32
+
+enum gfx_gl_buffer_slot
+{
+	GFX_GL_BUFFER_SLOT_ARRAY,
+	GFX_GL_BUFFER_SLOT_UNIFORM,
+	GFX_GL_BUFFER_SLOT_COPY_WRITE,
+	GFX_GL_BUFFER_SLOTS,
+};
+
+typedef struct gfx_gl_uniform_range_s
+{
+	GLuint buffer;
+	uint32_t offset;
+	uint32_t size;
+} gfx_gl_uniform_range_t;
+
+typedef struct gfx_gl_rect_s
+{
+	int32_t x;
+	int32_t y;
+	uint32_t width;
+	uint32_t height;
+} gfx_gl_rect_t;
+
+#define GFX_GL_VAO_CACHE_SIZE 256
+
+typedef struct gfx_gl_vao_bind_s
+{
+	GLuint buffer;
+	uint32_t stride;
+	uint32_t offset;
+	uint32_t type;
+} gfx_gl_vao_bind_t;
+
+typedef struct gfx_gl_vao_key_s
+{
+	gfx_gl_vao_bind_t binds[8];
+	GLuint index_buffer;
+} gfx_gl_vao_key_t;
+
+typedef struct gfx_gl_vao_s
+{
+	gfx_gl_vao_key_t key;
+	uint64_t hash;
+	uint64_t last_use;
+	GLuint vao;
+} gfx_gl_vao_t;
+
+#define GFX_GL_FBO_CACHE_SIZE 64
+
+/* attachments are always at level 0 */
+typedef struct gfx_gl_fbo_key_s
+{
+	GLuint colors[8];
+	GLuint depth_stencil;
+	uint8_t draw_buffers[8];
+	uint32_t draw_buffers_nb;
+} gfx_gl_fbo_key_t;
+
+typedef struct gfx_gl_fbo_s
+{
+	gfx_gl_fbo_key_t key;
+	uint64_t hash;
+	uint64_t last_use;
+	GLuint fbo;
+} gfx_gl_fbo_t;
+
+#define GFX_GL_FRAME_LATENCY 3
+#define GFX_GL_DELETE_BUDGET_NS 500000
+
+enum gfx_gl_object_type
+{
+	GFX_GL_OBJECT_BUFFER,
+	GFX_GL_OBJECT_RENDER_BUFFER,
+	GFX_GL_OBJECT_FRAME_BUFFER,
+	GFX_GL_OBJECT_VERTEX_ARRAY,
+	GFX_GL_OBJECT_PROGRAM,
+	GFX_GL_OBJECT_SHADER,
+	GFX_GL_OBJECT_TEXTURE,
+	GFX_GL_OBJECT_BUFFER_SHADOW,
+	GFX_GL_OBJECT_TYPES,
+};
+
+typedef struct gfx_gl_deletion_s
+{
+	struct gfx_gl_deletion_s *next;
+	uint64_t frame;
+	enum gfx_gl_object_type type;
+	GLuint name;
+	gfx_gl_buffer_shadow_t *shadow; /* for GFX_GL_OBJECT_BUFFER_SHADOW */
+} gfx_gl_deletion_t;
+
 typedef struct gfx_gl_device_s
 {
 	gfx_device_t device;
 	gfx_gl_load_addr_t *load_addr;
 	uint32_t textures[16];
-	jks_array_t delete_render_buffers; /* uint32_t */
-	jks_array_t delete_frame_buffers; /* uint32_t */
-	jks_array_t delete_vertex_arrays; /* uint32_t */
-	jks_array_t delete_programs; /* uint32_t */
-	jks_array_t delete_buffers; /* uint32_t */
-	jks_array_t delete_shaders; /* uint32_t */
-	jks_array_t delete_textures; /* uint32_t */
-	pthread_mutex_t delete_mutex;
+	/* deletions are pushed lock-free by any thread, and run once the GPU is past their frame */
+	_Atomic(gfx_gl_deletion_t*) deletions;
+	gfx_gl_deletion_t *deletions_head;
+	gfx_gl_deletion_t *deletions_tail;
+	_Atomic(uint64_t) frame;
+	uint64_t completed_frame;
+	GLsync fences[GFX_GL_FRAME_LATENCY];
+	uint64_t fences_frames[GFX_GL_FRAME_LATENCY];
+	uint32_t fences_head;
+	uint32_t fences_count;
+	jks_array_t pending_programs; /* gfx_gl_pending_program_t* */
+	jks_array_t program_layouts; /* gfx_gl_program_layout_t* */
+	jks_array_t dirty_buffers; /* gfx_gl_buffer_shadow_t* */
 	/* blend */
 	enum gfx_blend_equation blend_equation_c;
 	enum gfx_blend_equation blend_equation_a;
@@ -46,8 +189,30 @@ typedef struct gfx_gl_device_s
 	enum gfx_cull_mode cull_mode;
 	enum gfx_front_face front_face;
 	bool scissor;
+	/* bindings */
+	GLuint buffers[GFX_GL_BUFFER_SLOTS];
+	gfx_gl_uniform_range_t uniform_ranges[GFX_GL_UNIFORM_BINDINGS];
+	GLuint draw_framebuffer;
+	GLuint read_framebuffer;
+	gfx_gl_rect_t viewport;
+	gfx_gl_rect_t scissor_box;
+	/* union of the viewports of the render pass, the whole attachments when its width is UINT32_MAX */
+	gfx_gl_rect_t pass_area;
 	/* attributes */
 	const gfx_attributes_state_t *attributes_state;
+	gfx_gl_vao_t vaos[GFX_GL_VAO_CACHE_SIZE];
+	uint32_t vaos_count;
+	uint64_t vaos_clock;
+	/* render targets */
+	gfx_gl_fbo_t fbos[GFX_GL_FBO_CACHE_SIZE];
+	uint32_t fbos_count;
+	uint64_t fbos_clock;
+	/* vertex buffers of the bound vertex array, invalidated when it changes */
+	bool vertex_buffers_valid;
+	GLuint vertex_buffers[8];
+	GLintptr vertex_offsets[8];
+	GLsizei vertex_strides[8];
+	GLuint element_buffer;
 	uint32_t active_texture;
 	uint32_t vertex_array;
 	uint32_t program;
@@ -59,6 +224,10 @@ typedef struct gfx_gl_device_s
 	uint64_t depth_state;
 	uint64_t rasterizer_state;
 	uint64_t pipeline_state;
+	uint64_t driver_hash;
+	bool program_binary;
+	bool program_cache_pruned;
+	bool parallel_shader_compile;
 	PFNGLDELETEBUFFERSPROC DeleteBuffers;
 	PFNGLDELETERENDERBUFFERSPROC DeleteRenderbuffers;
 	PFNGLDELETEFRAMEBUFFERSPROC DeleteFramebuffers;
@@ -71,6 +240,13 @@ typedef struct gfx_gl_device_s
 	PFNGLENABLEPROC Enable;
 	PFNGLDISABLEPROC Disable;
 	PFNGLGETERRORPROC GetError;
+	PFNGLGETSTRINGPROC GetString;
+	PFNGLGETSTRINGIPROC GetStringi;
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC MaxShaderCompilerThreadsKHR;
+	PFNGLFENCESYNCPROC FenceSync;
+	PFNGLGETSYNCIVPROC GetSynciv;
+	PFNGLCLIENTWAITSYNCPROC ClientWaitSync;
+	PFNGLDELETESYNCPROC DeleteSync;
 	uint8_t states[(USHRT_MAX + 7) / 8];
 } gfx_gl_device_t;
 
@@ -95,6 +271,12 @@ do \
 
 #endif
 
+#ifndef NDEBUG
+# define GL_SKIPPED_CALL(device) ((gfx_device_t*)(device))->skipped_calls_count++
+#else
+# define GL_SKIPPED_CALL(device) do {} while (0)
+#endif
+
 #define GL_CALL(device, fn, ...) do { device->fn(__VA_ARGS__); GL_CALL_DEBUG(fn); } while (0)
 #define GL_CALL_RET(ret, device, fn, ...) do { ret = device->fn(__VA_ARGS__); GL_CALL_DEBUG(fn); } while (0)
 
@@ -137,6 +319,53 @@ extern const GLenum gfx_gl_attribute_types[];
 extern const GLint gfx_gl_attribute_nb[];
 extern const bool gfx_gl_attribute_float[];
 
+#define GFX_GL_HASH_INIT 0xcbf29ce484222325ull
+
+uint64_t gfx_gl_hash(uint64_t hash, const void *data, size_t size);
+uint64_t gfx_gl_program_key(gfx_device_t *device, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers);
+void *gfx_gl_program_cache_read(gfx_device_t *device, uint64_t key, GLenum *format, GLsizei *length);
+void gfx_gl_program_cache_write(gfx_device_t *device, uint64_t key, GLenum format, const void *data, GLsizei length);
+
+gfx_gl_pending_program_t *gfx_gl_pending_program_add(gfx_device_t *device, GLuint program, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers);
+gfx_gl_pending_program_t *gfx_gl_pending_program_get(gfx_device_t *device, GLuint program);
+void gfx_gl_pending_program_remove(gfx_device_t *device, GLuint program);
+const gfx_gl_program_layout_t *gfx_gl_program_layout_get(gfx_device_t *device, uint64_t key);
+const gfx_gl_program_layout_t *gfx_gl_program_layout_add(gfx_device_t *device, uint64_t key, const gfx_gl_program_slot_t *slots, uint32_t blocks_count, uint32_t samplers_count);
+
+static inline bool gfx_gl_program_cache_enabled(gfx_device_t *device)
+{
+	return ((gfx_gl_device_t*)device)->program_binary && device->shader_cache;
+}
+
+bool gfx_gl_constant_bind(const gfx_shader_constant_t *constants, const char *name, uint32_t *bind);
+bool gfx_gl_sampler_bind(const gfx_shader_sampler_t *samplers, const char *name, uint32_t *bind);
+bool gfx_gl_sampler_type(GLenum type);
+bool gfx_gl_buffer_shadow_create(gfx_device_t *device, gfx_buffer_t *buffer, const void *data);
+void gfx_gl_buffer_shadow_write(gfx_device_t *device, gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset);
+void gfx_gl_buffer_shadow_delete(gfx_device_t *device, gfx_buffer_t *buffer);
+
+static inline bool gfx_gl_buffer_shadowed(const gfx_buffer_t *buffer)
+{
+	return buffer->shadow.ptr != NULL;
+}
+
+void gfx_gl_vao_key(gfx_gl_vao_key_t *key, const gfx_attributes_state_t *state, const gfx_input_layout_t *input_layout);
+gfx_gl_vao_t *gfx_gl_vao_find(gfx_device_t *device, const gfx_gl_vao_key_t *key, uint32_t hint);
+gfx_gl_vao_t *gfx_gl_vao_alloc(gfx_device_t *device, const gfx_gl_vao_key_t *key);
+void gfx_gl_fbo_key(gfx_gl_fbo_key_t *key, const gfx_render_target_t *render_target);
+gfx_gl_fbo_t *gfx_gl_fbo_find(gfx_device_t *device, const gfx_gl_fbo_key_t *key, uint32_t hint);
+gfx_gl_fbo_t *gfx_gl_fbo_alloc(gfx_device_t *device, const gfx_gl_fbo_key_t *key);
+
+void gfx_gl_delete_object(gfx_device_t *device, enum gfx_gl_object_type type, GLuint name);
+void gfx_gl_delete_shadow(gfx_device_t *device, gfx_gl_buffer_shadow_t *shadow);
+
+void gfx_gl_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values);
+void gfx_gl_render_pass_viewport(gfx_device_t *device);
+void gfx_gl_render_pass_clear(gfx_device_t *device, const gfx_render_target_t *render_target);
+bool gfx_gl_render_pass_area(gfx_device_t *device, uint32_t width, uint32_t height, gfx_gl_rect_t *area);
+uint32_t gfx_gl_render_pass_attachments(const gfx_render_target_t *render_target, const bool *discarded, GLenum *attachments);
+
+bool gfx_gl_has_extension(gfx_device_t *device, const char *name);
 void gfx_gl_errors(uint32_t err, const char *fn, const char *file, int line);
 void gfx_gl_enable(gfx_device_t *device, uint32_t value);
 void gfx_gl_disable(gfx_device_t *device, uint32_t value);
@@ -14,6 +14,10 @@
 # define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
 #endif
 
+#ifndef GL_COMPLETION_STATUS_KHR
+# define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 #define GL3_CALL(fn, ...) GL_CALL(GL3_DEVICE, fn, __VA_ARGS__)
 #define GL3_CALL_RET(ret, fn, ...) GL_CALL_RET(ret, GL3_DEVICE, fn, __VA_ARGS__)
 
@@ -27,6 +31,7 @@ typedef struct gfx_gl3_device_s
 	PFNGLBLITFRAMEBUFFERPROC BlitFramebuffer;
 	PFNGLDRAWBUFFERPROC DrawBuffer;
 	PFNGLREADBUFFERPROC ReadBuffer;
+	PFNGLINVALIDATEFRAMEBUFFERPROC InvalidateFramebuffer;
 	PFNGLBINDFRAMEBUFFERPROC BindFramebuffer;
 	PFNGLGENFRAMEBUFFERSPROC GenFramebuffers;
 	PFNGLBINDBUFFERRANGEPROC BindBufferRange;
@@ -34,7 +39,9 @@ typedef struct gfx_gl3_device_s
 	PFNGLUNIFORM1IPROC Uniform1i;
 	PFNGLGETUNIFORMLOCATIONPROC GetUniformLocation;
 	PFNGLUNIFORMBLOCKBINDINGPROC UniformBlockBinding;
-	PFNGLGETUNIFORMBLOCKINDEXPROC GetUniformBlockIndex;
+	PFNGLGETACTIVEUNIFORMBLOCKNAMEPROC GetActiveUniformBlockName;
+	PFNGLGETACTIVEUNIFORMSIVPROC GetActiveUniformsiv;
+	PFNGLGETACTIVEUNIFORMNAMEPROC GetActiveUniformName;
 	PFNGLDETACHSHADERPROC DetachShader;
 	PFNGLGETPROGRAMINFOLOGPROC GetProgramInfoLog;
 	PFNGLGETPROGRAMIVPROC GetProgramiv;
@@ -97,7 +104,12 @@ typedef struct gfx_gl3_device_s
 	PFNGLTEXIMAGE2DMULTISAMPLEPROC TexImage2DMultisample;
 	PFNGLTEXIMAGE3DMULTISAMPLEPROC TexImage3DMultisample;
 	PFNGLCOLORMASKPROC ColorMask;
+	PFNGLGETPROGRAMBINARYPROC GetProgramBinary;
+	PFNGLPROGRAMBINARYPROC ProgramBinary;
+	PFNGLPROGRAMPARAMETERIPROC ProgramParameteri;
 	enum gfx_primitive_type primitive;
+	/* bound render target, whose framebuffer follows its attachments */
+	const gfx_render_target_t *render_target;
 } gfx_gl3_device_t;
 
 static void gl_active_texture(gfx_device_t *device, uint32_t bind)
@@ -121,10 +133,73 @@ static void gl_bind_texture(gfx_device_t *device, const gfx_texture_t *texture)
 	}
 }
 
+static void gl3_bind_buffer(gfx_device_t *device, GLenum target, GLuint buffer)
+{
+	enum gfx_gl_buffer_slot slot;
+	switch (target)
+	{
+		case GL_ARRAY_BUFFER:
+			slot = GFX_GL_BUFFER_SLOT_ARRAY;
+			break;
+		case GL_UNIFORM_BUFFER:
+			slot = GFX_GL_BUFFER_SLOT_UNIFORM;
+			break;
+		case GL_COPY_WRITE_BUFFER:
+			slot = GFX_GL_BUFFER_SLOT_COPY_WRITE;
+			break;
+		default:
+			/* element array binding belongs to the bound VAO */
+			GL3_CALL(BindBuffer, target, buffer);
+			return;
+	}
+	if (GL_DEVICE->buffers[slot] == buffer)
+	{
+		GL_SKIPPED_CALL(device);
+		return;
+	}
+	GL_DEVICE->buffers[slot] = buffer;
+	GL3_CALL(BindBuffer, target, buffer);
+}
+
+static void gl3_bind_framebuffer(gfx_device_t *device, GLenum target, GLuint framebuffer)
+{
+	switch (target)
+	{
+		case GL_DRAW_FRAMEBUFFER:
+			if (GL_DEVICE->draw_framebuffer == framebuffer)
+			{
+				GL_SKIPPED_CALL(device);
+				return;
+			}
+			GL_DEVICE->draw_framebuffer = framebuffer;
+			break;
+		case GL_READ_FRAMEBUFFER:
+			if (GL_DEVICE->read_framebuffer == framebuffer)
+			{
+				GL_SKIPPED_CALL(device);
+				return;
+			}
+			GL_DEVICE->read_framebuffer = framebuffer;
+			break;
+		default:
+			if (GL_DEVICE->draw_framebuffer == framebuffer
+			 && GL_DEVICE->read_framebuffer == framebuffer)
+			{
+				GL_SKIPPED_CALL(device);
+				return;
+			}
+			GL_DEVICE->draw_framebuffer = framebuffer;
+			GL_DEVICE->read_framebuffer = framebuffer;
+			break;
+	}
+	GL3_CALL(BindFramebuffer, target, framebuffer);
+}
+
 static bool gl3_ctr(gfx_device_t *device, gfx_window_t *window)
 {
 	if (!gfx_gl_device_vtable.ctr(device, window))
 		return false;
+	GL3_DEVICE->render_target = NULL;
 	GL3_LOAD_PROC(DrawBuffers);
 	GL3_LOAD_PROC(CheckFramebufferStatus);
 	GL3_LOAD_PROC(FramebufferRenderbuffer);
@@ -132,6 +207,7 @@ static bool gl3_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL3_LOAD_PROC(BlitFramebuffer);
 	GL3_LOAD_PROC(DrawBuffer);
 	GL3_LOAD_PROC(ReadBuffer);
+	gl_load_proc(device, "glInvalidateFramebuffer", (void**)&GL3_DEVICE->InvalidateFramebuffer);
 	GL3_LOAD_PROC(BindFramebuffer);
 	GL3_LOAD_PROC(GenFramebuffers);
 	GL3_LOAD_PROC(BindBufferRange);
@@ -139,7 +215,9 @@ static bool gl3_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL3_LOAD_PROC(Uniform1i);
 	GL3_LOAD_PROC(GetUniformLocation);
 	GL3_LOAD_PROC(UniformBlockBinding);
-	GL3_LOAD_PROC(GetUniformBlockIndex);
+	GL3_LOAD_PROC(GetActiveUniformBlockName);
+	GL3_LOAD_PROC(GetActiveUniformsiv);
+	GL3_LOAD_PROC(GetActiveUniformName);
 	GL3_LOAD_PROC(DetachShader);
 	GL3_LOAD_PROC(GetProgramInfoLog);
 	GL3_LOAD_PROC(GetProgramiv);
@@ -202,6 +280,11 @@ static bool gl3_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL3_LOAD_PROC(TexImage2DMultisample);
 	GL3_LOAD_PROC(TexImage3DMultisample);
 	GL3_LOAD_PROC(ColorMask);
+	gl_load_proc(device, "glGetProgramBinary", (void**)&GL3_DEVICE->GetProgramBinary);
+	gl_load_proc(device, "glProgramBinary", (void**)&GL3_DEVICE->ProgramBinary);
+	gl_load_proc(device, "glProgramParameteri", (void**)&GL3_DEVICE->ProgramParameteri);
+	if (!GL3_DEVICE->GetProgramBinary || !GL3_DEVICE->ProgramBinary || !GL3_DEVICE->ProgramParameteri)
+		GL_DEVICE->program_binary = false;
 	return true;
 }
 
@@ -215,20 +298,44 @@ static void gl3_tick(gfx_device_t *device)
 	gfx_gl_device_vtable.tick(device);
 }
 
+static GLuint gl3_render_target_fbo(gfx_device_t *device, const gfx_render_target_t *render_target);
+
 static void gl3_clear_color(gfx_device_t *device, const gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, vec4f_t color)
 {
-	GL3_CALL(BindFramebuffer, GL_DRAW_FRAMEBUFFER, render_target ? render_target->handle.u32[0] : 0);
+	gfx_gl_render_pass_clear(device, render_target);
+	gl3_bind_framebuffer(device, GL_DRAW_FRAMEBUFFER, gl3_render_target_fbo(device, render_target));
 	GL3_CALL(ClearBufferfv, GL_COLOR, render_target ? (attachment - GFX_RENDERTARGET_ATTACHMENT_COLOR0) : 0, &color.x);
 }
 
 static void gl3_clear_depth_stencil(gfx_device_t *device, const gfx_render_target_t *render_target, float depth, uint8_t stencil)
 {
-	GL3_CALL(BindFramebuffer, GL_DRAW_FRAMEBUFFER, render_target ? render_target->handle.u32[0] : 0);
+	gfx_gl_render_pass_clear(device, render_target);
+	gl3_bind_framebuffer(device, GL_DRAW_FRAMEBUFFER, gl3_render_target_fbo(device, render_target));
 	GL3_CALL(ClearBufferfi, GL_DEPTH_STENCIL, 0, depth, stencil);
 }
 
+/* upload the dirty ranges of the shadowed buffers, once per buffer and per draw batch */
+static void gl3_flush_buffers(gfx_device_t *device)
+{
+	for (uint32_t i = 0; i < GL_DEVICE->dirty_buffers.size; ++i)
+	{
+		gfx_gl_buffer_shadow_t *shadow = *JKS_ARRAY_GET(&GL_DEVICE->dirty_buffers, i, gfx_gl_buffer_shadow_t*);
+		gl3_bind_buffer(device, GL_COPY_WRITE_BUFFER, shadow->buffer);
+		for (uint32_t j = 0; j < shadow->ranges_count; ++j)
+		{
+			const gfx_gl_buffer_range_t *range = &shadow->ranges[j];
+			GL3_CALL(BufferSubData, GL_COPY_WRITE_BUFFER, range->start, range->end - range->start, &shadow->data[range->start]);
+		}
+		shadow->ranges_count = 0;
+		shadow->dirty = false;
+	}
+	jks_array_resize(&GL_DEVICE->dirty_buffers, 0);
+}
+
 static void gl3_draw_indexed_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl3_flush_buffers(device);
 	GL3_CALL(DrawElementsInstanced, gfx_gl_primitives[GL3_DEVICE->primitive], count, gfx_gl_index_types[GL_DEVICE->attributes_state->index_type], (void*)(intptr_t)(offset * gfx_gl_index_sizes[GL_DEVICE->attributes_state->index_type]), prim_count);
 #ifndef NDEBUG
 	switch (GL3_DEVICE->primitive)
@@ -249,6 +356,8 @@ static void gl3_draw_indexed_instanced(gfx_device_t *device, uint32_t count, uin
 
 static void gl3_draw_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl3_flush_buffers(device);
 	GL3_CALL(DrawArraysInstanced, gfx_gl_primitives[GL3_DEVICE->primitive], offset, count, prim_count);
 #ifndef NDEBUG
 	switch (GL3_DEVICE->primitive)
@@ -269,6 +378,8 @@ static void gl3_draw_instanced(gfx_device_t *device, uint32_t count, uint32_t of
 
 static void gl3_draw_indexed(gfx_device_t *device, uint32_t count, uint32_t offset)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl3_flush_buffers(device);
 	GL3_CALL(DrawElements, gfx_gl_primitives[GL3_DEVICE->primitive], count, gfx_gl_index_types[GL_DEVICE->attributes_state->index_type], (void*)(intptr_t)(offset * gfx_gl_index_sizes[GL_DEVICE->attributes_state->index_type]));
 #ifndef NDEBUG
 	switch (GL3_DEVICE->primitive)
@@ -289,6 +400,8 @@ static void gl3_draw_indexed(gfx_device_t *device, uint32_t count, uint32_t offs
 
 static void gl3_draw(gfx_device_t *device, uint32_t count, uint32_t offset)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl3_flush_buffers(device);
 	GL3_CALL(DrawArrays, gfx_gl_primitives[GL3_DEVICE->primitive], offset, count);
 #ifndef NDEBUG
 	switch (GL3_DEVICE->primitive)
@@ -510,27 +623,33 @@ static bool gl3_create_buffer(gfx_device_t *device, gfx_buffer_t *buffer, enum g
 	buffer->type = type;
 	buffer->size = size;
 	GL3_CALL(GenBuffers, 1, &buffer->handle.u32[0]);
-	GL3_CALL(BindBuffer, gfx_gl_buffer_types[buffer->type], buffer->handle.u32[0]);
-	GL3_CALL(BufferData, gfx_gl_buffer_types[type], size, data, gfx_gl_buffer_usages[usage]);
+	/* uploads go through the copy target to keep the bound VAO untouched */
+	gl3_bind_buffer(device, GL_COPY_WRITE_BUFFER, buffer->handle.u32[0]);
+	GL3_CALL(BufferData, GL_COPY_WRITE_BUFFER, size, data, gfx_gl_buffer_usages[usage]);
+	if (device->buffer_shadow && usage == GFX_BUFFER_DYNAMIC && size)
+		gfx_gl_buffer_shadow_create(device, buffer, data);
 	return true; //XXX
 }
 
 static void gl3_set_buffer_data(gfx_device_t *device, gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset)
 {
-	(void)device;
 	assert(buffer->handle.u64);
-	GL3_CALL(BindBuffer, gfx_gl_buffer_types[buffer->type], buffer->handle.u32[0]);
-	GL3_CALL(BufferSubData, gfx_gl_buffer_types[buffer->type], offset, size, data);
+	if (gfx_gl_buffer_shadowed(buffer))
+	{
+		gfx_gl_buffer_shadow_write(device, buffer, data, size, offset);
+		return;
+	}
+	gl3_bind_buffer(device, GL_COPY_WRITE_BUFFER, buffer->handle.u32[0]);
+	GL3_CALL(BufferSubData, GL_COPY_WRITE_BUFFER, offset, size, data);
 }
 
 static void gl3_delete_buffer(gfx_device_t *device, gfx_buffer_t *buffer)
 {
 	if (!buffer || !buffer->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_buffers, &buffer->handle.u32[0]))
-		assert(!"failed to push buffer gc");
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	if (gfx_gl_buffer_shadowed(buffer))
+		gfx_gl_buffer_shadow_delete(device, buffer);
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_BUFFER, buffer->handle.u32[0]);
 	buffer->handle.u32[0] = 0;
 }
 
@@ -542,6 +661,8 @@ static bool gl3_create_attributes_state(gfx_device_t *device, gfx_attributes_sta
 	state->count = count;
 	state->index_buffer = index_buffer;
 	state->index_type = index_type;
+	/* vertex arrays live in the device cache, the handle only keeps the last slot hit */
+	state->handle.u32[0] = UINT32_MAX;
 	state->handle.u32[1] = 1;
 	return true;
 }
@@ -550,22 +671,33 @@ static void gl3_bind_attributes_state(gfx_device_t *device, const gfx_attributes
 {
 	assert(state->handle.u64);
 	assert(input_layout->handle.u64);
-	if (state->handle.u32[1] == 1)
-		GL3_CALL(GenVertexArrays, 1, (GLuint*)&state->handle.u32[0]);
-	if (GL_DEVICE->vertex_array == state->handle.u32[0])
-		return;
-	GL_DEVICE->vertex_array = state->handle.u32[0];
-	GL3_CALL(BindVertexArray, state->handle.u32[0]);
+	gfx_gl_vao_key_t key;
+	gfx_gl_vao_key(&key, state, input_layout);
+	gfx_gl_vao_t *vao = gfx_gl_vao_find(device, &key, state->handle.u32[0]);
 	GL_DEVICE->attributes_state = state;
-	if (state->handle.u32[1] != 1)
+	if (vao)
+	{
+		((gfx_attributes_state_t*)state)->handle.u32[0] = vao - GL_DEVICE->vaos;
+		if (GL_DEVICE->vertex_array == vao->vao)
+		{
+			GL_SKIPPED_CALL(device);
+			return;
+		}
+		GL_DEVICE->vertex_array = vao->vao;
+		GL3_CALL(BindVertexArray, vao->vao);
 		return;
-	((gfx_attributes_state_t*)state)->handle.u32[1] = 0;
+	}
+	vao = gfx_gl_vao_alloc(device, &key);
+	((gfx_attributes_state_t*)state)->handle.u32[0] = vao - GL_DEVICE->vaos;
+	GL3_CALL(GenVertexArrays, 1, &vao->vao);
+	GL_DEVICE->vertex_array = vao->vao;
+	GL3_CALL(BindVertexArray, vao->vao);
 	for (size_t i = 0; i < sizeof(state->binds) / sizeof(*state->binds); ++i)
 	{
 		if (!state->binds[i].buffer)
 			continue;
 		enum gfx_attribute_type type = input_layout->binds[i].type;
-		GL3_CALL(BindBuffer, gfx_gl_buffer_types[state->binds[i].buffer->type], state->binds[i].buffer->handle.u32[0]);
+		gl3_bind_buffer(device, GL_ARRAY_BUFFER, state->binds[i].buffer->handle.u32[0]);
 		if (gfx_gl_attribute_normalized[type])
 			GL3_CALL(VertexAttribPointer, i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], true, state->binds[i].stride, (void*)(intptr_t)state->binds[i].offset);
 		else if (gfx_gl_attribute_float[type])
@@ -575,23 +707,17 @@ static void gl3_bind_attributes_state(gfx_device_t *device, const gfx_attributes
 		GL3_CALL(EnableVertexAttribArray, i);
 	}
 	if (state->index_buffer)
-		GL3_CALL(BindBuffer, gfx_gl_buffer_types[state->index_buffer->type], state->index_buffer->handle.u32[0]);
+		GL3_CALL(BindBuffer, GL_ELEMENT_ARRAY_BUFFER, state->index_buffer->handle.u32[0]);
 }
 
 static void gl3_delete_attributes_state(gfx_device_t *device, gfx_attributes_state_t *state)
 {
 	if (!state || !state->handle.u64)
 		return;
-	if (state->handle.u32[1] == 1)
-	{
-		state->handle.u64 = 0;
-		return;
-	}
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_vertex_arrays, &state->handle.u32[0]))
-		assert(!"failed to queue attribute_state gc");
+	/* the cached vertex arrays are shared and aged out by the cache */
+	if (GL_DEVICE->attributes_state == state)
+		GL_DEVICE->attributes_state = NULL;
 	state->handle.u64 = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
 }
 
 static bool gl3_create_input_layout(gfx_device_t *device, gfx_input_layout_t *input_layout, const gfx_input_layout_bind_t *binds, uint32_t count, const gfx_shader_state_t *shader_state)
@@ -642,20 +768,32 @@ static bool gl3_create_texture(gfx_device_t *device, gfx_texture_t *texture, enu
 			case GFX_BC1_RGBA:
 			case GFX_BC2_RGBA:
 			case GFX_BC3_RGBA:
+			case GFX_BC4_R:
+			case GFX_BC5_RG:
+			case GFX_BC6H_RGB_UFLOAT:
+			case GFX_BC7_RGBA:
+			case GFX_ETC2_RGB:
+			case GFX_ETC2_RGBA:
+			case GFX_EAC_R:
+			case GFX_EAC_RG:
 			{
 				uint32_t mult;
 				switch (format)
 				{
 					case GFX_BC1_RGB:
-						mult = 8;
-						break;
 					case GFX_BC1_RGBA:
+					case GFX_BC4_R:
+					case GFX_ETC2_RGB:
+					case GFX_EAC_R:
 						mult = 8;
 						break;
 					case GFX_BC2_RGBA:
-						mult = 16;
-						break;
 					case GFX_BC3_RGBA:
+					case GFX_BC5_RG:
+					case GFX_BC6H_RGB_UFLOAT:
+					case GFX_BC7_RGBA:
+					case GFX_ETC2_RGBA:
+					case GFX_EAC_RG:
 						mult = 16;
 						break;
 					default:
@@ -726,6 +864,12 @@ static void gl3_set_texture_data(gfx_device_t *device, gfx_texture_t *texture, u
 		case GFX_B5G6R5:
 		case GFX_R8G8:
 		case GFX_R8:
+		case GFX_R11G11B10F:
+		case GFX_R16G16F:
+		case GFX_R16F:
+		case GFX_R32F:
+		case GFX_D16:
+		case GFX_D32F:
 			switch (texture->type)
 			{
 				case GFX_TEXTURE_2D:
@@ -746,6 +890,14 @@ static void gl3_set_texture_data(gfx_device_t *device, gfx_texture_t *texture, u
 		case GFX_BC1_RGBA:
 		case GFX_BC2_RGBA:
 		case GFX_BC3_RGBA:
+		case GFX_BC4_R:
+		case GFX_BC5_RG:
+		case GFX_BC6H_RGB_UFLOAT:
+		case GFX_BC7_RGBA:
+		case GFX_ETC2_RGB:
+		case GFX_ETC2_RGBA:
+		case GFX_EAC_R:
+		case GFX_EAC_RG:
 			switch (texture->type)
 			{
 				case GFX_TEXTURE_2D:
@@ -842,11 +994,52 @@ static void gl3_delete_texture(gfx_device_t *device, gfx_texture_t *texture)
 {
 	if (!texture || !texture->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_textures, &texture->handle.u32[0]))
-		assert(!"failed to queue texture gc");
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_TEXTURE, texture->handle.u32[0]);
 	texture->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+}
+
+/* the shaders are held const by the programs which compile them on first use */
+static void gl3_set_shader_status(const gfx_shader_t *shader, enum gfx_shader_status status)
+{
+	((gfx_shader_t*)shader)->status = status;
+}
+
+static void gl3_submit_shader(gfx_device_t *device, const gfx_shader_t *shader)
+{
+	if (shader->status != GFX_SHADER_PENDING)
+		return;
+	GL3_CALL(CompileShader, shader->handle.u32[0]);
+	gl3_set_shader_status(shader, GFX_SHADER_COMPILING);
+}
+
+/* the errors are reported whatever the build, as the deferred compilations fail far from their shader creation */
+static bool gl3_compile_shader(gfx_device_t *device, const gfx_shader_t *shader)
+{
+	switch (shader->status)
+	{
+		case GFX_SHADER_COMPILED:
+			return true;
+		case GFX_SHADER_FAILED:
+			GFX_ERROR_CALLBACK("can't link program of a shader failing to compile");
+			return false;
+		case GFX_SHADER_PENDING:
+			GL3_CALL(CompileShader, shader->handle.u32[0]);
+			break;
+		case GFX_SHADER_COMPILING:
+			break;
+	}
+	GLint result = GL_FALSE;
+	GL3_CALL(GetShaderiv, shader->handle.u32[0], GL_COMPILE_STATUS, &result);
+	if (!result)
+	{
+		char error[4096] = "";
+		GL3_CALL(GetShaderInfoLog, shader->handle.u32[0], sizeof(error), NULL, error);
+		GFX_ERROR_CALLBACK("can't compile GLSL shader: %s", error);
+		gl3_set_shader_status(shader, GFX_SHADER_FAILED);
+		return false;
+	}
+	gl3_set_shader_status(shader, GFX_SHADER_COMPILED);
+	return true;
 }
 
 static bool gl3_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gfx_shader_type type, const uint8_t *data, uint32_t len)
@@ -856,32 +1049,243 @@ static bool gl3_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum g
 	shader->type = type;
 	GL3_CALL_RET(shader->handle.u32[0], CreateShader, gfx_gl_shader_types[type]);
 	GL3_CALL(ShaderSource, shader->handle.u32[0], 1, (const GLchar* const*)&data, (GLint*)&len);
-	GL3_CALL(CompileShader, shader->handle.u32[0]);
+	shader->status = GFX_SHADER_PENDING;
+	/* the code keys the program cache and the resolved program slots */
+	shader->code = GFX_MALLOC(len);
+	if (shader->code)
+	{
+		memcpy(shader->code, data, len);
+		shader->code_size = len;
+	}
+	if (!gfx_gl_program_cache_enabled(device) || !shader->code)
+	{
+		/* status is only queried once the program link completes */
+		if (device->async_shaders)
+		{
+			gl3_submit_shader(device, shader);
+			return true;
+		}
+		return gl3_compile_shader(device, shader);
+	}
+	/* compilation is deferred to the first program cache miss */
+	return true;
+}
+
+static void gl3_delete_shader(gfx_device_t *device, gfx_shader_t *shader)
+{
+	if (!shader || !shader->handle.u64)
+		return;
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_SHADER, shader->handle.u32[0]);
+	shader->handle.u64 = 0;
+	GFX_FREE(shader->code);
+	shader->code = NULL;
+	shader->code_size = 0;
+}
+
+static bool gl3_load_program_binary(gfx_device_t *device, GLuint program, uint64_t key)
+{
+	GLenum format;
+	GLsizei length;
+	void *data = gfx_gl_program_cache_read(device, key, &format, &length);
+	if (!data)
+		return false;
+	GL3_CALL(ProgramBinary, program, format, data, length);
+	GFX_FREE(data);
 	GLint result = GL_FALSE;
-	GL3_CALL(GetShaderiv, shader->handle.u32[0], GL_COMPILE_STATUS, &result);
+	GL3_CALL(GetProgramiv, program, GL_LINK_STATUS, &result);
+	return result == GL_TRUE;
+}
+
+static void gl3_store_program_binary(gfx_device_t *device, GLuint program, uint64_t key)
+{
+	GLint length = 0;
+	GL3_CALL(GetProgramiv, program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	void *data = GFX_MALLOC(length);
+	if (!data)
+		return;
+	GLenum format = 0;
+	GLsizei written = 0;
+	GL3_CALL(GetProgramBinary, program, length, &written, &format, data);
+	if (written > 0)
+		gfx_gl_program_cache_write(device, key, format, data, written);
+	GFX_FREE(data);
+}
+
+static void gl3_start_link(gfx_device_t *device, GLuint program, const gfx_shader_t *vertex_shader, const gfx_shader_t *fragment_shader, const gfx_shader_t *geometry_shader, uint64_t cache_key)
+{
+	GL3_CALL(AttachShader, program, vertex_shader->handle.u32[0]);
+	GL3_CALL(AttachShader, program, fragment_shader->handle.u32[0]);
+	if (geometry_shader)
+		GL3_CALL(AttachShader, program, geometry_shader->handle.u32[0]);
+	if (cache_key)
+		GL3_CALL(ProgramParameteri, program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	GL3_CALL(LinkProgram, program);
+}
+
+static bool gl3_finish_link(gfx_device_t *device, GLuint program, const GLuint *shaders, uint64_t cache_key)
+{
+	GLint result = GL_FALSE;
+	GL3_CALL(GetProgramiv, program, GL_LINK_STATUS, &result);
 	if (!result)
 	{
-#ifndef NDEBUG
-		//int info_log_length;
-		//GL3_CALL(GetShaderiv, shader->handle.u32[0], GL_INFO_LOG_LENGTH, &info_log_length);
 		char error[4096] = "";
-		GL3_CALL(GetShaderInfoLog, shader->handle.u32[0], sizeof(error), NULL, error);
-		GFX_ERROR_CALLBACK("can't compile GLSL shader %s", error);
-#endif
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			if (!shaders[i])
+				continue;
+			GL3_CALL(GetShaderiv, shaders[i], GL_COMPILE_STATUS, &result);
+			if (result)
+				continue;
+			GL3_CALL(GetShaderInfoLog, shaders[i], sizeof(error), NULL, error);
+			GFX_ERROR_CALLBACK("can't compile GLSL shader: %s", error);
+		}
+		GL3_CALL(GetProgramInfoLog, program, sizeof(error), NULL, error);
+		GFX_ERROR_CALLBACK("can't compile GLSL program: %s", error);
 		return false;
 	}
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		if (shaders[i])
+			GL3_CALL(DetachShader, program, shaders[i]);
+	}
+	if (cache_key)
+		gl3_store_program_binary(device, program, cache_key);
 	return true;
 }
 
-static void gl3_delete_shader(gfx_device_t *device, gfx_shader_t *shader)
+static bool gl3_link_program(gfx_device_t *device, GLuint program, const gfx_shader_t *vertex_shader, const gfx_shader_t *fragment_shader, const gfx_shader_t *geometry_shader, uint64_t cache_key)
 {
-	if (!shader || !shader->handle.u64)
+	if (!gl3_compile_shader(device, vertex_shader)
+	 || !gl3_compile_shader(device, fragment_shader)
+	 || (geometry_shader && !gl3_compile_shader(device, geometry_shader)))
+		return false;
+	gl3_start_link(device, program, vertex_shader, fragment_shader, geometry_shader, cache_key);
+	GLuint shaders[3];
+	shaders[0] = vertex_shader->handle.u32[0];
+	shaders[1] = fragment_shader->handle.u32[0];
+	shaders[2] = geometry_shader ? geometry_shader->handle.u32[0] : 0;
+	return gl3_finish_link(device, program, shaders, cache_key);
+}
+
+static bool gl3_link_program_async(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t *vertex_shader, const gfx_shader_t *fragment_shader, const gfx_shader_t *geometry_shader, uint64_t cache_key, uint64_t layout_key, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	GLuint program = shader_state->handle.u32[0];
+	gfx_gl_pending_program_t *pending = gfx_gl_pending_program_add(device, program, constants, samplers);
+	if (!pending)
+		return false;
+	gl3_submit_shader(device, vertex_shader);
+	gl3_submit_shader(device, fragment_shader);
+	if (geometry_shader)
+		gl3_submit_shader(device, geometry_shader);
+	gl3_start_link(device, program, vertex_shader, fragment_shader, geometry_shader, cache_key);
+	pending->shaders[0] = vertex_shader->handle.u32[0];
+	pending->shaders[1] = fragment_shader->handle.u32[0];
+	pending->shaders[2] = geometry_shader ? geometry_shader->handle.u32[0] : 0;
+	pending->cache_key = cache_key;
+	pending->layout_key = layout_key;
+	return true;
+}
+
+/* the types of all the uniforms are queried at once, only the samplers being named */
+static gfx_gl_program_slot_t *gl3_resolve_program_slots(gfx_device_t *device, GLuint program, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers, uint32_t *blocks_count, uint32_t *samplers_count)
+{
+	char name[256];
+	GLint blocks = 0;
+	GLint uniforms = 0;
+	uint32_t bind;
+	GL3_CALL(GetProgramiv, program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+	GL3_CALL(GetProgramiv, program, GL_ACTIVE_UNIFORMS, &uniforms);
+	gfx_gl_program_slot_t *slots = GFX_MALLOC(sizeof(*slots) * (blocks + uniforms) + (sizeof(GLuint) + sizeof(GLint)) * uniforms + 1);
+	if (!slots)
+	{
+		GFX_ERROR_CALLBACK("program slots allocation failed");
+		return NULL;
+	}
+	GLuint *indices = (GLuint*)&slots[blocks + uniforms];
+	GLint *types = (GLint*)&indices[uniforms];
+	*blocks_count = 0;
+	*samplers_count = 0;
+	for (GLint i = 0; i < blocks; ++i)
+	{
+		GL3_CALL(GetActiveUniformBlockName, program, i, sizeof(name), NULL, name);
+		if (!gfx_gl_constant_bind(constants, name, &bind))
+			continue;
+		slots[*blocks_count].index = i;
+		slots[*blocks_count].bind = bind;
+		(*blocks_count)++;
+	}
+	if (!uniforms || !samplers)
+		return slots;
+	for (GLint i = 0; i < uniforms; ++i)
+		indices[i] = i;
+	GL3_CALL(GetActiveUniformsiv, program, uniforms, indices, GL_UNIFORM_TYPE, types);
+	for (GLint i = 0; i < uniforms; ++i)
+	{
+		if (!gfx_gl_sampler_type(types[i]))
+			continue;
+		GL3_CALL(GetActiveUniformName, program, i, sizeof(name), NULL, name);
+		if (!gfx_gl_sampler_bind(samplers, name, &bind))
+			continue;
+		GLint location;
+		GL3_CALL_RET(location, GetUniformLocation, program, name);
+		if (location < 0)
+			continue;
+		gfx_gl_program_slot_t *slot = &slots[*blocks_count + *samplers_count];
+		slot->index = location;
+		slot->bind = bind;
+		(*samplers_count)++;
+	}
+	return slots;
+}
+
+/* the slots are resolved on the first program of a key, the next ones only being set */
+static void gl3_bind_program_slots(gfx_device_t *device, GLuint program, uint64_t key, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	if (!constants && !samplers)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_shaders, &shader->handle.u32[0]))
-		assert(!"failed to queue shader gc");
-	shader->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	const gfx_gl_program_layout_t *layout = key ? gfx_gl_program_layout_get(device, key) : NULL;
+	gfx_gl_program_slot_t *resolved = NULL;
+	const gfx_gl_program_slot_t *slots;
+	uint32_t blocks_count;
+	uint32_t samplers_count;
+	if (layout)
+	{
+		slots = layout->slots;
+		blocks_count = layout->blocks_count;
+		samplers_count = layout->samplers_count;
+	}
+	else
+	{
+		resolved = gl3_resolve_program_slots(device, program, constants, samplers, &blocks_count, &samplers_count);
+		if (!resolved)
+			return;
+		if (key)
+			gfx_gl_program_layout_add(device, key, resolved, blocks_count, samplers_count);
+		slots = resolved;
+	}
+	for (uint32_t i = 0; i < blocks_count; ++i)
+		GL3_CALL(UniformBlockBinding, program, slots[i].index, slots[i].bind);
+	if (samplers_count)
+	{
+		if (GL_DEVICE->program != program)
+			GL3_CALL(UseProgram, program);
+		for (uint32_t i = 0; i < samplers_count; ++i)
+			GL3_CALL(Uniform1i, slots[blocks_count + i].index, slots[blocks_count + i].bind);
+		if (GL_DEVICE->program != program)
+			GL3_CALL(UseProgram, GL_DEVICE->program);
+	}
+	GFX_FREE(resolved);
+}
+
+/* the pending state lives in the device list, the shader state is left untouched */
+static void gl3_finish_pending(gfx_device_t *device, gfx_gl_pending_program_t *pending)
+{
+	GLuint program = pending->program;
+	if (gl3_finish_link(device, program, pending->shaders, pending->cache_key))
+		gl3_bind_program_slots(device, program, pending->layout_key, pending->constants, pending->samplers);
+	gfx_gl_pending_program_remove(device, program);
 }
 
 static bool gl3_create_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
@@ -941,51 +1345,29 @@ static bool gl3_create_shader_state(gfx_device_t *device, gfx_shader_state_t *sh
 
 	shader_state->device = device;
 	GL3_CALL_RET(shader_state->handle.u32[0], CreateProgram);
-	GL3_CALL(AttachShader, shader_state->handle.u32[0], vertex_shader->handle.u32[0]);
-	GL3_CALL(AttachShader, shader_state->handle.u32[0], fragment_shader->handle.u32[0]);
-	if (geometry_shader)
-		GL3_CALL(AttachShader, shader_state->handle.u32[0], geometry_shader->handle.u32[0]);
-	/* OpenGL 2
-	for (uint32_t i = 0; attributes[i].name; ++i)
-		GL3_CALL(BindAttribLocation, shader_state->handle.u32[0], attributes[i].bind, attributes[i].name);
-	*/
-	GL3_CALL(LinkProgram, shader_state->handle.u32[0]);
-	GLint result = GL_FALSE;
-	GL3_CALL(GetProgramiv, shader_state->handle.u32[0], GL_LINK_STATUS, &result);
-	if (!result)
-	{
-#ifndef NDEBUG
-		//int info_log_length;
-		//GL3_CALL(GetProgramiv, shader_state->handle.u32[0], GL_INFO_LOG_LENGTH, &info_log_length);
-		char error[4096] = "";
-		GL3_CALL(GetProgramInfoLog, shader_state->handle.u32[0], sizeof(error), NULL, error);
-		GFX_ERROR_CALLBACK("can't compile GLSL program: %s", error);
-#endif
-		return false;
-	}
-	GL3_CALL(DetachShader, shader_state->handle.u32[0], vertex_shader->handle.u32[0]);
-	GL3_CALL(DetachShader, shader_state->handle.u32[0], fragment_shader->handle.u32[0]);
-	if (geometry_shader)
-		GL3_CALL(DetachShader, shader_state->handle.u32[0], geometry_shader->handle.u32[0]);
-	GL3_CALL(UseProgram, shader_state->handle.u32[0]);
-	for (uint32_t i = 0; constants[i].name; ++i)
-	{
-		GLint index;
-		GL3_CALL_RET(index, GetUniformBlockIndex, shader_state->handle.u32[0], constants[i].name);
-		GL3_CALL(UniformBlockBinding, shader_state->handle.u32[0], index, constants[i].bind);
-	}
-	for (uint32_t i = 0; samplers[i].name; ++i)
+	/* the key also names the resolved slots, so it is computed without program cache */
+	uint64_t layout_key = gfx_gl_program_key(device, shaders, shaders_count, attributes, constants, samplers);
+	uint64_t cache_key = gfx_gl_program_cache_enabled(device) ? layout_key : 0;
+	if (!cache_key || !gl3_load_program_binary(device, shader_state->handle.u32[0], cache_key))
 	{
-		GLint index;
-		GL3_CALL_RET(index, GetUniformLocation, shader_state->handle.u32[0], samplers[i].name);
-		GL3_CALL(Uniform1i, index, samplers[i].bind);
+		if (device->async_shaders)
+			return gl3_link_program_async(device, shader_state, vertex_shader, fragment_shader, geometry_shader, cache_key, layout_key, constants, samplers);
+		if (!gl3_link_program(device, shader_state->handle.u32[0], vertex_shader, fragment_shader, geometry_shader, cache_key))
+			return false;
 	}
+	gl3_bind_program_slots(device, shader_state->handle.u32[0], layout_key, constants, samplers);
 	return true;
 }
 
 static void gl3_bind_shader_state(gfx_device_t *device, const gfx_shader_state_t *shader_state)
 {
 	assert(shader_state->handle.u64);
+	if (GL_DEVICE->pending_programs.size)
+	{
+		gfx_gl_pending_program_t *pending = gfx_gl_pending_program_get(device, shader_state->handle.u32[0]);
+		if (pending)
+			gl3_finish_pending(device, pending);
+	}
 	if (GL_DEVICE->program == shader_state->handle.u32[0])
 		return;
 	GL_DEVICE->program = shader_state->handle.u32[0];
@@ -996,18 +1378,48 @@ static void gl3_delete_shader_state(gfx_device_t *device, gfx_shader_state_t *sh
 {
 	if (!shader_state || !shader_state->handle.u32[0])
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_programs, &shader_state->handle.u32[0]))
-		assert(!"failed to queue program gc");
-	shader_state->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_PROGRAM, shader_state->handle.u32[0]);
+	shader_state->handle.u64 = 0;
+}
+
+static bool gl3_shader_state_ready(gfx_device_t *device, const gfx_shader_state_t *shader_state)
+{
+	assert(shader_state->handle.u64);
+	if (!GL_DEVICE->pending_programs.size)
+		return true;
+	gfx_gl_pending_program_t *pending = gfx_gl_pending_program_get(device, shader_state->handle.u32[0]);
+	if (!pending)
+		return true;
+	if (GL_DEVICE->parallel_shader_compile)
+	{
+		GLint completed = GL_FALSE;
+		GL3_CALL(GetProgramiv, pending->program, GL_COMPLETION_STATUS_KHR, &completed);
+		if (!completed)
+			return false;
+	}
+	gl3_finish_pending(device, pending);
+	return true;
 }
 
 static void gl3_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset)
 {
-	(void)device;
 	assert(buffer->handle.u64);
-	GL3_CALL(BindBufferRange, GL_UNIFORM_BUFFER, bind, buffer->handle.u32[0], offset, size);
+	GLuint id = buffer->handle.u32[0];
+	if (bind < GFX_GL_UNIFORM_BINDINGS)
+	{
+		gfx_gl_uniform_range_t *range = &GL_DEVICE->uniform_ranges[bind];
+		if (range->buffer == id && range->offset == offset && range->size == size)
+		{
+			GL_SKIPPED_CALL(device);
+			return;
+		}
+		range->buffer = id;
+		range->offset = offset;
+		range->size = size;
+	}
+	/* indexed binds also replace the generic binding */
+	GL_DEVICE->buffers[GFX_GL_BUFFER_SLOT_UNIFORM] = id;
+	GL3_CALL(BindBufferRange, GL_UNIFORM_BUFFER, bind, id, offset, size);
 }
 
 static void gl3_bind_samplers(gfx_device_t *device, uint32_t start, uint32_t count, const gfx_texture_t **textures)
@@ -1026,8 +1438,6 @@ static void gl3_bind_samplers(gfx_device_t *device, uint32_t start, uint32_t cou
 	}
 }
 
-static void gl3_bind_render_target(gfx_device_t *device, const gfx_render_target_t *render_target);
-
 static bool gl3_create_render_target(gfx_device_t *device, gfx_render_target_t *render_target)
 {
 	assert(!render_target->handle.u64);
@@ -1035,68 +1445,100 @@ static bool gl3_create_render_target(gfx_device_t *device, gfx_render_target_t *
 	for (size_t i = 0; i < sizeof(render_target->colors) / sizeof(*render_target->colors); ++i)
 		render_target->colors[i].texture = NULL;
 	render_target->depth_stencil.texture = NULL;
-	GL3_CALL(GenFramebuffers, 1, &render_target->handle.u32[0]);
-	gl3_bind_render_target(device, render_target);
-	return true; //XXX
+	render_target->draw_buffers[0] = GFX_RENDERTARGET_ATTACHMENT_COLOR0;
+	render_target->draw_buffers_nb = 1;
+	/* framebuffers live in the device cache, the handle only keeps the last slot hit */
+	render_target->handle.u32[0] = UINT32_MAX;
+	render_target->handle.u32[1] = 1;
+	return true;
 }
 
 static void gl3_delete_render_target(gfx_device_t *device, gfx_render_target_t *render_target)
 {
 	if (!render_target || !render_target->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_frame_buffers, &render_target->handle.u32[0]))
-		assert(!"failed to queue render_target gc");
-	render_target->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	/* the cached framebuffers are shared and aged out by the cache */
+	if (GL3_DEVICE->render_target == render_target)
+		GL3_DEVICE->render_target = NULL;
+	render_target->handle.u64 = 0;
 }
 
-static void gl3_bind_render_target(gfx_device_t *device, const gfx_render_target_t *render_target)
+/* the framebuffer of the current attachments, created and validated once per attachment set */
+static GLuint gl3_render_target_fbo(gfx_device_t *device, const gfx_render_target_t *render_target)
 {
-	(void)device;
-	if (render_target)
+	if (!render_target)
+		return 0;
+	assert(render_target->handle.u64);
+	gfx_gl_fbo_key_t key;
+	gfx_gl_fbo_key(&key, render_target);
+	gfx_gl_fbo_t *fbo = gfx_gl_fbo_find(device, &key, render_target->handle.u32[0]);
+	if (fbo)
 	{
-		assert(render_target->handle.u64);
-		GL3_CALL(BindFramebuffer, GL_FRAMEBUFFER, render_target->handle.u32[0]);
+		((gfx_render_target_t*)render_target)->handle.u32[0] = fbo - GL_DEVICE->fbos;
+		return fbo->fbo;
 	}
-	else
+	fbo = gfx_gl_fbo_alloc(device, &key);
+	((gfx_render_target_t*)render_target)->handle.u32[0] = fbo - GL_DEVICE->fbos;
+	GL3_CALL(GenFramebuffers, 1, &fbo->fbo);
+	/* built on the draw binding to keep the read binding of a resolve */
+	gl3_bind_framebuffer(device, GL_DRAW_FRAMEBUFFER, fbo->fbo);
+	for (size_t i = 0; i < sizeof(key.colors) / sizeof(*key.colors); ++i)
+	{
+		if (key.colors[i])
+			GL3_CALL(FramebufferTexture, GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, key.colors[i], 0);
+	}
+	if (key.depth_stencil)
 	{
-		GL3_CALL(BindFramebuffer, GL_FRAMEBUFFER, 0);
+		GL3_CALL(FramebufferTexture, GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, key.depth_stencil, 0);
+		if (gfx_format_has_stencil(render_target->depth_stencil.texture->format))
+			GL3_CALL(FramebufferTexture, GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, key.depth_stencil, 0);
 	}
+	GLenum translated[8];
+	for (uint32_t i = 0; i < key.draw_buffers_nb; ++i)
+		translated[i] = gfx_gl_render_target_attachments[key.draw_buffers[i]];
+	GL3_CALL(DrawBuffers, key.draw_buffers_nb, translated);
+	GLuint status = GL3_DEVICE->CheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		GFX_ERROR_CALLBACK("invalid FBO init: %d", status);
+	return fbo->fbo;
+}
+
+static void gl3_bind_render_target(gfx_device_t *device, const gfx_render_target_t *render_target)
+{
+	GL3_DEVICE->render_target = render_target;
+	gl3_bind_framebuffer(device, GL_FRAMEBUFFER, gl3_render_target_fbo(device, render_target));
 }
 
+/* only the bound render target switches framebuffer right away, the others on their next use */
 static void gl3_set_render_target_texture(gfx_device_t *device, gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, const gfx_texture_t *texture)
 {
 	assert(render_target->handle.u64);
-	gl3_bind_render_target(device, render_target);
 	if (attachment == GFX_RENDERTARGET_ATTACHMENT_DEPTH_STENCIL)
-	{
 		render_target->depth_stencil.texture = texture;
-		GL3_CALL(FramebufferTexture, GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture ? texture->handle.u32[0] : 0, 0);
-		GL3_CALL(FramebufferTexture, GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, texture ? texture->handle.u32[0] : 0, 0);
-	}
 	else
-	{
 		render_target->colors[attachment - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture = texture;
-		GL3_CALL(FramebufferTexture, GL_FRAMEBUFFER, gfx_gl_render_target_attachments[attachment], texture ? texture->handle.u32[0] : 0, 0);
-	}
-#ifndef NDEBUG
-	{
-		GLuint status = GL3_DEVICE->CheckFramebufferStatus(GL_FRAMEBUFFER);
-		if (status != GL_FRAMEBUFFER_COMPLETE)
-			GFX_ERROR_CALLBACK("invalid FBO init: %d", status);
-	}
-#endif
+	if (GL3_DEVICE->render_target == render_target)
+		gl3_bind_render_target(device, render_target);
+}
+
+/* the draw buffers are part of the cached framebuffer, restored after the resolves writing to a single one */
+static void gl3_apply_draw_buffers(gfx_device_t *device, GLenum target, const gfx_render_target_t *render_target)
+{
+	GLenum translated[8];
+	for (uint32_t i = 0; i < render_target->draw_buffers_nb; ++i)
+		translated[i] = gfx_gl_render_target_attachments[render_target->draw_buffers[i]];
+	gl3_bind_framebuffer(device, target, gl3_render_target_fbo(device, render_target));
+	GL3_CALL(DrawBuffers, render_target->draw_buffers_nb, translated);
 }
 
 static void gl3_set_render_target_draw_buffers(gfx_device_t *device, gfx_render_target_t *render_target, uint32_t *render_buffers, uint32_t render_buffers_count)
 {
-	(void)device;
-	uint32_t translated[64];
+	assert(render_buffers_count <= sizeof(render_target->draw_buffers) / sizeof(*render_target->draw_buffers));
 	for (uint32_t i = 0; i < render_buffers_count; ++i)
-		translated[i] = gfx_gl_render_target_attachments[render_buffers[i]];
-	gl3_bind_render_target(device, render_target);
-	GL3_CALL(DrawBuffers, render_buffers_count, translated);
+		render_target->draw_buffers[i] = render_buffers[i];
+	render_target->draw_buffers_nb = render_buffers_count;
+	if (GL3_DEVICE->render_target == render_target)
+		gl3_bind_render_target(device, render_target);
 }
 
 static void gl3_resolve_render_target(gfx_device_t *device, const gfx_render_target_t *src, const gfx_render_target_t *dst, uint32_t buffers, uint32_t color_src, uint32_t color_dst)
@@ -1108,8 +1550,8 @@ static void gl3_resolve_render_target(gfx_device_t *device, const gfx_render_tar
 		assert(src->handle.u64);
 	if (dst)
 		assert(dst->handle.u64);
-	GL3_CALL(BindFramebuffer, GL_READ_FRAMEBUFFER, src ? src->handle.u32[0] : 0);
-	GL3_CALL(BindFramebuffer, GL_DRAW_FRAMEBUFFER, dst ? dst->handle.u32[0] : 0);
+	gl3_bind_framebuffer(device, GL_READ_FRAMEBUFFER, gl3_render_target_fbo(device, src));
+	gl3_bind_framebuffer(device, GL_DRAW_FRAMEBUFFER, gl3_render_target_fbo(device, dst));
 	uint32_t width = 0;
 	uint32_t height = 0;
 	if (buffers & GFX_BUFFER_COLOR_BIT)
@@ -1165,6 +1607,80 @@ static void gl3_resolve_render_target(gfx_device_t *device, const gfx_render_tar
 	if (width == 0 || height == 0)
 		return;
 	GL3_CALL(BlitFramebuffer, 0, 0, width, height, 0, 0, width, height, gl_buffers, GL_NEAREST);
+	if (dst && (buffers & GFX_BUFFER_COLOR_BIT))
+		gl3_apply_draw_buffers(device, GL_DRAW_FRAMEBUFFER, dst);
+}
+
+static void gl3_invalidate_attachments(gfx_device_t *device, const gfx_render_target_t *render_target, const bool *discarded)
+{
+	GLenum attachments[GFX_RENDER_PASS_ATTACHMENTS + 1];
+	uint32_t count = gfx_gl_render_pass_attachments(render_target, discarded, attachments);
+	if (!count || !GL3_DEVICE->InvalidateFramebuffer)
+		return;
+	gl3_bind_framebuffer(device, GL_DRAW_FRAMEBUFFER, gl3_render_target_fbo(device, render_target));
+	GL3_CALL(InvalidateFramebuffer, GL_DRAW_FRAMEBUFFER, count, attachments);
+}
+
+static void gl3_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	if (render_target)
+		assert(render_target->handle.u64);
+	gfx_gl_begin_render_pass(device, render_target, load_actions, clear_values);
+	if (!load_actions)
+		return;
+	bool discarded[GFX_RENDER_PASS_ATTACHMENTS];
+	for (uint32_t i = 0; i < GFX_RENDER_PASS_ATTACHMENTS; ++i)
+		discarded[i] = load_actions[i] == GFX_LOAD_ACTION_DONT_CARE;
+	gl3_invalidate_attachments(device, render_target, discarded);
+}
+
+/* unlike gl3_resolve_render_target, the blits only cover the area rendered during the pass */
+static void gl3_resolve_render_pass(gfx_device_t *device, const gfx_render_target_t *src, const gfx_render_target_t *dst)
+{
+	gfx_gl_rect_t area;
+	gl3_bind_framebuffer(device, GL_READ_FRAMEBUFFER, gl3_render_target_fbo(device, src));
+	gl3_bind_framebuffer(device, GL_DRAW_FRAMEBUFFER, gl3_render_target_fbo(device, dst));
+	for (uint32_t i = 0; i < src->draw_buffers_nb && i < dst->draw_buffers_nb; ++i)
+	{
+		uint8_t src_buffer = src->draw_buffers[i];
+		uint8_t dst_buffer = dst->draw_buffers[i];
+		if (src_buffer < GFX_RENDERTARGET_ATTACHMENT_COLOR0 || dst_buffer < GFX_RENDERTARGET_ATTACHMENT_COLOR0)
+			continue;
+		const gfx_texture_t *src_texture = src->colors[src_buffer - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture;
+		const gfx_texture_t *dst_texture = dst->colors[dst_buffer - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture;
+		if (!src_texture || !dst_texture)
+			continue;
+		if (!gfx_gl_render_pass_area(device, src_texture->width < dst_texture->width ? src_texture->width : dst_texture->width, src_texture->height < dst_texture->height ? src_texture->height : dst_texture->height, &area))
+			continue;
+		GL3_CALL(ReadBuffer, gfx_gl_render_target_attachments[src_buffer]);
+		GL3_CALL(DrawBuffer, gfx_gl_render_target_attachments[dst_buffer]);
+		GL3_CALL(BlitFramebuffer, area.x, area.y, area.x + area.width, area.y + area.height, area.x, area.y, area.x + area.width, area.y + area.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	const gfx_texture_t *src_texture = src->depth_stencil.texture;
+	const gfx_texture_t *dst_texture = dst->depth_stencil.texture;
+	if (src_texture && dst_texture && gfx_gl_render_pass_area(device, src_texture->width < dst_texture->width ? src_texture->width : dst_texture->width, src_texture->height < dst_texture->height ? src_texture->height : dst_texture->height, &area))
+		GL3_CALL(BlitFramebuffer, area.x, area.y, area.x + area.width, area.y + area.height, area.x, area.y, area.x + area.width, area.y + area.height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	gl3_apply_draw_buffers(device, GL_DRAW_FRAMEBUFFER, dst);
+}
+
+/* the resolves read the attachments before they are invalidated */
+static void gl3_end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target)
+{
+	assert(device->render_pass);
+	const gfx_render_target_t *render_target = device->render_pass_target;
+	if (resolve_target && render_target)
+	{
+		assert(resolve_target->handle.u64);
+		gl3_resolve_render_pass(device, render_target, resolve_target);
+	}
+	if (store_actions)
+	{
+		bool discarded[GFX_RENDER_PASS_ATTACHMENTS];
+		for (uint32_t i = 0; i < GFX_RENDER_PASS_ATTACHMENTS; ++i)
+			discarded[i] = store_actions[i] == GFX_STORE_ACTION_DONT_CARE;
+		gl3_invalidate_attachments(device, render_target, discarded);
+	}
+	gfx_device_vtable.end_render_pass(device, store_actions, NULL);
 }
 
 static bool gl3_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive)
@@ -1202,15 +1718,39 @@ static void gl3_bind_pipeline_state(gfx_device_t *device, const gfx_pipeline_sta
 	GL3_DEVICE->primitive = state->primitive;
 }
 
+static bool gl3_pipeline_state_ready(gfx_device_t *device, const gfx_pipeline_state_t *state)
+{
+	return gl3_shader_state_ready(device, state->shader_state);
+}
+
 static void gl3_set_viewport(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
-	(void)device;
+	gfx_gl_rect_t *viewport = &GL_DEVICE->viewport;
+	if (viewport->x == x && viewport->y == y && viewport->width == width && viewport->height == height)
+	{
+		GL_SKIPPED_CALL(device);
+		return;
+	}
+	viewport->x = x;
+	viewport->y = y;
+	viewport->width = width;
+	viewport->height = height;
 	GL3_CALL(Viewport, x, y, width, height);
+	gfx_gl_render_pass_viewport(device);
 }
 
 static void gl3_set_scissor(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
-	(void)device;
+	gfx_gl_rect_t *scissor = &GL_DEVICE->scissor_box;
+	if (scissor->x == x && scissor->y == y && scissor->width == width && scissor->height == height)
+	{
+		GL_SKIPPED_CALL(device);
+		return;
+	}
+	scissor->x = x;
+	scissor->y = y;
+	scissor->width = width;
+	scissor->height = height;
 	GL3_CALL(Scissor, x, y, width, height);
 }
 
@@ -1230,6 +1770,42 @@ static void gl3_set_point_size(gfx_device_t *device, float point_size)
 	GL3_CALL(PointSize, point_size);
 }
 
+/* a GL context is current on a single thread, recording from other threads isn't supported */
+static bool gl3_create_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+	GFX_ERROR_CALLBACK("command lists aren't supported");
+	return false;
+}
+
+static void gl3_delete_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+}
+
+static bool gl3_begin_command_list(gfx_device_t *device, gfx_command_list_t *list, const gfx_render_target_t *render_target)
+{
+	(void)device;
+	(void)list;
+	(void)render_target;
+	return false;
+}
+
+static void gl3_end_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+}
+
+static void gl3_execute_command_lists(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count)
+{
+	(void)device;
+	(void)lists;
+	(void)count;
+}
+
 static const gfx_device_vtable_t gl3_vtable =
 {
 	GFX_DEVICE_VTABLE_DEF(gl3)
@@ -14,6 +14,10 @@
 # define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
 #endif
 
+#ifndef GL_COMPLETION_STATUS_KHR
+# define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 #define GL4_CALL(fn, ...) GL_CALL(GL4_DEVICE, fn, __VA_ARGS__)
 #define GL4_CALL_RET(ret, fn, ...) GL_CALL_RET(ret, GL4_DEVICE, fn, __VA_ARGS__)
 
@@ -31,14 +35,17 @@ typedef struct gfx_gl4_device_s
 	PFNGLBLITNAMEDFRAMEBUFFERPROC BlitNamedFramebuffer;
 	PFNGLNAMEDFRAMEBUFFERDRAWBUFFERPROC NamedFramebufferDrawBuffer;
 	PFNGLNAMEDFRAMEBUFFERREADBUFFERPROC NamedFramebufferReadBuffer;
+	PFNGLINVALIDATENAMEDFRAMEBUFFERDATAPROC InvalidateNamedFramebufferData;
 	PFNGLBINDFRAMEBUFFERPROC BindFramebuffer;
 	PFNGLCREATEFRAMEBUFFERSPROC CreateFramebuffers;
 	PFNGLBINDBUFFERRANGEPROC BindBufferRange;
 	PFNGLUSEPROGRAMPROC UseProgram;
-	PFNGLUNIFORM1IPROC Uniform1i;
-	PFNGLGETUNIFORMLOCATIONPROC GetUniformLocation;
 	PFNGLUNIFORMBLOCKBINDINGPROC UniformBlockBinding;
-	PFNGLGETUNIFORMBLOCKINDEXPROC GetUniformBlockIndex;
+	PFNGLGETPROGRAMINTERFACEIVPROC GetProgramInterfaceiv;
+	PFNGLGETPROGRAMRESOURCENAMEPROC GetProgramResourceName;
+	PFNGLGETPROGRAMRESOURCEIVPROC GetProgramResourceiv;
+	PFNGLPROGRAMUNIFORM1IPROC ProgramUniform1i;
+	PFNGLGETUNIFORMIVPROC GetUniformiv;
 	PFNGLDETACHSHADERPROC DetachShader;
 	PFNGLGETPROGRAMINFOLOGPROC GetProgramInfoLog;
 	PFNGLGETPROGRAMIVPROC GetProgramiv;
@@ -98,6 +105,9 @@ typedef struct gfx_gl4_device_s
 	PFNGLBINDBUFFERPROC BindBuffer;
 	PFNGLBINDVERTEXBUFFERSPROC BindVertexBuffers;
 	PFNGLCOLORMASKPROC ColorMask;
+	PFNGLGETPROGRAMBINARYPROC GetProgramBinary;
+	PFNGLPROGRAMBINARYPROC ProgramBinary;
+	PFNGLPROGRAMPARAMETERIPROC ProgramParameteri;
 	enum gfx_primitive_type primitive;
 } gfx_gl4_device_t;
 
@@ -116,14 +126,17 @@ static bool gl4_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL4_LOAD_PROC(BlitNamedFramebuffer);
 	GL4_LOAD_PROC(NamedFramebufferDrawBuffer);
 	GL4_LOAD_PROC(NamedFramebufferReadBuffer);
+	GL4_LOAD_PROC(InvalidateNamedFramebufferData);
 	GL4_LOAD_PROC(BindFramebuffer);
 	GL4_LOAD_PROC(CreateFramebuffers);
 	GL4_LOAD_PROC(BindBufferRange);
 	GL4_LOAD_PROC(UseProgram);
-	GL4_LOAD_PROC(Uniform1i);
-	GL4_LOAD_PROC(GetUniformLocation);
 	GL4_LOAD_PROC(UniformBlockBinding);
-	GL4_LOAD_PROC(GetUniformBlockIndex);
+	GL4_LOAD_PROC(GetProgramInterfaceiv);
+	GL4_LOAD_PROC(GetProgramResourceName);
+	GL4_LOAD_PROC(GetProgramResourceiv);
+	GL4_LOAD_PROC(ProgramUniform1i);
+	GL4_LOAD_PROC(GetUniformiv);
 	GL4_LOAD_PROC(DetachShader);
 	GL4_LOAD_PROC(GetProgramInfoLog);
 	GL4_LOAD_PROC(GetProgramiv);
@@ -184,6 +197,11 @@ static bool gl4_ctr(gfx_device_t *device, gfx_window_t *window)
 	GL4_LOAD_PROC(BindBuffer);
 	GL4_LOAD_PROC(BindVertexBuffers);
 	GL4_LOAD_PROC(ColorMask);
+	gl_load_proc(device, "glGetProgramBinary", (void**)&GL4_DEVICE->GetProgramBinary);
+	gl_load_proc(device, "glProgramBinary", (void**)&GL4_DEVICE->ProgramBinary);
+	gl_load_proc(device, "glProgramParameteri", (void**)&GL4_DEVICE->ProgramParameteri);
+	if (!GL4_DEVICE->GetProgramBinary || !GL4_DEVICE->ProgramBinary || !GL4_DEVICE->ProgramParameteri)
+		GL_DEVICE->program_binary = false;
 	return true;
 }
 
@@ -199,16 +217,37 @@ static void gl4_tick(gfx_device_t *device)
 
 static void gl4_clear_color(gfx_device_t *device, const gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, vec4f_t color)
 {
+	gfx_gl_render_pass_clear(device, render_target);
 	GL4_CALL(ClearNamedFramebufferfv, render_target ? render_target->handle.u32[0] : 0, GL_COLOR, render_target ? (attachment - GFX_RENDERTARGET_ATTACHMENT_COLOR0) : 0, &color.x);
 }
 
 static void gl4_clear_depth_stencil(gfx_device_t *device, const gfx_render_target_t *render_target, float depth, uint8_t stencil)
 {
+	gfx_gl_render_pass_clear(device, render_target);
 	GL4_CALL(ClearNamedFramebufferfi, render_target ? render_target->handle.u32[0] : 0, GL_DEPTH_STENCIL, 0, depth, stencil);
 }
 
+/* upload the dirty ranges of the shadowed buffers, once per buffer and per draw batch */
+static void gl4_flush_buffers(gfx_device_t *device)
+{
+	for (uint32_t i = 0; i < GL_DEVICE->dirty_buffers.size; ++i)
+	{
+		gfx_gl_buffer_shadow_t *shadow = *JKS_ARRAY_GET(&GL_DEVICE->dirty_buffers, i, gfx_gl_buffer_shadow_t*);
+		for (uint32_t j = 0; j < shadow->ranges_count; ++j)
+		{
+			const gfx_gl_buffer_range_t *range = &shadow->ranges[j];
+			GL4_CALL(NamedBufferSubData, shadow->buffer, range->start, range->end - range->start, &shadow->data[range->start]);
+		}
+		shadow->ranges_count = 0;
+		shadow->dirty = false;
+	}
+	jks_array_resize(&GL_DEVICE->dirty_buffers, 0);
+}
+
 static void gl4_draw_indexed_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl4_flush_buffers(device);
 	GL4_CALL(DrawElementsInstanced, gfx_gl_primitives[GL4_DEVICE->primitive], count, gfx_gl_index_types[GL_DEVICE->attributes_state->index_type], (void*)(intptr_t)(offset * gfx_gl_index_sizes[GL_DEVICE->attributes_state->index_type]), prim_count);
 #ifndef NDEBUG
 	switch (GL4_DEVICE->primitive)
@@ -229,6 +268,8 @@ static void gl4_draw_indexed_instanced(gfx_device_t *device, uint32_t count, uin
 
 static void gl4_draw_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl4_flush_buffers(device);
 	GL4_CALL(DrawArraysInstanced, gfx_gl_primitives[GL4_DEVICE->primitive], offset, count, prim_count);
 #ifndef NDEBUG
 	switch (GL4_DEVICE->primitive)
@@ -249,6 +290,8 @@ static void gl4_draw_instanced(gfx_device_t *device, uint32_t count, uint32_t of
 
 static void gl4_draw_indexed(gfx_device_t *device, uint32_t count, uint32_t offset)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl4_flush_buffers(device);
 	GL4_CALL(DrawElements, gfx_gl_primitives[GL4_DEVICE->primitive], count, gfx_gl_index_types[GL_DEVICE->attributes_state->index_type], (void*)(intptr_t)(offset * gfx_gl_index_sizes[GL_DEVICE->attributes_state->index_type]));
 #ifndef NDEBUG
 	switch (GL4_DEVICE->primitive)
@@ -269,6 +312,8 @@ static void gl4_draw_indexed(gfx_device_t *device, uint32_t count, uint32_t offs
 
 static void gl4_draw(gfx_device_t *device, uint32_t count, uint32_t offset)
 {
+	if (GL_DEVICE->dirty_buffers.size)
+		gl4_flush_buffers(device);
 	GL4_CALL(DrawArrays, gfx_gl_primitives[GL4_DEVICE->primitive], offset, count);
 #ifndef NDEBUG
 	switch (GL4_DEVICE->primitive)
@@ -502,16 +547,19 @@ static bool gl4_create_buffer(gfx_device_t *device, gfx_buffer_t *buffer, enum g
 		GL4_CALL(NamedBufferStorage, buffer->handle.u32[0], size, data, flags);
 		if (usage == GFX_BUFFER_STREAM)
 			GL4_CALL_RET(buffer->map, MapNamedBufferRange, buffer->handle.u32[0], 0, size, flags);
+		else if (device->buffer_shadow && usage == GFX_BUFFER_DYNAMIC)
+			gfx_gl_buffer_shadow_create(device, buffer, data);
 	}
 	return true; //XXX
 }
 
 static void gl4_set_buffer_data(gfx_device_t *device, gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset)
 {
-	(void)device;
 	assert(buffer->handle.u64);
 	if (buffer->usage == GFX_BUFFER_STREAM)
 		memcpy(((uint8_t*)buffer->map) + offset, data, size);
+	else if (gfx_gl_buffer_shadowed(buffer))
+		gfx_gl_buffer_shadow_write(device, buffer, data, size, offset);
 	else
 		GL4_CALL(NamedBufferSubData, buffer->handle.u32[0], offset, size, data);
 }
@@ -520,10 +568,9 @@ static void gl4_delete_buffer(gfx_device_t *device, gfx_buffer_t *buffer)
 {
 	if (!buffer || !buffer->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_buffers, &buffer->handle.u32[0]))
-		assert(!"failed to push buffer gc");
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	if (gfx_gl_buffer_shadowed(buffer))
+		gfx_gl_buffer_shadow_delete(device, buffer);
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_BUFFER, buffer->handle.u32[0]);
 	buffer->handle.u32[0] = 0;
 }
 
@@ -539,54 +586,95 @@ static bool gl4_create_attributes_state(gfx_device_t *device, gfx_attributes_sta
 	return true;
 }
 
+/* the input layouts may be created from any thread, their vertex array is created by their first bind, on the device thread */
+static GLuint gl4_get_input_layout_vao(gfx_device_t *device, const gfx_input_layout_t *input_layout)
+{
+	if (input_layout->handle.u32[0])
+		return input_layout->handle.u32[0];
+	GLuint vao;
+	GL4_CALL(CreateVertexArrays, 1, &vao);
+	for (uint32_t i = 0; i < input_layout->count; ++i)
+	{
+		enum gfx_attribute_type type = input_layout->binds[i].type;
+		GL4_CALL(VertexArrayAttribBinding, vao, i, i);
+		if (gfx_gl_attribute_normalized[type])
+			GL4_CALL(VertexArrayAttribFormat, vao, i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], true, 0);
+		else if (gfx_gl_attribute_float[type])
+			GL4_CALL(VertexArrayAttribFormat, vao, i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], false, 0);
+		else
+			GL4_CALL(VertexArrayAttribIFormat, vao, i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], 0);
+		GL4_CALL(EnableVertexArrayAttrib, vao, i);
+	}
+	/* the bound layouts are const, the vertex array is only a cache of their binds */
+	((gfx_input_layout_t*)input_layout)->handle.u32[0] = vao;
+	return vao;
+}
+
+/* the vertex array belongs to the input layout, attributes only swap its buffers */
 static void gl4_bind_attributes_state(gfx_device_t *device, const gfx_attributes_state_t *state, const gfx_input_layout_t *input_layout)
 {
 	assert(state->handle.u64);
 	assert(input_layout->handle.u64);
-	if (state->handle.u32[1] == 1)
-		GL4_CALL(CreateVertexArrays, 1, (GLuint*)&state->handle.u32[0]);
-	if (GL_DEVICE->vertex_array == state->handle.u32[0])
-		return;
-	GL_DEVICE->vertex_array = state->handle.u32[0];
-	GL4_CALL(BindVertexArray, state->handle.u32[0]);
+	GLuint vao = gl4_get_input_layout_vao(device, input_layout);
 	GL_DEVICE->attributes_state = state;
-	if (state->handle.u32[1] != 1)
-		return;
-	((gfx_attributes_state_t*)state)->handle.u32[1] = 0;
+	if (GL_DEVICE->vertex_array != vao)
+	{
+		GL_DEVICE->vertex_array = vao;
+		GL_DEVICE->vertex_buffers_valid = false;
+		GL4_CALL(BindVertexArray, vao);
+	}
+	GLuint buffers[8];
+	GLintptr offsets[8];
+	GLsizei strides[8];
 	for (size_t i = 0; i < sizeof(state->binds) / sizeof(*state->binds); ++i)
 	{
-		if (!state->binds[i].buffer)
-			continue;
-		enum gfx_attribute_type type = input_layout->binds[i].type;
-		GL4_CALL(VertexArrayAttribBinding, state->handle.u32[0], i, i);
-		GL4_CALL(VertexArrayVertexBuffer, state->handle.u32[0], i, state->binds[i].buffer->handle.u32[0], state->binds[i].offset, state->binds[i].stride);
-		if (gfx_gl_attribute_normalized[type])
-			GL4_CALL(VertexArrayAttribFormat, state->handle.u32[0], i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], true, 0);
-		else if (gfx_gl_attribute_float[type])
-			GL4_CALL(VertexArrayAttribFormat, state->handle.u32[0], i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], false, 0);
+		if (state->binds[i].buffer)
+		{
+			buffers[i] = state->binds[i].buffer->handle.u32[0];
+			offsets[i] = state->binds[i].offset;
+			strides[i] = state->binds[i].stride;
+		}
 		else
-			GL4_CALL(VertexArrayAttribIFormat, state->handle.u32[0], i, gfx_gl_attribute_nb[type], gfx_gl_attribute_types[type], 0);
-		GL4_CALL(EnableVertexArrayAttrib, state->handle.u32[0], i);
+		{
+			buffers[i] = 0;
+			offsets[i] = 0;
+			strides[i] = 0;
+		}
+	}
+	GLuint element_buffer = state->index_buffer ? state->index_buffer->handle.u32[0] : 0;
+	if (GL_DEVICE->vertex_buffers_valid
+	 && !memcmp(GL_DEVICE->vertex_buffers, buffers, sizeof(buffers))
+	 && !memcmp(GL_DEVICE->vertex_offsets, offsets, sizeof(offsets))
+	 && !memcmp(GL_DEVICE->vertex_strides, strides, sizeof(strides)))
+	{
+		GL_SKIPPED_CALL(device);
+	}
+	else
+	{
+		memcpy(GL_DEVICE->vertex_buffers, buffers, sizeof(buffers));
+		memcpy(GL_DEVICE->vertex_offsets, offsets, sizeof(offsets));
+		memcpy(GL_DEVICE->vertex_strides, strides, sizeof(strides));
+		GL4_CALL(BindVertexBuffers, 0, 8, buffers, offsets, strides);
+	}
+	if (GL_DEVICE->vertex_buffers_valid && GL_DEVICE->element_buffer == element_buffer)
+	{
+		GL_SKIPPED_CALL(device);
+	}
+	else
+	{
+		GL_DEVICE->element_buffer = element_buffer;
+		GL4_CALL(VertexArrayElementBuffer, vao, element_buffer);
 	}
-	if (state->index_buffer)
-		GL4_CALL(BindBuffer, GL_ELEMENT_ARRAY_BUFFER, state->index_buffer->handle.u32[0]);
+	GL_DEVICE->vertex_buffers_valid = true;
 }
 
 static void gl4_delete_attributes_state(gfx_device_t *device, gfx_attributes_state_t *state)
 {
-	(void)device;
 	if (!state || !state->handle.u64)
 		return;
-	if (state->handle.u32[1] == 1)
-	{
-		state->handle.u64 = 0;
-		return;
-	}
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_vertex_arrays, &state->handle.u32[0]))
-		assert(!"failed to queue attribute_state gc");
+	if (GL_DEVICE->attributes_state == state)
+		GL_DEVICE->attributes_state = NULL;
 	state->handle.u64 = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
 }
 
 static bool gl4_create_input_layout(gfx_device_t *device, gfx_input_layout_t *input_layout, const gfx_input_layout_bind_t *binds, uint32_t count, const gfx_shader_state_t *shader_state)
@@ -596,15 +684,18 @@ static bool gl4_create_input_layout(gfx_device_t *device, gfx_input_layout_t *in
 	input_layout->device = device;
 	memcpy(input_layout->binds, binds, sizeof(*binds) * count);
 	input_layout->count = count;
-	input_layout->handle.u64 = ++GL_DEVICE->state_idx;
+	/* no gl call here, the vertex array is created on first bind */
+	input_layout->handle.u32[0] = 0;
+	input_layout->handle.u32[1] = 1;
 	return true;
 }
 
 static void gl4_delete_input_layout(gfx_device_t *device, gfx_input_layout_t *input_layout)
 {
-	(void)device;
 	if (!input_layout || !input_layout->handle.u64)
 		return;
+	if (input_layout->handle.u32[0])
+		gfx_gl_delete_object(device, GFX_GL_OBJECT_VERTEX_ARRAY, input_layout->handle.u32[0]);
 	input_layout->handle.u64 = 0;
 }
 
@@ -665,6 +756,12 @@ static void gl4_set_texture_data(gfx_device_t *device, gfx_texture_t *texture, u
 		case GFX_B5G6R5:
 		case GFX_R8G8:
 		case GFX_R8:
+		case GFX_R11G11B10F:
+		case GFX_R16G16F:
+		case GFX_R16F:
+		case GFX_R32F:
+		case GFX_D16:
+		case GFX_D32F:
 			switch (texture->type)
 			{
 				case GFX_TEXTURE_2D:
@@ -684,6 +781,14 @@ static void gl4_set_texture_data(gfx_device_t *device, gfx_texture_t *texture, u
 		case GFX_BC1_RGBA:
 		case GFX_BC2_RGBA:
 		case GFX_BC3_RGBA:
+		case GFX_BC4_R:
+		case GFX_BC5_RG:
+		case GFX_BC6H_RGB_UFLOAT:
+		case GFX_BC7_RGBA:
+		case GFX_ETC2_RGB:
+		case GFX_ETC2_RGBA:
+		case GFX_EAC_R:
+		case GFX_EAC_RG:
 			switch (texture->type)
 			{
 				case GFX_TEXTURE_2D:
@@ -771,34 +876,81 @@ static void gl4_delete_texture(gfx_device_t *device, gfx_texture_t *texture)
 {
 	if (!texture || !texture->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_textures, &texture->handle.u32[0]))
-		assert(!"failed to queue texture gc");
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_TEXTURE, texture->handle.u32[0]);
 	texture->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
 }
 
-static bool gl4_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gfx_shader_type type, const uint8_t *data, uint32_t len)
+/* the shaders are held const by the programs which compile them on first use */
+static void gl4_set_shader_status(const gfx_shader_t *shader, enum gfx_shader_status status)
 {
-	assert(!shader->handle.u64);
-	shader->device = device;
-	shader->type = type;
-	GL4_CALL_RET(shader->handle.u32[0], CreateShader, gfx_gl_shader_types[type]);
-	GL4_CALL(ShaderSource, shader->handle.u32[0], 1, (const GLchar* const*)&data, (GLint*)&len);
+	((gfx_shader_t*)shader)->status = status;
+}
+
+static void gl4_submit_shader(gfx_device_t *device, const gfx_shader_t *shader)
+{
+	if (shader->status != GFX_SHADER_PENDING)
+		return;
 	GL4_CALL(CompileShader, shader->handle.u32[0]);
+	gl4_set_shader_status(shader, GFX_SHADER_COMPILING);
+}
+
+/* the errors are reported whatever the build, as the deferred compilations fail far from their shader creation */
+static bool gl4_compile_shader(gfx_device_t *device, const gfx_shader_t *shader)
+{
+	switch (shader->status)
+	{
+		case GFX_SHADER_COMPILED:
+			return true;
+		case GFX_SHADER_FAILED:
+			GFX_ERROR_CALLBACK("can't link program of a shader failing to compile");
+			return false;
+		case GFX_SHADER_PENDING:
+			GL4_CALL(CompileShader, shader->handle.u32[0]);
+			break;
+		case GFX_SHADER_COMPILING:
+			break;
+	}
 	GLint result = GL_FALSE;
 	GL4_CALL(GetShaderiv, shader->handle.u32[0], GL_COMPILE_STATUS, &result);
 	if (!result)
 	{
-#ifndef NDEBUG
-		/*int info_log_length;
-		GL4_CALL(GetShaderiv, shader->handle.u32[0], GL_INFO_LOG_LENGTH, &info_log_length);*/
 		char error[4096] = "";
 		GL4_CALL(GetShaderInfoLog, shader->handle.u32[0], sizeof(error), NULL, error);
 		GFX_ERROR_CALLBACK("can't compile GLSL shader: %s", error);
-#endif
+		gl4_set_shader_status(shader, GFX_SHADER_FAILED);
 		return false;
 	}
+	gl4_set_shader_status(shader, GFX_SHADER_COMPILED);
+	return true;
+}
+
+static bool gl4_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gfx_shader_type type, const uint8_t *data, uint32_t len)
+{
+	assert(!shader->handle.u64);
+	shader->device = device;
+	shader->type = type;
+	GL4_CALL_RET(shader->handle.u32[0], CreateShader, gfx_gl_shader_types[type]);
+	GL4_CALL(ShaderSource, shader->handle.u32[0], 1, (const GLchar* const*)&data, (GLint*)&len);
+	shader->status = GFX_SHADER_PENDING;
+	if (!gfx_gl_program_cache_enabled(device))
+	{
+		/* status is only queried once the program link completes */
+		if (device->async_shaders)
+		{
+			gl4_submit_shader(device, shader);
+			return true;
+		}
+		return gl4_compile_shader(device, shader);
+	}
+	/* compilation is deferred to the first program cache miss */
+	shader->code = GFX_MALLOC(len);
+	if (!shader->code)
+	{
+		GFX_ERROR_CALLBACK("shader code allocation failed");
+		return gl4_compile_shader(device, shader);
+	}
+	memcpy(shader->code, data, len);
+	shader->code_size = len;
 	return true;
 }
 
@@ -806,11 +958,162 @@ static void gl4_delete_shader(gfx_device_t *device, gfx_shader_t *shader)
 {
 	if (!shader || !shader->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_shaders, &shader->handle.u32[0]))
-		assert(!"failed to queue shader gc");
-	shader->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_SHADER, shader->handle.u32[0]);
+	shader->handle.u64 = 0;
+	GFX_FREE(shader->code);
+	shader->code = NULL;
+	shader->code_size = 0;
+}
+
+static bool gl4_load_program_binary(gfx_device_t *device, GLuint program, uint64_t key)
+{
+	GLenum format;
+	GLsizei length;
+	void *data = gfx_gl_program_cache_read(device, key, &format, &length);
+	if (!data)
+		return false;
+	GL4_CALL(ProgramBinary, program, format, data, length);
+	GFX_FREE(data);
+	GLint result = GL_FALSE;
+	GL4_CALL(GetProgramiv, program, GL_LINK_STATUS, &result);
+	return result == GL_TRUE;
+}
+
+static void gl4_store_program_binary(gfx_device_t *device, GLuint program, uint64_t key)
+{
+	GLint length = 0;
+	GL4_CALL(GetProgramiv, program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	void *data = GFX_MALLOC(length);
+	if (!data)
+		return;
+	GLenum format = 0;
+	GLsizei written = 0;
+	GL4_CALL(GetProgramBinary, program, length, &written, &format, data);
+	if (written > 0)
+		gfx_gl_program_cache_write(device, key, format, data, written);
+	GFX_FREE(data);
+}
+
+static void gl4_start_link(gfx_device_t *device, GLuint program, const gfx_shader_t *vertex_shader, const gfx_shader_t *fragment_shader, const gfx_shader_t *geometry_shader, uint64_t cache_key)
+{
+	GL4_CALL(AttachShader, program, vertex_shader->handle.u32[0]);
+	GL4_CALL(AttachShader, program, fragment_shader->handle.u32[0]);
+	if (geometry_shader)
+		GL4_CALL(AttachShader, program, geometry_shader->handle.u32[0]);
+	if (cache_key)
+		GL4_CALL(ProgramParameteri, program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	GL4_CALL(LinkProgram, program);
+}
+
+static bool gl4_finish_link(gfx_device_t *device, GLuint program, const GLuint *shaders, uint64_t cache_key)
+{
+	GLint result = GL_FALSE;
+	GL4_CALL(GetProgramiv, program, GL_LINK_STATUS, &result);
+	if (!result)
+	{
+		char error[4096] = "";
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			if (!shaders[i])
+				continue;
+			GL4_CALL(GetShaderiv, shaders[i], GL_COMPILE_STATUS, &result);
+			if (result)
+				continue;
+			GL4_CALL(GetShaderInfoLog, shaders[i], sizeof(error), NULL, error);
+			GFX_ERROR_CALLBACK("can't compile GLSL shader: %s", error);
+		}
+		GL4_CALL(GetProgramInfoLog, program, sizeof(error), NULL, error);
+		GFX_ERROR_CALLBACK("can't compile GLSL program: %s", error);
+		return false;
+	}
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		if (shaders[i])
+			GL4_CALL(DetachShader, program, shaders[i]);
+	}
+	if (cache_key)
+		gl4_store_program_binary(device, program, cache_key);
+	return true;
+}
+
+static bool gl4_link_program(gfx_device_t *device, GLuint program, const gfx_shader_t *vertex_shader, const gfx_shader_t *fragment_shader, const gfx_shader_t *geometry_shader, uint64_t cache_key)
+{
+	if (!gl4_compile_shader(device, vertex_shader)
+	 || !gl4_compile_shader(device, fragment_shader)
+	 || (geometry_shader && !gl4_compile_shader(device, geometry_shader)))
+		return false;
+	gl4_start_link(device, program, vertex_shader, fragment_shader, geometry_shader, cache_key);
+	GLuint shaders[3];
+	shaders[0] = vertex_shader->handle.u32[0];
+	shaders[1] = fragment_shader->handle.u32[0];
+	shaders[2] = geometry_shader ? geometry_shader->handle.u32[0] : 0;
+	return gl4_finish_link(device, program, shaders, cache_key);
+}
+
+static bool gl4_link_program_async(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t *vertex_shader, const gfx_shader_t *fragment_shader, const gfx_shader_t *geometry_shader, uint64_t cache_key, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	GLuint program = shader_state->handle.u32[0];
+	gfx_gl_pending_program_t *pending = gfx_gl_pending_program_add(device, program, constants, samplers);
+	if (!pending)
+		return false;
+	gl4_submit_shader(device, vertex_shader);
+	gl4_submit_shader(device, fragment_shader);
+	if (geometry_shader)
+		gl4_submit_shader(device, geometry_shader);
+	gl4_start_link(device, program, vertex_shader, fragment_shader, geometry_shader, cache_key);
+	pending->shaders[0] = vertex_shader->handle.u32[0];
+	pending->shaders[1] = fragment_shader->handle.u32[0];
+	pending->shaders[2] = geometry_shader ? geometry_shader->handle.u32[0] : 0;
+	pending->cache_key = cache_key;
+	return true;
+}
+
+/* walk the program interfaces once, only touching the resources whose binding differs */
+static void gl4_bind_program_slots(gfx_device_t *device, GLuint program, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	char name[256];
+	GLint count = 0;
+	uint32_t bind;
+	GL4_CALL(GetProgramInterfaceiv, program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		GL4_CALL(GetProgramResourceName, program, GL_UNIFORM_BLOCK, i, sizeof(name), NULL, name);
+		if (!gfx_gl_constant_bind(constants, name, &bind))
+			continue;
+		static const GLenum props[] = {GL_BUFFER_BINDING};
+		GLint current;
+		GL4_CALL(GetProgramResourceiv, program, GL_UNIFORM_BLOCK, i, 1, props, 1, NULL, &current);
+		if ((uint32_t)current != bind)
+			GL4_CALL(UniformBlockBinding, program, i, bind);
+	}
+	count = 0;
+	GL4_CALL(GetProgramInterfaceiv, program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		static const GLenum props[] = {GL_TYPE, GL_LOCATION};
+		GLint values[2];
+		GL4_CALL(GetProgramResourceiv, program, GL_UNIFORM, i, 2, props, 2, NULL, values);
+		if (!gfx_gl_sampler_type(values[0]) || values[1] < 0)
+			continue;
+		GL4_CALL(GetProgramResourceName, program, GL_UNIFORM, i, sizeof(name), NULL, name);
+		if (!gfx_gl_sampler_bind(samplers, name, &bind))
+			continue;
+		GLint current;
+		GL4_CALL(GetUniformiv, program, values[1], &current);
+		if ((uint32_t)current != bind)
+			GL4_CALL(ProgramUniform1i, program, values[1], bind);
+	}
+}
+
+/* the pending state lives in the device list, the shader state is left untouched */
+static void gl4_finish_pending(gfx_device_t *device, gfx_gl_pending_program_t *pending)
+{
+	GLuint program = pending->program;
+	if (gl4_finish_link(device, program, pending->shaders, pending->cache_key))
+		gl4_bind_program_slots(device, program, pending->constants, pending->samplers);
+	gfx_gl_pending_program_remove(device, program);
 }
 
 static bool gl4_create_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
@@ -870,51 +1173,29 @@ static bool gl4_create_shader_state(gfx_device_t *device, gfx_shader_state_t *sh
 
 	shader_state->device = device;
 	GL4_CALL_RET(shader_state->handle.u32[0], CreateProgram);
-	GL4_CALL(AttachShader, shader_state->handle.u32[0], vertex_shader->handle.u32[0]);
-	GL4_CALL(AttachShader, shader_state->handle.u32[0], fragment_shader->handle.u32[0]);
-	if (geometry_shader)
-		GL4_CALL(AttachShader, shader_state->handle.u32[0], geometry_shader->handle.u32[0]);
-	/* OpenGL 2
-	for (uint32_t i = 0; attributes[i].name; ++i)
-		GL_CALL(glBindAttribLocation, shader_state->handle.u32[0], attributes[i].bind, attributes[i].name);
-	*/
-	GL4_CALL(LinkProgram, shader_state->handle.u32[0]);
-	GLint result = GL_FALSE;
-	GL4_CALL(GetProgramiv, shader_state->handle.u32[0], GL_LINK_STATUS, &result);
-	if (!result)
-	{
-#ifndef NDEBUG
-		//int info_log_length;
-		//GL4_CALL(GetProgramiv, shader_state->handle.u32[0], GL_INFO_LOG_LENGTH, &info_log_length);
-		char error[4096] = "";
-		GL4_CALL(GetProgramInfoLog, shader_state->handle.u32[0], sizeof(error), NULL, error);
-		GFX_ERROR_CALLBACK("can't compile GLSL program: %s", error);
-#endif
-		return false;
-	}
-	GL4_CALL(DetachShader, shader_state->handle.u32[0], vertex_shader->handle.u32[0]);
-	GL4_CALL(DetachShader, shader_state->handle.u32[0], fragment_shader->handle.u32[0]);
-	if (geometry_shader)
-		GL4_CALL(DetachShader, shader_state->handle.u32[0], geometry_shader->handle.u32[0]);
-	GL4_CALL(UseProgram, shader_state->handle.u32[0]);
-	for (uint32_t i = 0; constants[i].name; ++i)
-	{
-		GLint index;
-		GL4_CALL_RET(index, GetUniformBlockIndex, shader_state->handle.u32[0], constants[i].name);
-		GL4_CALL(UniformBlockBinding, shader_state->handle.u32[0], index, constants[i].bind);
-	}
-	for (uint32_t i = 0; samplers[i].name; ++i)
+	uint64_t cache_key = 0;
+	if (gfx_gl_program_cache_enabled(device))
+		cache_key = gfx_gl_program_key(device, shaders, shaders_count, attributes, constants, samplers);
+	if (!cache_key || !gl4_load_program_binary(device, shader_state->handle.u32[0], cache_key))
 	{
-		GLint index;
-		GL4_CALL_RET(index, GetUniformLocation, shader_state->handle.u32[0], samplers[i].name);
-		GL4_CALL(Uniform1i, index, samplers[i].bind);
+		if (device->async_shaders)
+			return gl4_link_program_async(device, shader_state, vertex_shader, fragment_shader, geometry_shader, cache_key, constants, samplers);
+		if (!gl4_link_program(device, shader_state->handle.u32[0], vertex_shader, fragment_shader, geometry_shader, cache_key))
+			return false;
 	}
+	gl4_bind_program_slots(device, shader_state->handle.u32[0], constants, samplers);
 	return true;
 }
 
 static void gl4_bind_shader_state(gfx_device_t *device, const gfx_shader_state_t *shader_state)
 {
 	assert(shader_state->handle.u64);
+	if (GL_DEVICE->pending_programs.size)
+	{
+		gfx_gl_pending_program_t *pending = gfx_gl_pending_program_get(device, shader_state->handle.u32[0]);
+		if (pending)
+			gl4_finish_pending(device, pending);
+	}
 	if (GL_DEVICE->program == shader_state->handle.u32[0])
 		return;
 	GL_DEVICE->program = shader_state->handle.u32[0];
@@ -925,11 +1206,27 @@ static void gl4_delete_shader_state(gfx_device_t *device, gfx_shader_state_t *sh
 {
 	if (!shader_state || !shader_state->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_programs, &shader_state->handle.u32[0]))
-		assert(!"failed to queue program gc");
-	shader_state->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_PROGRAM, shader_state->handle.u32[0]);
+	shader_state->handle.u64 = 0;
+}
+
+static bool gl4_shader_state_ready(gfx_device_t *device, const gfx_shader_state_t *shader_state)
+{
+	assert(shader_state->handle.u64);
+	if (!GL_DEVICE->pending_programs.size)
+		return true;
+	gfx_gl_pending_program_t *pending = gfx_gl_pending_program_get(device, shader_state->handle.u32[0]);
+	if (!pending)
+		return true;
+	if (GL_DEVICE->parallel_shader_compile)
+	{
+		GLint completed = GL_FALSE;
+		GL4_CALL(GetProgramiv, pending->program, GL_COMPLETION_STATUS_KHR, &completed);
+		if (!completed)
+			return false;
+	}
+	gl4_finish_pending(device, pending);
+	return true;
 }
 
 static void gl4_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset)
@@ -957,6 +1254,8 @@ static bool gl4_create_render_target(gfx_device_t *device, gfx_render_target_t *
 	for (size_t i = 0; i < sizeof(render_target->colors) / sizeof(*render_target->colors); ++i)
 		render_target->colors[i].texture = NULL;
 	render_target->depth_stencil.texture = NULL;
+	render_target->draw_buffers[0] = GFX_RENDERTARGET_ATTACHMENT_COLOR0;
+	render_target->draw_buffers_nb = 1;
 	GL4_CALL(CreateFramebuffers, 1, &render_target->handle.u32[0]);
 	return true; //XXX
 }
@@ -965,11 +1264,8 @@ static void gl4_delete_render_target(gfx_device_t *device, gfx_render_target_t *
 {
 	if (!render_target || !render_target->handle.u64)
 		return;
-	pthread_mutex_lock(&GL_DEVICE->delete_mutex);
-	if (!jks_array_push_back(&GL_DEVICE->delete_frame_buffers, &render_target->handle.u32[0]))
-		assert(!"failed to queue render_target gc");
+	gfx_gl_delete_object(device, GFX_GL_OBJECT_FRAME_BUFFER, render_target->handle.u32[0]);
 	render_target->handle.u32[0] = 0;
-	pthread_mutex_unlock(&GL_DEVICE->delete_mutex);
 }
 
 static void gl4_bind_render_target(gfx_device_t *device, const gfx_render_target_t *render_target)
@@ -994,7 +1290,8 @@ static void gl4_set_render_target_texture(gfx_device_t *device, gfx_render_targe
 	{
 		render_target->depth_stencil.texture = texture;
 		GL4_CALL(NamedFramebufferTexture, render_target->handle.u32[0], GL_DEPTH_ATTACHMENT, texture->handle.u32[0], 0);
-		GL4_CALL(NamedFramebufferTexture, render_target->handle.u32[0], GL_STENCIL_ATTACHMENT, texture->handle.u32[0], 0);
+		/* a stencil texture left from a previous depth stencil is detached */
+		GL4_CALL(NamedFramebufferTexture, render_target->handle.u32[0], GL_STENCIL_ATTACHMENT, gfx_format_has_stencil(texture->format) ? texture->handle.u32[0] : 0, 0);
 	}
 	else
 	{
@@ -1010,13 +1307,22 @@ static void gl4_set_render_target_texture(gfx_device_t *device, gfx_render_targe
 #endif
 }
 
+/* the draw buffers are kept by the render target to be restored after the resolves writing to a single one */
+static void gl4_apply_draw_buffers(gfx_device_t *device, const gfx_render_target_t *render_target)
+{
+	GLenum translated[8];
+	for (uint32_t i = 0; i < render_target->draw_buffers_nb; ++i)
+		translated[i] = gfx_gl_render_target_attachments[render_target->draw_buffers[i]];
+	GL4_CALL(NamedFramebufferDrawBuffers, render_target->handle.u32[0], render_target->draw_buffers_nb, translated);
+}
+
 static void gl4_set_render_target_draw_buffers(gfx_device_t *device, gfx_render_target_t *render_target, uint32_t *render_buffers, uint32_t render_buffers_count)
 {
-	(void)device;
-	uint32_t translated[64];
+	assert(render_buffers_count <= sizeof(render_target->draw_buffers) / sizeof(*render_target->draw_buffers));
 	for (uint32_t i = 0; i < render_buffers_count; ++i)
-		translated[i] = gfx_gl_render_target_attachments[render_buffers[i]];
-	GL4_CALL(NamedFramebufferDrawBuffers, render_target->handle.u32[0], render_buffers_count, translated);
+		render_target->draw_buffers[i] = render_buffers[i];
+	render_target->draw_buffers_nb = render_buffers_count;
+	gl4_apply_draw_buffers(device, render_target);
 }
 
 static void gl4_resolve_render_target(gfx_device_t *device, const gfx_render_target_t *src, const gfx_render_target_t *dst, uint32_t buffers, uint32_t color_src, uint32_t color_dst)
@@ -1085,6 +1391,74 @@ static void gl4_resolve_render_target(gfx_device_t *device, const gfx_render_tar
 	GL4_CALL(BlitNamedFramebuffer, src ? src->handle.u32[0] : 0, dst ? dst->handle.u32[0] : 0, 0, 0, width, height, 0, 0, width, height, gl_buffers, GL_NEAREST);
 }
 
+static void gl4_invalidate_attachments(gfx_device_t *device, const gfx_render_target_t *render_target, const bool *discarded)
+{
+	GLenum attachments[GFX_RENDER_PASS_ATTACHMENTS + 1];
+	uint32_t count = gfx_gl_render_pass_attachments(render_target, discarded, attachments);
+	if (count)
+		GL4_CALL(InvalidateNamedFramebufferData, render_target ? render_target->handle.u32[0] : 0, count, attachments);
+}
+
+static void gl4_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	if (render_target)
+		assert(render_target->handle.u64);
+	gfx_gl_begin_render_pass(device, render_target, load_actions, clear_values);
+	if (!load_actions)
+		return;
+	bool discarded[GFX_RENDER_PASS_ATTACHMENTS];
+	for (uint32_t i = 0; i < GFX_RENDER_PASS_ATTACHMENTS; ++i)
+		discarded[i] = load_actions[i] == GFX_LOAD_ACTION_DONT_CARE;
+	gl4_invalidate_attachments(device, render_target, discarded);
+}
+
+/* unlike gl4_resolve_render_target, the blits only cover the area rendered during the pass */
+static void gl4_resolve_render_pass(gfx_device_t *device, const gfx_render_target_t *src, const gfx_render_target_t *dst)
+{
+	gfx_gl_rect_t area;
+	for (uint32_t i = 0; i < src->draw_buffers_nb && i < dst->draw_buffers_nb; ++i)
+	{
+		uint8_t src_buffer = src->draw_buffers[i];
+		uint8_t dst_buffer = dst->draw_buffers[i];
+		if (src_buffer < GFX_RENDERTARGET_ATTACHMENT_COLOR0 || dst_buffer < GFX_RENDERTARGET_ATTACHMENT_COLOR0)
+			continue;
+		const gfx_texture_t *src_texture = src->colors[src_buffer - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture;
+		const gfx_texture_t *dst_texture = dst->colors[dst_buffer - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture;
+		if (!src_texture || !dst_texture)
+			continue;
+		if (!gfx_gl_render_pass_area(device, src_texture->width < dst_texture->width ? src_texture->width : dst_texture->width, src_texture->height < dst_texture->height ? src_texture->height : dst_texture->height, &area))
+			continue;
+		GL4_CALL(NamedFramebufferReadBuffer, src->handle.u32[0], gfx_gl_render_target_attachments[src_buffer]);
+		GL4_CALL(NamedFramebufferDrawBuffer, dst->handle.u32[0], gfx_gl_render_target_attachments[dst_buffer]);
+		GL4_CALL(BlitNamedFramebuffer, src->handle.u32[0], dst->handle.u32[0], area.x, area.y, area.x + area.width, area.y + area.height, area.x, area.y, area.x + area.width, area.y + area.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	const gfx_texture_t *src_texture = src->depth_stencil.texture;
+	const gfx_texture_t *dst_texture = dst->depth_stencil.texture;
+	if (src_texture && dst_texture && gfx_gl_render_pass_area(device, src_texture->width < dst_texture->width ? src_texture->width : dst_texture->width, src_texture->height < dst_texture->height ? src_texture->height : dst_texture->height, &area))
+		GL4_CALL(BlitNamedFramebuffer, src->handle.u32[0], dst->handle.u32[0], area.x, area.y, area.x + area.width, area.y + area.height, area.x, area.y, area.x + area.width, area.y + area.height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	gl4_apply_draw_buffers(device, dst);
+}
+
+/* the resolves read the attachments before they are invalidated */
+static void gl4_end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target)
+{
+	assert(device->render_pass);
+	const gfx_render_target_t *render_target = device->render_pass_target;
+	if (resolve_target && render_target)
+	{
+		assert(resolve_target->handle.u64);
+		gl4_resolve_render_pass(device, render_target, resolve_target);
+	}
+	if (store_actions)
+	{
+		bool discarded[GFX_RENDER_PASS_ATTACHMENTS];
+		for (uint32_t i = 0; i < GFX_RENDER_PASS_ATTACHMENTS; ++i)
+			discarded[i] = store_actions[i] == GFX_STORE_ACTION_DONT_CARE;
+		gl4_invalidate_attachments(device, render_target, discarded);
+	}
+	gfx_device_vtable.end_render_pass(device, store_actions, NULL);
+}
+
 static bool gl4_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive)
 {
 	assert(!state->handle.u64);
@@ -1120,10 +1494,20 @@ static void gl4_bind_pipeline_state(gfx_device_t *device, const gfx_pipeline_sta
 	GL4_DEVICE->primitive = state->primitive;
 }
 
+static bool gl4_pipeline_state_ready(gfx_device_t *device, const gfx_pipeline_state_t *state)
+{
+	return gl4_shader_state_ready(device, state->shader_state);
+}
+
 static void gl4_set_viewport(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
-	(void)device;
+	gfx_gl_rect_t *viewport = &GL_DEVICE->viewport;
+	viewport->x = x;
+	viewport->y = y;
+	viewport->width = width;
+	viewport->height = height;
 	GL4_CALL(Viewport, x, y, width, height);
+	gfx_gl_render_pass_viewport(device);
 }
 
 static void gl4_set_scissor(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
@@ -1148,6 +1532,42 @@ static void gl4_set_point_size(gfx_device_t *device, float point_size)
 	GL4_CALL(PointSize, point_size);
 }
 
+/* a GL context is current on a single thread, recording from other threads isn't supported */
+static bool gl4_create_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+	GFX_ERROR_CALLBACK("command lists aren't supported");
+	return false;
+}
+
+static void gl4_delete_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+}
+
+static bool gl4_begin_command_list(gfx_device_t *device, gfx_command_list_t *list, const gfx_render_target_t *render_target)
+{
+	(void)device;
+	(void)list;
+	(void)render_target;
+	return false;
+}
+
+static void gl4_end_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	(void)device;
+	(void)list;
+}
+
+static void gl4_execute_command_lists(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count)
+{
+	(void)device;
+	(void)lists;
+	(void)count;
+}
+
 static const gfx_device_vtable_t gl4_vtable =
 {
 	GFX_DEVICE_VTABLE_DEF(gl4)
@@ -1,14 +1,74 @@
 #include "vk.h"
+#include "vk_mem.h"
 #include "../device_vtable.h"
 #include "../window.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <errno.h>
 
 #define VK_DEVICE ((gfx_vk_device_t*)device)
 
+#define VK_PIPELINE_WORKERS 4
+#define VK_MAX_DESCRIPTOR_SETS 4
+#define VK_MAX_DESCRIPTOR_BINDINGS 64
+#define VK_MAX_SET_DESCRIPTORS 64
+#define VK_MAX_CONSTANTS 32
+#define VK_MAX_SAMPLERS 32
+#define VK_DESCRIPTOR_BUCKETS 256
+#define VK_DESCRIPTOR_POOL_SETS 256
+#define VK_DESCRIPTOR_POOLS_MAX 4
+#define VK_STAGING_SIZE (32 * 1024 * 1024)
+#ifndef VK_FRAMES_IN_FLIGHT
+#define VK_FRAMES_IN_FLIGHT 2
+#endif
+#define VK_UPLOAD_BATCHES 4
+#define VK_MAX_COLOR_ATTACHMENTS 8
+
+#define VK_DIRTY_PIPELINE       (1 << 0)
+#define VK_DIRTY_VIEWPORT       (1 << 1)
+#define VK_DIRTY_SCISSOR        (1 << 2)
+#define VK_DIRTY_LINE_WIDTH     (1 << 3)
+#define VK_DIRTY_VERTEX_BUFFERS (1 << 4)
+#define VK_DIRTY_ALL            ((1 << 5) - 1)
+
+#define VK_ATTACHMENT_STAGES (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT)
+#define VK_SAMPLED_STAGES (VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+
+#define SPIRV_MAGIC 0x07230203
+
+#define SPIRV_OP_NAME                5
+#define SPIRV_OP_TYPE_IMAGE         25
+#define SPIRV_OP_TYPE_SAMPLER       26
+#define SPIRV_OP_TYPE_SAMPLED_IMAGE 27
+#define SPIRV_OP_TYPE_ARRAY         28
+#define SPIRV_OP_TYPE_RUNTIME_ARRAY 29
+#define SPIRV_OP_TYPE_STRUCT        30
+#define SPIRV_OP_TYPE_POINTER       32
+#define SPIRV_OP_CONSTANT           43
+#define SPIRV_OP_VARIABLE           59
+#define SPIRV_OP_DECORATE           71
+
+#define SPIRV_DECORATION_BLOCK          2
+#define SPIRV_DECORATION_BUFFER_BLOCK   3
+#define SPIRV_DECORATION_BINDING        33
+#define SPIRV_DECORATION_DESCRIPTOR_SET 34
+
+#define SPIRV_STORAGE_UNIFORM_CONSTANT 0
+#define SPIRV_STORAGE_UNIFORM          2
+#define SPIRV_STORAGE_STORAGE_BUFFER   12
+
+#define SPIRV_DIM_BUFFER 5
+
+#define SPIRV_ID_BINDING      (1 << 0)
+#define SPIRV_ID_SET          (1 << 1)
+#define SPIRV_ID_BLOCK        (1 << 2)
+#define SPIRV_ID_BUFFER_BLOCK (1 << 3)
+
 static const VkFormat attribute_types[] =
 {
 	VK_FORMAT_R32G32B32A32_SFLOAT,
@@ -47,6 +107,152 @@ static const VkFormat attribute_types[] =
 	VK_FORMAT_R8_SINT,
 };
 
+static const VkBufferUsageFlags buffer_types[] =
+{
+	VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+};
+
+static const VkFormat texture_formats[] =
+{
+	VK_FORMAT_D24_UNORM_S8_UINT,
+	VK_FORMAT_R32G32B32A32_SFLOAT,
+	VK_FORMAT_R16G16B16A16_SFLOAT,
+	VK_FORMAT_R32G32B32_SFLOAT,
+	VK_FORMAT_B8G8R8A8_UNORM,
+	VK_FORMAT_A1R5G5B5_UNORM_PACK16,
+	VK_FORMAT_B4G4R4A4_UNORM_PACK16,
+	VK_FORMAT_B5G6R5_UNORM_PACK16,
+	VK_FORMAT_R8G8_UNORM,
+	VK_FORMAT_R8_UNORM,
+	VK_FORMAT_BC1_RGB_UNORM_BLOCK,
+	VK_FORMAT_BC1_RGBA_UNORM_BLOCK,
+	VK_FORMAT_BC2_UNORM_BLOCK,
+	VK_FORMAT_BC3_UNORM_BLOCK,
+	VK_FORMAT_BC4_UNORM_BLOCK,
+	VK_FORMAT_BC5_UNORM_BLOCK,
+	VK_FORMAT_BC6H_UFLOAT_BLOCK,
+	VK_FORMAT_BC7_UNORM_BLOCK,
+	VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK,
+	VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK,
+	VK_FORMAT_EAC_R11_UNORM_BLOCK,
+	VK_FORMAT_EAC_R11G11_UNORM_BLOCK,
+	VK_FORMAT_B10G11R11_UFLOAT_PACK32,
+	VK_FORMAT_R16G16_SFLOAT,
+	VK_FORMAT_R16_SFLOAT,
+	VK_FORMAT_R32_SFLOAT,
+	VK_FORMAT_D16_UNORM,
+	VK_FORMAT_D32_SFLOAT,
+};
+
+/* bytes per texel, or per 4x4 block for compressed formats */
+static const uint8_t texture_block_sizes[] =
+{
+	4,
+	16,
+	8,
+	12,
+	4,
+	2,
+	2,
+	2,
+	2,
+	1,
+	8,
+	8,
+	16,
+	16,
+	8,
+	16,
+	16,
+	16,
+	8,
+	16,
+	8,
+	16,
+	4,
+	4,
+	2,
+	4,
+	2,
+	4,
+};
+
+static const uint8_t texture_block_dims[] =
+{
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	4,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1,
+};
+
+static const VkImageType image_types[] =
+{
+	VK_IMAGE_TYPE_2D,
+	VK_IMAGE_TYPE_2D,
+	VK_IMAGE_TYPE_2D,
+	VK_IMAGE_TYPE_2D,
+	VK_IMAGE_TYPE_3D,
+};
+
+static const VkImageViewType image_view_types[] =
+{
+	VK_IMAGE_VIEW_TYPE_2D,
+	VK_IMAGE_VIEW_TYPE_2D,
+	VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+	VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+	VK_IMAGE_VIEW_TYPE_3D,
+};
+
+/* mirror once would need samplerMirrorClampToEdge, fallback to a plain mirror */
+static const VkSamplerAddressMode address_modes[] =
+{
+	VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+	VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT,
+	VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+	VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT,
+};
+
+static const VkFilter filters[] =
+{
+	VK_FILTER_NEAREST,
+	VK_FILTER_NEAREST,
+	VK_FILTER_LINEAR,
+};
+
+static const VkSamplerMipmapMode mipmap_modes[] =
+{
+	VK_SAMPLER_MIPMAP_MODE_NEAREST,
+	VK_SAMPLER_MIPMAP_MODE_NEAREST,
+	VK_SAMPLER_MIPMAP_MODE_LINEAR,
+};
+
 static const VkIndexType index_types[] =
 {
 	VK_INDEX_TYPE_UINT16,
@@ -149,10 +355,329 @@ static const VkColorComponentFlagBits color_masks[] =
 	VK_COLOR_COMPONENT_A_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_R_BIT,
 };
 
+typedef struct vk_descriptor_binding_s
+{
+	uint32_t set;
+	uint32_t binding;
+	uint32_t bind; /* first constant or sampler slot, given by the bind tables */
+	VkDescriptorType type;
+	uint32_t count;
+	VkShaderStageFlags stages;
+} vk_descriptor_binding_t;
+
+/* pipeline layouts are derived from the shaders reflection, and shared by every shader state with the same interface */
+typedef struct vk_pipeline_layout_s
+{
+	struct vk_pipeline_layout_s *next;
+	uint32_t refcount;
+	uint64_t hash;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSetLayout set_layouts[VK_MAX_DESCRIPTOR_SETS];
+	uint32_t set_layouts_count;
+	uint32_t bindings_count;
+	vk_descriptor_binding_t bindings[];
+} vk_pipeline_layout_t;
+
+typedef struct spirv_id_s
+{
+	uint32_t op;
+	uint32_t type;
+	uint32_t storage;
+	uint32_t value;
+	uint32_t dim;
+	uint32_t set;
+	uint32_t binding;
+	uint32_t flags;
+	const char *name; /* in the code, NULL if stripped */
+} spirv_id_t;
+
+/* formats of the rendering a pipeline is built for, zeroed before being filled so that they can be compared with memcmp */
+typedef struct vk_attachments_format_s
+{
+	VkFormat colors[VK_MAX_COLOR_ATTACHMENTS];
+	uint32_t colors_count;
+	VkFormat depth_stencil;
+	VkSampleCountFlagBits samples;
+} vk_attachments_format_t;
+
+enum vk_pipeline_status
+{
+	VK_PIPELINE_QUEUED,
+	VK_PIPELINE_RUNNING,
+	VK_PIPELINE_DONE,
+};
+
+typedef struct vk_pipeline_s
+{
+	VkPipeline pipeline;
+	VkResult result;
+	enum vk_pipeline_status status;
+	struct vk_pipeline_s *next;
+	vk_attachments_format_t format;
+	struct vk_pipeline_s *variants; /* built on first use for the other formats the pipeline is drawn with */
+	/* creation parameters are copied so the states can die before a worker picks the job */
+	VkShaderModule vertex_shader;
+	VkShaderModule fragment_shader;
+	VkShaderModule geometry_shader;
+	struct vk_pipeline_layout_s *layout; /* referenced until the pipeline is deleted */
+	gfx_rasterizer_state_t rasterizer;
+	gfx_depth_stencil_state_t depth_stencil;
+	gfx_blend_state_t blend;
+	gfx_input_layout_t input_layout;
+	enum gfx_primitive_type primitive;
+} vk_pipeline_t;
+
+typedef struct vk_buffer_s
+{
+	uint64_t id; /* never reused, unlike the handles, and changed with the memory of the buffer */
+	VkBuffer buffer;
+	gfx_vk_allocation_t allocation;
+	uint64_t upload_serial; /* last upload batch writing to the buffer */
+	VkBufferUsageFlags usage;
+	VkMemoryPropertyFlags required;
+	VkMemoryPropertyFlags preferred;
+	VkDeviceSize size;
+	_Atomic uint64_t used; /* frame + 1 of the last recording referencing the memory, 0 until then */
+} vk_buffer_t;
+
+typedef struct vk_texture_s
+{
+	uint64_t id; /* never reused, unlike the handles */
+	VkImage image;
+	VkImageView view;
+	VkImageView attachment_view; /* first level and layer, without swizzle, for the renderings */
+	gfx_vk_allocation_t allocation;
+	VkImageAspectFlags aspect;
+	VkImageLayout layout; /* always sampled outside of the renderings, until its first upload or rendering */
+	VkFormat format;
+	VkSampleCountFlagBits samples;
+	uint64_t upload_serial; /* last upload batch writing to the image */
+	_Atomic uint64_t used; /* frame + 1 of the last recording sampling the image, 0 until then */
+} vk_texture_t;
+
+/* samplers are shared by every texture with the same sampling state, and live as long as the device */
+typedef struct vk_sampler_s
+{
+	struct vk_sampler_s *next;
+	VkSampler sampler;
+	enum gfx_texture_addressing addressing_s;
+	enum gfx_texture_addressing addressing_t;
+	enum gfx_texture_addressing addressing_r;
+	enum gfx_filtering min_filtering;
+	enum gfx_filtering mag_filtering;
+	enum gfx_filtering mip_filtering;
+	uint32_t anisotropy;
+	uint32_t min_level;
+	uint32_t max_level;
+} vk_sampler_t;
+
+/* staging is either a range of the staging ring (staging 0) or a dedicated buffer of the batch (staging n + 1) */
+typedef struct vk_buffer_upload_s
+{
+	vk_buffer_t *dst;
+	uint32_t staging;
+	VkBufferCopy region;
+} vk_buffer_upload_t;
+
+typedef struct vk_image_upload_s
+{
+	vk_texture_t *dst;
+	uint32_t staging;
+	VkBufferImageCopy region;
+} vk_image_upload_t;
+
+typedef struct vk_staging_s
+{
+	VkBuffer buffer;
+	gfx_vk_allocation_t allocation;
+} vk_staging_t;
+
+/* uploads are recorded into a batch until the end of the frame, its staging memory is recycled once its fence is signaled */
+typedef struct vk_upload_batch_s
+{
+	VkCommandBuffer command_buffer;
+	VkFence fence;
+	uint64_t serial;
+	uint64_t staging_end;
+	vk_buffer_upload_t *buffer_uploads;
+	uint32_t buffer_uploads_count;
+	uint32_t buffer_uploads_size;
+	vk_image_upload_t *image_uploads;
+	uint32_t image_uploads_count;
+	uint32_t image_uploads_size;
+	vk_staging_t *stagings;
+	uint32_t stagings_count;
+	uint32_t stagings_size;
+} vk_upload_batch_t;
+
+/* a descriptor per element of the set layout bindings: the resource id, and the range size or sampler */
+typedef struct vk_descriptor_key_s
+{
+	uint64_t id;
+	uint64_t extra;
+} vk_descriptor_key_t;
+
+typedef struct vk_descriptor_set_s
+{
+	struct vk_descriptor_set_s *next;
+	uint64_t hash;
+	VkDescriptorSetLayout layout;
+	VkDescriptorSet set;
+	uint32_t keys_count;
+	vk_descriptor_key_t keys[];
+} vk_descriptor_set_t;
+
+/* every frame records into its own command pool, reused once the fence of its previous submission is signaled */
+typedef struct vk_frame_s
+{
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
+	VkFence fence;
+	VkSemaphore image_available;
+	/* sets allocated by the frame, found again by the next uses of the frame as long as the same resources are bound */
+	VkDescriptorPool descriptor_pools[VK_DESCRIPTOR_POOLS_MAX];
+	uint32_t descriptor_pools_count;
+	vk_descriptor_set_t *descriptor_sets[VK_DESCRIPTOR_BUCKETS];
+} vk_frame_t;
+
+typedef struct vk_constant_s
+{
+	vk_buffer_t *buffer;
+	uint64_t id; /* of the buffer memory the descriptors were written with */
+	uint32_t size;
+	uint32_t offset;
+} vk_constant_t;
+
+typedef struct vk_sampler_bind_s
+{
+	vk_texture_t *texture;
+	const vk_sampler_t *sampler;
+} vk_sampler_bind_t;
+
+/* state of a secondary buffer being recorded: the one of the bound render target pass, or the one of a command list */
+#ifndef NDEBUG
+/* the lists are recorded by other threads, their draws are counted apart and added to the device by their execution */
+typedef struct vk_draw_counts_s
+{
+	uint32_t draw_calls;
+	uint32_t triangles;
+	uint32_t points;
+	uint32_t lines;
+} vk_draw_counts_t;
+#endif
+
+typedef struct vk_recorder_s
+{
+	gfx_device_t *device;
+	VkCommandBuffer command_buffer;
+	enum gfx_primitive_type primitive;
+	/* the state is shadowed and recorded before the draws, so that every new buffer of a pass starts with it */
+	uint32_t dirty;
+	vk_pipeline_t *pipeline;
+	vk_attachments_format_t format;
+	VkExtent2D extent;
+	VkViewport viewport;
+	VkRect2D scissor;
+	float line_width;
+	vk_buffer_t *vertex_sources[8];
+	VkBuffer vertex_buffers[8]; /* memory of the sources bound on the command buffer */
+	uint64_t vertex_ids[8];
+	VkDeviceSize vertex_offsets[8];
+	uint32_t vertex_buffers_count;
+	vk_buffer_t *index_source;
+	uint64_t index_id;
+	VkIndexType index_type;
+	vk_constant_t constants[VK_MAX_CONSTANTS];
+	vk_sampler_bind_t samplers_binds[VK_MAX_SAMPLERS];
+	const vk_pipeline_layout_t *layout; /* layout of the bound pipeline */
+	bool pipeline_bound; /* the bound pipeline was built, else the draws are skipped */
+	const vk_pipeline_layout_t *bound_layout; /* layout the descriptor sets were bound with */
+	VkDescriptorSet bound_sets[VK_MAX_DESCRIPTOR_SETS];
+	uint32_t bound_offsets[VK_MAX_DESCRIPTOR_SETS][VK_MAX_SET_DESCRIPTORS];
+	bool descriptors_dirty;
+	uint64_t frame; /* frame the commands are recorded for */
+#ifndef NDEBUG
+	vk_draw_counts_t counts;
+#endif
+} vk_recorder_t;
+
+typedef struct vk_command_list_frame_s
+{
+	VkCommandPool command_pool;
+	VkCommandBuffer *command_buffers;
+	uint32_t command_buffers_count;
+	uint32_t command_buffers_used;
+	uint64_t frame; /* frame the pool was last reset for */
+} vk_command_list_frame_t;
+
+/* recorded by one thread at a time into secondary buffers, executed by the primary buffer of the same frame */
+typedef struct vk_command_list_s
+{
+	vk_recorder_t recorder;
+	vk_command_list_frame_t frames[VK_FRAMES_IN_FLIGHT];
+	uint64_t frame; /* frame of the last recording */
+	bool recording;
+} vk_command_list_t;
+
+/* the command list the calling thread records into, the gfx calls of other threads go to the frame */
+static _Thread_local vk_recorder_t *thread_recorder;
+
+/* an attachment without view is an unused fragment output, one without texture is the swapchain image */
+typedef struct vk_attachment_s
+{
+	vk_texture_t *texture;
+	VkImageView view;
+	VkAttachmentLoadOp load_op; /* a load of undefined content is recorded as a don't care */
+	VkAttachmentStoreOp store_op;
+	VkClearValue clear_value;
+	VkResolveModeFlagBits resolve_mode;
+	vk_texture_t *resolve_texture;
+	VkImageView resolve_view;
+} vk_attachment_t;
+
+/* the draws of the bound render target go to secondary buffers, executed in a single rendering once the pass is flushed,
+ * so that its clears become load operations and its resolves resolve attachments */
+typedef struct vk_pass_s
+{
+	vk_attachment_t colors[VK_MAX_COLOR_ATTACHMENTS];
+	uint32_t colors_count;
+	vk_attachment_t depth_stencil;
+	vk_attachments_format_t format;
+	VkExtent2D extent;
+	bool valid; /* false while the swapchain has no acquired image, or without any attachment */
+	bool open; /* some buffers are recorded for the rendering */
+	VkCommandBuffer *command_buffers;
+	uint32_t command_buffers_count;
+	uint32_t command_buffers_size;
+} vk_pass_t;
+
+/* a replaced swapchain lives until the frames submitted before its replacement are done */
+typedef struct vk_retired_swapchain_s
+{
+	struct vk_retired_swapchain_s *next;
+	VkSwapchainKHR swap_chain;
+	VkImageView *image_views;
+	VkSemaphore *render_finished;
+	uint32_t images_count;
+	uint64_t frame;
+} vk_retired_swapchain_t;
+
+/* deleted objects, and memory left by the buffers writes, live until the frames submitted before their deletion are done */
+typedef struct vk_garbage_s
+{
+	struct vk_garbage_s *next;
+	VkBuffer buffer;
+	VkImage image;
+	VkImageView views[2];
+	gfx_vk_allocation_t allocation;
+	uint64_t frame;
+} vk_garbage_t;
+
 typedef struct gfx_vk_device_s
 {
 	gfx_device_t device;
 	VkAllocationCallbacks allocation_callbacks;
+	gfx_vk_host_t host;
 	VkSurfaceCapabilitiesKHR surface_capabilities;
 	VkSurfaceFormatKHR *surface_formats;
 	uint32_t surface_formats_count;
@@ -162,11 +687,45 @@ typedef struct gfx_vk_device_s
 	uint32_t surface_image_views_count;
 	VkImage *surface_images;
 	uint32_t surface_images_count;
+	VkImageLayout *surface_layouts;
+	VkSemaphore *render_finished; /* one per swapchain image, as the presentation may hold it longer than a frame */
+	uint32_t surface_image;
+	bool surface_acquired;
 	VkFormat swap_chain_format;
+	VkExtent2D swap_chain_extent;
+	bool swap_chain_outdated;
+	vk_retired_swapchain_t *retired_swap_chains;
+	vk_garbage_t *garbage; /* protected by the queue mutex */
+	vk_frame_t frames[VK_FRAMES_IN_FLIGHT];
+	uint32_t frame_index;
+	uint64_t frame; /* submitted frames count */
+	_Atomic(uint64_t) frames_done; /* count of the first frames whose fence was waited */
 	VkPhysicalDevice physical_device;
-	VkCommandBuffer command_buffer;
+	vk_recorder_t recorder; /* pass buffer of the recording frame */
+	const gfx_render_target_t *render_target;
+	vk_pass_t pass;
+	vk_command_list_frame_t pass_buffers[VK_FRAMES_IN_FLIGHT];
+	bool dynamic_rendering_extension; /* dynamic rendering is core since 1.3 */
+	PFN_vkCmdBeginRenderingKHR begin_rendering;
+	PFN_vkCmdEndRenderingKHR end_rendering;
 	VkSwapchainKHR swap_chain;
-	VkCommandPool command_pool;
+	VkCommandPool upload_pool;
+	pthread_mutex_t queue_mutex; /* guards the queues and the upload batches */
+	VkBuffer staging_buffer;
+	gfx_vk_allocation_t staging_allocation;
+	uint64_t staging_head;
+	uint64_t staging_tail;
+	vk_upload_batch_t upload_batches[VK_UPLOAD_BATCHES];
+	uint32_t upload_batches_head; /* oldest submitted batch */
+	uint32_t upload_batches_count; /* submitted batches, the next one is recording */
+	uint64_t upload_serial; /* serial of the recording batch */
+	uint64_t upload_retired; /* serial of the last retired batch */
+	vk_sampler_t *samplers;
+	pthread_mutex_t samplers_mutex;
+	VkPhysicalDeviceFeatures features;
+	float max_anisotropy;
+	gfx_vk_mem_t mem;
+	bool memory_budget;
 	VkSurfaceKHR surface;
 	VkInstance instance;
 	VkDevice vk_device;
@@ -175,10 +734,27 @@ typedef struct gfx_vk_device_s
 	uint32_t graphics_family;
 	uint32_t present_family;
 	VkPresentModeKHR present_mode;
-	enum gfx_primitive_type primitive;
+	pthread_t pipeline_workers[VK_PIPELINE_WORKERS];
+	uint32_t pipeline_workers_count;
+	pthread_mutex_t pipeline_mutex;
+	pthread_cond_t pipeline_cond;
+	pthread_cond_t pipeline_done_cond;
+	vk_pipeline_t *pipeline_jobs;
+	uint32_t pipeline_running; /* jobs being built, which may read any shader module */
+	bool pipeline_workers_stop;
+	vk_pipeline_layout_t *pipeline_layouts;
+	_Atomic(uint64_t) resource_id;
+	pthread_mutex_t descriptors_mutex; /* guards the descriptor pools and sets of the frames */
 } gfx_vk_device_t;
 
-#define ALLOCATION_CALLBACKS NULL //&VK_DEVICE->allocation_callbacks
+#define ALLOCATION_CALLBACKS (&VK_DEVICE->allocation_callbacks)
+
+static vk_recorder_t *get_recorder(gfx_device_t *device)
+{
+	if (thread_recorder && thread_recorder->device == device)
+		return thread_recorder;
+	return &VK_DEVICE->recorder;
+}
 
 static const char *vk_err2str(VkResult result)
 {
@@ -259,7 +835,7 @@ static bool get_queues_id(gfx_device_t *device, VkPhysicalDevice physical_device
 	return graphics_found && present_found;
 }
 
-static bool support_extensions(VkPhysicalDevice physical_device)
+static bool support_extension(VkPhysicalDevice physical_device, const char *name)
 {
 	uint32_t extensions_count;
 	vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extensions_count, NULL);
@@ -270,14 +846,14 @@ static bool support_extensions(VkPhysicalDevice physical_device)
 		return false;
 	}
 	vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extensions_count, extensions);
-	bool support_swapchain = false;
+	bool supported = false;
 	for (uint32_t i = 0; i < extensions_count; ++i)
 	{
-		if (!strcmp(extensions[i].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME))
-			support_swapchain = true;
+		if (!strcmp(extensions[i].extensionName, name))
+			supported = true;
 	}
 	GFX_FREE(extensions);
-	return support_swapchain;
+	return supported;
 }
 
 static bool get_physical_device(gfx_device_t *device)
@@ -316,7 +892,11 @@ static bool get_physical_device(gfx_device_t *device)
 		//	continue;
 		if (!get_queues_id(device, devices[i]))
 			continue;
-		if (!support_extensions(devices[i]))
+		if (!support_extension(devices[i], VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+			continue;
+		/* render targets are drawn with dynamic rendering, which needs the depth stencil resolve of 1.2 */
+		if (device_properties.apiVersion < VK_API_VERSION_1_3
+		 && (device_properties.apiVersion < VK_API_VERSION_1_2 || !support_extension(devices[i], VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)))
 			continue;
 		uint32_t formats_count;
 		vkGetPhysicalDeviceSurfaceFormatsKHR(devices[i], VK_DEVICE->surface, &formats_count, NULL);
@@ -348,6 +928,8 @@ static bool get_physical_device(gfx_device_t *device)
 		VK_DEVICE->surface_formats = formats;
 		VK_DEVICE->surface_formats_count = formats_count;
 		VK_DEVICE->physical_device = devices[i];
+		VK_DEVICE->memory_budget = support_extension(devices[i], VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		VK_DEVICE->dynamic_rendering_extension = device_properties.apiVersion < VK_API_VERSION_1_3;
 		GFX_FREE(devices);
 		return true;
 	}
@@ -356,12 +938,48 @@ static bool get_physical_device(gfx_device_t *device)
 	return false;
 }
 
-static bool create_device(gfx_device_t *device)
+static VkFormat get_texture_format(gfx_device_t *device, enum gfx_format format);
+
+/* the compressed formats are only reported with their feature, enabled when available */
+static void query_formats(gfx_device_t *device)
 {
-	static const char *extensions[] =
+	device->formats = 0;
+	for (uint32_t i = 0; i < sizeof(texture_formats) / sizeof(*texture_formats); ++i)
 	{
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-	};
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(VK_DEVICE->physical_device, get_texture_format(device, i), &properties);
+		VkFormatFeatureFlags required = gfx_format_has_depth(i) ? VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+		if ((properties.optimalTilingFeatures & required) == required)
+			device->formats |= UINT64_C(1) << i;
+	}
+}
+
+static bool create_device(gfx_device_t *device)
+{
+	const char *extensions[3];
+	uint32_t extensions_count = 0;
+	extensions[extensions_count++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+	if (VK_DEVICE->memory_budget)
+		extensions[extensions_count++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+	if (VK_DEVICE->dynamic_rendering_extension)
+		extensions[extensions_count++] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering;
+	dynamic_rendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+	dynamic_rendering.pNext = NULL;
+	dynamic_rendering.dynamicRendering = VK_TRUE;
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(VK_DEVICE->physical_device, &features);
+	memset(&VK_DEVICE->features, 0, sizeof(VK_DEVICE->features));
+	VK_DEVICE->features.samplerAnisotropy = features.samplerAnisotropy;
+	VK_DEVICE->features.textureCompressionBC = features.textureCompressionBC;
+	VK_DEVICE->features.textureCompressionETC2 = features.textureCompressionETC2;
+	query_formats(device);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(VK_DEVICE->physical_device, &properties);
+	VK_DEVICE->max_anisotropy = features.samplerAnisotropy ? properties.limits.maxSamplerAnisotropy : 1;
+	device->max_texture_size = properties.limits.maxImageDimension2D;
+	device->max_texture_3d_size = properties.limits.maxImageDimension3D;
+	device->max_texture_layers = properties.limits.maxImageArrayLayers;
 	float queue_priority = 1;
 	VkDeviceQueueCreateInfo queues_create_info[2];
 	queues_create_info[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
@@ -378,15 +996,15 @@ static bool create_device(gfx_device_t *device)
 	queues_create_info[1].pQueuePriorities = &queue_priority;
 	VkDeviceCreateInfo create_info;
 	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	create_info.pNext = NULL;
+	create_info.pNext = &dynamic_rendering;
 	create_info.flags = 0;
 	create_info.queueCreateInfoCount = sizeof(queues_create_info) / sizeof(*queues_create_info);
 	create_info.pQueueCreateInfos = queues_create_info;
 	create_info.enabledLayerCount = 0;
 	create_info.ppEnabledLayerNames = NULL;
-	create_info.enabledExtensionCount = sizeof(extensions) / sizeof(*extensions);
+	create_info.enabledExtensionCount = extensions_count;
 	create_info.ppEnabledExtensionNames = extensions;
-	create_info.pEnabledFeatures = NULL;
+	create_info.pEnabledFeatures = &VK_DEVICE->features;
 	VkResult result = vkCreateDevice(VK_DEVICE->physical_device, &create_info, ALLOCATION_CALLBACKS, &VK_DEVICE->vk_device);
 	if (result != VK_SUCCESS)
 	{
@@ -395,6 +1013,21 @@ static bool create_device(gfx_device_t *device)
 	}
 	vkGetDeviceQueue(VK_DEVICE->vk_device, VK_DEVICE->graphics_family, 0, &VK_DEVICE->graphics_queue);
 	vkGetDeviceQueue(VK_DEVICE->vk_device, VK_DEVICE->present_family, 0, &VK_DEVICE->present_queue);
+	if (VK_DEVICE->dynamic_rendering_extension)
+	{
+		VK_DEVICE->begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(VK_DEVICE->vk_device, "vkCmdBeginRenderingKHR");
+		VK_DEVICE->end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(VK_DEVICE->vk_device, "vkCmdEndRenderingKHR");
+	}
+	else
+	{
+		VK_DEVICE->begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(VK_DEVICE->vk_device, "vkCmdBeginRendering");
+		VK_DEVICE->end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(VK_DEVICE->vk_device, "vkCmdEndRendering");
+	}
+	if (!VK_DEVICE->begin_rendering || !VK_DEVICE->end_rendering)
+	{
+		GFX_ERROR_CALLBACK("can't get dynamic rendering functions");
+		return false;
+	}
 	return true;
 }
 
@@ -445,10 +1078,18 @@ static bool create_swapchain(gfx_device_t *device)
 	VkSurfaceFormatKHR *surface_format = get_surface_format(device);
 	VkPresentModeKHR present_mode = get_present_mode(device);
 	VkExtent2D extent = get_extent(device);
+	if (!extent.width || !extent.height)
+	{
+		/* minimized, retried every frame until the surface gets a size again */
+		VK_DEVICE->swap_chain = VK_NULL_HANDLE;
+		VK_DEVICE->swap_chain_outdated = true;
+		return false;
+	}
 	uint32_t image_count = VK_DEVICE->surface_capabilities.minImageCount + 1;
 	if (VK_DEVICE->surface_capabilities.maxImageCount && image_count > VK_DEVICE->surface_capabilities.maxImageCount)
 		image_count = VK_DEVICE->surface_capabilities.maxImageCount;
 	VK_DEVICE->swap_chain_format = surface_format->format;
+	VK_DEVICE->swap_chain_extent = extent;
 	VkSwapchainCreateInfoKHR create_info;
 	create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	create_info.pNext = NULL;
@@ -459,7 +1100,7 @@ static bool create_swapchain(gfx_device_t *device)
 	create_info.imageColorSpace = surface_format->colorSpace;
 	create_info.imageExtent = extent;
 	create_info.imageArrayLayers = 1;
-	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	if (VK_DEVICE->graphics_family != VK_DEVICE->present_family)
 	{
 		uint32_t families[2] = {VK_DEVICE->graphics_family, VK_DEVICE->present_family};
@@ -482,8 +1123,11 @@ static bool create_swapchain(gfx_device_t *device)
 	if (result != VK_SUCCESS)
 	{
 		GFX_ERROR_CALLBACK("can't create swapchain: %s (%d)", vk_err2str(result), result);
+		VK_DEVICE->swap_chain = VK_NULL_HANDLE;
+		VK_DEVICE->swap_chain_outdated = true;
 		return false;
 	}
+	VK_DEVICE->swap_chain_outdated = false;
 	uint32_t images_count = 0;
 	result = vkGetSwapchainImagesKHR(VK_DEVICE->vk_device, VK_DEVICE->swap_chain, &images_count, NULL);
 	if (result != VK_SUCCESS)
@@ -503,8 +1147,19 @@ static bool create_swapchain(gfx_device_t *device)
 		GFX_ERROR_CALLBACK("can't get swapchain images: %s (%d)", vk_err2str(result), result);
 		return false;
 	}
+	VkImageLayout *layouts = GFX_MALLOC(sizeof(*layouts) * images_count);
+	if (!layouts)
+	{
+		GFX_ERROR_CALLBACK("can't allocate images layouts: %s (%d)", strerror(errno), errno);
+		GFX_FREE(images);
+		return false;
+	}
+	for (uint32_t i = 0; i < images_count; ++i)
+		layouts[i] = VK_IMAGE_LAYOUT_UNDEFINED;
 	GFX_FREE(VK_DEVICE->surface_images);
+	GFX_FREE(VK_DEVICE->surface_layouts);
 	VK_DEVICE->surface_images = images;
+	VK_DEVICE->surface_layouts = layouts;
 	VK_DEVICE->surface_images_count = images_count;
 	return true;
 }
@@ -531,7 +1186,7 @@ static bool create_image_views(gfx_device_t *device)
 		create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
 		create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
 		create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-		create_info.subresourceRange.aspectMask = 0;
+		create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		create_info.subresourceRange.baseMipLevel = 0;
 		create_info.subresourceRange.levelCount = 1;
 		create_info.subresourceRange.baseArrayLayer = 0;
@@ -540,6 +1195,8 @@ static bool create_image_views(gfx_device_t *device)
 		if (result != VK_SUCCESS)
 		{
 			GFX_ERROR_CALLBACK("can't allocate image views: %s (%d)", vk_err2str(result), result);
+			for (uint32_t j = 0; j < i; ++j)
+				vkDestroyImageView(VK_DEVICE->vk_device, image_views[j], ALLOCATION_CALLBACKS);
 			GFX_FREE(image_views);
 			return false;
 		}
@@ -549,190 +1206,1812 @@ static bool create_image_views(gfx_device_t *device)
 	return true;
 }
 
-static bool create_command_pool(gfx_device_t *device)
+static bool create_render_finished(gfx_device_t *device)
 {
-	VkCommandPoolCreateInfo create_info;
-	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	create_info.pNext = NULL;
-	create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	create_info.queueFamilyIndex = 0;
-	VkResult result = vkCreateCommandPool(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &VK_DEVICE->command_pool);
-	if (result != VK_SUCCESS)
+	VkSemaphore *semaphores = GFX_MALLOC(sizeof(*semaphores) * VK_DEVICE->surface_images_count);
+	if (!semaphores)
 	{
-		GFX_ERROR_CALLBACK("can't create vulkan command pool: %s (%d)", vk_err2str(result), result);
+		GFX_ERROR_CALLBACK("can't allocate semaphores: %s (%d)", strerror(errno), errno);
 		return false;
 	}
-	return true;
-}
-
-static bool create_command_buffers(gfx_device_t *device)
-{
-	VkCommandBufferAllocateInfo allocate_info;
-	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocate_info.pNext = NULL;
-	allocate_info.commandPool = VK_DEVICE->command_pool;
-	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocate_info.commandBufferCount = 1;
-	VkResult result = vkAllocateCommandBuffers(VK_DEVICE->vk_device, &allocate_info, &VK_DEVICE->command_buffer);
-	if (result != VK_SUCCESS)
+	for (uint32_t i = 0; i < VK_DEVICE->surface_images_count; ++i)
 	{
-		GFX_ERROR_CALLBACK("can't create vulkan command buffer: %s (%d)", vk_err2str(result), result);
-		return false;
+		VkSemaphoreCreateInfo create_info;
+		create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		create_info.pNext = NULL;
+		create_info.flags = 0;
+		VkResult result = vkCreateSemaphore(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &semaphores[i]);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create semaphore: %s (%d)", vk_err2str(result), result);
+			for (uint32_t j = 0; j < i; ++j)
+				vkDestroySemaphore(VK_DEVICE->vk_device, semaphores[j], ALLOCATION_CALLBACKS);
+			GFX_FREE(semaphores);
+			return false;
+		}
 	}
+	VK_DEVICE->render_finished = semaphores;
 	return true;
 }
 
-static bool vk_ctr(gfx_device_t *device, gfx_window_t *window)
+static bool create_frames(gfx_device_t *device)
 {
-	VkResult result;
-	VK_DEVICE->present_mode = VK_PRESENT_MODE_FIFO_KHR;
-	if (!gfx_device_vtable.ctr(device, window))
-		return false;
-	if (!get_physical_device(device))
-		return false;
-	if (!create_device(device))
-		return false;
-	if (!create_swapchain(device))
-		return false;
-	if (!create_image_views(device))
-		return false;
-	if (!create_command_pool(device))
-		return false;
-	if (!create_command_buffers(device))
-		return false;
+	for (uint32_t i = 0; i < VK_FRAMES_IN_FLIGHT; ++i)
+	{
+		vk_frame_t *frame = &VK_DEVICE->frames[i];
+		VkCommandPoolCreateInfo pool_info;
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.pNext = NULL;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		pool_info.queueFamilyIndex = VK_DEVICE->graphics_family;
+		VkResult result = vkCreateCommandPool(VK_DEVICE->vk_device, &pool_info, ALLOCATION_CALLBACKS, &frame->command_pool);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create vulkan command pool: %s (%d)", vk_err2str(result), result);
+			return false;
+		}
+		VkCommandBufferAllocateInfo allocate_info;
+		allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocate_info.pNext = NULL;
+		allocate_info.commandPool = frame->command_pool;
+		allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocate_info.commandBufferCount = 1;
+		result = vkAllocateCommandBuffers(VK_DEVICE->vk_device, &allocate_info, &frame->command_buffer);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create vulkan command buffer: %s (%d)", vk_err2str(result), result);
+			return false;
+		}
+		/* signaled, as if the frame had already been submitted once */
+		VkFenceCreateInfo fence_info;
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.pNext = NULL;
+		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		result = vkCreateFence(VK_DEVICE->vk_device, &fence_info, ALLOCATION_CALLBACKS, &frame->fence);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create frame fence: %s (%d)", vk_err2str(result), result);
+			return false;
+		}
+		VkSemaphoreCreateInfo semaphore_info;
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = NULL;
+		semaphore_info.flags = 0;
+		result = vkCreateSemaphore(VK_DEVICE->vk_device, &semaphore_info, ALLOCATION_CALLBACKS, &frame->image_available);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create semaphore: %s (%d)", vk_err2str(result), result);
+			return false;
+		}
+		vk_command_list_frame_t *pass_buffers = &VK_DEVICE->pass_buffers[i];
+		result = vkCreateCommandPool(VK_DEVICE->vk_device, &pool_info, ALLOCATION_CALLBACKS, &pass_buffers->command_pool);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create vulkan command pool: %s (%d)", vk_err2str(result), result);
+			return false;
+		}
+		pass_buffers->frame = UINT64_MAX;
+	}
 	return true;
 }
 
-static void vk_dtr(gfx_device_t *device)
+static void destroy_swapchain_images(gfx_device_t *device, VkImageView *image_views, VkSemaphore *render_finished, uint32_t count)
 {
-	for (uint32_t i = 0; i < VK_DEVICE->surface_image_views_count; ++i)
-		vkDestroyImageView(VK_DEVICE->vk_device, VK_DEVICE->surface_image_views[i], ALLOCATION_CALLBACKS);
-	vkFreeCommandBuffers(VK_DEVICE->vk_device, VK_DEVICE->command_pool, 1, &VK_DEVICE->command_buffer);
-	vkDestroyCommandPool(VK_DEVICE->vk_device, VK_DEVICE->command_pool, ALLOCATION_CALLBACKS);
-	vkDestroySwapchainKHR(VK_DEVICE->vk_device, VK_DEVICE->swap_chain, ALLOCATION_CALLBACKS);
-	vkDestroySurfaceKHR(VK_DEVICE->instance, VK_DEVICE->surface, ALLOCATION_CALLBACKS);
-	vkDestroyInstance(VK_DEVICE->instance, NULL); /* XXX: allocation callbacks */
-	vkDestroyDevice(VK_DEVICE->vk_device, NULL); /* XXX: allocation callbacks */
-	GFX_FREE(VK_DEVICE->surface_image_views);
-	GFX_FREE(VK_DEVICE->surface_formats);
-	GFX_FREE(VK_DEVICE->surface_images);
-	GFX_FREE(VK_DEVICE->present_modes);
-	gfx_device_vtable.dtr(device);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (image_views)
+			vkDestroyImageView(VK_DEVICE->vk_device, image_views[i], ALLOCATION_CALLBACKS);
+		if (render_finished)
+			vkDestroySemaphore(VK_DEVICE->vk_device, render_finished[i], ALLOCATION_CALLBACKS);
+	}
+	GFX_FREE(image_views);
+	GFX_FREE(render_finished);
 }
 
-static void vk_tick(gfx_device_t *device)
+static void release_swapchains(gfx_device_t *device, bool force)
 {
-	gfx_device_vtable.tick(device);
+	vk_retired_swapchain_t **prev = &VK_DEVICE->retired_swap_chains;
+	while (*prev)
+	{
+		vk_retired_swapchain_t *retired = *prev;
+		if (!force && retired->frame + VK_FRAMES_IN_FLIGHT > VK_DEVICE->frame)
+		{
+			prev = &retired->next;
+			continue;
+		}
+		*prev = retired->next;
+		destroy_swapchain_images(device, retired->image_views, retired->render_finished, retired->images_count);
+		vkDestroySwapchainKHR(VK_DEVICE->vk_device, retired->swap_chain, ALLOCATION_CALLBACKS);
+		GFX_FREE(retired);
+	}
 }
 
-static void vk_clear_color(gfx_device_t *device, const gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, vec4f_t color)
+static void destroy_garbage(gfx_device_t *device, vk_garbage_t *garbage)
 {
-	VkClearColorValue vk_color;
-	vk_color.float32[0] = color.x;
-	vk_color.float32[1] = color.y;
-	vk_color.float32[2] = color.z;
-	vk_color.float32[3] = color.w;
-	VkImageSubresourceRange range;
-	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	range.baseMipLevel = 0;
-	range.levelCount = 1;
-	range.baseArrayLayer = 0;
-	range.layerCount = 1;
-	for (uint32_t i = 0; i < VK_DEVICE->surface_images_count; ++i)
-		vkCmdClearColorImage(VK_DEVICE->command_buffer, VK_DEVICE->surface_images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &vk_color, 1, &range);
+	vkDestroyImageView(VK_DEVICE->vk_device, garbage->views[0], ALLOCATION_CALLBACKS);
+	vkDestroyImageView(VK_DEVICE->vk_device, garbage->views[1], ALLOCATION_CALLBACKS);
+	vkDestroyImage(VK_DEVICE->vk_device, garbage->image, ALLOCATION_CALLBACKS);
+	vkDestroyBuffer(VK_DEVICE->vk_device, garbage->buffer, ALLOCATION_CALLBACKS);
+	gfx_vk_mem_free(&VK_DEVICE->mem, &garbage->allocation);
 }
 
-static void vk_clear_depth_stencil(gfx_device_t *device, const gfx_render_target_t *render_target, float depth, uint8_t stencil)
+/* must be called with the queue mutex held */
+static void release_garbage(gfx_device_t *device, bool force)
 {
-	VkClearDepthStencilValue vk_depth_stencil;
-	vk_depth_stencil.depth = depth;
-	vk_depth_stencil.stencil = stencil;
-	VkImageSubresourceRange range;
-	range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-	range.baseMipLevel = 0;
-	range.levelCount = 1;
-	range.baseArrayLayer = 0;
-	range.layerCount = 1;
-	//vkCmdClearDepthStencilImage(VK_DEVICE->command_buffer, image, image_layout, &vk_depth_stencil, 1, &range
+	vk_garbage_t **prev = &VK_DEVICE->garbage;
+	while (*prev)
+	{
+		vk_garbage_t *garbage = *prev;
+		if (!force && garbage->frame + VK_FRAMES_IN_FLIGHT > VK_DEVICE->frame)
+		{
+			prev = &garbage->next;
+			continue;
+		}
+		*prev = garbage->next;
+		destroy_garbage(device, garbage);
+		GFX_FREE(garbage);
+	}
 }
 
-static void vk_draw_indexed_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
+/* the frames in flight and the recorded commands may still use the objects, must be called with the queue mutex held */
+static void retire_objects(gfx_device_t *device, vk_garbage_t *objects)
 {
-	vkCmdDrawIndexed(VK_DEVICE->command_buffer, count, prim_count, offset, 0, 0);
-#ifndef NDEBUG
-	switch (VK_DEVICE->primitive)
+	vk_garbage_t *garbage = GFX_MALLOC(sizeof(*garbage));
+	if (!garbage)
 	{
-		case GFX_PRIMITIVE_TRIANGLES:
-			device->triangles_count += count / 3 * prim_count;
-			break;
-		case GFX_PRIMITIVE_POINTS:
-			device->points_count += count * prim_count;
-			break;
-		case GFX_PRIMITIVE_LINES:
-			device->lines_count += count / 2 * prim_count;
-			break;
+		GFX_ERROR_CALLBACK("can't allocate garbage: %s (%d)", strerror(errno), errno);
+		vkDeviceWaitIdle(VK_DEVICE->vk_device);
+		destroy_garbage(device, objects);
+		return;
 	}
-	device->draw_calls_count++;
-#endif
+	*garbage = *objects;
+	garbage->frame = VK_DEVICE->frame;
+	garbage->next = VK_DEVICE->garbage;
+	VK_DEVICE->garbage = garbage;
 }
 
-static void vk_draw_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
+/* the previous swapchain is handed to its replacement, and destroyed once the frames still using it are done, so there's no need to idle the device */
+static bool recreate_swapchain(gfx_device_t *device)
 {
-	vkCmdDraw(VK_DEVICE->command_buffer, count, prim_count, offset, 0);
-#ifndef NDEBUG
-	switch (VK_DEVICE->primitive)
+	if (VK_DEVICE->swap_chain != VK_NULL_HANDLE)
 	{
-		case GFX_PRIMITIVE_TRIANGLES:
-			device->triangles_count += count / 3;
-			break;
-		case GFX_PRIMITIVE_POINTS:
-			device->points_count += count;
-			break;
-		case GFX_PRIMITIVE_LINES:
-			device->lines_count += count / 2;
-			break;
+		vk_retired_swapchain_t *retired = GFX_MALLOC(sizeof(*retired));
+		if (!retired)
+		{
+			GFX_ERROR_CALLBACK("can't allocate retired swapchain: %s (%d)", strerror(errno), errno);
+			return false;
+		}
+		retired->swap_chain = VK_DEVICE->swap_chain;
+		retired->image_views = VK_DEVICE->surface_image_views;
+		retired->render_finished = VK_DEVICE->render_finished;
+		retired->images_count = VK_DEVICE->surface_images_count;
+		retired->frame = VK_DEVICE->frame;
+		retired->next = VK_DEVICE->retired_swap_chains;
+		VK_DEVICE->retired_swap_chains = retired;
+		VK_DEVICE->surface_image_views = NULL;
+		VK_DEVICE->surface_image_views_count = 0;
+		VK_DEVICE->render_finished = NULL;
 	}
-	device->draw_calls_count++;
-#endif
+	if (!create_swapchain(device))
+		return false;
+	if (!create_image_views(device))
+		return false;
+	if (!create_render_finished(device))
+		return false;
+	return true;
+}
+
+static void acquire_image(gfx_device_t *device)
+{
+	vk_frame_t *frame = &VK_DEVICE->frames[VK_DEVICE->frame_index];
+	VK_DEVICE->surface_acquired = false;
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		if (VK_DEVICE->swap_chain_outdated && !recreate_swapchain(device))
+			return;
+		VkResult result = vkAcquireNextImageKHR(VK_DEVICE->vk_device, VK_DEVICE->swap_chain, UINT64_MAX, frame->image_available, VK_NULL_HANDLE, &VK_DEVICE->surface_image);
+		if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+		{
+			/* a suboptimal swapchain is still presented, and replaced on the next frame */
+			if (result == VK_SUBOPTIMAL_KHR)
+				VK_DEVICE->swap_chain_outdated = true;
+			VK_DEVICE->surface_layouts[VK_DEVICE->surface_image] = VK_IMAGE_LAYOUT_UNDEFINED;
+			VK_DEVICE->surface_acquired = true;
+			return;
+		}
+		if (result != VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			GFX_ERROR_CALLBACK("can't acquire swapchain image: %s (%d)", vk_err2str(result), result);
+			return;
+		}
+		VK_DEVICE->swap_chain_outdated = true;
+	}
+}
+
+static void reset_descriptor_sets(gfx_device_t *device, vk_frame_t *frame)
+{
+	for (uint32_t i = 0; i < VK_DESCRIPTOR_BUCKETS; ++i)
+	{
+		while (frame->descriptor_sets[i])
+		{
+			vk_descriptor_set_t *set = frame->descriptor_sets[i];
+			frame->descriptor_sets[i] = set->next;
+			GFX_FREE(set);
+		}
+	}
+	for (uint32_t i = 0; i < frame->descriptor_pools_count; ++i)
+		vkResetDescriptorPool(VK_DEVICE->vk_device, frame->descriptor_pools[i], 0);
+}
+
+static void destroy_descriptor_sets(gfx_device_t *device, vk_frame_t *frame)
+{
+	reset_descriptor_sets(device, frame);
+	for (uint32_t i = 0; i < frame->descriptor_pools_count; ++i)
+		vkDestroyDescriptorPool(VK_DEVICE->vk_device, frame->descriptor_pools[i], ALLOCATION_CALLBACKS);
+	frame->descriptor_pools_count = 0;
+}
+
+static void bind_pass(gfx_device_t *device);
+
+static void begin_frame(gfx_device_t *device)
+{
+	vk_frame_t *frame = &VK_DEVICE->frames[VK_DEVICE->frame_index];
+	VkResult result = vkWaitForFences(VK_DEVICE->vk_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+	if (result != VK_SUCCESS)
+		GFX_ERROR_CALLBACK("can't wait for frame fence: %s (%d)", vk_err2str(result), result);
+	/* the fence is the one of the frame submitted VK_FRAMES_IN_FLIGHT frames ago */
+	if (VK_DEVICE->frame + 1 >= VK_FRAMES_IN_FLIGHT)
+		atomic_store(&VK_DEVICE->frames_done, VK_DEVICE->frame + 1 - VK_FRAMES_IN_FLIGHT);
+	release_swapchains(device, false);
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	release_garbage(device, false);
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+	VK_DEVICE->recorder.frame = VK_DEVICE->frame;
+	vkResetCommandPool(VK_DEVICE->vk_device, frame->command_pool, 0);
+	/* sets of deleted resources or stale bindings only go away when the frame needs more than one pool */
+	if (frame->descriptor_pools_count > 1)
+	{
+		reset_descriptor_sets(device, frame);
+		while (frame->descriptor_pools_count > 1)
+			vkDestroyDescriptorPool(VK_DEVICE->vk_device, frame->descriptor_pools[--frame->descriptor_pools_count], ALLOCATION_CALLBACKS);
+	}
+	VkCommandBufferBeginInfo begin_info;
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = NULL;
+	result = vkBeginCommandBuffer(frame->command_buffer, &begin_info);
+	if (result != VK_SUCCESS)
+		GFX_ERROR_CALLBACK("can't begin frame command buffer: %s (%d)", vk_err2str(result), result);
+	acquire_image(device);
+	/* the swapchain image changes every frame */
+	bind_pass(device);
+}
+
+/* the acquire semaphore is waited by the transfers and the color outputs, which every use of the image starts after */
+static void transition_surface(gfx_device_t *device, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	VkImageLayout *current = &VK_DEVICE->surface_layouts[VK_DEVICE->surface_image];
+	if (*current == layout)
+		return;
+	VkImageMemoryBarrier barrier;
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = *current == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = access;
+	barrier.oldLayout = *current;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = VK_DEVICE->surface_images[VK_DEVICE->surface_image];
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(VK_DEVICE->frames[VK_DEVICE->frame_index].command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, stages, 0, 0, NULL, 0, NULL, 1, &barrier);
+	*current = layout;
+}
+
+static bool create_upload_pool(gfx_device_t *device)
+{
+	VkCommandPoolCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	create_info.queueFamilyIndex = VK_DEVICE->graphics_family;
+	VkResult result = vkCreateCommandPool(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &VK_DEVICE->upload_pool);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create vulkan upload command pool: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	return true;
+}
+
+static bool create_memory_allocator(gfx_device_t *device)
+{
+	PFN_vkGetPhysicalDeviceMemoryProperties2 get_memory_properties2 = NULL;
+	if (VK_DEVICE->memory_budget)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(VK_DEVICE->physical_device, &properties);
+		if (properties.apiVersion >= VK_API_VERSION_1_1)
+			get_memory_properties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2)vkGetInstanceProcAddr(VK_DEVICE->instance, "vkGetPhysicalDeviceMemoryProperties2");
+		if (!get_memory_properties2)
+			get_memory_properties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2)vkGetInstanceProcAddr(VK_DEVICE->instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+	}
+	return gfx_vk_mem_init(&VK_DEVICE->mem, VK_DEVICE->physical_device, VK_DEVICE->vk_device, get_memory_properties2, ALLOCATION_CALLBACKS);
+}
+
+static bool create_upload_batches(gfx_device_t *device)
+{
+	VkBufferCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.size = VK_STAGING_SIZE;
+	create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	create_info.queueFamilyIndexCount = 0;
+	create_info.pQueueFamilyIndices = NULL;
+	VkResult result = vkCreateBuffer(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &VK_DEVICE->staging_buffer);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create staging buffer: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(VK_DEVICE->vk_device, VK_DEVICE->staging_buffer, &requirements);
+	if (!gfx_vk_mem_alloc(&VK_DEVICE->mem, &requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true, &VK_DEVICE->staging_allocation))
+	{
+		vkDestroyBuffer(VK_DEVICE->vk_device, VK_DEVICE->staging_buffer, ALLOCATION_CALLBACKS);
+		VK_DEVICE->staging_buffer = VK_NULL_HANDLE;
+		return false;
+	}
+	result = vkBindBufferMemory(VK_DEVICE->vk_device, VK_DEVICE->staging_buffer, VK_DEVICE->staging_allocation.memory, VK_DEVICE->staging_allocation.offset);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't bind staging buffer memory: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	VkCommandBuffer command_buffers[VK_UPLOAD_BATCHES];
+	VkCommandBufferAllocateInfo allocate_info;
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.pNext = NULL;
+	allocate_info.commandPool = VK_DEVICE->upload_pool;
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocate_info.commandBufferCount = VK_UPLOAD_BATCHES;
+	result = vkAllocateCommandBuffers(VK_DEVICE->vk_device, &allocate_info, command_buffers);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create upload command buffers: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	for (uint32_t i = 0; i < VK_UPLOAD_BATCHES; ++i)
+	{
+		vk_upload_batch_t *batch = &VK_DEVICE->upload_batches[i];
+		batch->command_buffer = command_buffers[i];
+		VkFenceCreateInfo fence_info;
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.pNext = NULL;
+		fence_info.flags = 0;
+		result = vkCreateFence(VK_DEVICE->vk_device, &fence_info, ALLOCATION_CALLBACKS, &batch->fence);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create upload fence: %s (%d)", vk_err2str(result), result);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void *array_reserve(void *data, uint32_t *size, uint32_t count, size_t elem_size)
+{
+	if (count < *size)
+		return data;
+	uint32_t new_size = *size ? *size * 2 : 16;
+	void *new_data = GFX_REALLOC(data, elem_size * new_size);
+	if (!new_data)
+	{
+		GFX_ERROR_CALLBACK("can't allocate uploads: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	*size = new_size;
+	return new_data;
+}
+
+static bool ranges_overlap(uint64_t a, uint64_t a_size, uint64_t b, uint64_t b_size)
+{
+	return a < b + b_size && b < a + a_size;
+}
+
+static vk_upload_batch_t *recording_batch(gfx_device_t *device)
+{
+	return &VK_DEVICE->upload_batches[(VK_DEVICE->upload_batches_head + VK_DEVICE->upload_batches_count) % VK_UPLOAD_BATCHES];
+}
+
+/* retire every submitted batch up to serial, waiting for them if needed, and the following ones already done */
+static void retire_uploads(gfx_device_t *device, uint64_t serial)
+{
+	while (VK_DEVICE->upload_batches_count)
+	{
+		vk_upload_batch_t *batch = &VK_DEVICE->upload_batches[VK_DEVICE->upload_batches_head];
+		if (batch->serial <= serial)
+		{
+			VkResult result = vkWaitForFences(VK_DEVICE->vk_device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+			if (result != VK_SUCCESS)
+				GFX_ERROR_CALLBACK("can't wait for upload fence: %s (%d)", vk_err2str(result), result);
+		}
+		else if (vkGetFenceStatus(VK_DEVICE->vk_device, batch->fence) != VK_SUCCESS)
+		{
+			break;
+		}
+		vkResetFences(VK_DEVICE->vk_device, 1, &batch->fence);
+		vkResetCommandBuffer(batch->command_buffer, 0);
+		for (uint32_t i = 0; i < batch->stagings_count; ++i)
+		{
+			vkDestroyBuffer(VK_DEVICE->vk_device, batch->stagings[i].buffer, ALLOCATION_CALLBACKS);
+			gfx_vk_mem_free(&VK_DEVICE->mem, &batch->stagings[i].allocation);
+		}
+		batch->stagings_count = 0;
+		VK_DEVICE->staging_tail = batch->staging_end;
+		VK_DEVICE->upload_retired = batch->serial;
+		VK_DEVICE->upload_batches_head = (VK_DEVICE->upload_batches_head + 1) % VK_UPLOAD_BATCHES;
+		VK_DEVICE->upload_batches_count--;
+	}
+}
+
+static int buffer_upload_cmp(const void *a, const void *b)
+{
+	const vk_buffer_upload_t *upload_a = a;
+	const vk_buffer_upload_t *upload_b = b;
+	if (upload_a->dst != upload_b->dst)
+		return (uintptr_t)upload_a->dst < (uintptr_t)upload_b->dst ? -1 : 1;
+	if (upload_a->staging != upload_b->staging)
+		return upload_a->staging < upload_b->staging ? -1 : 1;
+	return 0;
+}
+
+static int image_upload_cmp(const void *a, const void *b)
+{
+	const vk_image_upload_t *upload_a = a;
+	const vk_image_upload_t *upload_b = b;
+	if (upload_a->dst != upload_b->dst)
+		return (uintptr_t)upload_a->dst < (uintptr_t)upload_b->dst ? -1 : 1;
+	if (upload_a->staging != upload_b->staging)
+		return upload_a->staging < upload_b->staging ? -1 : 1;
+	return 0;
+}
+
+static VkBuffer staging_buffer(gfx_device_t *device, const vk_upload_batch_t *batch, uint32_t staging)
+{
+	return staging ? batch->stagings[staging - 1].buffer : VK_DEVICE->staging_buffer;
+}
+
+/* uploads never overlap inside a batch, so they are sorted to issue a single copy per destination and staging buffer */
+static void record_uploads(gfx_device_t *device, vk_upload_batch_t *batch, VkImageMemoryBarrier *barriers, uint32_t barriers_count, void *regions)
+{
+	VkCommandBuffer command_buffer = batch->command_buffer;
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < batch->image_uploads_count; ++i)
+	{
+		vk_texture_t *texture = batch->image_uploads[i].dst;
+		if (i && texture == batch->image_uploads[i - 1].dst)
+			continue;
+		VkImageMemoryBarrier *barrier = &barriers[n++];
+		barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier->pNext = NULL;
+		barrier->srcAccessMask = 0;
+		barrier->dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier->oldLayout = texture->layout;
+		barrier->newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier->image = texture->image;
+		barrier->subresourceRange.aspectMask = texture->aspect;
+		barrier->subresourceRange.baseMipLevel = 0;
+		barrier->subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		barrier->subresourceRange.baseArrayLayer = 0;
+		barrier->subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+	}
+	assert(n == barriers_count);
+	/* the first scope holds every previous submission, so the frames still reading the destinations are waited for */
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, barriers_count, barriers);
+	VkBufferCopy *buffer_regions = regions;
+	for (uint32_t i = 0; i < batch->buffer_uploads_count;)
+	{
+		const vk_buffer_upload_t *first = &batch->buffer_uploads[i];
+		uint32_t count = 0;
+		while (i < batch->buffer_uploads_count && !buffer_upload_cmp(first, &batch->buffer_uploads[i]))
+			buffer_regions[count++] = batch->buffer_uploads[i++].region;
+		vkCmdCopyBuffer(command_buffer, staging_buffer(device, batch, first->staging), first->dst->buffer, count, buffer_regions);
+	}
+	VkBufferImageCopy *image_regions = regions;
+	for (uint32_t i = 0; i < batch->image_uploads_count;)
+	{
+		const vk_image_upload_t *first = &batch->image_uploads[i];
+		uint32_t count = 0;
+		while (i < batch->image_uploads_count && !image_upload_cmp(first, &batch->image_uploads[i]))
+			image_regions[count++] = batch->image_uploads[i++].region;
+		vkCmdCopyBufferToImage(command_buffer, staging_buffer(device, batch, first->staging), first->dst->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, count, image_regions);
+	}
+	for (uint32_t i = 0; i < barriers_count; ++i)
+	{
+		barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	for (uint32_t i = 0; i < batch->image_uploads_count; ++i)
+		batch->image_uploads[i].dst->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	VkMemoryBarrier memory_barrier;
+	memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memory_barrier.pNext = NULL;
+	memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memory_barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memory_barrier, 0, NULL, barriers_count, barriers);
+}
+
+/* submit the recording batch, must be called with the queue mutex held */
+static bool submit_uploads(gfx_device_t *device)
+{
+	vk_upload_batch_t *batch = recording_batch(device);
+	if (!batch->buffer_uploads_count && !batch->image_uploads_count)
+		return true;
+	qsort(batch->buffer_uploads, batch->buffer_uploads_count, sizeof(*batch->buffer_uploads), buffer_upload_cmp);
+	qsort(batch->image_uploads, batch->image_uploads_count, sizeof(*batch->image_uploads), image_upload_cmp);
+	uint32_t barriers_count = 0;
+	for (uint32_t i = 0; i < batch->image_uploads_count; ++i)
+	{
+		if (!i || batch->image_uploads[i].dst != batch->image_uploads[i - 1].dst)
+			barriers_count++;
+	}
+	size_t regions_size = sizeof(VkBufferCopy) * batch->buffer_uploads_count;
+	if (regions_size < sizeof(VkBufferImageCopy) * batch->image_uploads_count)
+		regions_size = sizeof(VkBufferImageCopy) * batch->image_uploads_count;
+	VkImageMemoryBarrier *barriers = GFX_MALLOC(sizeof(*barriers) * barriers_count + regions_size);
+	if (!barriers)
+	{
+		GFX_ERROR_CALLBACK("can't allocate upload regions: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	VkCommandBufferBeginInfo begin_info;
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = NULL;
+	VkResult result = vkBeginCommandBuffer(batch->command_buffer, &begin_info);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't begin upload command buffer: %s (%d)", vk_err2str(result), result);
+		GFX_FREE(barriers);
+		return false;
+	}
+	record_uploads(device, batch, barriers, barriers_count, &barriers[barriers_count]);
+	GFX_FREE(barriers);
+	result = vkEndCommandBuffer(batch->command_buffer);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't end upload command buffer: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	VkSubmitInfo submit_info;
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = NULL;
+	submit_info.waitSemaphoreCount = 0;
+	submit_info.pWaitSemaphores = NULL;
+	submit_info.pWaitDstStageMask = NULL;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &batch->command_buffer;
+	submit_info.signalSemaphoreCount = 0;
+	submit_info.pSignalSemaphores = NULL;
+	result = vkQueueSubmit(VK_DEVICE->graphics_queue, 1, &submit_info, batch->fence);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't submit uploads: %s (%d)", vk_err2str(result), result);
+		vkResetCommandBuffer(batch->command_buffer, 0);
+		return false;
+	}
+	batch->buffer_uploads_count = 0;
+	batch->image_uploads_count = 0;
+	batch->serial = VK_DEVICE->upload_serial++;
+	batch->staging_end = VK_DEVICE->staging_head;
+	VK_DEVICE->upload_batches_count++;
+	if (VK_DEVICE->upload_batches_count == VK_UPLOAD_BATCHES)
+		retire_uploads(device, VK_DEVICE->upload_batches[VK_DEVICE->upload_batches_head].serial);
+	return true;
+}
+
+/* data too large for the ring gets a buffer of its own, released with the batch */
+static bool staging_write_dedicated(gfx_device_t *device, const void *data, VkDeviceSize size, uint32_t *staging, VkDeviceSize *offset)
+{
+	vk_upload_batch_t *batch = recording_batch(device);
+	vk_staging_t *stagings = array_reserve(batch->stagings, &batch->stagings_size, batch->stagings_count, sizeof(*stagings));
+	if (!stagings)
+		return false;
+	batch->stagings = stagings;
+	vk_staging_t *dedicated = &stagings[batch->stagings_count];
+	VkBufferCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.size = size;
+	create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	create_info.queueFamilyIndexCount = 0;
+	create_info.pQueueFamilyIndices = NULL;
+	VkResult result = vkCreateBuffer(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &dedicated->buffer);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create staging buffer: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(VK_DEVICE->vk_device, dedicated->buffer, &requirements);
+	if (!gfx_vk_mem_alloc(&VK_DEVICE->mem, &requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true, &dedicated->allocation))
+	{
+		vkDestroyBuffer(VK_DEVICE->vk_device, dedicated->buffer, ALLOCATION_CALLBACKS);
+		return false;
+	}
+	result = vkBindBufferMemory(VK_DEVICE->vk_device, dedicated->buffer, dedicated->allocation.memory, dedicated->allocation.offset);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't bind staging buffer memory: %s (%d)", vk_err2str(result), result);
+		vkDestroyBuffer(VK_DEVICE->vk_device, dedicated->buffer, ALLOCATION_CALLBACKS);
+		gfx_vk_mem_free(&VK_DEVICE->mem, &dedicated->allocation);
+		return false;
+	}
+	memcpy(dedicated->allocation.data, data, size);
+	gfx_vk_mem_flush(&VK_DEVICE->mem, &dedicated->allocation, 0, size);
+	*staging = ++batch->stagings_count;
+	*offset = 0;
+	return true;
+}
+
+/* copy data into the staging ring, submitting the recording batch and waiting for the oldest ones while it is full */
+static bool staging_write(gfx_device_t *device, const void *data, VkDeviceSize size, VkDeviceSize alignment, uint32_t *staging, VkDeviceSize *offset)
+{
+	if (size > VK_STAGING_SIZE)
+		return staging_write_dedicated(device, data, size, staging, offset);
+	while (1)
+	{
+		uint64_t head = VK_DEVICE->staging_head;
+		VkDeviceSize ring_offset = head % VK_STAGING_SIZE;
+		VkDeviceSize aligned = (ring_offset + alignment - 1) / alignment * alignment;
+		if (aligned + size > VK_STAGING_SIZE)
+		{
+			head += VK_STAGING_SIZE - ring_offset;
+			aligned = 0;
+		}
+		else
+		{
+			head += aligned - ring_offset;
+		}
+		if (head + size - VK_DEVICE->staging_tail <= VK_STAGING_SIZE)
+		{
+			VK_DEVICE->staging_head = head + size;
+			memcpy(VK_DEVICE->staging_allocation.data + aligned, data, size);
+			gfx_vk_mem_flush(&VK_DEVICE->mem, &VK_DEVICE->staging_allocation, aligned, size);
+			*staging = 0;
+			*offset = aligned;
+			return true;
+		}
+		vk_upload_batch_t *batch = recording_batch(device);
+		if (batch->buffer_uploads_count || batch->image_uploads_count)
+		{
+			if (!submit_uploads(device))
+				return false;
+		}
+		else if (VK_DEVICE->upload_batches_count)
+		{
+			retire_uploads(device, VK_DEVICE->upload_batches[VK_DEVICE->upload_batches_head].serial);
+		}
+		else
+		{
+			/* nothing references the ring anymore */
+			VK_DEVICE->staging_head = 0;
+			VK_DEVICE->staging_tail = 0;
+		}
+	}
+}
+
+/* drop the pending uploads to a resource about to be retired, the submitted ones being done before the end of its frame, must be called with the queue mutex held */
+static void forget_uploads(gfx_device_t *device, uint64_t serial, const vk_buffer_t *buffer, const vk_texture_t *texture)
+{
+	if (serial != VK_DEVICE->upload_serial)
+		return;
+	vk_upload_batch_t *batch = recording_batch(device);
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < batch->buffer_uploads_count; ++i)
+	{
+		if (batch->buffer_uploads[i].dst != buffer)
+			batch->buffer_uploads[n++] = batch->buffer_uploads[i];
+	}
+	batch->buffer_uploads_count = n;
+	n = 0;
+	for (uint32_t i = 0; i < batch->image_uploads_count; ++i)
+	{
+		if (batch->image_uploads[i].dst != texture)
+			batch->image_uploads[n++] = batch->image_uploads[i];
+	}
+	batch->image_uploads_count = n;
+}
+
+static void destroy_upload_batches(gfx_device_t *device)
+{
+	retire_uploads(device, UINT64_MAX);
+	for (uint32_t i = 0; i < VK_UPLOAD_BATCHES; ++i)
+	{
+		vk_upload_batch_t *batch = &VK_DEVICE->upload_batches[i];
+		for (uint32_t j = 0; j < batch->stagings_count; ++j)
+		{
+			vkDestroyBuffer(VK_DEVICE->vk_device, batch->stagings[j].buffer, ALLOCATION_CALLBACKS);
+			gfx_vk_mem_free(&VK_DEVICE->mem, &batch->stagings[j].allocation);
+		}
+		GFX_FREE(batch->buffer_uploads);
+		GFX_FREE(batch->image_uploads);
+		GFX_FREE(batch->stagings);
+		vkDestroyFence(VK_DEVICE->vk_device, batch->fence, ALLOCATION_CALLBACKS);
+	}
+	if (VK_DEVICE->staging_buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(VK_DEVICE->vk_device, VK_DEVICE->staging_buffer, ALLOCATION_CALLBACKS);
+		gfx_vk_mem_free(&VK_DEVICE->mem, &VK_DEVICE->staging_allocation);
+	}
+}
+
+static bool vk_ctr(gfx_device_t *device, gfx_window_t *window)
+{
+	VkResult result;
+	VK_DEVICE->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	VK_DEVICE->pipeline_workers_count = 0;
+	VK_DEVICE->pipeline_jobs = NULL;
+	VK_DEVICE->pipeline_running = 0;
+	VK_DEVICE->pipeline_workers_stop = false;
+	VK_DEVICE->pipeline_layouts = NULL;
+	VK_DEVICE->garbage = NULL;
+	VK_DEVICE->memory_budget = false;
+	VK_DEVICE->staging_buffer = VK_NULL_HANDLE;
+	VK_DEVICE->staging_head = 0;
+	VK_DEVICE->staging_tail = 0;
+	memset(VK_DEVICE->upload_batches, 0, sizeof(VK_DEVICE->upload_batches));
+	VK_DEVICE->upload_batches_head = 0;
+	VK_DEVICE->upload_batches_count = 0;
+	VK_DEVICE->upload_serial = 1;
+	VK_DEVICE->upload_retired = 0;
+	VK_DEVICE->samplers = NULL;
+	pthread_mutex_init(&VK_DEVICE->pipeline_mutex, NULL);
+	pthread_mutex_init(&VK_DEVICE->queue_mutex, NULL);
+	pthread_mutex_init(&VK_DEVICE->samplers_mutex, NULL);
+	pthread_mutex_init(&VK_DEVICE->descriptors_mutex, NULL);
+	VK_DEVICE->recorder.device = device;
+	VK_DEVICE->recorder.line_width = 1;
+	pthread_cond_init(&VK_DEVICE->pipeline_cond, NULL);
+	pthread_cond_init(&VK_DEVICE->pipeline_done_cond, NULL);
+	if (!gfx_device_vtable.ctr(device, window))
+		return false;
+	if (!get_physical_device(device))
+		return false;
+	if (!create_device(device))
+		return false;
+	if (!create_memory_allocator(device))
+		return false;
+	if (!create_swapchain(device))
+		return false;
+	if (!create_image_views(device))
+		return false;
+	if (!create_render_finished(device))
+		return false;
+	if (!create_frames(device))
+		return false;
+	if (!create_upload_pool(device))
+		return false;
+	if (!create_upload_batches(device))
+		return false;
+	begin_frame(device);
+	return true;
+}
+
+static void vk_dtr(gfx_device_t *device)
+{
+	if (VK_DEVICE->vk_device)
+		vkDeviceWaitIdle(VK_DEVICE->vk_device);
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	VK_DEVICE->pipeline_workers_stop = true;
+	pthread_cond_broadcast(&VK_DEVICE->pipeline_cond);
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	for (uint32_t i = 0; i < VK_DEVICE->pipeline_workers_count; ++i)
+		pthread_join(VK_DEVICE->pipeline_workers[i], NULL);
+	/* the jobs no worker took die with the device, their layouts with the list below */
+	while (VK_DEVICE->pipeline_jobs)
+	{
+		vk_pipeline_t *pipeline = VK_DEVICE->pipeline_jobs;
+		VK_DEVICE->pipeline_jobs = pipeline->next;
+		GFX_FREE(pipeline);
+	}
+	pthread_cond_destroy(&VK_DEVICE->pipeline_done_cond);
+	pthread_cond_destroy(&VK_DEVICE->pipeline_cond);
+	pthread_mutex_destroy(&VK_DEVICE->pipeline_mutex);
+	while (VK_DEVICE->pipeline_layouts)
+	{
+		vk_pipeline_layout_t *layout = VK_DEVICE->pipeline_layouts;
+		VK_DEVICE->pipeline_layouts = layout->next;
+		vkDestroyPipelineLayout(VK_DEVICE->vk_device, layout->pipeline_layout, ALLOCATION_CALLBACKS);
+		for (uint32_t i = 0; i < layout->set_layouts_count; ++i)
+			vkDestroyDescriptorSetLayout(VK_DEVICE->vk_device, layout->set_layouts[i], ALLOCATION_CALLBACKS);
+		GFX_FREE(layout);
+	}
+	release_swapchains(device, true);
+	release_garbage(device, true);
+	destroy_swapchain_images(device, VK_DEVICE->surface_image_views, VK_DEVICE->render_finished, VK_DEVICE->surface_images_count);
+	for (uint32_t i = 0; i < VK_FRAMES_IN_FLIGHT; ++i)
+	{
+		vk_frame_t *frame = &VK_DEVICE->frames[i];
+		destroy_descriptor_sets(device, frame);
+		vkDestroySemaphore(VK_DEVICE->vk_device, frame->image_available, ALLOCATION_CALLBACKS);
+		vkDestroyFence(VK_DEVICE->vk_device, frame->fence, ALLOCATION_CALLBACKS);
+		vkDestroyCommandPool(VK_DEVICE->vk_device, frame->command_pool, ALLOCATION_CALLBACKS);
+		vkDestroyCommandPool(VK_DEVICE->vk_device, VK_DEVICE->pass_buffers[i].command_pool, ALLOCATION_CALLBACKS);
+		GFX_FREE(VK_DEVICE->pass_buffers[i].command_buffers);
+	}
+	GFX_FREE(VK_DEVICE->pass.command_buffers);
+	pthread_mutex_destroy(&VK_DEVICE->descriptors_mutex);
+	while (VK_DEVICE->samplers)
+	{
+		vk_sampler_t *sampler = VK_DEVICE->samplers;
+		VK_DEVICE->samplers = sampler->next;
+		vkDestroySampler(VK_DEVICE->vk_device, sampler->sampler, ALLOCATION_CALLBACKS);
+		GFX_FREE(sampler);
+	}
+	pthread_mutex_destroy(&VK_DEVICE->samplers_mutex);
+	destroy_upload_batches(device);
+	vkDestroyCommandPool(VK_DEVICE->vk_device, VK_DEVICE->upload_pool, ALLOCATION_CALLBACKS);
+	pthread_mutex_destroy(&VK_DEVICE->queue_mutex);
+	gfx_vk_mem_destroy(&VK_DEVICE->mem);
+	vkDestroySwapchainKHR(VK_DEVICE->vk_device, VK_DEVICE->swap_chain, ALLOCATION_CALLBACKS);
+	vkDestroyDevice(VK_DEVICE->vk_device, ALLOCATION_CALLBACKS);
+	/* the instance and the surface are created by the window, without callbacks */
+	vkDestroySurfaceKHR(VK_DEVICE->instance, VK_DEVICE->surface, NULL);
+	vkDestroyInstance(VK_DEVICE->instance, NULL);
+	GFX_FREE(VK_DEVICE->surface_formats);
+	GFX_FREE(VK_DEVICE->surface_images);
+	GFX_FREE(VK_DEVICE->surface_layouts);
+	GFX_FREE(VK_DEVICE->present_modes);
+	gfx_device_vtable.dtr(device);
+	gfx_vk_host_destroy(&VK_DEVICE->host);
+}
+
+static void vk_tick(gfx_device_t *device)
+{
+	gfx_device_vtable.tick(device);
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	retire_uploads(device, 0);
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+	if (VK_DEVICE->memory_budget)
+		gfx_vk_mem_update_budget(&VK_DEVICE->mem);
+	pthread_mutex_lock(&VK_DEVICE->mem.mutex);
+	gfx_device_set_memory_usage(device, GFX_MEMORY_ALLOCATION, VK_DEVICE->mem.allocated, VK_DEVICE->mem.allocated_peak, VK_DEVICE->mem.blocks_count);
+	/* the device local heaps budget given by VK_EXT_memory_budget */
+	if (VK_DEVICE->memory_budget)
+	{
+		device->driver_memory_budget = 0;
+		for (uint32_t i = 0; i < VK_DEVICE->mem.properties.memoryHeapCount; ++i)
+		{
+			if (VK_DEVICE->mem.properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+				device->driver_memory_budget += VK_DEVICE->mem.heaps_budget[i];
+		}
+	}
+	pthread_mutex_unlock(&VK_DEVICE->mem.mutex);
+}
+
+static bool create_descriptor_pool(gfx_device_t *device, vk_frame_t *frame)
+{
+	VkDescriptorPoolSize sizes[4];
+	sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	sizes[0].descriptorCount = VK_DESCRIPTOR_POOL_SETS * 4;
+	sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sizes[1].descriptorCount = VK_DESCRIPTOR_POOL_SETS * 8;
+	sizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	sizes[2].descriptorCount = VK_DESCRIPTOR_POOL_SETS;
+	sizes[3].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	sizes[3].descriptorCount = VK_DESCRIPTOR_POOL_SETS;
+	VkDescriptorPoolCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.maxSets = VK_DESCRIPTOR_POOL_SETS;
+	create_info.poolSizeCount = sizeof(sizes) / sizeof(*sizes);
+	create_info.pPoolSizes = sizes;
+	VkResult result = vkCreateDescriptorPool(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &frame->descriptor_pools[frame->descriptor_pools_count]);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create descriptor pool: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	frame->descriptor_pools_count++;
+	return true;
+}
+
+/* the last pool of the frame is the only one with free space, the previous ones being full */
+static VkDescriptorSet allocate_descriptor_set(gfx_device_t *device, vk_frame_t *frame, VkDescriptorSetLayout layout)
+{
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		if (frame->descriptor_pools_count)
+		{
+			VkDescriptorSetAllocateInfo allocate_info;
+			allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocate_info.pNext = NULL;
+			allocate_info.descriptorPool = frame->descriptor_pools[frame->descriptor_pools_count - 1];
+			allocate_info.descriptorSetCount = 1;
+			allocate_info.pSetLayouts = &layout;
+			VkDescriptorSet set;
+			VkResult result = vkAllocateDescriptorSets(VK_DEVICE->vk_device, &allocate_info, &set);
+			if (result == VK_SUCCESS)
+				return set;
+			if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+			{
+				GFX_ERROR_CALLBACK("can't allocate descriptor set: %s (%d)", vk_err2str(result), result);
+				return VK_NULL_HANDLE;
+			}
+		}
+		if (frame->descriptor_pools_count == VK_DESCRIPTOR_POOLS_MAX)
+		{
+			GFX_ERROR_CALLBACK("too many descriptor sets in frame");
+			return VK_NULL_HANDLE;
+		}
+		if (!create_descriptor_pool(device, frame))
+			return VK_NULL_HANDLE;
+	}
+	return VK_NULL_HANDLE;
+}
+
+/* constants and samplers are bound to the bindings named by the bind tables, else of the same number, whatever their set */
+static uint32_t descriptor_set_keys(const vk_recorder_t *recorder, uint32_t set, vk_descriptor_key_t *keys, uint32_t *offsets, uint32_t *offsets_count)
+{
+	const vk_pipeline_layout_t *layout = recorder->layout;
+	uint32_t keys_count = 0;
+	*offsets_count = 0;
+	for (uint32_t i = 0; i < layout->bindings_count; ++i)
+	{
+		const vk_descriptor_binding_t *binding = &layout->bindings[i];
+		if (binding->set != set)
+			continue;
+		for (uint32_t j = 0; j < binding->count && keys_count < VK_MAX_SET_DESCRIPTORS; ++j)
+		{
+			vk_descriptor_key_t *key = &keys[keys_count++];
+			uint32_t bind = binding->bind + j;
+			key->id = 0;
+			key->extra = 0;
+			switch (binding->type)
+			{
+				case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+					if (bind < VK_MAX_CONSTANTS && recorder->constants[bind].buffer)
+					{
+						key->id = recorder->constants[bind].buffer->id;
+						key->extra = recorder->constants[bind].size;
+						offsets[(*offsets_count)++] = recorder->constants[bind].offset;
+					}
+					else
+					{
+						offsets[(*offsets_count)++] = 0;
+					}
+					break;
+				case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+				case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+				case VK_DESCRIPTOR_TYPE_SAMPLER:
+					if (bind < VK_MAX_SAMPLERS && recorder->samplers_binds[bind].texture)
+					{
+						key->id = recorder->samplers_binds[bind].texture->id;
+						key->extra = (uintptr_t)recorder->samplers_binds[bind].sampler;
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	return keys_count;
+}
+
+static uint64_t hash_descriptor_keys(VkDescriptorSetLayout layout, const vk_descriptor_key_t *keys, uint32_t count)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	const uint8_t *data = (const uint8_t*)&layout;
+	for (size_t i = 0; i < sizeof(layout); ++i)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	data = (const uint8_t*)keys;
+	for (size_t i = 0; i < sizeof(*keys) * count; ++i)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static void write_descriptor_set(gfx_device_t *device, const vk_recorder_t *recorder, VkDescriptorSet set, uint32_t set_index)
+{
+	const vk_pipeline_layout_t *layout = recorder->layout;
+	VkWriteDescriptorSet writes[VK_MAX_DESCRIPTOR_BINDINGS];
+	VkDescriptorBufferInfo buffers_infos[VK_MAX_SET_DESCRIPTORS];
+	VkDescriptorImageInfo images_infos[VK_MAX_SET_DESCRIPTORS];
+	uint32_t writes_count = 0;
+	uint32_t infos_count = 0;
+	for (uint32_t i = 0; i < layout->bindings_count; ++i)
+	{
+		const vk_descriptor_binding_t *binding = &layout->bindings[i];
+		if (binding->set != set_index)
+			continue;
+		uint32_t first = infos_count;
+		for (uint32_t j = 0; j < binding->count && infos_count < VK_MAX_SET_DESCRIPTORS; ++j)
+		{
+			uint32_t bind = binding->bind + j;
+			switch (binding->type)
+			{
+				case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+				{
+					if (bind >= VK_MAX_CONSTANTS || !recorder->constants[bind].buffer)
+						goto next_binding;
+					VkDescriptorBufferInfo *info = &buffers_infos[infos_count++];
+					info->buffer = recorder->constants[bind].buffer->buffer;
+					info->offset = 0;
+					info->range = recorder->constants[bind].size;
+					break;
+				}
+				case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+				case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+				case VK_DESCRIPTOR_TYPE_SAMPLER:
+				{
+					if (bind >= VK_MAX_SAMPLERS || !recorder->samplers_binds[bind].texture)
+						goto next_binding;
+					VkDescriptorImageInfo *info = &images_infos[infos_count++];
+					info->sampler = recorder->samplers_binds[bind].sampler->sampler;
+					info->imageView = recorder->samplers_binds[bind].texture->view;
+					info->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+					break;
+				}
+				default:
+					goto next_binding;
+			}
+		}
+next_binding:
+		/* unbound elements are left unwritten, the shader must not use them */
+		if (infos_count == first)
+			continue;
+		VkWriteDescriptorSet *write = &writes[writes_count++];
+		write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write->pNext = NULL;
+		write->dstSet = set;
+		write->dstBinding = binding->binding;
+		write->dstArrayElement = 0;
+		write->descriptorCount = infos_count - first;
+		write->descriptorType = binding->type;
+		write->pImageInfo = &images_infos[first];
+		write->pBufferInfo = &buffers_infos[first];
+		write->pTexelBufferView = NULL;
+	}
+	vkUpdateDescriptorSets(VK_DEVICE->vk_device, writes_count, writes, 0, NULL);
+}
+
+static VkDescriptorSet get_descriptor_set(gfx_device_t *device, const vk_recorder_t *recorder, uint32_t set_index, const vk_descriptor_key_t *keys, uint32_t keys_count)
+{
+	vk_frame_t *frame = &VK_DEVICE->frames[VK_DEVICE->frame_index];
+	VkDescriptorSetLayout layout = recorder->layout->set_layouts[set_index];
+	uint64_t hash = hash_descriptor_keys(layout, keys, keys_count);
+	vk_descriptor_set_t **bucket = &frame->descriptor_sets[hash % VK_DESCRIPTOR_BUCKETS];
+	for (vk_descriptor_set_t *set = *bucket; set; set = set->next)
+	{
+		if (set->hash == hash
+		 && set->layout == layout
+		 && set->keys_count == keys_count
+		 && !memcmp(set->keys, keys, sizeof(*keys) * keys_count))
+			return set->set;
+	}
+	vk_descriptor_set_t *set = GFX_MALLOC(sizeof(*set) + sizeof(*keys) * keys_count);
+	if (!set)
+	{
+		GFX_ERROR_CALLBACK("can't allocate descriptor set: %s (%d)", strerror(errno), errno);
+		return VK_NULL_HANDLE;
+	}
+	set->set = allocate_descriptor_set(device, frame, layout);
+	if (set->set == VK_NULL_HANDLE)
+	{
+		GFX_FREE(set);
+		return VK_NULL_HANDLE;
+	}
+	write_descriptor_set(device, recorder, set->set, set_index);
+	set->hash = hash;
+	set->layout = layout;
+	set->keys_count = keys_count;
+	memcpy(set->keys, keys, sizeof(*keys) * keys_count);
+	set->next = *bucket;
+	*bucket = set;
+	return set->set;
+}
+
+/* resolve the bound resources into descriptor sets before a draw, binding only the sets or offsets that changed */
+/* the constant of a slot read by the layout, NULL if the slot isn't a constant or has none bound */
+static vk_constant_t *layout_constant(vk_recorder_t *recorder, const vk_descriptor_binding_t *binding, uint32_t j)
+{
+	uint32_t bind = binding->bind + j;
+	if (binding->type != VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || bind >= VK_MAX_CONSTANTS || !recorder->constants[bind].buffer)
+		return NULL;
+	return &recorder->constants[bind];
+}
+
+static vk_texture_t *layout_texture(vk_recorder_t *recorder, const vk_descriptor_binding_t *binding, uint32_t j)
+{
+	uint32_t bind = binding->bind + j;
+	switch (binding->type)
+	{
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		case VK_DESCRIPTOR_TYPE_SAMPLER:
+			return bind < VK_MAX_SAMPLERS ? recorder->samplers_binds[bind].texture : NULL;
+		default:
+			return NULL;
+	}
+}
+
+/* only the slots read by the layout are looked at, as the other ones aren't used by the draws */
+static void flush_descriptors(gfx_device_t *device, vk_recorder_t *recorder)
+{
+	const vk_pipeline_layout_t *layout = recorder->layout;
+	if (!layout)
+		return;
+	/* the constants written since they were bound moved to new memory */
+	for (uint32_t i = 0; i < layout->bindings_count; ++i)
+	{
+		for (uint32_t j = 0; j < layout->bindings[i].count; ++j)
+		{
+			const vk_constant_t *constant = layout_constant(recorder, &layout->bindings[i], j);
+			if (constant && constant->id != constant->buffer->id)
+				recorder->descriptors_dirty = true;
+		}
+	}
+	if (!recorder->descriptors_dirty)
+		return;
+	recorder->descriptors_dirty = false;
+	for (uint32_t i = 0; i < layout->bindings_count; ++i)
+	{
+		for (uint32_t j = 0; j < layout->bindings[i].count; ++j)
+		{
+			vk_constant_t *constant = layout_constant(recorder, &layout->bindings[i], j);
+			if (constant)
+			{
+				constant->id = constant->buffer->id;
+				atomic_store(&constant->buffer->used, recorder->frame + 1);
+			}
+			vk_texture_t *texture = layout_texture(recorder, &layout->bindings[i], j);
+			if (texture)
+				atomic_store(&texture->used, recorder->frame + 1);
+		}
+	}
+	bool layout_changed = recorder->bound_layout != layout;
+	recorder->bound_layout = layout;
+	for (uint32_t i = 0; i < layout->set_layouts_count; ++i)
+	{
+		vk_descriptor_key_t keys[VK_MAX_SET_DESCRIPTORS];
+		uint32_t offsets[VK_MAX_SET_DESCRIPTORS];
+		uint32_t offsets_count;
+		uint32_t keys_count = descriptor_set_keys(recorder, i, keys, offsets, &offsets_count);
+		pthread_mutex_lock(&VK_DEVICE->descriptors_mutex);
+		VkDescriptorSet set = get_descriptor_set(device, recorder, i, keys, keys_count);
+		pthread_mutex_unlock(&VK_DEVICE->descriptors_mutex);
+		if (set == VK_NULL_HANDLE)
+			continue;
+		if (!layout_changed
+		 && recorder->bound_sets[i] == set
+		 && !memcmp(recorder->bound_offsets[i], offsets, sizeof(*offsets) * offsets_count))
+			continue;
+		recorder->bound_sets[i] = set;
+		memcpy(recorder->bound_offsets[i], offsets, sizeof(*offsets) * offsets_count);
+		vkCmdBindDescriptorSets(recorder->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout->pipeline_layout, i, 1, &set, offsets_count, offsets);
+	}
+}
+
+static VkImageAspectFlags format_aspects(VkFormat format)
+{
+	switch (format)
+	{
+		case VK_FORMAT_UNDEFINED:
+			return 0;
+		case VK_FORMAT_D16_UNORM:
+		case VK_FORMAT_X8_D24_UNORM_PACK32:
+		case VK_FORMAT_D32_SFLOAT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT;
+		case VK_FORMAT_S8_UINT:
+			return VK_IMAGE_ASPECT_STENCIL_BIT;
+		case VK_FORMAT_D16_UNORM_S8_UINT:
+		case VK_FORMAT_D24_UNORM_S8_UINT:
+		case VK_FORMAT_D32_SFLOAT_S8_UINT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		default:
+			return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+/* textures without attachment view can't be rendered to, and are left out like unused outputs */
+static vk_texture_t *attachment_texture(const gfx_texture_t *texture)
+{
+	return texture && ((vk_texture_t*)texture->handle.ptr)->attachment_view ? texture->handle.ptr : NULL;
+}
+
+static void setup_attachment(vk_attachment_t *attachment, const gfx_texture_t *texture)
+{
+	attachment->texture = attachment_texture(texture);
+	attachment->view = attachment->texture ? attachment->texture->attachment_view : VK_NULL_HANDLE;
+	attachment->load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachment->store_op = VK_ATTACHMENT_STORE_OP_STORE;
+	memset(&attachment->clear_value, 0, sizeof(attachment->clear_value));
+	attachment->resolve_mode = VK_RESOLVE_MODE_NONE;
+	attachment->resolve_texture = NULL;
+	attachment->resolve_view = VK_NULL_HANDLE;
+}
+
+/* like on gl, the fragment outputs are the draw buffers of the render target, and the swapchain image without one */
+static const gfx_texture_t *draw_buffer_texture(const gfx_render_target_t *render_target, uint32_t i)
+{
+	uint8_t draw_buffer = render_target->draw_buffers[i];
+	return draw_buffer >= GFX_RENDERTARGET_ATTACHMENT_COLOR0 ? render_target->colors[draw_buffer - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture : NULL;
+}
+
+/* only reads the render target, so that the command lists get the format of theirs without the bound pass, false without any attachment */
+static bool attachments_format(gfx_device_t *device, const gfx_render_target_t *render_target, vk_attachments_format_t *format, VkExtent2D *extent)
+{
+	memset(format, 0, sizeof(*format));
+	format->depth_stencil = VK_FORMAT_UNDEFINED;
+	format->samples = VK_SAMPLE_COUNT_1_BIT;
+	if (!render_target)
+	{
+		format->colors[0] = VK_DEVICE->swap_chain_format;
+		format->colors_count = 1;
+		*extent = VK_DEVICE->swap_chain_extent;
+		return true;
+	}
+	assert(render_target->draw_buffers_nb <= VK_MAX_COLOR_ATTACHMENTS);
+	const gfx_texture_t *textures[VK_MAX_COLOR_ATTACHMENTS + 1];
+	format->colors_count = render_target->draw_buffers_nb;
+	for (uint32_t i = 0; i < format->colors_count; ++i)
+	{
+		textures[i] = draw_buffer_texture(render_target, i);
+		if (!attachment_texture(textures[i]))
+			textures[i] = NULL;
+		format->colors[i] = textures[i] ? ((vk_texture_t*)textures[i]->handle.ptr)->format : VK_FORMAT_UNDEFINED;
+	}
+	textures[format->colors_count] = attachment_texture(render_target->depth_stencil.texture) ? render_target->depth_stencil.texture : NULL;
+	if (textures[format->colors_count])
+		format->depth_stencil = ((vk_texture_t*)textures[format->colors_count]->handle.ptr)->format;
+	/* the render area is the one of the smallest attachment */
+	extent->width = UINT32_MAX;
+	extent->height = UINT32_MAX;
+	for (uint32_t i = 0; i <= format->colors_count; ++i)
+	{
+		if (!textures[i])
+			continue;
+		if (textures[i]->width < extent->width)
+			extent->width = textures[i]->width;
+		if (textures[i]->height < extent->height)
+			extent->height = textures[i]->height;
+		format->samples = ((vk_texture_t*)textures[i]->handle.ptr)->samples;
+	}
+	return extent->width != UINT32_MAX;
+}
+
+static void setup_pass(gfx_device_t *device, vk_pass_t *pass, const gfx_render_target_t *render_target)
+{
+	pass->open = false;
+	pass->command_buffers_count = 0;
+	pass->valid = attachments_format(device, render_target, &pass->format, &pass->extent);
+	if (!render_target)
+	{
+		setup_attachment(&pass->colors[0], NULL);
+		setup_attachment(&pass->depth_stencil, NULL);
+		pass->colors_count = 1;
+		pass->valid = VK_DEVICE->surface_acquired;
+		if (pass->valid)
+			pass->colors[0].view = VK_DEVICE->surface_image_views[VK_DEVICE->surface_image];
+		return;
+	}
+	pass->colors_count = render_target->draw_buffers_nb;
+	for (uint32_t i = 0; i < pass->colors_count; ++i)
+		setup_attachment(&pass->colors[i], draw_buffer_texture(render_target, i));
+	setup_attachment(&pass->depth_stencil, render_target->depth_stencil.texture);
+}
+
+/* set the pass of the bound render target up, once the previous one is flushed */
+static void bind_pass(gfx_device_t *device)
+{
+	setup_pass(device, &VK_DEVICE->pass, VK_DEVICE->render_target);
+	VK_DEVICE->recorder.format = VK_DEVICE->pass.format;
+	VK_DEVICE->recorder.extent = VK_DEVICE->pass.extent;
+}
+
+static VkCommandBuffer next_command_list_buffer(gfx_device_t *device, vk_command_list_frame_t *frame)
+{
+	/* the frame fence was waited by begin_frame, the buffers of the previous use of the pool are done */
+	if (frame->frame != VK_DEVICE->frame)
+	{
+		vkResetCommandPool(VK_DEVICE->vk_device, frame->command_pool, 0);
+		frame->command_buffers_used = 0;
+		frame->frame = VK_DEVICE->frame;
+	}
+	if (frame->command_buffers_used < frame->command_buffers_count)
+		return frame->command_buffers[frame->command_buffers_used++];
+	VkCommandBuffer *command_buffers = GFX_REALLOC(frame->command_buffers, sizeof(*command_buffers) * (frame->command_buffers_count + 1));
+	if (!command_buffers)
+	{
+		GFX_ERROR_CALLBACK("can't allocate command buffers: %s (%d)", strerror(errno), errno);
+		return VK_NULL_HANDLE;
+	}
+	frame->command_buffers = command_buffers;
+	VkCommandBufferAllocateInfo allocate_info;
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.pNext = NULL;
+	allocate_info.commandPool = frame->command_pool;
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	allocate_info.commandBufferCount = 1;
+	VkResult result = vkAllocateCommandBuffers(VK_DEVICE->vk_device, &allocate_info, &command_buffers[frame->command_buffers_count]);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create vulkan command buffer: %s (%d)", vk_err2str(result), result);
+		return VK_NULL_HANDLE;
+	}
+	frame->command_buffers_count++;
+	return command_buffers[frame->command_buffers_used++];
+}
+
+/* secondary buffers continue the rendering of the pass they are executed in, and inherit nothing else from the primary buffer */
+static bool begin_pass_secondary(gfx_device_t *device, VkCommandBuffer command_buffer, const vk_attachments_format_t *format)
+{
+	VkImageAspectFlags aspects = format_aspects(format->depth_stencil);
+	VkCommandBufferInheritanceRenderingInfoKHR rendering_info;
+	rendering_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+	rendering_info.pNext = NULL;
+	rendering_info.flags = 0;
+	rendering_info.viewMask = 0;
+	rendering_info.colorAttachmentCount = format->colors_count;
+	rendering_info.pColorAttachmentFormats = format->colors;
+	rendering_info.depthAttachmentFormat = (aspects & VK_IMAGE_ASPECT_DEPTH_BIT) ? format->depth_stencil : VK_FORMAT_UNDEFINED;
+	rendering_info.stencilAttachmentFormat = (aspects & VK_IMAGE_ASPECT_STENCIL_BIT) ? format->depth_stencil : VK_FORMAT_UNDEFINED;
+	rendering_info.rasterizationSamples = format->samples;
+	VkCommandBufferInheritanceInfo inheritance_info;
+	inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance_info.pNext = &rendering_info;
+	inheritance_info.renderPass = VK_NULL_HANDLE;
+	inheritance_info.subpass = 0;
+	inheritance_info.framebuffer = VK_NULL_HANDLE;
+	inheritance_info.occlusionQueryEnable = VK_FALSE;
+	inheritance_info.queryFlags = 0;
+	inheritance_info.pipelineStatistics = 0;
+	VkCommandBufferBeginInfo begin_info;
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	begin_info.pInheritanceInfo = &inheritance_info;
+	VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't begin pass command buffer: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	return true;
+}
+
+/* the draws following executed command lists go to a new buffer, which starts with the shadowed state */
+static bool begin_pass_buffer(gfx_device_t *device)
+{
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	if (!pass->valid)
+		return false;
+	VkCommandBuffer *command_buffers = array_reserve(pass->command_buffers, &pass->command_buffers_size, pass->command_buffers_count, sizeof(*command_buffers));
+	if (!command_buffers)
+		return false;
+	pass->command_buffers = command_buffers;
+	VkCommandBuffer command_buffer = next_command_list_buffer(device, &VK_DEVICE->pass_buffers[VK_DEVICE->frame_index]);
+	if (command_buffer == VK_NULL_HANDLE || !begin_pass_secondary(device, command_buffer, &pass->format))
+		return false;
+	command_buffers[pass->command_buffers_count++] = command_buffer;
+	pass->open = true;
+	vk_recorder_t *recorder = &VK_DEVICE->recorder;
+	recorder->command_buffer = command_buffer;
+	recorder->dirty = VK_DIRTY_ALL;
+	recorder->bound_layout = NULL;
+	recorder->descriptors_dirty = true;
+	return true;
+}
+
+static void end_pass_buffer(gfx_device_t *device)
+{
+	vk_recorder_t *recorder = &VK_DEVICE->recorder;
+	if (recorder->command_buffer == VK_NULL_HANDLE)
+		return;
+	VkResult result = vkEndCommandBuffer(recorder->command_buffer);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't end pass command buffer: %s (%d)", vk_err2str(result), result);
+		/* the recording buffer is always the last one of the pass */
+		VK_DEVICE->pass.command_buffers_count--;
+	}
+	recorder->command_buffer = VK_NULL_HANDLE;
+}
+
+static void texture_barrier(VkImageMemoryBarrier *barrier, vk_texture_t *texture, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access)
+{
+	barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier->pNext = NULL;
+	barrier->srcAccessMask = src_access;
+	barrier->dstAccessMask = dst_access;
+	barrier->oldLayout = old_layout;
+	barrier->newLayout = new_layout;
+	barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier->image = texture->image;
+	barrier->subresourceRange.aspectMask = format_aspects(texture->format);
+	barrier->subresourceRange.baseMipLevel = 0;
+	barrier->subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	barrier->subresourceRange.baseArrayLayer = 0;
+	barrier->subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+	texture->layout = new_layout;
+}
+
+/* the attachment is moved to its rendering layout, the content being discarded when it isn't loaded */
+static uint32_t begin_attachment(gfx_device_t *device, const vk_attachment_t *attachment, bool depth_stencil, VkRenderingAttachmentInfoKHR *info, VkImageMemoryBarrier *barriers)
+{
+	VkImageLayout layout = depth_stencil ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	VkAccessFlags access = depth_stencil ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	VkAccessFlags src_access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	VkImageLayout current = VK_IMAGE_LAYOUT_UNDEFINED;
+	if (attachment->texture)
+		current = attachment->texture->layout;
+	else if (attachment->view)
+		current = VK_DEVICE->surface_layouts[VK_DEVICE->surface_image];
+	info->sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	info->pNext = NULL;
+	info->imageView = attachment->view;
+	info->imageLayout = layout;
+	info->resolveMode = attachment->resolve_mode;
+	info->resolveImageView = attachment->resolve_view;
+	info->resolveImageLayout = layout;
+	info->loadOp = attachment->load_op;
+	if (info->loadOp == VK_ATTACHMENT_LOAD_OP_LOAD && current == VK_IMAGE_LAYOUT_UNDEFINED)
+		info->loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	info->storeOp = attachment->store_op;
+	info->clearValue = attachment->clear_value;
+	uint32_t barriers_count = 0;
+	if (attachment->texture)
+		texture_barrier(&barriers[barriers_count++], attachment->texture, info->loadOp == VK_ATTACHMENT_LOAD_OP_LOAD ? current : VK_IMAGE_LAYOUT_UNDEFINED, layout, src_access, access);
+	else if (attachment->view)
+		transition_surface(device, layout, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, access);
+	if (attachment->resolve_mode == VK_RESOLVE_MODE_NONE)
+		return barriers_count;
+	if (attachment->resolve_texture)
+		texture_barrier(&barriers[barriers_count++], attachment->resolve_texture, VK_IMAGE_LAYOUT_UNDEFINED, layout, src_access, access);
+	else
+		transition_surface(device, layout, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, access);
+	return barriers_count;
+}
+
+/* record the rendering of a pass on the primary buffer, its textures being sampled again after it */
+static void execute_pass(gfx_device_t *device, vk_pass_t *pass)
+{
+	VkCommandBuffer command_buffer = VK_DEVICE->frames[VK_DEVICE->frame_index].command_buffer;
+	VkRenderingAttachmentInfoKHR colors[VK_MAX_COLOR_ATTACHMENTS];
+	VkRenderingAttachmentInfoKHR depth_stencil;
+	VkImageMemoryBarrier barriers[(VK_MAX_COLOR_ATTACHMENTS + 1) * 2];
+	uint32_t barriers_count = 0;
+	for (uint32_t i = 0; i < pass->colors_count; ++i)
+		barriers_count += begin_attachment(device, &pass->colors[i], false, &colors[i], &barriers[barriers_count]);
+	barriers_count += begin_attachment(device, &pass->depth_stencil, true, &depth_stencil, &barriers[barriers_count]);
+	if (barriers_count)
+		vkCmdPipelineBarrier(command_buffer, VK_ATTACHMENT_STAGES | VK_SAMPLED_STAGES, VK_ATTACHMENT_STAGES, 0, 0, NULL, 0, NULL, barriers_count, barriers);
+	VkImageAspectFlags aspects = format_aspects(pass->format.depth_stencil);
+	VkRenderingInfoKHR rendering_info;
+	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+	rendering_info.pNext = NULL;
+	rendering_info.flags = pass->command_buffers_count ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+	rendering_info.renderArea.offset.x = 0;
+	rendering_info.renderArea.offset.y = 0;
+	rendering_info.renderArea.extent = pass->extent;
+	rendering_info.layerCount = 1;
+	rendering_info.viewMask = 0;
+	rendering_info.colorAttachmentCount = pass->colors_count;
+	rendering_info.pColorAttachments = colors;
+	rendering_info.pDepthAttachment = (aspects & VK_IMAGE_ASPECT_DEPTH_BIT) ? &depth_stencil : NULL;
+	rendering_info.pStencilAttachment = (aspects & VK_IMAGE_ASPECT_STENCIL_BIT) ? &depth_stencil : NULL;
+	VK_DEVICE->begin_rendering(command_buffer, &rendering_info);
+	if (pass->command_buffers_count)
+		vkCmdExecuteCommands(command_buffer, pass->command_buffers_count, pass->command_buffers);
+	VK_DEVICE->end_rendering(command_buffer);
+	barriers_count = 0;
+	for (uint32_t i = 0; i <= pass->colors_count; ++i)
+	{
+		const vk_attachment_t *attachment = i < pass->colors_count ? &pass->colors[i] : &pass->depth_stencil;
+		VkAccessFlags src_access = i < pass->colors_count ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		if (attachment->texture)
+			texture_barrier(&barriers[barriers_count++], attachment->texture, attachment->texture->layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, src_access, VK_ACCESS_SHADER_READ_BIT);
+		if (attachment->resolve_mode != VK_RESOLVE_MODE_NONE && attachment->resolve_texture)
+			texture_barrier(&barriers[barriers_count++], attachment->resolve_texture, attachment->resolve_texture->layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, src_access, VK_ACCESS_SHADER_READ_BIT);
+	}
+	if (barriers_count)
+		vkCmdPipelineBarrier(command_buffer, VK_ATTACHMENT_STAGES, VK_SAMPLED_STAGES, 0, 0, NULL, 0, NULL, barriers_count, barriers);
+}
+
+static void reset_attachment(vk_attachment_t *attachment)
+{
+	attachment->load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachment->store_op = VK_ATTACHMENT_STORE_OP_STORE;
+	attachment->resolve_mode = VK_RESOLVE_MODE_NONE;
+	attachment->resolve_texture = NULL;
+	attachment->resolve_view = VK_NULL_HANDLE;
+}
+
+/* execute the pass of the bound render target if it has anything to do, the next draws loading its attachments again */
+static void flush_pass(gfx_device_t *device)
+{
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	end_pass_buffer(device);
+	if (!pass->valid)
+		return;
+	bool pending = pass->open;
+	for (uint32_t i = 0; i <= pass->colors_count; ++i)
+	{
+		const vk_attachment_t *attachment = i < pass->colors_count ? &pass->colors[i] : &pass->depth_stencil;
+		if (attachment->load_op == VK_ATTACHMENT_LOAD_OP_CLEAR || attachment->resolve_mode != VK_RESOLVE_MODE_NONE)
+			pending = true;
+	}
+	if (pending)
+		execute_pass(device, pass);
+	pass->open = false;
+	pass->command_buffers_count = 0;
+	for (uint32_t i = 0; i < pass->colors_count; ++i)
+		reset_attachment(&pass->colors[i]);
+	reset_attachment(&pass->depth_stencil);
+}
+
+static void record_clear(vk_recorder_t *recorder, VkImageAspectFlags aspects, uint32_t location, const VkClearValue *value)
+{
+	VkClearAttachment attachment;
+	attachment.aspectMask = aspects;
+	attachment.colorAttachment = location;
+	attachment.clearValue = *value;
+	VkClearRect rect;
+	rect.rect.offset.x = 0;
+	rect.rect.offset.y = 0;
+	rect.rect.extent = recorder->extent;
+	rect.baseArrayLayer = 0;
+	rect.layerCount = 1;
+	vkCmdClearAttachments(recorder->command_buffer, 1, &attachment, 1, &rect);
+}
+
+/* a clear of the bound render target before its first draw is a load operation, other render targets get a rendering of their own */
+static void clear_attachment(gfx_device_t *device, const gfx_render_target_t *render_target, uint32_t location, bool depth_stencil, const VkClearValue *value)
+{
+	vk_recorder_t *recorder = get_recorder(device);
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	VkImageAspectFlags aspects = depth_stencil ? format_aspects(pass->format.depth_stencil) : VK_IMAGE_ASPECT_COLOR_BIT;
+	/* command lists only record into the rendering of the bound render target */
+	if (recorder != &VK_DEVICE->recorder)
+	{
+		if (aspects)
+			record_clear(recorder, aspects, location, value);
+		return;
+	}
+	vk_pass_t other;
+	if (render_target != VK_DEVICE->render_target)
+	{
+		flush_pass(device);
+		pass = &other;
+		pass->command_buffers = NULL;
+		pass->command_buffers_size = 0;
+		setup_pass(device, pass, render_target);
+		aspects = depth_stencil ? format_aspects(pass->format.depth_stencil) : VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+	if (!pass->valid)
+		return;
+	vk_attachment_t *attachment = depth_stencil ? &pass->depth_stencil : &pass->colors[location];
+	if (!depth_stencil && location >= pass->colors_count)
+		return;
+	if (!attachment->view)
+		return;
+	if (pass->open)
+	{
+		if (recorder->command_buffer == VK_NULL_HANDLE && !begin_pass_buffer(device))
+			return;
+		record_clear(recorder, aspects, location, value);
+		return;
+	}
+	attachment->load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachment->clear_value = *value;
+	if (pass == &other)
+		execute_pass(device, pass);
+}
+
+static void vk_clear_color(gfx_device_t *device, const gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, vec4f_t color)
+{
+	VkClearValue value;
+	value.color.float32[0] = color.x;
+	value.color.float32[1] = color.y;
+	value.color.float32[2] = color.z;
+	value.color.float32[3] = color.w;
+	/* like on gl, the attachment is the draw buffer to clear */
+	clear_attachment(device, render_target, render_target ? attachment - GFX_RENDERTARGET_ATTACHMENT_COLOR0 : 0, false, &value);
+}
+
+static void vk_clear_depth_stencil(gfx_device_t *device, const gfx_render_target_t *render_target, float depth, uint8_t stencil)
+{
+	VkClearValue value;
+	value.depthStencil.depth = depth;
+	value.depthStencil.stencil = stencil;
+	clear_attachment(device, render_target, 0, true, &value);
+}
+
+static VkPipeline get_pipeline(gfx_device_t *device, vk_pipeline_t *pipeline, const vk_attachments_format_t *format);
+
+/* record the shadowed state the buffer doesn't have yet */
+static void flush_state(gfx_device_t *device, vk_recorder_t *recorder)
+{
+	if (!recorder->dirty)
+		return;
+	VkCommandBuffer command_buffer = recorder->command_buffer;
+	if (recorder->dirty & VK_DIRTY_PIPELINE)
+	{
+		VkPipeline pipeline = recorder->pipeline ? get_pipeline(device, recorder->pipeline, &recorder->format) : VK_NULL_HANDLE;
+		recorder->pipeline_bound = pipeline != VK_NULL_HANDLE;
+		if (recorder->pipeline_bound)
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	}
+	if (recorder->dirty & VK_DIRTY_VIEWPORT)
+	{
+		VkViewport viewport = recorder->viewport;
+		/* the whole render area until a viewport is set */
+		if (!viewport.width || !viewport.height)
+		{
+			viewport.x = 0;
+			viewport.y = 0;
+			viewport.width = recorder->extent.width;
+			viewport.height = recorder->extent.height;
+			viewport.minDepth = 0;
+			viewport.maxDepth = 1;
+		}
+		vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	}
+	/* the scissor is a dynamic state, so it covers the render area when the rasterizer state disables it */
+	if (recorder->dirty & (VK_DIRTY_SCISSOR | VK_DIRTY_PIPELINE))
+	{
+		VkRect2D rect = recorder->scissor;
+		if (!recorder->pipeline || !recorder->pipeline->rasterizer.scissor)
+		{
+			rect.offset.x = 0;
+			rect.offset.y = 0;
+			rect.extent = recorder->extent;
+		}
+		vkCmdSetScissor(command_buffer, 0, 1, &rect);
+	}
+	if (recorder->dirty & VK_DIRTY_LINE_WIDTH)
+		vkCmdSetLineWidth(command_buffer, recorder->line_width);
+	/* the buffers written since they were bound moved to new memory */
+	for (uint32_t i = 0; i < recorder->vertex_buffers_count; ++i)
+	{
+		if (recorder->vertex_ids[i] != recorder->vertex_sources[i]->id)
+			recorder->dirty |= VK_DIRTY_VERTEX_BUFFERS;
+	}
+	if (recorder->index_source && recorder->index_id != recorder->index_source->id)
+		recorder->dirty |= VK_DIRTY_VERTEX_BUFFERS;
+	if (recorder->dirty & VK_DIRTY_VERTEX_BUFFERS)
+	{
+		for (uint32_t i = 0; i < recorder->vertex_buffers_count; ++i)
+		{
+			vk_buffer_t *source = recorder->vertex_sources[i];
+			recorder->vertex_buffers[i] = source->buffer;
+			recorder->vertex_ids[i] = source->id;
+			atomic_store(&source->used, recorder->frame + 1);
+		}
+		if (recorder->vertex_buffers_count)
+			vkCmdBindVertexBuffers(command_buffer, 0, recorder->vertex_buffers_count, recorder->vertex_buffers, recorder->vertex_offsets);
+		if (recorder->index_source)
+		{
+			recorder->index_id = recorder->index_source->id;
+			atomic_store(&recorder->index_source->used, recorder->frame + 1);
+			vkCmdBindIndexBuffer(command_buffer, recorder->index_source->buffer, 0, recorder->index_type);
+		}
+	}
+	recorder->dirty = 0;
+}
+
+/* the draws of the frame open a buffer in the pass of the bound render target, the command lists already record into one */
+static bool prepare_draw(gfx_device_t *device, vk_recorder_t *recorder)
+{
+	if (recorder->command_buffer == VK_NULL_HANDLE
+	 && (recorder != &VK_DEVICE->recorder || !begin_pass_buffer(device)))
+		return false;
+	flush_state(device, recorder);
+	/* the pipelines failing to build were reported by their job */
+	if (!recorder->pipeline_bound)
+		return false;
+	flush_descriptors(device, recorder);
+	return true;
+}
+
+#ifndef NDEBUG
+static void add_draw_counts(gfx_device_t *device, const vk_draw_counts_t *counts)
+{
+	device->draw_calls_count += counts->draw_calls;
+	device->triangles_count += counts->triangles;
+	device->points_count += counts->points;
+	device->lines_count += counts->lines;
+}
+
+static void count_draw(gfx_device_t *device, vk_recorder_t *recorder, uint32_t count, uint32_t instances)
+{
+	vk_draw_counts_t *counts = &recorder->counts;
+	switch (recorder->primitive)
+	{
+		case GFX_PRIMITIVE_TRIANGLES:
+			counts->triangles += count / 3 * instances;
+			break;
+		case GFX_PRIMITIVE_POINTS:
+			counts->points += count * instances;
+			break;
+		case GFX_PRIMITIVE_LINES:
+			counts->lines += count / 2 * instances;
+			break;
+	}
+	counts->draw_calls++;
+	/* the draws of the frame are recorded by the device thread */
+	if (recorder == &VK_DEVICE->recorder)
+	{
+		add_draw_counts(device, counts);
+		memset(counts, 0, sizeof(*counts));
+	}
+}
+#endif
+
+static void vk_draw_indexed_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
+{
+	vk_recorder_t *recorder = get_recorder(device);
+	if (!prepare_draw(device, recorder))
+		return;
+	vkCmdDrawIndexed(recorder->command_buffer, count, prim_count, offset, 0, 0);
+#ifndef NDEBUG
+	count_draw(device, recorder, count, prim_count);
+#endif
+}
+
+static void vk_draw_instanced(gfx_device_t *device, uint32_t count, uint32_t offset, uint32_t prim_count)
+{
+	vk_recorder_t *recorder = get_recorder(device);
+	if (!prepare_draw(device, recorder))
+		return;
+	vkCmdDraw(recorder->command_buffer, count, prim_count, offset, 0);
+#ifndef NDEBUG
+	count_draw(device, recorder, count, 1);
+#endif
 }
 
 static void vk_draw_indexed(gfx_device_t *device, uint32_t count, uint32_t offset)
 {
-	vkCmdDrawIndexed(VK_DEVICE->command_buffer, count, 1, offset, 0, 0);
+	vk_recorder_t *recorder = get_recorder(device);
+	if (!prepare_draw(device, recorder))
+		return;
+	vkCmdDrawIndexed(recorder->command_buffer, count, 1, offset, 0, 0);
 #ifndef NDEBUG
-	switch (VK_DEVICE->primitive)
-	{
-		case GFX_PRIMITIVE_TRIANGLES:
-			device->triangles_count += count / 3;
-			break;
-		case GFX_PRIMITIVE_POINTS:
-			device->points_count += count;
-			break;
-		case GFX_PRIMITIVE_LINES:
-			device->lines_count += count / 2;
-			break;
-	}
-	device->draw_calls_count++;
+	count_draw(device, recorder, count, 1);
 #endif
 }
 
 static void vk_draw(gfx_device_t *device, uint32_t count, uint32_t offset)
 {
-	vkCmdDraw(VK_DEVICE->command_buffer, count, 1, offset, 0);
+	vk_recorder_t *recorder = get_recorder(device);
+	if (!prepare_draw(device, recorder))
+		return;
+	vkCmdDraw(recorder->command_buffer, count, 1, offset, 0);
 #ifndef NDEBUG
-	switch (VK_DEVICE->primitive)
-	{
-		case GFX_PRIMITIVE_TRIANGLES:
-			device->triangles_count += count / 3;
-			break;
-		case GFX_PRIMITIVE_POINTS:
-			device->points_count += count;
-			break;
-		case GFX_PRIMITIVE_LINES:
-			device->lines_count += count / 2;
-			break;
-	}
-	device->draw_calls_count++;
+	count_draw(device, recorder, count, 1);
 #endif
 }
 
@@ -805,17 +3084,230 @@ static void vk_delete_rasterizer_state(gfx_device_t *device, gfx_rasterizer_stat
 	state->handle.ptr = NULL;
 }
 
+/* copy through the staging ring, for memory the host can't map */
+static bool upload_buffer(gfx_device_t *device, vk_buffer_t *vk_buffer, const void *data, uint32_t size, uint32_t offset)
+{
+	/* the uploads are submitted ahead of the frame, the draws already recorded by it would see the data */
+	assert(atomic_load(&vk_buffer->used) != VK_DEVICE->frame + 1);
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	vk_upload_batch_t *batch = recording_batch(device);
+	for (uint32_t i = 0; i < batch->buffer_uploads_count; ++i)
+	{
+		const vk_buffer_upload_t *upload = &batch->buffer_uploads[i];
+		if (upload->dst == vk_buffer && ranges_overlap(upload->region.dstOffset, upload->region.size, offset, size))
+		{
+			submit_uploads(device);
+			break;
+		}
+	}
+	uint32_t staging;
+	VkDeviceSize staging_offset;
+	if (!staging_write(device, data, size, 16, &staging, &staging_offset))
+	{
+		pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+		return false;
+	}
+	batch = recording_batch(device);
+	vk_buffer_upload_t *uploads = array_reserve(batch->buffer_uploads, &batch->buffer_uploads_size, batch->buffer_uploads_count, sizeof(*uploads));
+	if (!uploads)
+	{
+		pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+		return false;
+	}
+	batch->buffer_uploads = uploads;
+	vk_buffer_upload_t *upload = &uploads[batch->buffer_uploads_count++];
+	upload->dst = vk_buffer;
+	upload->staging = staging;
+	upload->region.srcOffset = staging_offset;
+	upload->region.dstOffset = offset;
+	upload->region.size = size;
+	vk_buffer->upload_serial = VK_DEVICE->upload_serial;
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+	return true;
+}
+
+static bool create_buffer_memory(gfx_device_t *device, const vk_buffer_t *vk_buffer, VkMemoryPropertyFlags required, VkBuffer *buffer, gfx_vk_allocation_t *allocation)
+{
+	VkBufferCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.size = vk_buffer->size ? vk_buffer->size : 1;
+	create_info.usage = vk_buffer->usage;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	create_info.queueFamilyIndexCount = 0;
+	create_info.pQueueFamilyIndices = NULL;
+	VkResult result = vkCreateBuffer(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, buffer);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create buffer: %s (%d)", vk_err2str(result), result);
+		return false;
+	}
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(VK_DEVICE->vk_device, *buffer, &requirements);
+	if (!gfx_vk_mem_alloc(&VK_DEVICE->mem, &requirements, required, vk_buffer->preferred, true, allocation))
+	{
+		vkDestroyBuffer(VK_DEVICE->vk_device, *buffer, ALLOCATION_CALLBACKS);
+		return false;
+	}
+	result = vkBindBufferMemory(VK_DEVICE->vk_device, *buffer, allocation->memory, allocation->offset);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't bind buffer memory: %s (%d)", vk_err2str(result), result);
+		vkDestroyBuffer(VK_DEVICE->vk_device, *buffer, ALLOCATION_CALLBACKS);
+		gfx_vk_mem_free(&VK_DEVICE->mem, allocation);
+		return false;
+	}
+	return true;
+}
+
+/* the memory referenced by the recorded commands is never written: the buffer moves to new memory, with the rest of
+ * its content, the previous one being retired with the frame, writes through the map are still done in place */
+static bool write_buffer(gfx_device_t *device, gfx_buffer_t *buffer, vk_buffer_t *vk_buffer, const void *data, uint32_t size, uint32_t offset)
+{
+	if (!vk_buffer->allocation.data)
+		return upload_buffer(device, vk_buffer, data, size, offset);
+	/* the memory is renamed while a frame not yet done reads it, used being its frame + 1 */
+	if (atomic_load(&vk_buffer->used) > atomic_load(&VK_DEVICE->frames_done))
+	{
+		VkBuffer handle;
+		gfx_vk_allocation_t allocation;
+		if (!create_buffer_memory(device, vk_buffer, vk_buffer->required | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &handle, &allocation))
+			return false;
+		memcpy(allocation.data, vk_buffer->allocation.data, offset);
+		memcpy(allocation.data + offset + size, vk_buffer->allocation.data + offset + size, vk_buffer->size - offset - size);
+		vk_garbage_t garbage;
+		garbage.buffer = vk_buffer->buffer;
+		garbage.image = VK_NULL_HANDLE;
+		garbage.views[0] = VK_NULL_HANDLE;
+		garbage.views[1] = VK_NULL_HANDLE;
+		garbage.allocation = vk_buffer->allocation;
+		pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+		retire_objects(device, &garbage);
+		pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+		vk_buffer->buffer = handle;
+		vk_buffer->allocation = allocation;
+		vk_buffer->id = atomic_fetch_add(&VK_DEVICE->resource_id, 1) + 1;
+		vk_buffer->used = 0;
+		buffer->map = allocation.data;
+		memcpy(allocation.data + offset, data, size);
+		gfx_vk_mem_flush(&VK_DEVICE->mem, &allocation, 0, vk_buffer->size);
+		return true;
+	}
+	memcpy(vk_buffer->allocation.data + offset, data, size);
+	gfx_vk_mem_flush(&VK_DEVICE->mem, &vk_buffer->allocation, offset, size);
+	return true;
+}
+
 static bool vk_create_buffer(gfx_device_t *device, gfx_buffer_t *buffer, enum gfx_buffer_type type, const void *data, uint32_t size, enum gfx_buffer_usage usage)
 {
+	assert(!buffer->handle.ptr);
+	vk_buffer_t *vk_buffer = GFX_MALLOC(sizeof(*vk_buffer));
+	if (!vk_buffer)
+	{
+		GFX_ERROR_CALLBACK("can't allocate buffer: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	vk_buffer->size = size;
+	vk_buffer->usage = buffer_types[type] | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	/* buffers written often live in host visible memory, preferably device local (resizable BAR), the others are uploaded once to device local memory */
+	if (usage == GFX_BUFFER_DYNAMIC || usage == GFX_BUFFER_STREAM)
+	{
+		vk_buffer->required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		vk_buffer->preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	}
+	else
+	{
+		vk_buffer->required = 0;
+		vk_buffer->preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	}
+	if (!create_buffer_memory(device, vk_buffer, vk_buffer->required, &vk_buffer->buffer, &vk_buffer->allocation))
+	{
+		GFX_FREE(vk_buffer);
+		return false;
+	}
+	buffer->device = device;
+	buffer->usage = usage;
+	buffer->type = type;
+	buffer->size = size;
+	buffer->map = vk_buffer->allocation.data;
+	buffer->handle.ptr = vk_buffer;
+	vk_buffer->upload_serial = 0;
+	vk_buffer->used = 0;
+	vk_buffer->id = atomic_fetch_add(&VK_DEVICE->resource_id, 1) + 1;
+	if (data && size && !write_buffer(device, buffer, vk_buffer, data, size, 0))
+	{
+		vkDestroyBuffer(VK_DEVICE->vk_device, vk_buffer->buffer, ALLOCATION_CALLBACKS);
+		gfx_vk_mem_free(&VK_DEVICE->mem, &vk_buffer->allocation);
+		GFX_FREE(vk_buffer);
+		buffer->handle.ptr = NULL;
+		buffer->map = NULL;
+		return false;
+	}
 	return true;
 }
 
 static void vk_set_buffer_data(gfx_device_t *device, gfx_buffer_t *buffer, const void *data, uint32_t size, uint32_t offset)
 {
+	assert(buffer->handle.ptr);
+	assert(offset + size <= buffer->size);
+	write_buffer(device, buffer, buffer->handle.ptr, data, size, offset);
+}
+
+/* the slots of the frame recorder keep the objects they were bound with, they are cleared before the objects are freed */
+static void unbind_buffer(gfx_device_t *device, const vk_buffer_t *buffer)
+{
+	vk_recorder_t *recorder = &VK_DEVICE->recorder;
+	for (uint32_t i = 0; i < VK_MAX_CONSTANTS; ++i)
+	{
+		if (recorder->constants[i].buffer != buffer)
+			continue;
+		recorder->constants[i].buffer = NULL;
+		recorder->descriptors_dirty = true;
+	}
+	bool bound = recorder->index_source == buffer;
+	for (uint32_t i = 0; i < recorder->vertex_buffers_count; ++i)
+		bound |= recorder->vertex_sources[i] == buffer;
+	/* drawing with the attributes of a deleted buffer is invalid, they are all unbound until the next bind */
+	if (bound)
+	{
+		recorder->vertex_buffers_count = 0;
+		recorder->index_source = NULL;
+		recorder->dirty |= VK_DIRTY_VERTEX_BUFFERS;
+	}
+}
+
+static void unbind_texture(gfx_device_t *device, const vk_texture_t *texture)
+{
+	vk_recorder_t *recorder = &VK_DEVICE->recorder;
+	for (uint32_t i = 0; i < VK_MAX_SAMPLERS; ++i)
+	{
+		if (recorder->samplers_binds[i].texture != texture)
+			continue;
+		recorder->samplers_binds[i].texture = NULL;
+		recorder->descriptors_dirty = true;
+	}
 }
 
 static void vk_delete_buffer(gfx_device_t *device, gfx_buffer_t *buffer)
 {
+	if (!buffer || !buffer->handle.ptr)
+		return;
+	vk_buffer_t *vk_buffer = buffer->handle.ptr;
+	vk_garbage_t garbage;
+	garbage.buffer = vk_buffer->buffer;
+	garbage.image = VK_NULL_HANDLE;
+	garbage.views[0] = VK_NULL_HANDLE;
+	garbage.views[1] = VK_NULL_HANDLE;
+	garbage.allocation = vk_buffer->allocation;
+	unbind_buffer(device, vk_buffer);
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	forget_uploads(device, vk_buffer->upload_serial, vk_buffer, NULL);
+	retire_objects(device, &garbage);
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+	GFX_FREE(vk_buffer);
+	buffer->handle.ptr = NULL;
+	buffer->map = NULL;
 }
 
 static bool vk_create_attributes_state(gfx_device_t *device, gfx_attributes_state_t *state, const gfx_attribute_bind_t *binds, uint32_t count, const gfx_buffer_t *index_buffer, enum gfx_index_type index_type)
@@ -832,16 +3324,16 @@ static bool vk_create_attributes_state(gfx_device_t *device, gfx_attributes_stat
 static void vk_bind_attributes_state(gfx_device_t *device, const gfx_attributes_state_t *state, const gfx_input_layout_t *input_layout)
 {
 	assert(state->handle.ptr);
-	VkBuffer buffers[8];
-	VkDeviceSize offsets[8];
+	vk_recorder_t *recorder = get_recorder(device);
 	for (uint32_t i = 0; i < state->count; ++i)
 	{
-		buffers[i] = state->binds[i].buffer->handle.ptr;
-		offsets[i] = state->binds[i].offset;
+		recorder->vertex_sources[i] = state->binds[i].buffer->handle.ptr;
+		recorder->vertex_offsets[i] = state->binds[i].offset;
 	}
-	vkCmdBindVertexBuffers(VK_DEVICE->command_buffer, 0, state->count, buffers, offsets);
-	if (state->index_buffer)
-		vkCmdBindIndexBuffer(VK_DEVICE->command_buffer, state->index_buffer->handle.ptr, 0, index_types[state->index_type]);
+	recorder->vertex_buffers_count = state->count;
+	recorder->index_source = state->index_buffer ? state->index_buffer->handle.ptr : NULL;
+	recorder->index_type = index_types[state->index_type];
+	recorder->dirty |= VK_DIRTY_VERTEX_BUFFERS;
 }
 
 static void vk_delete_attributes_state(gfx_device_t *device, gfx_attributes_state_t *state)
@@ -870,33 +3362,436 @@ static void vk_delete_input_layout(gfx_device_t *device, gfx_input_layout_t *inp
 	input_layout->handle.u64 = 0;
 }
 
+static VkFormat get_texture_format(gfx_device_t *device, enum gfx_format format)
+{
+	if (format == GFX_DEPTH24_STENCIL8)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(VK_DEVICE->physical_device, VK_FORMAT_D24_UNORM_S8_UINT, &properties);
+		if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT))
+			return VK_FORMAT_D32_SFLOAT_S8_UINT;
+	}
+	return texture_formats[format];
+}
+
+/* the formats without a vulkan equivalent are stored with their components swapped */
+static VkComponentMapping get_texture_components(enum gfx_format format)
+{
+	VkComponentMapping components;
+	components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	switch (format)
+	{
+		case GFX_BGRA32F:
+		case GFX_BGRA16F:
+			components.r = VK_COMPONENT_SWIZZLE_B;
+			components.b = VK_COMPONENT_SWIZZLE_R;
+			break;
+		case GFX_B4G4R4A4:
+			components.r = VK_COMPONENT_SWIZZLE_G;
+			components.g = VK_COMPONENT_SWIZZLE_R;
+			components.b = VK_COMPONENT_SWIZZLE_A;
+			components.a = VK_COMPONENT_SWIZZLE_B;
+			break;
+		default:
+			break;
+	}
+	return components;
+}
+
+static bool sampler_match(const vk_sampler_t *sampler, const gfx_texture_t *texture)
+{
+	return sampler->addressing_s == texture->addressing_s
+	    && sampler->addressing_t == texture->addressing_t
+	    && sampler->addressing_r == texture->addressing_r
+	    && sampler->min_filtering == texture->min_filtering
+	    && sampler->mag_filtering == texture->mag_filtering
+	    && sampler->mip_filtering == texture->mip_filtering
+	    && sampler->anisotropy == texture->anisotropy
+	    && sampler->min_level == texture->min_level
+	    && sampler->max_level == texture->max_level;
+}
+
+static vk_sampler_t *get_sampler(gfx_device_t *device, const gfx_texture_t *texture)
+{
+	pthread_mutex_lock(&VK_DEVICE->samplers_mutex);
+	for (vk_sampler_t *sampler = VK_DEVICE->samplers; sampler; sampler = sampler->next)
+	{
+		if (sampler_match(sampler, texture))
+		{
+			pthread_mutex_unlock(&VK_DEVICE->samplers_mutex);
+			return sampler;
+		}
+	}
+	vk_sampler_t *sampler = GFX_MALLOC(sizeof(*sampler));
+	if (!sampler)
+	{
+		GFX_ERROR_CALLBACK("can't allocate sampler: %s (%d)", strerror(errno), errno);
+		pthread_mutex_unlock(&VK_DEVICE->samplers_mutex);
+		return NULL;
+	}
+	float anisotropy = texture->anisotropy;
+	if (anisotropy > VK_DEVICE->max_anisotropy)
+		anisotropy = VK_DEVICE->max_anisotropy;
+	VkSamplerCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.magFilter = filters[texture->mag_filtering];
+	create_info.minFilter = filters[texture->min_filtering];
+	create_info.mipmapMode = mipmap_modes[texture->mip_filtering];
+	create_info.addressModeU = address_modes[texture->addressing_s];
+	create_info.addressModeV = address_modes[texture->addressing_t];
+	create_info.addressModeW = address_modes[texture->addressing_r];
+	create_info.mipLodBias = 0;
+	create_info.anisotropyEnable = anisotropy > 1;
+	create_info.maxAnisotropy = anisotropy;
+	create_info.compareEnable = VK_FALSE;
+	create_info.compareOp = VK_COMPARE_OP_ALWAYS;
+	create_info.minLod = texture->min_level;
+	/* sampling the base level only is done by clamping the lod */
+	create_info.maxLod = texture->mip_filtering == GFX_FILTERING_NONE ? texture->min_level + 0.25f : texture->max_level;
+	create_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+	create_info.unnormalizedCoordinates = VK_FALSE;
+	VkResult result = vkCreateSampler(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &sampler->sampler);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create sampler: %s (%d)", vk_err2str(result), result);
+		GFX_FREE(sampler);
+		pthread_mutex_unlock(&VK_DEVICE->samplers_mutex);
+		return NULL;
+	}
+	sampler->addressing_s = texture->addressing_s;
+	sampler->addressing_t = texture->addressing_t;
+	sampler->addressing_r = texture->addressing_r;
+	sampler->min_filtering = texture->min_filtering;
+	sampler->mag_filtering = texture->mag_filtering;
+	sampler->mip_filtering = texture->mip_filtering;
+	sampler->anisotropy = texture->anisotropy;
+	sampler->min_level = texture->min_level;
+	sampler->max_level = texture->max_level;
+	sampler->next = VK_DEVICE->samplers;
+	VK_DEVICE->samplers = sampler;
+	pthread_mutex_unlock(&VK_DEVICE->samplers_mutex);
+	return sampler;
+}
+
+static void update_sampler(gfx_device_t *device, gfx_texture_t *texture)
+{
+	vk_sampler_t *sampler = get_sampler(device, texture);
+	if (sampler)
+		texture->sampler.ptr = sampler;
+}
+
 static bool vk_create_texture(gfx_device_t *device, gfx_texture_t *texture, enum gfx_texture_type type, enum gfx_format format, uint8_t lod, uint32_t width, uint32_t height, uint32_t depth)
 {
+	assert(!texture->handle.ptr);
+	vk_texture_t *vk_texture = GFX_MALLOC(sizeof(*vk_texture));
+	if (!vk_texture)
+	{
+		GFX_ERROR_CALLBACK("can't allocate texture: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	vk_texture->image = VK_NULL_HANDLE;
+	vk_texture->view = VK_NULL_HANDLE;
+	vk_texture->attachment_view = VK_NULL_HANDLE;
+	vk_texture->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	vk_texture->upload_serial = 0;
+	vk_texture->used = 0;
+	vk_texture->id = atomic_fetch_add(&VK_DEVICE->resource_id, 1) + 1;
+	vk_texture->aspect = gfx_format_has_depth(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	VkFormat vk_format = get_texture_format(device, format);
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(VK_DEVICE->physical_device, vk_format, &format_properties);
+	VkImageCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.imageType = image_types[type];
+	create_info.format = vk_format;
+	create_info.extent.width = width;
+	create_info.extent.height = height;
+	create_info.extent.depth = 1;
+	create_info.mipLevels = lod;
+	create_info.arrayLayers = 1;
+	create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	switch (type)
+	{
+		case GFX_TEXTURE_2D:
+			break;
+		case GFX_TEXTURE_2D_MS:
+			/* like on gl, the lod of multisample textures is their samples count */
+			create_info.mipLevels = 1;
+			create_info.samples = lod;
+			create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+			break;
+		case GFX_TEXTURE_2D_ARRAY:
+			create_info.arrayLayers = depth;
+			break;
+		case GFX_TEXTURE_2D_ARRAY_MS:
+			create_info.mipLevels = 1;
+			create_info.arrayLayers = depth;
+			create_info.samples = lod;
+			create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+			break;
+		case GFX_TEXTURE_3D:
+			create_info.extent.depth = depth;
+			break;
+	}
+	vk_texture->format = vk_format;
+	vk_texture->samples = create_info.samples;
+	if (gfx_format_has_depth(format))
+		create_info.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	else if (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)
+		create_info.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	create_info.queueFamilyIndexCount = 0;
+	create_info.pQueueFamilyIndices = NULL;
+	create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkResult result = vkCreateImage(VK_DEVICE->vk_device, &create_info, ALLOCATION_CALLBACKS, &vk_texture->image);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create image: %s (%d)", vk_err2str(result), result);
+		GFX_FREE(vk_texture);
+		return false;
+	}
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(VK_DEVICE->vk_device, vk_texture->image, &requirements);
+	if (!gfx_vk_mem_alloc(&VK_DEVICE->mem, &requirements, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, &vk_texture->allocation))
+	{
+		vkDestroyImage(VK_DEVICE->vk_device, vk_texture->image, ALLOCATION_CALLBACKS);
+		GFX_FREE(vk_texture);
+		return false;
+	}
+	result = vkBindImageMemory(VK_DEVICE->vk_device, vk_texture->image, vk_texture->allocation.memory, vk_texture->allocation.offset);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't bind image memory: %s (%d)", vk_err2str(result), result);
+		goto err;
+	}
+	VkImageViewCreateInfo view_info;
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.pNext = NULL;
+	view_info.flags = 0;
+	view_info.image = vk_texture->image;
+	view_info.viewType = image_view_types[type];
+	view_info.format = vk_format;
+	view_info.components = get_texture_components(format);
+	view_info.subresourceRange.aspectMask = vk_texture->aspect;
+	view_info.subresourceRange.baseMipLevel = 0;
+	view_info.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+	result = vkCreateImageView(VK_DEVICE->vk_device, &view_info, ALLOCATION_CALLBACKS, &vk_texture->view);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't create image view: %s (%d)", vk_err2str(result), result);
+		goto err;
+	}
+	if (type != GFX_TEXTURE_3D && (create_info.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)))
+	{
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		view_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		view_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		view_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+		view_info.subresourceRange.aspectMask = format_aspects(vk_format);
+		view_info.subresourceRange.levelCount = 1;
+		view_info.subresourceRange.layerCount = 1;
+		result = vkCreateImageView(VK_DEVICE->vk_device, &view_info, ALLOCATION_CALLBACKS, &vk_texture->attachment_view);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create attachment image view: %s (%d)", vk_err2str(result), result);
+			goto err;
+		}
+	}
+	texture->device = device;
+	texture->format = format;
+	texture->type = type;
+	texture->width = width;
+	texture->height = height;
+	texture->depth = depth;
+	texture->lod = lod;
+	texture->addressing_s = GFX_TEXTURE_ADDRESSING_REPEAT;
+	texture->addressing_t = GFX_TEXTURE_ADDRESSING_REPEAT;
+	texture->addressing_r = GFX_TEXTURE_ADDRESSING_REPEAT;
+	texture->min_filtering = GFX_FILTERING_NEAREST;
+	texture->mag_filtering = GFX_FILTERING_LINEAR;
+	texture->mip_filtering = GFX_FILTERING_LINEAR;
+	texture->anisotropy = 1;
+	texture->min_level = 0;
+	texture->max_level = 1000;
+	texture->sampler.ptr = get_sampler(device, texture);
+	if (!texture->sampler.ptr)
+		goto err;
+	texture->handle.ptr = vk_texture;
 	return true;
+
+err:
+	vkDestroyImageView(VK_DEVICE->vk_device, vk_texture->attachment_view, ALLOCATION_CALLBACKS);
+	vkDestroyImageView(VK_DEVICE->vk_device, vk_texture->view, ALLOCATION_CALLBACKS);
+	vkDestroyImage(VK_DEVICE->vk_device, vk_texture->image, ALLOCATION_CALLBACKS);
+	gfx_vk_mem_free(&VK_DEVICE->mem, &vk_texture->allocation);
+	GFX_FREE(vk_texture);
+	return false;
 }
 
 static void vk_set_texture_data(gfx_device_t *device, gfx_texture_t *texture, uint8_t lod, uint32_t offset, uint32_t width, uint32_t height, uint32_t depth, uint32_t size, const void *data)
 {
+	assert(texture->handle.ptr);
+	vk_texture_t *vk_texture = texture->handle.ptr;
+	if (vk_texture->aspect != VK_IMAGE_ASPECT_COLOR_BIT || texture->type == GFX_TEXTURE_2D_MS || texture->type == GFX_TEXTURE_2D_ARRAY_MS)
+	{
+		GFX_ERROR_CALLBACK("can't upload depth or multisample texture data");
+		return;
+	}
+	VkBufferImageCopy region;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = lod;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset.x = 0;
+	region.imageOffset.y = 0;
+	region.imageOffset.z = 0;
+	region.imageExtent.width = width;
+	region.imageExtent.height = height;
+	region.imageExtent.depth = 1;
+	switch (texture->type)
+	{
+		case GFX_TEXTURE_2D:
+			region.imageOffset.y = offset;
+			depth = 1;
+			break;
+		case GFX_TEXTURE_2D_ARRAY:
+			region.imageSubresource.baseArrayLayer = offset;
+			region.imageSubresource.layerCount = depth;
+			break;
+		case GFX_TEXTURE_3D:
+			region.imageOffset.z = offset;
+			region.imageExtent.depth = depth;
+			break;
+		default:
+			return;
+	}
+	/* the data is tightly packed, blocks of compressed formats included */
+	uint32_t block_dim = texture_block_dims[texture->format];
+	uint32_t block_size = texture_block_sizes[texture->format];
+	VkDeviceSize bytes = (VkDeviceSize)((width + block_dim - 1) / block_dim) * ((height + block_dim - 1) / block_dim) * depth * block_size;
+	assert(!size || size >= bytes);
+	/* the uploads are submitted ahead of the frame, the levels its recorded draws sample must not change */
+	assert(lod < texture->min_level || lod > texture->max_level || atomic_load(&vk_texture->used) != VK_DEVICE->frame + 1);
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	vk_upload_batch_t *batch = recording_batch(device);
+	for (uint32_t i = 0; i < batch->image_uploads_count; ++i)
+	{
+		const vk_image_upload_t *upload = &batch->image_uploads[i];
+		const VkBufferImageCopy *other = &upload->region;
+		if (upload->dst == vk_texture
+		 && other->imageSubresource.mipLevel == lod
+		 && ranges_overlap(other->imageSubresource.baseArrayLayer, other->imageSubresource.layerCount, region.imageSubresource.baseArrayLayer, region.imageSubresource.layerCount)
+		 && ranges_overlap(other->imageOffset.y, other->imageExtent.height, region.imageOffset.y, region.imageExtent.height)
+		 && ranges_overlap(other->imageOffset.z, other->imageExtent.depth, region.imageOffset.z, region.imageExtent.depth))
+		{
+			submit_uploads(device);
+			break;
+		}
+	}
+	uint32_t staging;
+	VkDeviceSize staging_offset;
+	/* buffer offsets must be a multiple of both the texel block size and 4 */
+	if (!staging_write(device, data, bytes, block_size % 4 ? 4 : block_size, &staging, &staging_offset))
+	{
+		pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+		return;
+	}
+	batch = recording_batch(device);
+	vk_image_upload_t *uploads = array_reserve(batch->image_uploads, &batch->image_uploads_size, batch->image_uploads_count, sizeof(*uploads));
+	if (!uploads)
+	{
+		pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+		return;
+	}
+	batch->image_uploads = uploads;
+	vk_image_upload_t *upload = &uploads[batch->image_uploads_count++];
+	region.bufferOffset = staging_offset;
+	upload->dst = vk_texture;
+	upload->staging = staging;
+	upload->region = region;
+	vk_texture->upload_serial = VK_DEVICE->upload_serial;
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
 }
 
 static void vk_set_texture_addressing(gfx_device_t *device, gfx_texture_t *texture, enum gfx_texture_addressing addressing_s, enum gfx_texture_addressing addressing_t, enum gfx_texture_addressing addressing_r)
 {
+	assert(texture->handle.ptr);
+	if (texture->addressing_s == addressing_s
+	 && texture->addressing_t == addressing_t
+	 && texture->addressing_r == addressing_r)
+		return;
+	texture->addressing_s = addressing_s;
+	texture->addressing_t = addressing_t;
+	texture->addressing_r = addressing_r;
+	update_sampler(device, texture);
 }
 
 static void vk_set_texture_filtering(gfx_device_t *device, gfx_texture_t *texture, enum gfx_filtering min_filtering, enum gfx_filtering mag_filtering, enum gfx_filtering mip_filtering)
 {
+	assert(texture->handle.ptr);
+	if (texture->min_filtering == min_filtering
+	 && texture->mag_filtering == mag_filtering
+	 && texture->mip_filtering == mip_filtering)
+		return;
+	texture->min_filtering = min_filtering;
+	texture->mag_filtering = mag_filtering;
+	texture->mip_filtering = mip_filtering;
+	update_sampler(device, texture);
 }
 
 static void vk_set_texture_anisotropy(gfx_device_t *device, gfx_texture_t *texture, uint32_t anisotropy)
 {
+	assert(texture->handle.ptr);
+	if (texture->anisotropy == anisotropy)
+		return;
+	texture->anisotropy = anisotropy;
+	update_sampler(device, texture);
 }
 
 static void vk_set_texture_levels(gfx_device_t *device, gfx_texture_t *texture, uint32_t min_level, uint32_t max_level)
 {
+	assert(texture->handle.ptr);
+	if (texture->min_level == min_level
+	 && texture->max_level == max_level)
+		return;
+	texture->min_level = min_level;
+	texture->max_level = max_level;
+	update_sampler(device, texture);
 }
 
 static void vk_delete_texture(gfx_device_t *device, gfx_texture_t *texture)
 {
+	if (!texture || !texture->handle.ptr)
+		return;
+	vk_texture_t *vk_texture = texture->handle.ptr;
+	vk_garbage_t garbage;
+	garbage.buffer = VK_NULL_HANDLE;
+	garbage.image = vk_texture->image;
+	garbage.views[0] = vk_texture->view;
+	garbage.views[1] = vk_texture->attachment_view;
+	garbage.allocation = vk_texture->allocation;
+	unbind_texture(device, vk_texture);
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	forget_uploads(device, vk_texture->upload_serial, NULL, vk_texture);
+	retire_objects(device, &garbage);
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+	GFX_FREE(vk_texture);
+	texture->handle.ptr = NULL;
+	texture->sampler.ptr = NULL;
 }
 
 static bool vk_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gfx_shader_type type, const uint8_t *data, uint32_t len)
@@ -907,84 +3802,349 @@ static bool vk_create_shader(gfx_device_t *device, gfx_shader_t *shader, enum gf
 	shader_create_info.flags = 0;
 	shader_create_info.codeSize = len;
 	shader_create_info.pCode = (const uint32_t*)data;
-	VkShaderModule shaderModule;
 	VkResult result = vkCreateShaderModule(VK_DEVICE->vk_device, &shader_create_info, ALLOCATION_CALLBACKS, (VkShaderModule*)&shader->handle.ptr);
 	if (result != VK_SUCCESS)
 	{
 		GFX_ERROR_CALLBACK("can't create shader module: %s (%d)", vk_err2str(result), result);
 		return false;
 	}
+	/* the SPIR-V is kept for the shader states reflection */
+	shader->code = GFX_MALLOC(len);
+	if (!shader->code)
+	{
+		GFX_ERROR_CALLBACK("can't allocate shader code: %s (%d)", strerror(errno), errno);
+		vkDestroyShaderModule(VK_DEVICE->vk_device, (VkShaderModule)shader->handle.ptr, ALLOCATION_CALLBACKS);
+		shader->handle.ptr = NULL;
+		return false;
+	}
+	memcpy(shader->code, data, len);
+	shader->code_size = len;
+	shader->device = device;
+	shader->type = type;
 	return true;
 }
 
+static void wait_shader_jobs(gfx_device_t *device, VkShaderModule module);
+
 static void vk_delete_shader(gfx_device_t *device, gfx_shader_t *shader)
 {
 	if (!shader || !shader->handle.ptr)
 		return;
+	wait_shader_jobs(device, (VkShaderModule)shader->handle.ptr);
 	vkDestroyShaderModule(VK_DEVICE->vk_device, (VkShaderModule)shader->handle.ptr, ALLOCATION_CALLBACKS);
 	shader->handle.ptr = NULL;
+	GFX_FREE(shader->code);
+	shader->code = NULL;
+	shader->code_size = 0;
 }
 
-static bool vk_create_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+static bool spirv_descriptor_type(const spirv_id_t *ids, const spirv_id_t *variable, uint32_t type, VkDescriptorType *descriptor_type)
 {
-	VkResult result;
-	assert(!shader_state->handle.ptr);
-	uint32_t constant_layouts_count = 0;
-	uint32_t sampler_layouts_count = 0;
-	while (constants[constant_layouts_count].name)
-		constant_layouts_count++;
-	while (samplers[sampler_layouts_count].name)
-		sampler_layouts_count++;
-	VkDescriptorSetLayout *layouts = GFX_MALLOC(sizeof(*layouts) * (sampler_layouts_count + constant_layouts_count));
-	if (!layouts)
+	const spirv_id_t *id = &ids[type];
+	switch (id->op)
+	{
+		case SPIRV_OP_TYPE_STRUCT:
+			if (variable->storage == SPIRV_STORAGE_STORAGE_BUFFER
+			 || (id->flags & SPIRV_ID_BUFFER_BLOCK))
+				*descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			else
+				*descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; /* the bound offset is given at bind time */
+			return true;
+		case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+			*descriptor_type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			return true;
+		case SPIRV_OP_TYPE_SAMPLER:
+			*descriptor_type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			return true;
+		case SPIRV_OP_TYPE_IMAGE:
+			if (id->dim == SPIRV_DIM_BUFFER)
+				*descriptor_type = id->value == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			else
+				*descriptor_type = id->value == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			return true;
+	}
+	return false;
+}
+
+static bool spirv_add_binding(vk_descriptor_binding_t *bindings, uint32_t *bindings_count, const vk_descriptor_binding_t *binding)
+{
+	for (uint32_t i = 0; i < *bindings_count; ++i)
+	{
+		if (bindings[i].set != binding->set || bindings[i].binding != binding->binding)
+			continue;
+		if (bindings[i].type != binding->type || bindings[i].bind != binding->bind)
+		{
+			GFX_ERROR_CALLBACK("descriptor %" PRIu32 ".%" PRIu32 " declared with different types or names", binding->set, binding->binding);
+			return false;
+		}
+		bindings[i].stages |= binding->stages;
+		if (binding->count > bindings[i].count)
+			bindings[i].count = binding->count;
+		return true;
+	}
+	if (*bindings_count >= VK_MAX_DESCRIPTOR_BINDINGS)
 	{
-		GFX_ERROR_CALLBACK("can't allocate layouts: %s (%d)", strerror(errno), errno);
+		GFX_ERROR_CALLBACK("too many descriptor bindings");
 		return false;
 	}
-	for (uint32_t i = 0; i < constant_layouts_count; ++i)
+	bindings[(*bindings_count)++] = *binding;
+	return true;
+}
+
+/* blocks are named by their type, as gl does, or by their variable, samplers by their variable */
+static bool spirv_table_bind(const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers, VkDescriptorType type, const char *name, uint32_t *bind)
+{
+	switch (type)
 	{
-		VkDescriptorSetLayoutBinding binding;
-		binding.binding = i;
-		binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		binding.descriptorCount = 1;
-		binding.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
-		binding.pImmutableSamplers = NULL;
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+			for (uint32_t i = 0; constants && constants[i].name; ++i)
+			{
+				if (!strcmp(constants[i].name, name))
+				{
+					*bind = constants[i].bind;
+					return true;
+				}
+			}
+			return false;
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		case VK_DESCRIPTOR_TYPE_SAMPLER:
+			for (uint32_t i = 0; samplers && samplers[i].name; ++i)
+			{
+				if (!strcmp(samplers[i].name, name))
+				{
+					*bind = samplers[i].bind;
+					return true;
+				}
+			}
+			return false;
+		default:
+			return false;
+	}
+}
 
-		VkDescriptorSetLayoutCreateInfo layout_create_info;
-		layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layout_create_info.pNext = NULL;
-		layout_create_info.flags = 0;
-		layout_create_info.bindingCount = 1;
-		layout_create_info.pBindings = &binding;
-		result = vkCreateDescriptorSetLayout(VK_DEVICE->vk_device, &layout_create_info, ALLOCATION_CALLBACKS, (VkDescriptorSetLayout*)&layouts[i]);
-		if (result != VK_SUCCESS)
+static bool spirv_reflect(const gfx_shader_t *shader, VkShaderStageFlags stage, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers, vk_descriptor_binding_t *bindings, uint32_t *bindings_count)
+{
+	const uint32_t *code = (const uint32_t*)shader->code;
+	size_t words = shader->code_size / 4;
+	if (words < 5 || code[0] != SPIRV_MAGIC)
+	{
+		GFX_ERROR_CALLBACK("invalid SPIR-V header");
+		return false;
+	}
+	uint32_t bound = code[3];
+	spirv_id_t *ids = GFX_MALLOC(sizeof(*ids) * bound);
+	if (!ids)
+	{
+		GFX_ERROR_CALLBACK("can't allocate SPIR-V ids: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	memset(ids, 0, sizeof(*ids) * bound);
+	bool ret = false;
+	for (size_t i = 5; i < words;)
+	{
+		const uint32_t *ins = &code[i];
+		uint32_t op = ins[0] & 0xFFFF;
+		uint32_t n = ins[0] >> 16;
+		if (!n || n > words - i)
 		{
-			/* XXX: release all previously created */
-			GFX_ERROR_CALLBACK("can't create descriptor set layout: %s (%d)", vk_err2str(result), result);
-			return false;
+			GFX_ERROR_CALLBACK("malformed SPIR-V instruction");
+			goto end;
+		}
+		i += n;
+		switch (op)
+		{
+			case SPIRV_OP_NAME:
+				if (n < 3 || ins[1] >= bound || !memchr(&ins[2], 0, (n - 2) * 4))
+					break;
+				ids[ins[1]].name = (const char*)&ins[2];
+				break;
+			case SPIRV_OP_DECORATE:
+				if (n < 3 || ins[1] >= bound)
+					break;
+				switch (ins[2])
+				{
+					case SPIRV_DECORATION_BLOCK:
+						ids[ins[1]].flags |= SPIRV_ID_BLOCK;
+						break;
+					case SPIRV_DECORATION_BUFFER_BLOCK:
+						ids[ins[1]].flags |= SPIRV_ID_BUFFER_BLOCK;
+						break;
+					case SPIRV_DECORATION_BINDING:
+						if (n < 4)
+							break;
+						ids[ins[1]].flags |= SPIRV_ID_BINDING;
+						ids[ins[1]].binding = ins[3];
+						break;
+					case SPIRV_DECORATION_DESCRIPTOR_SET:
+						if (n < 4)
+							break;
+						ids[ins[1]].flags |= SPIRV_ID_SET;
+						ids[ins[1]].set = ins[3];
+						break;
+				}
+				break;
+			case SPIRV_OP_TYPE_IMAGE:
+				if (n < 9 || ins[1] >= bound)
+					break;
+				ids[ins[1]].op = op;
+				ids[ins[1]].dim = ins[3];
+				ids[ins[1]].value = ins[7];
+				break;
+			case SPIRV_OP_TYPE_SAMPLER:
+			case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+			case SPIRV_OP_TYPE_STRUCT:
+				if (n < 2 || ins[1] >= bound)
+					break;
+				ids[ins[1]].op = op;
+				break;
+			case SPIRV_OP_TYPE_ARRAY:
+				if (n < 4 || ins[1] >= bound)
+					break;
+				ids[ins[1]].op = op;
+				ids[ins[1]].type = ins[2];
+				ids[ins[1]].value = ins[3];
+				break;
+			case SPIRV_OP_TYPE_RUNTIME_ARRAY:
+				if (n < 3 || ins[1] >= bound)
+					break;
+				ids[ins[1]].op = op;
+				ids[ins[1]].type = ins[2];
+				break;
+			case SPIRV_OP_TYPE_POINTER:
+				if (n < 4 || ins[1] >= bound)
+					break;
+				ids[ins[1]].op = op;
+				ids[ins[1]].storage = ins[2];
+				ids[ins[1]].type = ins[3];
+				break;
+			case SPIRV_OP_CONSTANT:
+				if (n < 4 || ins[2] >= bound)
+					break;
+				ids[ins[2]].op = op;
+				ids[ins[2]].value = ins[3];
+				break;
+			case SPIRV_OP_VARIABLE:
+				if (n < 4 || ins[2] >= bound)
+					break;
+				ids[ins[2]].op = op;
+				ids[ins[2]].type = ins[1];
+				ids[ins[2]].storage = ins[3];
+				break;
+		}
+	}
+	for (uint32_t i = 0; i < bound; ++i)
+	{
+		const spirv_id_t *variable = &ids[i];
+		if (variable->op != SPIRV_OP_VARIABLE
+		 || !(variable->flags & SPIRV_ID_BINDING))
+			continue;
+		if (variable->storage != SPIRV_STORAGE_UNIFORM_CONSTANT
+		 && variable->storage != SPIRV_STORAGE_UNIFORM
+		 && variable->storage != SPIRV_STORAGE_STORAGE_BUFFER)
+			continue;
+		if (variable->type >= bound || ids[variable->type].op != SPIRV_OP_TYPE_POINTER)
+			continue;
+		vk_descriptor_binding_t binding;
+		binding.set = variable->set;
+		binding.binding = variable->binding;
+		binding.count = 1;
+		binding.stages = stage;
+		uint32_t type = ids[variable->type].type;
+		while (type < bound
+		    && (ids[type].op == SPIRV_OP_TYPE_ARRAY
+		     || ids[type].op == SPIRV_OP_TYPE_RUNTIME_ARRAY))
+		{
+			if (ids[type].op == SPIRV_OP_TYPE_ARRAY
+			 && ids[type].value < bound
+			 && ids[ids[type].value].op == SPIRV_OP_CONSTANT)
+				binding.count *= ids[ids[type].value].value;
+			type = ids[type].type;
+		}
+		if (type >= bound || !spirv_descriptor_type(ids, variable, type, &binding.type))
+			continue;
+		binding.bind = binding.binding;
+		if ((constants && constants->name) || (samplers && samplers->name))
+		{
+			if (!ids[type].name && !variable->name)
+			{
+				GFX_ERROR_CALLBACK("descriptor %" PRIu32 ".%" PRIu32 " has no name for the bind tables", binding.set, binding.binding);
+				goto end;
+			}
+			if ((!ids[type].name || !spirv_table_bind(constants, samplers, binding.type, ids[type].name, &binding.bind))
+			 && variable->name)
+				spirv_table_bind(constants, samplers, binding.type, variable->name, &binding.bind);
 		}
+		if (binding.set >= VK_MAX_DESCRIPTOR_SETS)
+		{
+			GFX_ERROR_CALLBACK("descriptor set %" PRIu32 " out of range", binding.set);
+			goto end;
+		}
+		if (!spirv_add_binding(bindings, bindings_count, &binding))
+			goto end;
+	}
+	ret = true;
+
+end:
+	GFX_FREE(ids);
+	return ret;
+}
+
+static uint64_t hash_bindings(const vk_descriptor_binding_t *bindings, uint32_t count)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	const uint8_t *data = (const uint8_t*)bindings;
+	for (size_t i = 0; i < sizeof(*bindings) * count; ++i)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static vk_pipeline_layout_t *create_pipeline_layout(gfx_device_t *device, const vk_descriptor_binding_t *bindings, uint32_t bindings_count, uint64_t hash)
+{
+	VkResult result;
+	vk_pipeline_layout_t *layout = GFX_MALLOC(sizeof(*layout) + sizeof(*bindings) * bindings_count);
+	if (!layout)
+	{
+		GFX_ERROR_CALLBACK("can't allocate pipeline layout: %s (%d)", strerror(errno), errno);
+		return NULL;
 	}
-	for (uint32_t i = 0; i < sampler_layouts_count; ++i)
+	layout->refcount = 1;
+	layout->hash = hash;
+	layout->bindings_count = bindings_count;
+	memcpy(layout->bindings, bindings, sizeof(*bindings) * bindings_count);
+	layout->set_layouts_count = bindings_count ? bindings[bindings_count - 1].set + 1 : 0;
+	uint32_t first = 0;
+	for (uint32_t set = 0; set < layout->set_layouts_count; ++set)
 	{
-		VkDescriptorSetLayoutBinding binding;
-		binding.binding = i;
-		binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		binding.descriptorCount = 1;
-		binding.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
-		binding.pImmutableSamplers = NULL;
-
+		VkDescriptorSetLayoutBinding set_bindings[VK_MAX_DESCRIPTOR_BINDINGS];
+		uint32_t set_bindings_count = 0;
+		while (first < bindings_count && bindings[first].set == set)
+		{
+			VkDescriptorSetLayoutBinding *binding = &set_bindings[set_bindings_count++];
+			binding->binding = bindings[first].binding;
+			binding->descriptorType = bindings[first].type;
+			binding->descriptorCount = bindings[first].count;
+			binding->stageFlags = bindings[first].stages;
+			binding->pImmutableSamplers = NULL;
+			first++;
+		}
 		VkDescriptorSetLayoutCreateInfo layout_create_info;
 		layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		layout_create_info.pNext = NULL;
 		layout_create_info.flags = 0;
-		layout_create_info.bindingCount = 1;
-		layout_create_info.pBindings = &binding;
-		result = vkCreateDescriptorSetLayout(VK_DEVICE->vk_device, &layout_create_info, ALLOCATION_CALLBACKS, (VkDescriptorSetLayout*)&layouts[constant_layouts_count + i]);
+		layout_create_info.bindingCount = set_bindings_count;
+		layout_create_info.pBindings = set_bindings;
+		result = vkCreateDescriptorSetLayout(VK_DEVICE->vk_device, &layout_create_info, ALLOCATION_CALLBACKS, &layout->set_layouts[set]);
 		if (result != VK_SUCCESS)
 		{
-			/* XXX: release all previously created */
 			GFX_ERROR_CALLBACK("can't create descriptor set layout: %s (%d)", vk_err2str(result), result);
-			return false;
+			for (uint32_t i = 0; i < set; ++i)
+				vkDestroyDescriptorSetLayout(VK_DEVICE->vk_device, layout->set_layouts[i], ALLOCATION_CALLBACKS);
+			GFX_FREE(layout);
+			return NULL;
 		}
 	}
 
@@ -992,16 +4152,120 @@ static bool vk_create_shader_state(gfx_device_t *device, gfx_shader_state_t *sha
 	pipeline_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipeline_create_info.pNext = NULL;
 	pipeline_create_info.flags = 0;
-	pipeline_create_info.setLayoutCount = constant_layouts_count + sampler_layouts_count;
-	pipeline_create_info.pSetLayouts = layouts;
+	pipeline_create_info.setLayoutCount = layout->set_layouts_count;
+	pipeline_create_info.pSetLayouts = layout->set_layouts;
 	pipeline_create_info.pushConstantRangeCount = 0;
 	pipeline_create_info.pPushConstantRanges = NULL;
-	result = vkCreatePipelineLayout(VK_DEVICE->vk_device, &pipeline_create_info, ALLOCATION_CALLBACKS, (VkPipelineLayout*)&shader_state->pipeline_layout.ptr);
+	result = vkCreatePipelineLayout(VK_DEVICE->vk_device, &pipeline_create_info, ALLOCATION_CALLBACKS, &layout->pipeline_layout);
 	if (result != VK_SUCCESS)
 	{
 		GFX_ERROR_CALLBACK("can't create pipeline layout: %s (%d)", vk_err2str(result), result);
-		return false;
+		for (uint32_t i = 0; i < layout->set_layouts_count; ++i)
+			vkDestroyDescriptorSetLayout(VK_DEVICE->vk_device, layout->set_layouts[i], ALLOCATION_CALLBACKS);
+		GFX_FREE(layout);
+		return NULL;
+	}
+	layout->next = VK_DEVICE->pipeline_layouts;
+	VK_DEVICE->pipeline_layouts = layout;
+	return layout;
+}
+
+/* the layouts are referenced by the shader states and by their pipelines, which may be deleted on other threads */
+static vk_pipeline_layout_t *get_pipeline_layout(gfx_device_t *device, const vk_descriptor_binding_t *bindings, uint32_t bindings_count)
+{
+	uint64_t hash = hash_bindings(bindings, bindings_count);
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	for (vk_pipeline_layout_t *layout = VK_DEVICE->pipeline_layouts; layout; layout = layout->next)
+	{
+		if (layout->hash != hash
+		 || layout->bindings_count != bindings_count
+		 || memcmp(layout->bindings, bindings, sizeof(*bindings) * bindings_count))
+			continue;
+		layout->refcount++;
+		pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+		return layout;
+	}
+	vk_pipeline_layout_t *layout = create_pipeline_layout(device, bindings, bindings_count, hash);
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	return layout;
+}
+
+static vk_pipeline_layout_t *retain_pipeline_layout(gfx_device_t *device, vk_pipeline_layout_t *layout)
+{
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	layout->refcount++;
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	return layout;
+}
+
+static void release_pipeline_layout(gfx_device_t *device, vk_pipeline_layout_t *layout)
+{
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	if (--layout->refcount)
+	{
+		pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+		return;
+	}
+	vk_pipeline_layout_t **it = &VK_DEVICE->pipeline_layouts;
+	while (*it != layout)
+		it = &(*it)->next;
+	*it = layout->next;
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	vkDestroyPipelineLayout(VK_DEVICE->vk_device, layout->pipeline_layout, ALLOCATION_CALLBACKS);
+	for (uint32_t i = 0; i < layout->set_layouts_count; ++i)
+		vkDestroyDescriptorSetLayout(VK_DEVICE->vk_device, layout->set_layouts[i], ALLOCATION_CALLBACKS);
+	GFX_FREE(layout);
+}
+
+static bool vk_create_shader_state(gfx_device_t *device, gfx_shader_state_t *shader_state, const gfx_shader_t **shaders, uint32_t shaders_count, const gfx_shader_attribute_t *attributes, const gfx_shader_constant_t *constants, const gfx_shader_sampler_t *samplers)
+{
+	(void)attributes;
+	assert(!shader_state->handle.ptr);
+	vk_descriptor_binding_t bindings[VK_MAX_DESCRIPTOR_BINDINGS];
+	uint32_t bindings_count = 0;
+	for (uint32_t i = 0; i < shaders_count; ++i)
+	{
+		if (!shaders[i])
+			continue;
+		VkShaderStageFlags stage;
+		switch (shaders[i]->type)
+		{
+			case GFX_SHADER_VERTEX:
+				shader_state->vertex_shader = shaders[i]->handle;
+				stage = VK_SHADER_STAGE_VERTEX_BIT;
+				break;
+			case GFX_SHADER_FRAGMENT:
+				shader_state->fragment_shader = shaders[i]->handle;
+				stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+				break;
+			case GFX_SHADER_GEOMETRY:
+				shader_state->geometry_shader = shaders[i]->handle;
+				stage = VK_SHADER_STAGE_GEOMETRY_BIT;
+				break;
+			default:
+				continue;
+		}
+		if (!spirv_reflect(shaders[i], stage, constants, samplers, bindings, &bindings_count))
+			return false;
+	}
+	/* sorted so that identical interfaces give identical keys */
+	for (uint32_t i = 1; i < bindings_count; ++i)
+	{
+		vk_descriptor_binding_t tmp = bindings[i];
+		uint32_t j = i;
+		while (j > 0 && (bindings[j - 1].set > tmp.set || (bindings[j - 1].set == tmp.set && bindings[j - 1].binding > tmp.binding)))
+		{
+			bindings[j] = bindings[j - 1];
+			j--;
+		}
+		bindings[j] = tmp;
 	}
+	vk_pipeline_layout_t *layout = get_pipeline_layout(device, bindings, bindings_count);
+	if (!layout)
+		return false;
+	shader_state->device = device;
+	shader_state->pipeline_layout.ptr = layout->pipeline_layout;
+	shader_state->handle.ptr = layout;
 	return true;
 }
 
@@ -1009,85 +4273,292 @@ static void vk_delete_shader_state(gfx_device_t *device, gfx_shader_state_t *sha
 {
 	if (!shader_state || !shader_state->handle.ptr)
 		return;
-	vkDestroyPipelineLayout(VK_DEVICE->vk_device, (VkPipelineLayout)shader_state->pipeline_layout.ptr, ALLOCATION_CALLBACKS);
+	release_pipeline_layout(device, shader_state->handle.ptr);
+	shader_state->pipeline_layout.ptr = NULL;
 	shader_state->handle.ptr = NULL;
 }
 
+static bool vk_shader_state_ready(gfx_device_t *device, const gfx_shader_state_t *shader_state)
+{
+	(void)device;
+	(void)shader_state;
+	return true;
+}
+
 static void vk_bind_constant(gfx_device_t *device, uint32_t bind, const gfx_buffer_t *buffer, uint32_t size, uint32_t offset)
 {
-	//vkCmdBindDescriptorSets(VK_DEVICE->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, bind, 1, &descriptor_sets[i], 1, &offset);
+	assert(bind < VK_MAX_CONSTANTS);
+	vk_recorder_t *recorder = get_recorder(device);
+	vk_constant_t *constant = &recorder->constants[bind];
+	constant->buffer = buffer ? buffer->handle.ptr : NULL;
+	constant->id = 0;
+	constant->size = size;
+	constant->offset = offset;
+	recorder->descriptors_dirty = true;
 }
 
-static void vk_bind_samplers(gfx_device_t *device, uint32_t start, uint32_t count, const gfx_texture_t **texture)
+static void vk_bind_samplers(gfx_device_t *device, uint32_t start, uint32_t count, const gfx_texture_t **textures)
 {
-	//vkCmdBindDescriptorSets
+	assert(start + count <= VK_MAX_SAMPLERS);
+	vk_recorder_t *recorder = get_recorder(device);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		vk_sampler_bind_t *bind = &recorder->samplers_binds[start + i];
+		bind->texture = textures[i] ? textures[i]->handle.ptr : NULL;
+		bind->sampler = textures[i] ? textures[i]->sampler.ptr : NULL;
+	}
+	recorder->descriptors_dirty = true;
 }
 
+/* render targets have no vulkan object, their attachments are read by the pass when they are bound */
 static bool vk_create_render_target(gfx_device_t *device, gfx_render_target_t *render_target)
 {
+	assert(!render_target->handle.ptr);
+	render_target->device = device;
+	render_target->handle.ptr = (void*)1;
+	for (size_t i = 0; i < sizeof(render_target->colors) / sizeof(*render_target->colors); ++i)
+		render_target->colors[i].texture = NULL;
+	render_target->depth_stencil.texture = NULL;
+	render_target->draw_buffers[0] = GFX_RENDERTARGET_ATTACHMENT_COLOR0;
+	render_target->draw_buffers_nb = 1;
 	return true;
 }
 
 static void vk_delete_render_target(gfx_device_t *device, gfx_render_target_t *render_target)
 {
+	if (!render_target || !render_target->handle.ptr)
+		return;
+	if (VK_DEVICE->render_target == render_target)
+	{
+		flush_pass(device);
+		VK_DEVICE->render_target = NULL;
+		bind_pass(device);
+	}
+	render_target->handle.ptr = NULL;
 }
 
 static void vk_bind_render_target(gfx_device_t *device, const gfx_render_target_t *render_target)
 {
+	if (render_target)
+		assert(render_target->handle.ptr);
+	if (render_target == VK_DEVICE->render_target)
+		return;
+	flush_pass(device);
+	VK_DEVICE->render_target = render_target;
+	bind_pass(device);
 }
 
 static void vk_set_render_target_texture(gfx_device_t *device, gfx_render_target_t *render_target, enum gfx_render_target_attachment attachment, const gfx_texture_t *texture)
 {
+	assert(render_target->handle.ptr);
+	if (VK_DEVICE->render_target == render_target)
+		flush_pass(device);
+	if (attachment == GFX_RENDERTARGET_ATTACHMENT_DEPTH_STENCIL)
+		render_target->depth_stencil.texture = texture;
+	else
+		render_target->colors[attachment - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture = texture;
+	if (VK_DEVICE->render_target == render_target)
+		bind_pass(device);
+}
+
+static void vk_set_render_target_draw_buffers(gfx_device_t *device, gfx_render_target_t *render_target, uint32_t *draw_buffers, uint32_t draw_buffers_count)
+{
+	assert(render_target->handle.ptr);
+	assert(draw_buffers_count <= VK_MAX_COLOR_ATTACHMENTS);
+	if (VK_DEVICE->render_target == render_target)
+		flush_pass(device);
+	for (size_t i = 0; i < draw_buffers_count; ++i)
+		render_target->draw_buffers[i] = draw_buffers[i];
+	render_target->draw_buffers_nb = draw_buffers_count;
+	if (VK_DEVICE->render_target == render_target)
+		bind_pass(device);
 }
 
-static void vk_set_render_target_draw_buffers(gfx_device_t *device, gfx_render_target_t *render_target, uint32_t *render_buffers, uint32_t render_buffers_count)
+static void clamp_extent(VkExtent2D *extent, uint32_t width, uint32_t height)
 {
+	if (width < extent->width)
+		extent->width = width;
+	if (height < extent->height)
+		extent->height = height;
 }
 
+static void resolve_attachment(vk_pass_t *pass, vk_attachment_t *attachment, const gfx_texture_t *resolve, VkResolveModeFlagBits mode)
+{
+	if (!resolve || !((vk_texture_t*)resolve->handle.ptr)->attachment_view)
+		return;
+	attachment->resolve_mode = mode;
+	attachment->resolve_texture = resolve->handle.ptr;
+	attachment->resolve_view = attachment->resolve_texture->attachment_view;
+	clamp_extent(&pass->extent, resolve->width, resolve->height);
+}
+
+/* resolves are resolve attachments of the rendering of the multisampled source, which is then flushed */
 static void vk_resolve_render_target(gfx_device_t *device, const gfx_render_target_t *src, const gfx_render_target_t *dst, uint32_t buffers, uint32_t color_src, uint32_t color_dst)
 {
+	if (!(buffers & (GFX_BUFFER_COLOR_BIT | GFX_BUFFER_DEPTH_BIT | GFX_BUFFER_STENCIL_BIT)))
+		return;
+	if (!src)
+	{
+		GFX_ERROR_CALLBACK("can't resolve from the swapchain");
+		return;
+	}
+	assert(src->handle.ptr);
+	if (dst)
+		assert(dst->handle.ptr);
+	vk_pass_t other;
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	if (src != VK_DEVICE->render_target)
+	{
+		flush_pass(device);
+		pass = &other;
+		pass->command_buffers = NULL;
+		pass->command_buffers_size = 0;
+		setup_pass(device, pass, src);
+	}
+	if (!pass->valid || pass->format.samples == VK_SAMPLE_COUNT_1_BIT)
+	{
+		GFX_ERROR_CALLBACK("can't resolve a single sample render target");
+		return;
+	}
+	if (buffers & GFX_BUFFER_COLOR_BIT)
+	{
+		const gfx_texture_t *texture = src->colors[color_src].texture;
+		vk_attachment_t *attachment = NULL;
+		for (uint32_t i = 0; i < pass->colors_count; ++i)
+		{
+			if (texture && pass->colors[i].texture == texture->handle.ptr)
+				attachment = &pass->colors[i];
+		}
+		if (!attachment)
+		{
+			GFX_ERROR_CALLBACK("resolved color isn't a draw buffer");
+		}
+		else if (dst)
+		{
+			resolve_attachment(pass, attachment, dst->colors[color_dst].texture, VK_RESOLVE_MODE_AVERAGE_BIT);
+		}
+		else if (VK_DEVICE->surface_acquired)
+		{
+			attachment->resolve_mode = VK_RESOLVE_MODE_AVERAGE_BIT;
+			attachment->resolve_texture = NULL;
+			attachment->resolve_view = VK_DEVICE->surface_image_views[VK_DEVICE->surface_image];
+			clamp_extent(&pass->extent, VK_DEVICE->swap_chain_extent.width, VK_DEVICE->swap_chain_extent.height);
+		}
+	}
+	if ((buffers & (GFX_BUFFER_DEPTH_BIT | GFX_BUFFER_STENCIL_BIT)) && dst && pass->depth_stencil.view)
+	{
+		/* the sample zero mode is the only one every device supports for both aspects */
+		resolve_attachment(pass, &pass->depth_stencil, dst->depth_stencil.texture, VK_RESOLVE_MODE_SAMPLE_ZERO_BIT);
+	}
+	if (pass == &other)
+	{
+		execute_pass(device, pass);
+		return;
+	}
+	flush_pass(device);
+	/* the render area may have been reduced to the resolved textures */
+	bind_pass(device);
+}
+
+/* the load and store actions are the operations of the rendering the pass is executed in */
+static void vk_begin_render_pass(gfx_device_t *device, const gfx_render_target_t *render_target, const enum gfx_load_action *load_actions, const gfx_clear_value_t *clear_values)
+{
+	if (get_recorder(device) != &VK_DEVICE->recorder)
+	{
+		GFX_ERROR_CALLBACK("can't begin a render pass in a command list");
+		return;
+	}
+	/* the draws made before the pass are executed with their own load operations */
+	if (render_target == VK_DEVICE->render_target)
+		flush_pass(device);
+	gfx_device_vtable.begin_render_pass(device, render_target, load_actions, clear_values);
+	if (!load_actions)
+		return;
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	for (uint32_t i = 0; i < pass->colors_count; ++i)
+	{
+		if (load_actions[i] == GFX_LOAD_ACTION_DONT_CARE)
+			pass->colors[i].load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	}
+	if (load_actions[GFX_RENDER_PASS_DEPTH_STENCIL] == GFX_LOAD_ACTION_DONT_CARE)
+		pass->depth_stencil.load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 }
 
-static bool vk_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive)
+static void vk_end_render_pass(gfx_device_t *device, const enum gfx_store_action *store_actions, const gfx_render_target_t *resolve_target)
 {
-	assert(state && !state->handle.ptr);
-	state->primitive = primitive;
+	assert(device->render_pass);
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	if (resolve_target && device->render_pass_target && pass->valid)
+	{
+		assert(resolve_target->handle.ptr);
+		if (pass->format.samples == VK_SAMPLE_COUNT_1_BIT)
+		{
+			GFX_ERROR_CALLBACK("can't resolve a single sample render target");
+		}
+		else
+		{
+			for (uint32_t i = 0; i < pass->colors_count && i < resolve_target->draw_buffers_nb; ++i)
+			{
+				uint8_t draw_buffer = resolve_target->draw_buffers[i];
+				if (pass->colors[i].view && draw_buffer >= GFX_RENDERTARGET_ATTACHMENT_COLOR0)
+					resolve_attachment(pass, &pass->colors[i], resolve_target->colors[draw_buffer - GFX_RENDERTARGET_ATTACHMENT_COLOR0].texture, VK_RESOLVE_MODE_AVERAGE_BIT);
+			}
+			if (pass->depth_stencil.view)
+				resolve_attachment(pass, &pass->depth_stencil, resolve_target->depth_stencil.texture, VK_RESOLVE_MODE_SAMPLE_ZERO_BIT);
+		}
+	}
+	if (store_actions)
+	{
+		for (uint32_t i = 0; i < pass->colors_count; ++i)
+		{
+			if (store_actions[i] == GFX_STORE_ACTION_DONT_CARE)
+				pass->colors[i].store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		}
+		if (store_actions[GFX_RENDER_PASS_DEPTH_STENCIL] == GFX_STORE_ACTION_DONT_CARE)
+			pass->depth_stencil.store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	}
+	flush_pass(device);
+	bind_pass(device);
+	gfx_device_vtable.end_render_pass(device, store_actions, NULL);
+}
 
+static VkResult build_pipeline(gfx_device_t *device, vk_pipeline_t *pipeline)
+{
 	uint32_t shader_stages_count = 2;
 	VkPipelineShaderStageCreateInfo shader_stages[3];
 	shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shader_stages[0].pNext = NULL;
 	shader_stages[0].flags = 0;
 	shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-	shader_stages[0].module = (VkShaderModule)shader_state->vertex_shader.ptr;
+	shader_stages[0].module = pipeline->vertex_shader;
 	shader_stages[0].pName = "main";
 	shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shader_stages[1].pNext = NULL;
 	shader_stages[1].flags = 0;
 	shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	shader_stages[1].module = (VkShaderModule)shader_state->fragment_shader.ptr;
+	shader_stages[1].module = pipeline->fragment_shader;
 	shader_stages[1].pName = "main";
-	if (shader_state->geometry_shader.ptr)
+	if (pipeline->geometry_shader)
 	{
 		shader_stages_count++;
 		shader_stages[2].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		shader_stages[2].pNext = NULL;
 		shader_stages[2].flags = 0;
-		shader_stages[2].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		shader_stages[2].module = (VkShaderModule)shader_state->geometry_shader.ptr;
+		shader_stages[2].stage = VK_SHADER_STAGE_GEOMETRY_BIT;
+		shader_stages[2].module = pipeline->geometry_shader;
 		shader_stages[2].pName = "main";
 	}
 
 	VkVertexInputAttributeDescription input_attribute_descriptions[8];
 	VkVertexInputBindingDescription input_binding_descriptions[8];
-	for (uint32_t i = 0; i < input_layout->count; ++i)
+	for (uint32_t i = 0; i < pipeline->input_layout.count; ++i)
 	{
 		input_attribute_descriptions[i].location = i;
 		input_attribute_descriptions[i].binding = i;
-		input_attribute_descriptions[i].format = attribute_types[input_layout->binds[i].type];
-		input_attribute_descriptions[i].offset = input_layout->binds[i].offset;
+		input_attribute_descriptions[i].format = attribute_types[pipeline->input_layout.binds[i].type];
+		input_attribute_descriptions[i].offset = pipeline->input_layout.binds[i].offset;
 		input_binding_descriptions[i].binding = i;
-		input_binding_descriptions[i].stride = input_layout->binds[i].stride;
+		input_binding_descriptions[i].stride = pipeline->input_layout.binds[i].stride;
 		input_binding_descriptions[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	}
 
@@ -1095,38 +4566,48 @@ static bool vk_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t
 	vertex_input_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertex_input_create_info.pNext = NULL;
 	vertex_input_create_info.flags = 0;
-	vertex_input_create_info.vertexBindingDescriptionCount = input_layout->count;
+	vertex_input_create_info.vertexBindingDescriptionCount = pipeline->input_layout.count;
 	vertex_input_create_info.pVertexBindingDescriptions = input_binding_descriptions;
-	vertex_input_create_info.vertexAttributeDescriptionCount = input_layout->count;
+	vertex_input_create_info.vertexAttributeDescriptionCount = pipeline->input_layout.count;
 	vertex_input_create_info.pVertexAttributeDescriptions = input_attribute_descriptions;
 
 	VkPipelineInputAssemblyStateCreateInfo input_assembly_create_info;
 	input_assembly_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	input_assembly_create_info.pNext = NULL;
 	input_assembly_create_info.flags = 0;
-	input_assembly_create_info.topology = primitive_types[primitive];
+	input_assembly_create_info.topology = primitive_types[pipeline->primitive];
 	input_assembly_create_info.primitiveRestartEnable = VK_FALSE;
 
 	VkPipelineRasterizationStateCreateInfo rasterization_create_info;
 	rasterization_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 	rasterization_create_info.pNext = NULL;
 	rasterization_create_info.flags = 0;
-	rasterization_create_info.depthClampEnable = VK_TRUE;
-	rasterization_create_info.rasterizerDiscardEnable = VK_TRUE;
-	rasterization_create_info.polygonMode = fill_modes[rasterizer->fill_mode];
-	rasterization_create_info.cullMode = cull_modes[rasterizer->cull_mode];
-	rasterization_create_info.frontFace = front_faces[rasterizer->front_face];
+	rasterization_create_info.depthClampEnable = VK_FALSE;
+	rasterization_create_info.rasterizerDiscardEnable = VK_FALSE;
+	rasterization_create_info.polygonMode = fill_modes[pipeline->rasterizer.fill_mode];
+	rasterization_create_info.cullMode = cull_modes[pipeline->rasterizer.cull_mode];
+	rasterization_create_info.frontFace = front_faces[pipeline->rasterizer.front_face];
 	rasterization_create_info.depthBiasEnable = VK_FALSE;
 	rasterization_create_info.depthBiasConstantFactor = 0;
 	rasterization_create_info.depthBiasClamp = 0;
 	rasterization_create_info.depthBiasSlopeFactor = 0;
 	rasterization_create_info.lineWidth = 1;
 
+	/* the viewport and the scissor are dynamic */
+	VkPipelineViewportStateCreateInfo viewport_create_info;
+	viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport_create_info.pNext = NULL;
+	viewport_create_info.flags = 0;
+	viewport_create_info.viewportCount = 1;
+	viewport_create_info.pViewports = NULL;
+	viewport_create_info.scissorCount = 1;
+	viewport_create_info.pScissors = NULL;
+
 	VkPipelineMultisampleStateCreateInfo multisample_create_info;
 	multisample_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
 	multisample_create_info.pNext = NULL;
 	multisample_create_info.flags = 0;
-	multisample_create_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; //XXX
+	multisample_create_info.rasterizationSamples = pipeline->format.samples;
 	multisample_create_info.sampleShadingEnable = VK_FALSE; //XXX
 	multisample_create_info.minSampleShading = 1; //XXX
 	multisample_create_info.pSampleMask = NULL; //XXX
@@ -1137,37 +4618,42 @@ static bool vk_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t
 	depth_stencil_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	depth_stencil_create_info.pNext = NULL;
 	depth_stencil_create_info.flags = 0;
-	depth_stencil_create_info.depthTestEnable = depth_stencil->depth_test;
-	depth_stencil_create_info.depthWriteEnable = depth_stencil->depth_write;
-	depth_stencil_create_info.depthCompareOp = compare_functions[depth_stencil->depth_compare];
-	depth_stencil_create_info.depthBoundsTestEnable = VK_TRUE;
-	depth_stencil_create_info.stencilTestEnable = depth_stencil->stencil_enabled;
-	depth_stencil_create_info.front.failOp = stencil_operations[depth_stencil->stencil_fail];
-	depth_stencil_create_info.front.passOp = stencil_operations[depth_stencil->stencil_pass];
-	depth_stencil_create_info.front.depthFailOp = stencil_operations[depth_stencil->stencil_zfail];
-	depth_stencil_create_info.front.compareOp = compare_functions[depth_stencil->stencil_compare];
-	depth_stencil_create_info.front.compareMask = depth_stencil->stencil_compare_mask;
-	depth_stencil_create_info.front.writeMask = depth_stencil->stencil_write_mask;
-	depth_stencil_create_info.front.reference = depth_stencil->stencil_reference;
-	depth_stencil_create_info.back.failOp = stencil_operations[depth_stencil->stencil_fail];
-	depth_stencil_create_info.back.passOp = stencil_operations[depth_stencil->stencil_pass];
-	depth_stencil_create_info.back.depthFailOp = stencil_operations[depth_stencil->stencil_zfail];
-	depth_stencil_create_info.back.compareOp = compare_functions[depth_stencil->stencil_compare];
-	depth_stencil_create_info.back.compareMask = depth_stencil->stencil_compare_mask;
-	depth_stencil_create_info.back.writeMask = depth_stencil->stencil_write_mask;
-	depth_stencil_create_info.back.reference = depth_stencil->stencil_reference;
+	depth_stencil_create_info.depthTestEnable = pipeline->depth_stencil.depth_test;
+	depth_stencil_create_info.depthWriteEnable = pipeline->depth_stencil.depth_write;
+	depth_stencil_create_info.depthCompareOp = compare_functions[pipeline->depth_stencil.depth_compare];
+	depth_stencil_create_info.depthBoundsTestEnable = VK_FALSE;
+	depth_stencil_create_info.stencilTestEnable = pipeline->depth_stencil.stencil_enabled;
+	depth_stencil_create_info.front.failOp = stencil_operations[pipeline->depth_stencil.stencil_fail];
+	depth_stencil_create_info.front.passOp = stencil_operations[pipeline->depth_stencil.stencil_pass];
+	depth_stencil_create_info.front.depthFailOp = stencil_operations[pipeline->depth_stencil.stencil_zfail];
+	depth_stencil_create_info.front.compareOp = compare_functions[pipeline->depth_stencil.stencil_compare];
+	depth_stencil_create_info.front.compareMask = pipeline->depth_stencil.stencil_compare_mask;
+	depth_stencil_create_info.front.writeMask = pipeline->depth_stencil.stencil_write_mask;
+	depth_stencil_create_info.front.reference = pipeline->depth_stencil.stencil_reference;
+	depth_stencil_create_info.back.failOp = stencil_operations[pipeline->depth_stencil.stencil_fail];
+	depth_stencil_create_info.back.passOp = stencil_operations[pipeline->depth_stencil.stencil_pass];
+	depth_stencil_create_info.back.depthFailOp = stencil_operations[pipeline->depth_stencil.stencil_zfail];
+	depth_stencil_create_info.back.compareOp = compare_functions[pipeline->depth_stencil.stencil_compare];
+	depth_stencil_create_info.back.compareMask = pipeline->depth_stencil.stencil_compare_mask;
+	depth_stencil_create_info.back.writeMask = pipeline->depth_stencil.stencil_write_mask;
+	depth_stencil_create_info.back.reference = pipeline->depth_stencil.stencil_reference;
 	depth_stencil_create_info.minDepthBounds = 0;
 	depth_stencil_create_info.maxDepthBounds = 1;
 
-	VkPipelineColorBlendAttachmentState color_blend_attachment;
-	color_blend_attachment.blendEnable = blend->enabled;
-	color_blend_attachment.srcColorBlendFactor = blend_functions[blend->src_c];
-	color_blend_attachment.dstColorBlendFactor = blend_functions[blend->dst_c];
-	color_blend_attachment.colorBlendOp = blend_equations[blend->equation_c];
-	color_blend_attachment.srcAlphaBlendFactor = blend_functions[blend->src_a];
-	color_blend_attachment.dstAlphaBlendFactor = blend_functions[blend->dst_a];
-	color_blend_attachment.alphaBlendOp = blend_equations[blend->equation_a];
-	color_blend_attachment.colorWriteMask = color_masks[blend->color_mask];
+	/* like on gl, the blend state applies to every draw buffer */
+	VkPipelineColorBlendAttachmentState color_blend_attachments[VK_MAX_COLOR_ATTACHMENTS];
+	for (uint32_t i = 0; i < pipeline->format.colors_count; ++i)
+	{
+		VkPipelineColorBlendAttachmentState *color_blend_attachment = &color_blend_attachments[i];
+		color_blend_attachment->blendEnable = pipeline->blend.enabled;
+		color_blend_attachment->srcColorBlendFactor = blend_functions[pipeline->blend.src_c];
+		color_blend_attachment->dstColorBlendFactor = blend_functions[pipeline->blend.dst_c];
+		color_blend_attachment->colorBlendOp = blend_equations[pipeline->blend.equation_c];
+		color_blend_attachment->srcAlphaBlendFactor = blend_functions[pipeline->blend.src_a];
+		color_blend_attachment->dstAlphaBlendFactor = blend_functions[pipeline->blend.dst_a];
+		color_blend_attachment->alphaBlendOp = blend_equations[pipeline->blend.equation_a];
+		color_blend_attachment->colorWriteMask = color_masks[pipeline->blend.color_mask];
+	}
 
 	VkPipelineColorBlendStateCreateInfo color_blend_create_info;
 	color_blend_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -1175,8 +4661,8 @@ static bool vk_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t
 	color_blend_create_info.flags = 0;
 	color_blend_create_info.logicOpEnable = VK_FALSE;
 	color_blend_create_info.logicOp = 0;
-	color_blend_create_info.attachmentCount = 1;
-	color_blend_create_info.pAttachments = &color_blend_attachment;
+	color_blend_create_info.attachmentCount = pipeline->format.colors_count;
+	color_blend_create_info.pAttachments = color_blend_attachments;
 	color_blend_create_info.blendConstants[0] = 1;
 	color_blend_create_info.blendConstants[1] = 1;
 	color_blend_create_info.blendConstants[2] = 1;
@@ -1196,30 +4682,239 @@ static bool vk_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t
 	dynamic_state_create_info.dynamicStateCount = sizeof(dynamic_states) / sizeof(*dynamic_states);
 	dynamic_state_create_info.pDynamicStates = dynamic_states;
 
+	VkImageAspectFlags aspects = format_aspects(pipeline->format.depth_stencil);
+	VkPipelineRenderingCreateInfoKHR rendering_create_info;
+	rendering_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+	rendering_create_info.pNext = NULL;
+	rendering_create_info.viewMask = 0;
+	rendering_create_info.colorAttachmentCount = pipeline->format.colors_count;
+	rendering_create_info.pColorAttachmentFormats = pipeline->format.colors;
+	rendering_create_info.depthAttachmentFormat = (aspects & VK_IMAGE_ASPECT_DEPTH_BIT) ? pipeline->format.depth_stencil : VK_FORMAT_UNDEFINED;
+	rendering_create_info.stencilAttachmentFormat = (aspects & VK_IMAGE_ASPECT_STENCIL_BIT) ? pipeline->format.depth_stencil : VK_FORMAT_UNDEFINED;
+
 	VkGraphicsPipelineCreateInfo create_info;
 	create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	create_info.pNext = NULL;
+	create_info.pNext = &rendering_create_info;
 	create_info.flags = 0;
 	create_info.stageCount = shader_stages_count;
 	create_info.pStages = shader_stages;
 	create_info.pVertexInputState = &vertex_input_create_info;
 	create_info.pInputAssemblyState = &input_assembly_create_info;
 	create_info.pTessellationState = NULL;
-	create_info.pViewportState = NULL;
+	create_info.pViewportState = &viewport_create_info;
 	create_info.pRasterizationState = &rasterization_create_info;
 	create_info.pMultisampleState = &multisample_create_info;
 	create_info.pDepthStencilState = &depth_stencil_create_info;
 	create_info.pColorBlendState = &color_blend_create_info;
 	create_info.pDynamicState = &dynamic_state_create_info;
-	create_info.layout = (VkPipelineLayout)shader_state->pipeline_layout.ptr;
-	//create_info.renderPass = ;
-	//create_info.subpass = ;
+	create_info.layout = pipeline->layout->pipeline_layout;
+	create_info.renderPass = VK_NULL_HANDLE;
+	create_info.subpass = 0;
 	create_info.basePipelineHandle = VK_NULL_HANDLE;
 	create_info.basePipelineIndex = -1;
-	VkResult result = vkCreateGraphicsPipelines(VK_DEVICE->vk_device, VK_NULL_HANDLE, 1, &create_info, NULL, (VkPipeline*)&state->handle.ptr);
-	if (result != VK_SUCCESS)
+	return vkCreateGraphicsPipelines(VK_DEVICE->vk_device, VK_NULL_HANDLE, 1, &create_info, ALLOCATION_CALLBACKS, &pipeline->pipeline);
+}
+
+/* pipelines are built for the attachments of the pass bound at their creation, the other ones get a variant on their first draw */
+static VkPipeline get_pipeline(gfx_device_t *device, vk_pipeline_t *pipeline, const vk_attachments_format_t *format)
+{
+	if (pipeline->result != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+	if (!memcmp(&pipeline->format, format, sizeof(*format)))
+		return pipeline->pipeline;
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	for (vk_pipeline_t *variant = pipeline->variants; variant; variant = variant->next)
+	{
+		if (!memcmp(&variant->format, format, sizeof(*format)))
+		{
+			pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+			return variant->pipeline;
+		}
+	}
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	vk_pipeline_t *variant = GFX_MALLOC(sizeof(*variant));
+	if (!variant)
+	{
+		GFX_ERROR_CALLBACK("can't allocate pipeline: %s (%d)", strerror(errno), errno);
+		return VK_NULL_HANDLE;
+	}
+	*variant = *pipeline;
+	variant->pipeline = VK_NULL_HANDLE;
+	variant->format = *format;
+	variant->variants = NULL;
+	variant->result = build_pipeline(device, variant);
+	variant->status = VK_PIPELINE_DONE;
+	if (variant->result != VK_SUCCESS)
 	{
+		GFX_ERROR_CALLBACK("can't create graphics pipeline: %s (%d)", vk_err2str(variant->result), variant->result);
+		GFX_FREE(variant);
+		return VK_NULL_HANDLE;
+	}
+	/* the variants are never queued, their next is the next variant */
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	variant->next = pipeline->variants;
+	pipeline->variants = variant;
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	return variant->pipeline;
+}
+
+static void run_pipeline_job(gfx_device_t *device, vk_pipeline_t *pipeline)
+{
+	VkResult result = build_pipeline(device, pipeline);
+	if (result != VK_SUCCESS)
 		GFX_ERROR_CALLBACK("can't create graphics pipeline: %s (%d)", vk_err2str(result), result);
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	pipeline->result = result;
+	pipeline->status = VK_PIPELINE_DONE;
+	VK_DEVICE->pipeline_running--;
+	pthread_cond_broadcast(&VK_DEVICE->pipeline_done_cond);
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+}
+
+static void *pipeline_worker(void *data)
+{
+	gfx_device_t *device = data;
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	while (1)
+	{
+		while (!VK_DEVICE->pipeline_jobs && !VK_DEVICE->pipeline_workers_stop)
+			pthread_cond_wait(&VK_DEVICE->pipeline_cond, &VK_DEVICE->pipeline_mutex);
+		if (VK_DEVICE->pipeline_workers_stop)
+			break;
+		vk_pipeline_t *pipeline = VK_DEVICE->pipeline_jobs;
+		VK_DEVICE->pipeline_jobs = pipeline->next;
+		pipeline->status = VK_PIPELINE_RUNNING;
+		VK_DEVICE->pipeline_running++;
+		pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+		run_pipeline_job(device, pipeline);
+		pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	}
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	return NULL;
+}
+
+static bool queue_pipeline_job(gfx_device_t *device, vk_pipeline_t *pipeline)
+{
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	if (!VK_DEVICE->pipeline_workers_count)
+	{
+		for (uint32_t i = 0; i < VK_PIPELINE_WORKERS; ++i)
+		{
+			if (pthread_create(&VK_DEVICE->pipeline_workers[i], NULL, pipeline_worker, device))
+				break;
+			VK_DEVICE->pipeline_workers_count++;
+		}
+		if (!VK_DEVICE->pipeline_workers_count)
+		{
+			pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+			return false;
+		}
+	}
+	vk_pipeline_t **tail = &VK_DEVICE->pipeline_jobs;
+	while (*tail)
+		tail = &(*tail)->next;
+	pipeline->next = NULL;
+	pipeline->status = VK_PIPELINE_QUEUED;
+	*tail = pipeline;
+	pthread_cond_signal(&VK_DEVICE->pipeline_cond);
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	return true;
+}
+
+/* wait for a pipeline job, running it on the calling thread if no worker took it yet */
+static void wait_pipeline_job(gfx_device_t *device, vk_pipeline_t *pipeline)
+{
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	if (pipeline->status == VK_PIPELINE_QUEUED)
+	{
+		vk_pipeline_t **it = &VK_DEVICE->pipeline_jobs;
+		while (*it != pipeline)
+			it = &(*it)->next;
+		*it = pipeline->next;
+		pipeline->status = VK_PIPELINE_RUNNING;
+		VK_DEVICE->pipeline_running++;
+		pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+		run_pipeline_job(device, pipeline);
+		return;
+	}
+	while (pipeline->status != VK_PIPELINE_DONE)
+		pthread_cond_wait(&VK_DEVICE->pipeline_done_cond, &VK_DEVICE->pipeline_mutex);
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+}
+
+/* the queued jobs of the module are run on the calling thread, the running ones waited for */
+static void wait_shader_jobs(gfx_device_t *device, VkShaderModule module)
+{
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	while (1)
+	{
+		vk_pipeline_t **it = &VK_DEVICE->pipeline_jobs;
+		while (*it
+		    && (*it)->vertex_shader != module
+		    && (*it)->fragment_shader != module
+		    && (*it)->geometry_shader != module)
+			it = &(*it)->next;
+		if (*it)
+		{
+			vk_pipeline_t *pipeline = *it;
+			*it = pipeline->next;
+			pipeline->status = VK_PIPELINE_RUNNING;
+			VK_DEVICE->pipeline_running++;
+			pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+			run_pipeline_job(device, pipeline);
+			pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+			continue;
+		}
+		if (!VK_DEVICE->pipeline_running)
+			break;
+		pthread_cond_wait(&VK_DEVICE->pipeline_done_cond, &VK_DEVICE->pipeline_mutex);
+	}
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+}
+
+static bool vk_create_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t *state, const gfx_shader_state_t *shader_state, const gfx_rasterizer_state_t *rasterizer, const gfx_depth_stencil_state_t *depth_stencil, const gfx_blend_state_t *blend, const gfx_input_layout_t *input_layout, enum gfx_primitive_type primitive)
+{
+	assert(state && !state->handle.ptr);
+	vk_pipeline_t *pipeline = GFX_MALLOC(sizeof(*pipeline));
+	if (!pipeline)
+	{
+		GFX_ERROR_CALLBACK("can't allocate pipeline: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	pipeline->pipeline = VK_NULL_HANDLE;
+	pipeline->result = VK_SUCCESS;
+	pipeline->next = NULL;
+	pipeline->format = VK_DEVICE->pass.format;
+	pipeline->variants = NULL;
+	pipeline->vertex_shader = (VkShaderModule)shader_state->vertex_shader.ptr;
+	pipeline->fragment_shader = (VkShaderModule)shader_state->fragment_shader.ptr;
+	pipeline->geometry_shader = (VkShaderModule)shader_state->geometry_shader.ptr;
+	pipeline->layout = retain_pipeline_layout(device, shader_state->handle.ptr);
+	pipeline->rasterizer = *rasterizer;
+	pipeline->depth_stencil = *depth_stencil;
+	pipeline->blend = *blend;
+	pipeline->input_layout = *input_layout;
+	pipeline->primitive = primitive;
+	state->device = device;
+	state->shader_state = shader_state;
+	state->rasterizer_state = rasterizer;
+	state->depth_stencil_state = depth_stencil;
+	state->blend_state = blend;
+	state->input_layout = input_layout;
+	state->primitive = primitive;
+	state->handle.ptr = pipeline;
+	if (device->async_shaders && queue_pipeline_job(device, pipeline))
+		return true;
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	pipeline->status = VK_PIPELINE_RUNNING;
+	VK_DEVICE->pipeline_running++;
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	run_pipeline_job(device, pipeline);
+	if (pipeline->result != VK_SUCCESS)
+	{
+		release_pipeline_layout(device, pipeline->layout);
+		GFX_FREE(pipeline);
+		state->handle.ptr = NULL;
 		return false;
 	}
 	return true;
@@ -1229,45 +4924,80 @@ static void vk_delete_pipeline_state(gfx_device_t *device, gfx_pipeline_state_t
 {
 	if (!state || !state->handle.ptr)
 		return;
-	vkDestroyPipeline(VK_DEVICE->vk_device, (VkPipeline)state->handle.ptr, NULL);
+	vk_pipeline_t *pipeline = state->handle.ptr;
+	wait_pipeline_job(device, pipeline);
+	if (VK_DEVICE->recorder.pipeline == pipeline)
+	{
+		VK_DEVICE->recorder.pipeline = NULL;
+		VK_DEVICE->recorder.layout = NULL;
+	}
+	while (pipeline->variants)
+	{
+		vk_pipeline_t *variant = pipeline->variants;
+		pipeline->variants = variant->next;
+		vkDestroyPipeline(VK_DEVICE->vk_device, variant->pipeline, ALLOCATION_CALLBACKS);
+		GFX_FREE(variant);
+	}
+	if (pipeline->pipeline)
+		vkDestroyPipeline(VK_DEVICE->vk_device, pipeline->pipeline, ALLOCATION_CALLBACKS);
+	release_pipeline_layout(device, pipeline->layout);
+	GFX_FREE(pipeline);
 	state->handle.ptr = NULL;
 }
 
 static void vk_bind_pipeline_state(gfx_device_t *device, const gfx_pipeline_state_t *state)
 {
-	assert(state);
-	VK_DEVICE->primitive = state->primitive;
-	vkCmdBindPipeline(VK_DEVICE->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, (VkPipeline)state->handle.ptr);
+	assert(state && state->handle.ptr);
+	vk_pipeline_t *pipeline = state->handle.ptr;
+	wait_pipeline_job(device, pipeline);
+	vk_recorder_t *recorder = get_recorder(device);
+	recorder->primitive = state->primitive;
+	if (recorder->layout != pipeline->layout)
+	{
+		recorder->layout = pipeline->layout;
+		recorder->descriptors_dirty = true;
+	}
+	recorder->pipeline = pipeline;
+	recorder->dirty |= VK_DIRTY_PIPELINE;
+}
+
+static bool vk_pipeline_state_ready(gfx_device_t *device, const gfx_pipeline_state_t *state)
+{
+	assert(state && state->handle.ptr);
+	vk_pipeline_t *pipeline = state->handle.ptr;
+	pthread_mutex_lock(&VK_DEVICE->pipeline_mutex);
+	bool ready = pipeline->status == VK_PIPELINE_DONE;
+	pthread_mutex_unlock(&VK_DEVICE->pipeline_mutex);
+	return ready;
 }
 
 static void vk_set_viewport(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
-	VkViewport viewports[8];
-	for (size_t i = 0; i < 8; ++i)
-	{
-		viewports[i].x = x;
-		viewports[i].y = y;
-		viewports[i].width = width;
-		viewports[i].height = height;
-		viewports[i].minDepth = 0;
-		viewports[i].maxDepth = 1;
-	}
-	vkCmdSetViewport(VK_DEVICE->command_buffer, 0, 8, viewports);
+	vk_recorder_t *recorder = get_recorder(device);
+	recorder->viewport.x = x;
+	recorder->viewport.y = y;
+	recorder->viewport.width = width;
+	recorder->viewport.height = height;
+	recorder->viewport.minDepth = 0;
+	recorder->viewport.maxDepth = 1;
+	recorder->dirty |= VK_DIRTY_VIEWPORT;
 }
 
 static void vk_set_scissor(gfx_device_t *device, int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
-	VkRect2D rect;
-	rect.offset.x = x;
-	rect.offset.y = y;
-	rect.extent.width = width;
-	rect.extent.height = height;
-	vkCmdSetScissor(VK_DEVICE->command_buffer, 0, 1, &rect);
+	vk_recorder_t *recorder = get_recorder(device);
+	recorder->scissor.offset.x = x;
+	recorder->scissor.offset.y = y;
+	recorder->scissor.extent.width = width;
+	recorder->scissor.extent.height = height;
+	recorder->dirty |= VK_DIRTY_SCISSOR;
 }
 
 static void vk_set_line_width(gfx_device_t *device, float line_width)
 {
-	vkCmdSetLineWidth(VK_DEVICE->command_buffer, line_width);
+	vk_recorder_t *recorder = get_recorder(device);
+	recorder->line_width = line_width;
+	recorder->dirty |= VK_DIRTY_LINE_WIDTH;
 }
 
 static void vk_set_point_size(gfx_device_t *device, float point_size)
@@ -1276,57 +5006,223 @@ static void vk_set_point_size(gfx_device_t *device, float point_size)
 	(void)point_size;
 }
 
-static const gfx_device_vtable_t vk_vtable =
+static void destroy_command_list(gfx_device_t *device, vk_command_list_t *vk_list)
 {
-	GFX_DEVICE_VTABLE_DEF(vk)
-};
+	for (uint32_t i = 0; i < VK_FRAMES_IN_FLIGHT; ++i)
+	{
+		vk_command_list_frame_t *frame = &vk_list->frames[i];
+		if (frame->command_pool)
+			vkDestroyCommandPool(VK_DEVICE->vk_device, frame->command_pool, ALLOCATION_CALLBACKS);
+		GFX_FREE(frame->command_buffers);
+	}
+	GFX_FREE(vk_list);
+}
 
-void gfx_vk_set_swap_interval(gfx_device_t *device, int interval)
+static bool vk_create_command_list(gfx_device_t *device, gfx_command_list_t *list)
 {
-	if (interval < 0)
-		VK_DEVICE->present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
-	else if (!interval)
-		VK_DEVICE->present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
-	else
-		VK_DEVICE->present_mode = VK_PRESENT_MODE_FIFO_KHR;
-	if (create_swapchain(device))
-		create_image_views(device);
+	assert(!list->handle.ptr);
+	list->device = device;
+	vk_command_list_t *vk_list = GFX_MALLOC(sizeof(*vk_list));
+	if (!vk_list)
+	{
+		GFX_ERROR_CALLBACK("can't allocate command list: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	memset(vk_list, 0, sizeof(*vk_list));
+	vk_list->recorder.device = device;
+	/* a pool per frame in flight, so that recording a frame never waits for the buffers of the previous one */
+	for (uint32_t i = 0; i < VK_FRAMES_IN_FLIGHT; ++i)
+	{
+		VkCommandPoolCreateInfo pool_info;
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.pNext = NULL;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		pool_info.queueFamilyIndex = VK_DEVICE->graphics_family;
+		VkResult result = vkCreateCommandPool(VK_DEVICE->vk_device, &pool_info, ALLOCATION_CALLBACKS, &vk_list->frames[i].command_pool);
+		if (result != VK_SUCCESS)
+		{
+			GFX_ERROR_CALLBACK("can't create vulkan command pool: %s (%d)", vk_err2str(result), result);
+			destroy_command_list(device, vk_list);
+			return false;
+		}
+		vk_list->frames[i].frame = UINT64_MAX;
+	}
+	list->handle.ptr = vk_list;
+	return true;
 }
 
-void gfx_vk_swap_buffers(gfx_device_t *device)
+static void vk_delete_command_list(gfx_device_t *device, gfx_command_list_t *list)
+{
+	if (!list || !list->handle.ptr)
+		return;
+	vk_command_list_t *vk_list = list->handle.ptr;
+	assert(!vk_list->recording);
+	destroy_command_list(device, vk_list);
+	list->handle.ptr = NULL;
+}
+
+static bool vk_begin_command_list(gfx_device_t *device, gfx_command_list_t *list, const gfx_render_target_t *render_target)
 {
-	//vkQueuePresentKHR
+	assert(list && list->handle.ptr);
+	vk_command_list_t *vk_list = list->handle.ptr;
+	assert(!vk_list->recording);
+	if (thread_recorder)
+	{
+		GFX_ERROR_CALLBACK("thread is already recording a command list");
+		return false;
+	}
+	/* the list records into the rendering of its render target, the pass of the device thread may be bound to another one */
+	vk_attachments_format_t format;
+	VkExtent2D extent;
+	if (!attachments_format(device, render_target, &format, &extent))
+	{
+		GFX_ERROR_CALLBACK("command list render target has no attachment");
+		return false;
+	}
+	VkCommandBuffer command_buffer = next_command_list_buffer(device, &vk_list->frames[VK_DEVICE->frame_index]);
+	if (command_buffer == VK_NULL_HANDLE || !begin_pass_secondary(device, command_buffer, &format))
+		return false;
+	vk_recorder_t *recorder = &vk_list->recorder;
+	memset(recorder, 0, sizeof(*recorder));
+	recorder->device = device;
+	recorder->command_buffer = command_buffer;
+	recorder->format = format;
+	recorder->extent = extent;
+	recorder->line_width = 1;
+	recorder->dirty = VK_DIRTY_ALL;
+	recorder->frame = VK_DEVICE->frame;
+	vk_list->frame = VK_DEVICE->frame;
+	vk_list->recording = true;
+	thread_recorder = recorder;
+	return true;
 }
 
-static void *vk_allocation(void *userdata, size_t size, size_t alignment, VkSystemAllocationScope scope)
+static void vk_end_command_list(gfx_device_t *device, gfx_command_list_t *list)
 {
-	uint8_t *addr = GFX_MALLOC(size + alignment);
-	size_t delta = (size_t)addr % alignment;
-	if (!delta)
-		return addr;
-	return addr - delta + alignment;
+	assert(list && list->handle.ptr);
+	vk_command_list_t *vk_list = list->handle.ptr;
+	assert(vk_list->recording && thread_recorder == &vk_list->recorder);
+	VkResult result = vkEndCommandBuffer(vk_list->recorder.command_buffer);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't end command list buffer: %s (%d)", vk_err2str(result), result);
+		vk_list->recorder.command_buffer = VK_NULL_HANDLE;
+	}
+	vk_list->recording = false;
+	thread_recorder = NULL;
 }
 
-static void *vk_realloaction(void *userdata, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+/* the lists join the buffers of the pass, the next draws of the frame going to a new one */
+static void vk_execute_command_lists(gfx_device_t *device, const gfx_command_list_t **lists, uint32_t count)
 {
-	uint8_t *addr = GFX_REALLOC(original, size + alignment);
-	size_t delta = (size_t)addr % alignment;
-	if (!delta)
-		return addr;
-	return addr - delta + alignment;
+	vk_pass_t *pass = &VK_DEVICE->pass;
+	if (!pass->valid)
+		return;
+	end_pass_buffer(device);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const vk_command_list_t *vk_list = lists[i]->handle.ptr;
+		assert(!vk_list->recording);
+		if (vk_list->frame != VK_DEVICE->frame || vk_list->recorder.command_buffer == VK_NULL_HANDLE)
+		{
+			GFX_ERROR_CALLBACK("command list wasn't recorded for this frame");
+			continue;
+		}
+		if (memcmp(&vk_list->recorder.format, &pass->format, sizeof(pass->format)))
+		{
+			GFX_ERROR_CALLBACK("command list wasn't recorded for the bound render target");
+			continue;
+		}
+		VkCommandBuffer *command_buffers = array_reserve(pass->command_buffers, &pass->command_buffers_size, pass->command_buffers_count, sizeof(*command_buffers));
+		if (!command_buffers)
+			return;
+		pass->command_buffers = command_buffers;
+		command_buffers[pass->command_buffers_count++] = vk_list->recorder.command_buffer;
+		pass->open = true;
+#ifndef NDEBUG
+		add_draw_counts(device, &vk_list->recorder.counts);
+#endif
+	}
 }
 
-static void vk_free(void *userdata, void *memory)
+static const gfx_device_vtable_t vk_vtable =
+{
+	GFX_DEVICE_VTABLE_DEF(vk)
+};
+
+void gfx_vk_set_swap_interval(gfx_device_t *device, int interval)
 {
-	GFX_FREE(memory);
+	if (interval < 0)
+		VK_DEVICE->present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+	else if (!interval)
+		VK_DEVICE->present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	else
+		VK_DEVICE->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	/* applied when the next frame acquires its image */
+	VK_DEVICE->swap_chain_outdated = true;
 }
 
-static void vk_internal_allocation(void *userdata, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+static void present(gfx_device_t *device)
 {
+	VkPresentInfoKHR present_info;
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.pNext = NULL;
+	present_info.waitSemaphoreCount = 1;
+	present_info.pWaitSemaphores = &VK_DEVICE->render_finished[VK_DEVICE->surface_image];
+	present_info.swapchainCount = 1;
+	present_info.pSwapchains = &VK_DEVICE->swap_chain;
+	present_info.pImageIndices = &VK_DEVICE->surface_image;
+	present_info.pResults = NULL;
+	VkResult result = vkQueuePresentKHR(VK_DEVICE->present_queue, &present_info);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+		VK_DEVICE->swap_chain_outdated = true;
+	else if (result != VK_SUCCESS)
+		GFX_ERROR_CALLBACK("can't present: %s (%d)", vk_err2str(result), result);
+	if ((uint32_t)device->window->width != VK_DEVICE->swap_chain_extent.width
+	 || (uint32_t)device->window->height != VK_DEVICE->swap_chain_extent.height)
+		VK_DEVICE->swap_chain_outdated = true;
 }
 
-static void vk_internal_free(void *userdata, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+void gfx_vk_swap_buffers(gfx_device_t *device)
 {
+	vk_frame_t *frame = &VK_DEVICE->frames[VK_DEVICE->frame_index];
+	flush_pass(device);
+	if (VK_DEVICE->surface_acquired)
+		transition_surface(device, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+	VkResult result = vkEndCommandBuffer(frame->command_buffer);
+	if (result != VK_SUCCESS)
+		GFX_ERROR_CALLBACK("can't end frame command buffer: %s (%d)", vk_err2str(result), result);
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkSubmitInfo submit_info;
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = NULL;
+	submit_info.waitSemaphoreCount = VK_DEVICE->surface_acquired ? 1 : 0;
+	submit_info.pWaitSemaphores = &frame->image_available;
+	submit_info.pWaitDstStageMask = &wait_stage;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &frame->command_buffer;
+	submit_info.signalSemaphoreCount = VK_DEVICE->surface_acquired ? 1 : 0;
+	submit_info.pSignalSemaphores = VK_DEVICE->surface_acquired ? &VK_DEVICE->render_finished[VK_DEVICE->surface_image] : NULL;
+	pthread_mutex_lock(&VK_DEVICE->queue_mutex);
+	/* the uploads of the frame are submitted ahead of its commands */
+	submit_uploads(device);
+	vkResetFences(VK_DEVICE->vk_device, 1, &frame->fence);
+	result = vkQueueSubmit(VK_DEVICE->graphics_queue, 1, &submit_info, frame->fence);
+	if (result != VK_SUCCESS)
+	{
+		GFX_ERROR_CALLBACK("can't submit frame: %s (%d)", vk_err2str(result), result);
+		/* the fence must still be signaled for the next use of the frame */
+		vkQueueSubmit(VK_DEVICE->graphics_queue, 0, NULL, frame->fence);
+	}
+	else if (VK_DEVICE->surface_acquired)
+	{
+		present(device);
+	}
+	/* counted with the queue mutex held, so the objects are never retired with a frame already submitted */
+	VK_DEVICE->frame++;
+	pthread_mutex_unlock(&VK_DEVICE->queue_mutex);
+	VK_DEVICE->frame_index = (VK_DEVICE->frame_index + 1) % VK_FRAMES_IN_FLIGHT;
+	begin_frame(device);
 }
 
 gfx_device_t *gfx_vk_device_new(gfx_window_t *window, VkInstance instance, VkSurfaceKHR surface)
@@ -1335,12 +5231,7 @@ gfx_device_t *gfx_vk_device_new(gfx_window_t *window, VkInstance instance, VkSur
 	if (!device)
 		return NULL;
 	memset(device, 0, sizeof(*device));
-	device->allocation_callbacks.pUserData = NULL;
-	device->allocation_callbacks.pfnAllocation = NULL;//vk_allocation;
-	device->allocation_callbacks.pfnReallocation = NULL;//vk_realloaction;
-	device->allocation_callbacks.pfnFree = NULL;//vk_free;
-	device->allocation_callbacks.pfnInternalAllocation = NULL;//vk_internal_allocation;
-	device->allocation_callbacks.pfnInternalFree = NULL;//vk_internal_free;
+	gfx_vk_host_init(&device->host, &device->allocation_callbacks);
 	gfx_device_t *dev = &device->device;
 	dev->vtable = &vk_vtable;
 	device->instance = instance;
@@ -1353,3 +5244,8 @@ gfx_device_t *gfx_vk_device_new(gfx_window_t *window, VkInstance instance, VkSur
 	}
 	return dev;
 }
+
+void gfx_vk_get_host_stats(gfx_device_t *device, gfx_vk_host_stats_t *scopes, uint64_t *pooled_bytes)
+{
+	gfx_vk_host_get_stats(&VK_DEVICE->host, scopes, pooled_bytes);
+}
@@ -2,6 +2,7 @@
 #define GFX_VK_DEVICE_H
 
 #include "../device.h"
+#include "vk_host.h"
 #include <vulkan/vulkan.h>
 
 gfx_device_t *gfx_vk_device_new(gfx_window_t *window, VkInstance instance, VkSurfaceKHR surface);
@@ -9,4 +10,7 @@ gfx_device_t *gfx_vk_device_new(gfx_window_t *window, VkInstance instance, VkSur
 void gfx_vk_set_swap_interval(gfx_device_t *device, int interval);
 void gfx_vk_swap_buffers(gfx_device_t *device);
 
+/* host memory allocated by the driver, per VkSystemAllocationScope */
+void gfx_vk_get_host_stats(gfx_device_t *device, gfx_vk_host_stats_t *scopes, uint64_t *pooled_bytes);
+
 #endif
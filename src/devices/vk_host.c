@@ -0,0 +1,201 @@
+#include "vk_host.h"
+#include "../window.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* the header sits right before the pointer given to the driver, which is aligned in the slot or the plain allocation */
+typedef struct vk_host_header_s
+{
+	void *base;
+	uint32_t size;
+	uint8_t size_class; /* GFX_VK_HOST_CLASSES for plain allocations */
+	uint8_t scope;
+} vk_host_header_t;
+
+struct gfx_vk_host_slot_s
+{
+	gfx_vk_host_slot_t *next;
+};
+
+struct gfx_vk_host_chunk_s
+{
+	gfx_vk_host_chunk_t *next;
+	uint8_t data[];
+};
+
+static uint8_t get_size_class(size_t size)
+{
+	uint8_t size_class = 0;
+	while (size_class < GFX_VK_HOST_CLASSES && ((size_t)GFX_VK_HOST_MIN_SIZE << size_class) < size)
+		size_class++;
+	return size_class;
+}
+
+static bool fill_size_class(gfx_vk_host_t *host, uint8_t size_class)
+{
+	gfx_vk_host_chunk_t *chunk = GFX_MALLOC(sizeof(*chunk) + GFX_VK_HOST_CHUNK_SIZE);
+	if (!chunk)
+		return false;
+	chunk->next = host->chunks;
+	host->chunks = chunk;
+	host->pooled_bytes += GFX_VK_HOST_CHUNK_SIZE;
+	size_t slot_size = (size_t)GFX_VK_HOST_MIN_SIZE << size_class;
+	for (size_t offset = 0; offset + slot_size <= GFX_VK_HOST_CHUNK_SIZE; offset += slot_size)
+	{
+		gfx_vk_host_slot_t *slot = (gfx_vk_host_slot_t*)&chunk->data[offset];
+		slot->next = host->free_slots[size_class];
+		host->free_slots[size_class] = slot;
+	}
+	return true;
+}
+
+static void *host_alloc(gfx_vk_host_t *host, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (!size || size > UINT32_MAX)
+		return NULL;
+	if (alignment < _Alignof(vk_host_header_t))
+		alignment = _Alignof(vk_host_header_t);
+	size_t padded = sizeof(vk_host_header_t) + alignment - 1 + size;
+	uint8_t size_class = get_size_class(padded);
+	void *base;
+	pthread_mutex_lock(&host->mutex);
+	if (size_class < GFX_VK_HOST_CLASSES)
+	{
+		if (!host->free_slots[size_class] && !fill_size_class(host, size_class))
+		{
+			pthread_mutex_unlock(&host->mutex);
+			return NULL;
+		}
+		gfx_vk_host_slot_t *slot = host->free_slots[size_class];
+		host->free_slots[size_class] = slot->next;
+		base = slot;
+	}
+	else
+	{
+		base = GFX_MALLOC(padded);
+		if (!base)
+		{
+			pthread_mutex_unlock(&host->mutex);
+			return NULL;
+		}
+	}
+	gfx_vk_host_stats_t *stats = &host->scopes[scope];
+	stats->bytes += size;
+	if (stats->bytes > stats->peak_bytes)
+		stats->peak_bytes = stats->bytes;
+	stats->count++;
+	stats->total_count++;
+	pthread_mutex_unlock(&host->mutex);
+	uintptr_t addr = (uintptr_t)base + sizeof(vk_host_header_t);
+	addr = (addr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	vk_host_header_t *header = &((vk_host_header_t*)addr)[-1];
+	header->base = base;
+	header->size = size;
+	header->size_class = size_class;
+	header->scope = scope;
+	return (void*)addr;
+}
+
+static void host_free(gfx_vk_host_t *host, void *memory)
+{
+	if (!memory)
+		return;
+	vk_host_header_t *header = &((vk_host_header_t*)memory)[-1];
+	pthread_mutex_lock(&host->mutex);
+	gfx_vk_host_stats_t *stats = &host->scopes[header->scope];
+	stats->bytes -= header->size;
+	stats->count--;
+	if (header->size_class < GFX_VK_HOST_CLASSES)
+	{
+		gfx_vk_host_slot_t *slot = header->base;
+		slot->next = host->free_slots[header->size_class];
+		host->free_slots[header->size_class] = slot;
+	}
+	else
+	{
+		GFX_FREE(header->base);
+	}
+	pthread_mutex_unlock(&host->mutex);
+}
+
+static void *vk_allocation(void *userdata, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	return host_alloc(userdata, size, alignment, scope);
+}
+
+/* the new alignment may not be honored by the old placement, so the data is always moved */
+static void *vk_reallocation(void *userdata, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (!original)
+		return host_alloc(userdata, size, alignment, scope);
+	if (!size)
+	{
+		host_free(userdata, original);
+		return NULL;
+	}
+	void *memory = host_alloc(userdata, size, alignment, scope);
+	if (!memory)
+		return NULL;
+	vk_host_header_t *header = &((vk_host_header_t*)original)[-1];
+	memcpy(memory, original, header->size < size ? header->size : size);
+	host_free(userdata, original);
+	return memory;
+}
+
+static void vk_free(void *userdata, void *memory)
+{
+	host_free(userdata, memory);
+}
+
+static void vk_internal_allocation(void *userdata, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	gfx_vk_host_t *host = userdata;
+	pthread_mutex_lock(&host->mutex);
+	host->scopes[scope].internal_bytes += size;
+	pthread_mutex_unlock(&host->mutex);
+}
+
+static void vk_internal_free(void *userdata, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	gfx_vk_host_t *host = userdata;
+	pthread_mutex_lock(&host->mutex);
+	host->scopes[scope].internal_bytes -= size;
+	pthread_mutex_unlock(&host->mutex);
+}
+
+void gfx_vk_host_init(gfx_vk_host_t *host, VkAllocationCallbacks *callbacks)
+{
+	memset(host->free_slots, 0, sizeof(host->free_slots));
+	host->chunks = NULL;
+	host->pooled_bytes = 0;
+	memset(host->scopes, 0, sizeof(host->scopes));
+	pthread_mutex_init(&host->mutex, NULL);
+	callbacks->pUserData = host;
+	callbacks->pfnAllocation = vk_allocation;
+	callbacks->pfnReallocation = vk_reallocation;
+	callbacks->pfnFree = vk_free;
+	callbacks->pfnInternalAllocation = vk_internal_allocation;
+	callbacks->pfnInternalFree = vk_internal_free;
+}
+
+/* the chunks are only released here, once every object allocated through the callbacks is destroyed */
+void gfx_vk_host_destroy(gfx_vk_host_t *host)
+{
+	while (host->chunks)
+	{
+		gfx_vk_host_chunk_t *chunk = host->chunks;
+		host->chunks = chunk->next;
+		GFX_FREE(chunk);
+	}
+	pthread_mutex_destroy(&host->mutex);
+}
+
+void gfx_vk_host_get_stats(gfx_vk_host_t *host, gfx_vk_host_stats_t *scopes, uint64_t *pooled_bytes)
+{
+	pthread_mutex_lock(&host->mutex);
+	if (scopes)
+		memcpy(scopes, host->scopes, sizeof(host->scopes));
+	if (pooled_bytes)
+		*pooled_bytes = host->pooled_bytes;
+	pthread_mutex_unlock(&host->mutex);
+}
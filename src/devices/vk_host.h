@@ -0,0 +1,39 @@
+#ifndef GFX_VK_HOST_H
+#define GFX_VK_HOST_H
+
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define GFX_VK_HOST_MIN_SIZE 64
+#define GFX_VK_HOST_CLASSES 8 /* 64 to 8192 bytes, larger ones are plain allocations */
+#define GFX_VK_HOST_CHUNK_SIZE (64 * 1024)
+#define GFX_VK_HOST_SCOPES (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
+
+typedef struct gfx_vk_host_chunk_s gfx_vk_host_chunk_t;
+typedef struct gfx_vk_host_slot_s gfx_vk_host_slot_t;
+
+typedef struct gfx_vk_host_stats_s
+{
+	uint64_t bytes; /* requested by the driver, alignment and headers excluded */
+	uint64_t peak_bytes;
+	uint64_t count;
+	uint64_t total_count; /* allocations made since creation, reallocations included */
+	uint64_t internal_bytes; /* reported through the internal allocation notifications */
+} gfx_vk_host_stats_t;
+
+typedef struct gfx_vk_host_s
+{
+	gfx_vk_host_slot_t *free_slots[GFX_VK_HOST_CLASSES];
+	gfx_vk_host_chunk_t *chunks;
+	uint64_t pooled_bytes; /* held by the chunks, used or not */
+	gfx_vk_host_stats_t scopes[GFX_VK_HOST_SCOPES];
+	pthread_mutex_t mutex;
+} gfx_vk_host_t;
+
+void gfx_vk_host_init(gfx_vk_host_t *host, VkAllocationCallbacks *callbacks);
+void gfx_vk_host_destroy(gfx_vk_host_t *host);
+void gfx_vk_host_get_stats(gfx_vk_host_t *host, gfx_vk_host_stats_t *scopes, uint64_t *pooled_bytes);
+
+#endif
@@ -0,0 +1,351 @@
+#include "vk_mem.h"
+#include "../window.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* blocks are split with a buddy allocator, whose tree nodes hold the order of their largest free child plus one */
+struct gfx_vk_mem_block_s
+{
+	gfx_vk_mem_block_t *next;
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	uint8_t *data;
+	uint32_t memory_type;
+	uint32_t allocations;
+	bool dedicated;
+	bool linear;
+	uint8_t order;
+	uint8_t tree[];
+};
+
+static uint8_t size_order(VkDeviceSize size)
+{
+	uint8_t order = 0;
+	while (((VkDeviceSize)GFX_VK_MEM_MIN_SIZE << order) < size)
+		order++;
+	return order;
+}
+
+static void buddy_update(gfx_vk_mem_block_t *block, uint32_t idx, uint8_t order)
+{
+	while (idx)
+	{
+		idx = (idx - 1) / 2;
+		order++;
+		uint8_t left = block->tree[idx * 2 + 1];
+		uint8_t right = block->tree[idx * 2 + 2];
+		if (left == order && right == order)
+			block->tree[idx] = order + 1;
+		else
+			block->tree[idx] = left > right ? left : right;
+	}
+}
+
+static VkDeviceSize buddy_alloc(gfx_vk_mem_block_t *block, uint8_t order)
+{
+	uint32_t idx = 0;
+	uint8_t node_order = block->order;
+	for (; node_order > order; --node_order)
+	{
+		idx = idx * 2 + 1;
+		if (block->tree[idx] <= order)
+			idx++;
+	}
+	block->tree[idx] = 0;
+	buddy_update(block, idx, node_order);
+	VkDeviceSize leaf = (((VkDeviceSize)idx + 1) << node_order) - ((VkDeviceSize)1 << block->order);
+	return leaf * GFX_VK_MEM_MIN_SIZE;
+}
+
+static void buddy_free(gfx_vk_mem_block_t *block, VkDeviceSize offset)
+{
+	/* nodes under an allocated one are never written, so the first used node on the way up is the allocation */
+	uint32_t idx = offset / GFX_VK_MEM_MIN_SIZE + (1u << block->order) - 1;
+	uint8_t order = 0;
+	while (block->tree[idx])
+	{
+		idx = (idx - 1) / 2;
+		order++;
+	}
+	block->tree[idx] = order + 1;
+	buddy_update(block, idx, order);
+}
+
+static VkDeviceSize default_block_size(gfx_vk_mem_t *mem, uint32_t heap)
+{
+	VkDeviceSize size = GFX_VK_MEM_BLOCK_SIZE;
+	while (size > 1024 * 1024 && size > mem->properties.memoryHeaps[heap].size / 8)
+		size /= 2;
+	return size;
+}
+
+static gfx_vk_mem_block_t *create_block(gfx_vk_mem_t *mem, uint32_t memory_type, VkDeviceSize size, bool dedicated, bool linear, bool budget)
+{
+	uint32_t heap = mem->properties.memoryTypes[memory_type].heapIndex;
+	if (budget && mem->heaps_usage[heap] + size > mem->heaps_budget[heap])
+		return NULL;
+	uint8_t order = dedicated ? 0 : size_order(size);
+	size_t tree_size = dedicated ? 0 : (2u << order) - 1;
+	gfx_vk_mem_block_t *block = GFX_MALLOC(sizeof(*block) + tree_size);
+	if (!block)
+	{
+		GFX_ERROR_CALLBACK("can't allocate memory block: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	VkMemoryAllocateInfo allocate_info;
+	allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocate_info.pNext = NULL;
+	allocate_info.allocationSize = size;
+	allocate_info.memoryTypeIndex = memory_type;
+	VkResult result = vkAllocateMemory(mem->device, &allocate_info, mem->allocation_callbacks, &block->memory);
+	if (result != VK_SUCCESS)
+	{
+		GFX_FREE(block);
+		return NULL;
+	}
+	block->data = NULL;
+	if (mem->properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		result = vkMapMemory(mem->device, block->memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->data);
+		if (result != VK_SUCCESS)
+		{
+			vkFreeMemory(mem->device, block->memory, mem->allocation_callbacks);
+			GFX_FREE(block);
+			return NULL;
+		}
+	}
+	block->next = NULL;
+	block->size = size;
+	block->memory_type = memory_type;
+	block->allocations = 0;
+	block->dedicated = dedicated;
+	block->linear = linear;
+	block->order = order;
+	for (uint8_t depth = 0; !dedicated && depth <= order; ++depth)
+		memset(&block->tree[(1u << depth) - 1], order - depth + 1, 1u << depth);
+	mem->heaps_usage[heap] += size;
+	mem->allocated += size;
+	if (mem->allocated > mem->allocated_peak)
+		mem->allocated_peak = mem->allocated;
+	mem->blocks_count++;
+	return block;
+}
+
+static void destroy_block(gfx_vk_mem_t *mem, gfx_vk_mem_block_t *block)
+{
+	uint32_t heap = mem->properties.memoryTypes[block->memory_type].heapIndex;
+	if (block->data)
+		vkUnmapMemory(mem->device, block->memory);
+	vkFreeMemory(mem->device, block->memory, mem->allocation_callbacks);
+	if (mem->heaps_usage[heap] >= block->size)
+		mem->heaps_usage[heap] -= block->size;
+	else
+		mem->heaps_usage[heap] = 0;
+	mem->allocated -= block->size;
+	mem->blocks_count--;
+	GFX_FREE(block);
+}
+
+static uint32_t find_memory_type(gfx_vk_mem_t *mem, uint32_t types, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+{
+	uint32_t best = UINT32_MAX;
+	int best_score = -1;
+	for (uint32_t i = 0; i < mem->properties.memoryTypeCount; ++i)
+	{
+		if (!(types & (1u << i)))
+			continue;
+		VkMemoryPropertyFlags flags = mem->properties.memoryTypes[i].propertyFlags;
+		if ((flags & required) != required)
+			continue;
+		if (flags & ~required & (VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+			continue;
+		int score = __builtin_popcount(flags & preferred);
+		if (score > best_score)
+		{
+			best = i;
+			best_score = score;
+		}
+	}
+	return best;
+}
+
+static bool alloc_from_type(gfx_vk_mem_t *mem, uint32_t memory_type, const VkMemoryRequirements *requirements, bool linear, bool budget, gfx_vk_allocation_t *allocation)
+{
+	uint32_t heap = mem->properties.memoryTypes[memory_type].heapIndex;
+	gfx_vk_mem_block_t **blocks = &mem->blocks[memory_type][linear];
+	VkDeviceSize block_size = default_block_size(mem, heap);
+	uint8_t order = size_order(requirements->size > requirements->alignment ? requirements->size : requirements->alignment);
+	VkDeviceSize node_size = (VkDeviceSize)GFX_VK_MEM_MIN_SIZE << order;
+	gfx_vk_mem_block_t *block = NULL;
+	VkDeviceSize offset = 0;
+	if (node_size > block_size / 2)
+	{
+		block = create_block(mem, memory_type, requirements->size, true, linear, budget);
+		if (!block)
+			return false;
+		block->next = *blocks;
+		*blocks = block;
+	}
+	else
+	{
+		/* pick the block with the smallest free run that fits, to keep the large ones for large allocations */
+		for (gfx_vk_mem_block_t *it = *blocks; it; it = it->next)
+		{
+			if (it->dedicated || it->tree[0] <= order)
+				continue;
+			if (!block || it->tree[0] < block->tree[0])
+				block = it;
+		}
+		if (!block)
+		{
+			while (budget && block_size > node_size && mem->heaps_usage[heap] + block_size > mem->heaps_budget[heap])
+				block_size /= 2;
+			block = create_block(mem, memory_type, block_size, false, linear, budget);
+			if (!block)
+				return false;
+			block->next = *blocks;
+			*blocks = block;
+		}
+		offset = buddy_alloc(block, order);
+	}
+	block->allocations++;
+	allocation->block = block;
+	allocation->memory = block->memory;
+	allocation->offset = offset;
+	allocation->size = requirements->size;
+	allocation->data = block->data ? block->data + offset : NULL;
+	return true;
+}
+
+bool gfx_vk_mem_alloc(gfx_vk_mem_t *mem, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linear, gfx_vk_allocation_t *allocation)
+{
+	pthread_mutex_lock(&mem->mutex);
+	/* a type whose heap is out of budget is skipped for the next best one, the budget is only exceeded as a last resort */
+	for (int budget = 1; budget >= 0; --budget)
+	{
+		uint32_t types = requirements->memoryTypeBits;
+		while (1)
+		{
+			uint32_t memory_type = find_memory_type(mem, types, required, preferred);
+			if (memory_type == UINT32_MAX)
+				break;
+			if (alloc_from_type(mem, memory_type, requirements, linear, budget, allocation))
+			{
+				pthread_mutex_unlock(&mem->mutex);
+				return true;
+			}
+			types &= ~(1u << memory_type);
+		}
+	}
+	pthread_mutex_unlock(&mem->mutex);
+	GFX_ERROR_CALLBACK("can't allocate %" PRIu64 " bytes of device memory", (uint64_t)requirements->size);
+	return false;
+}
+
+void gfx_vk_mem_free(gfx_vk_mem_t *mem, gfx_vk_allocation_t *allocation)
+{
+	gfx_vk_mem_block_t *block = allocation->block;
+	if (!block)
+		return;
+	pthread_mutex_lock(&mem->mutex);
+	if (!block->dedicated)
+		buddy_free(block, allocation->offset);
+	gfx_vk_mem_block_t **blocks = &mem->blocks[block->memory_type][block->linear];
+	/* an empty block is kept if it's the only one, so a single buffer being recreated doesn't thrash the driver */
+	if (!--block->allocations && (block->dedicated || *blocks != block || block->next))
+	{
+		while (*blocks != block)
+			blocks = &(*blocks)->next;
+		*blocks = block->next;
+		destroy_block(mem, block);
+	}
+	pthread_mutex_unlock(&mem->mutex);
+	allocation->block = NULL;
+	allocation->memory = VK_NULL_HANDLE;
+	allocation->data = NULL;
+}
+
+void gfx_vk_mem_flush(gfx_vk_mem_t *mem, const gfx_vk_allocation_t *allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+	const gfx_vk_mem_block_t *block = allocation->block;
+	if (mem->properties.memoryTypes[block->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+		return;
+	VkDeviceSize atom = mem->non_coherent_atom_size;
+	VkDeviceSize begin = (allocation->offset + offset) / atom * atom;
+	VkDeviceSize end = (allocation->offset + offset + size + atom - 1) / atom * atom;
+	VkMappedMemoryRange range;
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.pNext = NULL;
+	range.memory = block->memory;
+	range.offset = begin;
+	range.size = end > block->size ? VK_WHOLE_SIZE : end - begin;
+	vkFlushMappedMemoryRanges(mem->device, 1, &range);
+}
+
+void gfx_vk_mem_update_budget(gfx_vk_mem_t *mem)
+{
+	if (!mem->get_memory_properties2)
+		return;
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget;
+	budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	budget.pNext = NULL;
+	VkPhysicalDeviceMemoryProperties2 properties;
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	properties.pNext = &budget;
+	mem->get_memory_properties2(mem->physical_device, &properties);
+	pthread_mutex_lock(&mem->mutex);
+	for (uint32_t i = 0; i < mem->properties.memoryHeapCount; ++i)
+	{
+		mem->heaps_budget[i] = budget.heapBudget[i];
+		mem->heaps_usage[i] = budget.heapUsage[i];
+	}
+	pthread_mutex_unlock(&mem->mutex);
+}
+
+bool gfx_vk_mem_init(gfx_vk_mem_t *mem, VkPhysicalDevice physical_device, VkDevice device, PFN_vkGetPhysicalDeviceMemoryProperties2 get_memory_properties2, const VkAllocationCallbacks *allocation_callbacks)
+{
+	mem->device = device;
+	mem->physical_device = physical_device;
+	mem->get_memory_properties2 = get_memory_properties2;
+	mem->allocation_callbacks = allocation_callbacks;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &mem->properties);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	mem->non_coherent_atom_size = properties.limits.nonCoherentAtomSize ? properties.limits.nonCoherentAtomSize : 1;
+	/* without VK_EXT_memory_budget, leave some room to the other processes and the driver */
+	for (uint32_t i = 0; i < mem->properties.memoryHeapCount; ++i)
+	{
+		mem->heaps_budget[i] = mem->properties.memoryHeaps[i].size / 10 * 8;
+		mem->heaps_usage[i] = 0;
+	}
+	memset(mem->blocks, 0, sizeof(mem->blocks));
+	mem->allocated = 0;
+	mem->allocated_peak = 0;
+	mem->blocks_count = 0;
+	if (pthread_mutex_init(&mem->mutex, NULL))
+	{
+		GFX_ERROR_CALLBACK("can't create memory mutex");
+		return false;
+	}
+	gfx_vk_mem_update_budget(mem);
+	return true;
+}
+
+void gfx_vk_mem_destroy(gfx_vk_mem_t *mem)
+{
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i)
+	{
+		for (uint32_t j = 0; j < 2; ++j)
+		{
+			while (mem->blocks[i][j])
+			{
+				gfx_vk_mem_block_t *block = mem->blocks[i][j];
+				mem->blocks[i][j] = block->next;
+				destroy_block(mem, block);
+			}
+		}
+	}
+	pthread_mutex_destroy(&mem->mutex);
+}
@@ -0,0 +1,48 @@
+#ifndef GFX_VK_MEM_H
+#define GFX_VK_MEM_H
+
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define GFX_VK_MEM_BLOCK_SIZE (64 * 1024 * 1024)
+#define GFX_VK_MEM_MIN_SIZE 256
+
+typedef struct gfx_vk_mem_block_s gfx_vk_mem_block_t;
+
+typedef struct gfx_vk_allocation_s
+{
+	gfx_vk_mem_block_t *block;
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	uint8_t *data; /* persistent mapping, NULL if not host visible */
+} gfx_vk_allocation_t;
+
+typedef struct gfx_vk_mem_s
+{
+	VkDevice device;
+	PFN_vkGetPhysicalDeviceMemoryProperties2 get_memory_properties2; /* only set if VK_EXT_memory_budget is enabled */
+	VkPhysicalDevice physical_device;
+	VkPhysicalDeviceMemoryProperties properties;
+	const VkAllocationCallbacks *allocation_callbacks;
+	VkDeviceSize non_coherent_atom_size;
+	VkDeviceSize heaps_budget[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heaps_usage[VK_MAX_MEMORY_HEAPS];
+	/* blocks allocated by this allocator, unlike the heaps usage which is the whole process one with the budget */
+	VkDeviceSize allocated;
+	VkDeviceSize allocated_peak;
+	uint32_t blocks_count;
+	/* linear resources (buffers) and optimal images never share a block, so bufferImageGranularity can be ignored */
+	gfx_vk_mem_block_t *blocks[VK_MAX_MEMORY_TYPES][2];
+	pthread_mutex_t mutex;
+} gfx_vk_mem_t;
+
+bool gfx_vk_mem_init(gfx_vk_mem_t *mem, VkPhysicalDevice physical_device, VkDevice device, PFN_vkGetPhysicalDeviceMemoryProperties2 get_memory_properties2, const VkAllocationCallbacks *allocation_callbacks);
+void gfx_vk_mem_destroy(gfx_vk_mem_t *mem);
+void gfx_vk_mem_update_budget(gfx_vk_mem_t *mem);
+bool gfx_vk_mem_alloc(gfx_vk_mem_t *mem, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linear, gfx_vk_allocation_t *allocation);
+void gfx_vk_mem_free(gfx_vk_mem_t *mem, gfx_vk_allocation_t *allocation);
+void gfx_vk_mem_flush(gfx_vk_mem_t *mem, const gfx_vk_allocation_t *allocation, VkDeviceSize offset, VkDeviceSize size);
+
+#endif
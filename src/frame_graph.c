@@ -0,0 +1,710 @@
+#include "frame_graph.h"
+#include "config.h"
+#include "window.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+enum frame_resource_type
+{
+	FRAME_RESOURCE_TEXTURE, /* transient, backed by a pooled texture once compiled */
+	FRAME_RESOURCE_IMPORTED_TEXTURE,
+	FRAME_RESOURCE_IMPORTED_BUFFER,
+	FRAME_RESOURCE_BACKBUFFER,
+};
+
+typedef struct frame_texture_s
+{
+	gfx_texture_t *texture; /* acquired from the pool until a compile doesn't use it */
+	gfx_texture_desc_t desc;
+	uint32_t busy_until; /* last pass of the resource using it in the compiled frame */
+} frame_texture_t;
+
+typedef struct frame_resource_s
+{
+	enum frame_resource_type type;
+	gfx_texture_desc_t desc;
+	const gfx_texture_t *texture;
+	const gfx_buffer_t *buffer;
+	uint32_t first;
+	uint32_t last;
+	bool needed;
+} frame_resource_t;
+
+typedef struct frame_attachment_s
+{
+	uint32_t resource;
+	uint32_t resolve;
+	enum gfx_load_action load_action;
+	enum gfx_store_action store_action;
+	gfx_clear_value_t clear_value;
+} frame_attachment_t;
+
+typedef struct frame_access_s
+{
+	uint32_t pass;
+	uint32_t resource;
+	bool write;
+} frame_access_t;
+
+typedef struct frame_pass_s
+{
+	const char *name;
+	gfx_frame_graph_pass_fn_t fn;
+	void *userdata;
+	frame_attachment_t colors[GFX_FRAME_GRAPH_COLORS];
+	uint32_t colors_count;
+	frame_attachment_t depth_stencil;
+	bool side_effects;
+	bool kept;
+} frame_pass_t;
+
+struct gfx_frame_graph_s
+{
+	gfx_device_t *device;
+	frame_resource_t *resources;
+	uint32_t resources_count;
+	uint32_t resources_size;
+	frame_pass_t *passes;
+	uint32_t passes_count;
+	uint32_t passes_size;
+	frame_access_t *accesses;
+	uint32_t accesses_count;
+	uint32_t accesses_size;
+	uint32_t backbuffer;
+	bool compiled;
+	gfx_texture_pool_t *pool;
+	bool own_pool;
+	uint64_t pool_generation; /* of the textures the render targets were built with */
+	frame_texture_t *textures;
+	uint32_t textures_count;
+	uint32_t textures_size;
+	gfx_render_target_t **render_targets;
+	uint32_t render_targets_count;
+	uint32_t render_targets_used;
+};
+
+static bool grow(void **data, uint32_t *size, uint32_t count, size_t entry_size)
+{
+	if (count < *size)
+		return true;
+	uint32_t new_size = *size ? *size * 2 : 16;
+	void *new_data = GFX_REALLOC(*data, entry_size * new_size);
+	if (!new_data)
+	{
+		GFX_ERROR_CALLBACK("frame graph allocation failed: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	*data = new_data;
+	*size = new_size;
+	return true;
+}
+
+gfx_frame_graph_t *gfx_frame_graph_new(gfx_device_t *device, gfx_texture_pool_t *pool)
+{
+	gfx_frame_graph_t *graph = GFX_MALLOC(sizeof(*graph));
+	if (!graph)
+	{
+		GFX_ERROR_CALLBACK("frame graph allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	memset(graph, 0, sizeof(*graph));
+	graph->device = device;
+	graph->backbuffer = GFX_FRAME_GRAPH_NONE;
+	graph->pool = pool;
+	if (!pool)
+	{
+		graph->pool = gfx_texture_pool_new(device);
+		if (!graph->pool)
+		{
+			GFX_FREE(graph);
+			return NULL;
+		}
+		graph->own_pool = true;
+	}
+	graph->pool_generation = gfx_texture_pool_generation(graph->pool);
+	return graph;
+}
+
+static void delete_render_targets(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->render_targets_count; ++i)
+	{
+		gfx_delete_render_target(graph->device, graph->render_targets[i]);
+		GFX_FREE(graph->render_targets[i]);
+	}
+	GFX_FREE(graph->render_targets);
+	graph->render_targets = NULL;
+	graph->render_targets_count = 0;
+}
+
+static void release_textures(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->textures_count; ++i)
+		gfx_texture_pool_release(graph->pool, graph->textures[i].texture);
+	graph->textures_count = 0;
+}
+
+void gfx_frame_graph_delete(gfx_frame_graph_t *graph)
+{
+	if (!graph)
+		return;
+	delete_render_targets(graph);
+	release_textures(graph);
+	if (graph->own_pool)
+		gfx_texture_pool_delete(graph->pool);
+	GFX_FREE(graph->textures);
+	GFX_FREE(graph->resources);
+	GFX_FREE(graph->passes);
+	GFX_FREE(graph->accesses);
+	GFX_FREE(graph);
+}
+
+void gfx_frame_graph_reset(gfx_frame_graph_t *graph)
+{
+	graph->resources_count = 0;
+	graph->passes_count = 0;
+	graph->accesses_count = 0;
+	graph->backbuffer = GFX_FRAME_GRAPH_NONE;
+	graph->compiled = false;
+	if (graph->own_pool)
+		gfx_texture_pool_tick(graph->pool);
+}
+
+static uint32_t add_resource(gfx_frame_graph_t *graph, enum frame_resource_type type)
+{
+	if (!grow((void**)&graph->resources, &graph->resources_size, graph->resources_count, sizeof(*graph->resources)))
+		return GFX_FRAME_GRAPH_NONE;
+	frame_resource_t *resource = &graph->resources[graph->resources_count];
+	memset(resource, 0, sizeof(*resource));
+	resource->type = type;
+	graph->compiled = false;
+	return graph->resources_count++;
+}
+
+uint32_t gfx_frame_graph_texture(gfx_frame_graph_t *graph, const gfx_texture_desc_t *desc)
+{
+	uint32_t id = add_resource(graph, FRAME_RESOURCE_TEXTURE);
+	if (id != GFX_FRAME_GRAPH_NONE)
+		graph->resources[id].desc = *desc;
+	return id;
+}
+
+uint32_t gfx_frame_graph_import_texture(gfx_frame_graph_t *graph, const gfx_texture_t *texture)
+{
+	uint32_t id = add_resource(graph, FRAME_RESOURCE_IMPORTED_TEXTURE);
+	if (id != GFX_FRAME_GRAPH_NONE)
+		graph->resources[id].texture = texture;
+	return id;
+}
+
+uint32_t gfx_frame_graph_import_buffer(gfx_frame_graph_t *graph, const gfx_buffer_t *buffer)
+{
+	uint32_t id = add_resource(graph, FRAME_RESOURCE_IMPORTED_BUFFER);
+	if (id != GFX_FRAME_GRAPH_NONE)
+		graph->resources[id].buffer = buffer;
+	return id;
+}
+
+uint32_t gfx_frame_graph_backbuffer(gfx_frame_graph_t *graph)
+{
+	if (graph->backbuffer == GFX_FRAME_GRAPH_NONE)
+		graph->backbuffer = add_resource(graph, FRAME_RESOURCE_BACKBUFFER);
+	return graph->backbuffer;
+}
+
+/* transient textures only have one once the graph is compiled */
+const gfx_texture_t *gfx_frame_graph_get_texture(const gfx_frame_graph_t *graph, uint32_t resource)
+{
+	if (resource >= graph->resources_count)
+		return NULL;
+	return graph->resources[resource].texture;
+}
+
+static void init_attachment(frame_attachment_t *attachment)
+{
+	attachment->resource = GFX_FRAME_GRAPH_NONE;
+	attachment->resolve = GFX_FRAME_GRAPH_NONE;
+	attachment->load_action = GFX_LOAD_ACTION_LOAD;
+	attachment->store_action = GFX_STORE_ACTION_STORE;
+	memset(&attachment->clear_value, 0, sizeof(attachment->clear_value));
+}
+
+uint32_t gfx_frame_graph_pass(gfx_frame_graph_t *graph, const char *name, gfx_frame_graph_pass_fn_t fn, void *userdata)
+{
+	if (!grow((void**)&graph->passes, &graph->passes_size, graph->passes_count, sizeof(*graph->passes)))
+		return GFX_FRAME_GRAPH_NONE;
+	frame_pass_t *pass = &graph->passes[graph->passes_count];
+	pass->name = name;
+	pass->fn = fn;
+	pass->userdata = userdata;
+	for (uint32_t i = 0; i < GFX_FRAME_GRAPH_COLORS; ++i)
+		init_attachment(&pass->colors[i]);
+	pass->colors_count = 0;
+	init_attachment(&pass->depth_stencil);
+	pass->side_effects = false;
+	pass->kept = false;
+	graph->compiled = false;
+	return graph->passes_count++;
+}
+
+static bool is_texture(const frame_resource_t *resource)
+{
+	return resource->type == FRAME_RESOURCE_TEXTURE
+	    || resource->type == FRAME_RESOURCE_IMPORTED_TEXTURE
+	    || resource->type == FRAME_RESOURCE_BACKBUFFER;
+}
+
+static bool set_attachment(gfx_frame_graph_t *graph, uint32_t pass, frame_attachment_t *attachment, uint32_t resource, enum gfx_load_action load_action, const gfx_clear_value_t *clear_value)
+{
+	if (resource >= graph->resources_count || !is_texture(&graph->resources[resource]))
+	{
+		GFX_ERROR_CALLBACK("invalid attachment of pass %s", graph->passes[pass].name);
+		return false;
+	}
+	attachment->resource = resource;
+	attachment->load_action = load_action;
+	if (clear_value)
+		attachment->clear_value = *clear_value;
+	graph->compiled = false;
+	return true;
+}
+
+bool gfx_frame_graph_write_color(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource, enum gfx_load_action load_action, const gfx_clear_value_t *clear_value)
+{
+	if (pass >= graph->passes_count)
+		return false;
+	frame_pass_t *frame_pass = &graph->passes[pass];
+	if (frame_pass->colors_count == GFX_FRAME_GRAPH_COLORS)
+	{
+		GFX_ERROR_CALLBACK("too many colors in pass %s", frame_pass->name);
+		return false;
+	}
+	if (!set_attachment(graph, pass, &frame_pass->colors[frame_pass->colors_count], resource, load_action, clear_value))
+		return false;
+	frame_pass->colors_count++;
+	return true;
+}
+
+bool gfx_frame_graph_write_depth_stencil(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource, enum gfx_load_action load_action, const gfx_clear_value_t *clear_value)
+{
+	if (pass >= graph->passes_count)
+		return false;
+	return set_attachment(graph, pass, &graph->passes[pass].depth_stencil, resource, load_action, clear_value);
+}
+
+/* the attachment is resolved at the end of the pass, before its content may be discarded */
+bool gfx_frame_graph_resolve(gfx_frame_graph_t *graph, uint32_t pass, uint32_t src, uint32_t dst)
+{
+	if (pass >= graph->passes_count)
+		return false;
+	frame_pass_t *frame_pass = &graph->passes[pass];
+	if (dst >= graph->resources_count
+	 || (graph->resources[dst].type != FRAME_RESOURCE_TEXTURE && graph->resources[dst].type != FRAME_RESOURCE_IMPORTED_TEXTURE))
+	{
+		GFX_ERROR_CALLBACK("invalid resolve of pass %s", frame_pass->name);
+		return false;
+	}
+	for (uint32_t i = 0; i <= frame_pass->colors_count; ++i)
+	{
+		frame_attachment_t *attachment = i < frame_pass->colors_count ? &frame_pass->colors[i] : &frame_pass->depth_stencil;
+		if (attachment->resource != src)
+			continue;
+		attachment->resolve = dst;
+		graph->compiled = false;
+		return true;
+	}
+	GFX_ERROR_CALLBACK("resolved texture isn't written by pass %s", frame_pass->name);
+	return false;
+}
+
+static bool add_access(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource, bool write)
+{
+	if (pass >= graph->passes_count || resource >= graph->resources_count)
+		return false;
+	if (!grow((void**)&graph->accesses, &graph->accesses_size, graph->accesses_count, sizeof(*graph->accesses)))
+		return false;
+	frame_access_t *access = &graph->accesses[graph->accesses_count++];
+	access->pass = pass;
+	access->resource = resource;
+	access->write = write;
+	graph->compiled = false;
+	return true;
+}
+
+bool gfx_frame_graph_read(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource)
+{
+	return add_access(graph, pass, resource, false);
+}
+
+/* writes out of the attachments may be partial, they keep the previous content */
+bool gfx_frame_graph_write(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource)
+{
+	return add_access(graph, pass, resource, true);
+}
+
+void gfx_frame_graph_keep(gfx_frame_graph_t *graph, uint32_t pass)
+{
+	if (pass >= graph->passes_count)
+		return;
+	graph->passes[pass].side_effects = true;
+	graph->compiled = false;
+}
+
+static bool check_pass(gfx_frame_graph_t *graph, const frame_pass_t *pass)
+{
+	uint32_t backbuffers = 0;
+	uint32_t attachments = 0;
+	for (uint32_t i = 0; i <= pass->colors_count; ++i)
+	{
+		const frame_attachment_t *attachment = i < pass->colors_count ? &pass->colors[i] : &pass->depth_stencil;
+		if (attachment->resource == GFX_FRAME_GRAPH_NONE)
+			continue;
+		attachments++;
+		if (graph->resources[attachment->resource].type == FRAME_RESOURCE_BACKBUFFER)
+			backbuffers++;
+	}
+	if (backbuffers && (backbuffers != attachments || pass->colors_count > 1))
+	{
+		GFX_ERROR_CALLBACK("pass %s mixes the backbuffer with textures", pass->name);
+		return false;
+	}
+	if (backbuffers && (pass->colors[0].resolve != GFX_FRAME_GRAPH_NONE || pass->depth_stencil.resolve != GFX_FRAME_GRAPH_NONE))
+	{
+		GFX_ERROR_CALLBACK("pass %s resolves the backbuffer", pass->name);
+		return false;
+	}
+	return true;
+}
+
+static bool pass_writes_needed(const gfx_frame_graph_t *graph, uint32_t pass_id)
+{
+	const frame_pass_t *pass = &graph->passes[pass_id];
+	for (uint32_t i = 0; i <= pass->colors_count; ++i)
+	{
+		const frame_attachment_t *attachment = i < pass->colors_count ? &pass->colors[i] : &pass->depth_stencil;
+		if (attachment->resource != GFX_FRAME_GRAPH_NONE && graph->resources[attachment->resource].needed)
+			return true;
+		if (attachment->resolve != GFX_FRAME_GRAPH_NONE && graph->resources[attachment->resolve].needed)
+			return true;
+	}
+	for (uint32_t i = 0; i < graph->accesses_count; ++i)
+	{
+		const frame_access_t *access = &graph->accesses[i];
+		if (access->pass == pass_id && access->write && graph->resources[access->resource].needed)
+			return true;
+	}
+	return false;
+}
+
+/* the content of a resource is needed before a pass when the pass is kept and loads or reads it,
+ * the imported resources always being needed as they outlive the frame
+ */
+static void cull_passes(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->resources_count; ++i)
+		graph->resources[i].needed = graph->resources[i].type != FRAME_RESOURCE_TEXTURE;
+	for (uint32_t i = graph->passes_count; i > 0; --i)
+	{
+		frame_pass_t *pass = &graph->passes[i - 1];
+		pass->kept = pass->side_effects || pass_writes_needed(graph, i - 1);
+		if (!pass->kept)
+			continue;
+		for (uint32_t j = 0; j <= pass->colors_count; ++j)
+		{
+			frame_attachment_t *attachment = j < pass->colors_count ? &pass->colors[j] : &pass->depth_stencil;
+			if (attachment->resolve != GFX_FRAME_GRAPH_NONE && graph->resources[attachment->resolve].type == FRAME_RESOURCE_TEXTURE)
+				graph->resources[attachment->resolve].needed = false;
+			if (attachment->resource == GFX_FRAME_GRAPH_NONE)
+				continue;
+			frame_resource_t *resource = &graph->resources[attachment->resource];
+			if (attachment->load_action == GFX_LOAD_ACTION_LOAD)
+				resource->needed = true;
+			else if (resource->type == FRAME_RESOURCE_TEXTURE)
+				resource->needed = false;
+		}
+		for (uint32_t j = 0; j < graph->accesses_count; ++j)
+		{
+			if (graph->accesses[j].pass == i - 1)
+				graph->resources[graph->accesses[j].resource].needed = true;
+		}
+	}
+}
+
+static void use_resource(gfx_frame_graph_t *graph, uint32_t resource_id, uint32_t pass)
+{
+	if (resource_id == GFX_FRAME_GRAPH_NONE)
+		return;
+	frame_resource_t *resource = &graph->resources[resource_id];
+	if (resource->first == GFX_FRAME_GRAPH_NONE)
+		resource->first = pass;
+	resource->last = pass;
+}
+
+static void compute_lifetimes(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->resources_count; ++i)
+	{
+		graph->resources[i].first = GFX_FRAME_GRAPH_NONE;
+		graph->resources[i].last = GFX_FRAME_GRAPH_NONE;
+	}
+	for (uint32_t i = 0; i < graph->passes_count; ++i)
+	{
+		const frame_pass_t *pass = &graph->passes[i];
+		if (!pass->kept)
+			continue;
+		for (uint32_t j = 0; j <= pass->colors_count; ++j)
+		{
+			const frame_attachment_t *attachment = j < pass->colors_count ? &pass->colors[j] : &pass->depth_stencil;
+			use_resource(graph, attachment->resource, i);
+			use_resource(graph, attachment->resolve, i);
+		}
+	}
+	for (uint32_t i = 0; i < graph->accesses_count; ++i)
+	{
+		const frame_access_t *access = &graph->accesses[i];
+		if (!graph->passes[access->pass].kept)
+			continue;
+		frame_resource_t *resource = &graph->resources[access->resource];
+		if (resource->first == GFX_FRAME_GRAPH_NONE || access->pass < resource->first)
+			resource->first = access->pass;
+		if (resource->last == GFX_FRAME_GRAPH_NONE || access->pass > resource->last)
+			resource->last = access->pass;
+	}
+}
+
+/* transient textures have no content before their first pass nor after their last one */
+static void set_actions(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->passes_count; ++i)
+	{
+		frame_pass_t *pass = &graph->passes[i];
+		if (!pass->kept)
+			continue;
+		for (uint32_t j = 0; j <= pass->colors_count; ++j)
+		{
+			frame_attachment_t *attachment = j < pass->colors_count ? &pass->colors[j] : &pass->depth_stencil;
+			attachment->store_action = GFX_STORE_ACTION_STORE;
+			if (attachment->resource == GFX_FRAME_GRAPH_NONE)
+				continue;
+			const frame_resource_t *resource = &graph->resources[attachment->resource];
+			if (resource->type != FRAME_RESOURCE_TEXTURE)
+				continue;
+			if (resource->first == i && attachment->load_action == GFX_LOAD_ACTION_LOAD)
+				attachment->load_action = GFX_LOAD_ACTION_DONT_CARE;
+			if (resource->last == i)
+				attachment->store_action = GFX_STORE_ACTION_DONT_CARE;
+		}
+	}
+}
+
+/* resources are placed by first use, on a texture of the same description whose previous user is done,
+ * the textures of the previous compile being kept while they are used, and the others going back to the pool
+ */
+static bool alias_textures(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->textures_count; ++i)
+		graph->textures[i].busy_until = GFX_FRAME_GRAPH_NONE;
+	for (uint32_t i = 0; i < graph->resources_count; ++i)
+	{
+		if (graph->resources[i].type == FRAME_RESOURCE_TEXTURE)
+			graph->resources[i].texture = NULL;
+	}
+	for (uint32_t pass = 0; pass < graph->passes_count; ++pass)
+	{
+		for (uint32_t i = 0; i < graph->resources_count; ++i)
+		{
+			frame_resource_t *resource = &graph->resources[i];
+			if (resource->type != FRAME_RESOURCE_TEXTURE || resource->first != pass)
+				continue;
+			frame_texture_t *texture = NULL;
+			for (uint32_t j = 0; j < graph->textures_count; ++j)
+			{
+				frame_texture_t *acquired = &graph->textures[j];
+				if ((acquired->busy_until == GFX_FRAME_GRAPH_NONE || acquired->busy_until < pass)
+				 && gfx_texture_desc_equal(&acquired->desc, &resource->desc))
+				{
+					texture = acquired;
+					break;
+				}
+			}
+			if (!texture)
+			{
+				if (!grow((void**)&graph->textures, &graph->textures_size, graph->textures_count, sizeof(*graph->textures)))
+					return false;
+				gfx_texture_t *pooled = gfx_texture_pool_acquire(graph->pool, &resource->desc);
+				if (!pooled)
+					return false;
+				texture = &graph->textures[graph->textures_count++];
+				texture->texture = pooled;
+				texture->desc = resource->desc;
+			}
+			texture->busy_until = resource->last;
+			resource->texture = texture->texture;
+		}
+	}
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < graph->textures_count; ++i)
+	{
+		if (graph->textures[i].busy_until == GFX_FRAME_GRAPH_NONE)
+			gfx_texture_pool_release(graph->pool, graph->textures[i].texture);
+		else
+			graph->textures[count++] = graph->textures[i];
+	}
+	graph->textures_count = count;
+	return true;
+}
+
+bool gfx_frame_graph_compile(gfx_frame_graph_t *graph)
+{
+	for (uint32_t i = 0; i < graph->passes_count; ++i)
+	{
+		if (!check_pass(graph, &graph->passes[i]))
+			return false;
+	}
+	cull_passes(graph);
+	compute_lifetimes(graph);
+	set_actions(graph);
+	if (!alias_textures(graph))
+		return false;
+	graph->compiled = true;
+	return true;
+}
+
+/* the render targets are reused in execution order, so that a stable graph keeps the same attachments every frame */
+static gfx_render_target_t *get_render_target(gfx_frame_graph_t *graph, const gfx_texture_t **colors, uint32_t colors_count, const gfx_texture_t *depth_stencil)
+{
+	gfx_render_target_t *render_target;
+	if (graph->render_targets_used == graph->render_targets_count)
+	{
+		gfx_render_target_t **render_targets = GFX_REALLOC(graph->render_targets, sizeof(*render_targets) * (graph->render_targets_count + 1));
+		if (!render_targets)
+		{
+			GFX_ERROR_CALLBACK("frame graph render target allocation failed: %s (%d)", strerror(errno), errno);
+			return NULL;
+		}
+		graph->render_targets = render_targets;
+		render_target = GFX_MALLOC(sizeof(*render_target));
+		if (!render_target)
+		{
+			GFX_ERROR_CALLBACK("frame graph render target allocation failed: %s (%d)", strerror(errno), errno);
+			return NULL;
+		}
+		*render_target = GFX_RENDER_TARGET_INIT();
+		if (!gfx_create_render_target(graph->device, render_target))
+		{
+			GFX_FREE(render_target);
+			return NULL;
+		}
+		render_target->draw_buffers_nb = 0;
+		graph->render_targets[graph->render_targets_count++] = render_target;
+	}
+	render_target = graph->render_targets[graph->render_targets_used++];
+	/* the textures can't be detached, and stale ones would limit the render area to their size */
+	bool stale = depth_stencil ? false : render_target->depth_stencil.texture != NULL;
+	for (uint32_t i = 0; i < GFX_FRAME_GRAPH_COLORS; ++i)
+	{
+		if (render_target->colors[i].texture && (i >= colors_count || !colors[i]))
+			stale = true;
+	}
+	if (stale)
+	{
+		gfx_delete_render_target(graph->device, render_target);
+		*render_target = GFX_RENDER_TARGET_INIT();
+		if (!gfx_create_render_target(graph->device, render_target))
+			return NULL;
+		render_target->draw_buffers_nb = 0;
+	}
+	uint32_t draw_buffers[GFX_FRAME_GRAPH_COLORS];
+	bool draw_buffers_changed = render_target->draw_buffers_nb != colors_count;
+	for (uint32_t i = 0; i < colors_count; ++i)
+	{
+		draw_buffers[i] = colors[i] ? GFX_RENDERTARGET_ATTACHMENT_COLOR0 + i : GFX_RENDERTARGET_ATTACHMENT_NONE;
+		if (render_target->draw_buffers[i] != draw_buffers[i])
+			draw_buffers_changed = true;
+		if (colors[i] && render_target->colors[i].texture != colors[i])
+			gfx_set_render_target_texture(render_target, GFX_RENDERTARGET_ATTACHMENT_COLOR0 + i, colors[i]);
+	}
+	if (depth_stencil && render_target->depth_stencil.texture != depth_stencil)
+		gfx_set_render_target_texture(render_target, GFX_RENDERTARGET_ATTACHMENT_DEPTH_STENCIL, depth_stencil);
+	if (draw_buffers_changed)
+		gfx_set_render_target_draw_buffers(render_target, draw_buffers, colors_count);
+	return render_target;
+}
+
+static const gfx_texture_t *get_attachment_texture(const gfx_frame_graph_t *graph, uint32_t resource)
+{
+	return resource == GFX_FRAME_GRAPH_NONE ? NULL : graph->resources[resource].texture;
+}
+
+static void execute_pass(gfx_frame_graph_t *graph, frame_pass_t *pass)
+{
+	enum gfx_load_action load_actions[GFX_RENDER_PASS_ATTACHMENTS];
+	enum gfx_store_action store_actions[GFX_RENDER_PASS_ATTACHMENTS];
+	gfx_clear_value_t clear_values[GFX_RENDER_PASS_ATTACHMENTS];
+	const gfx_texture_t *colors[GFX_FRAME_GRAPH_COLORS];
+	const gfx_texture_t *resolves[GFX_FRAME_GRAPH_COLORS];
+	bool resolved = false;
+	if (!pass->colors_count && pass->depth_stencil.resource == GFX_FRAME_GRAPH_NONE)
+	{
+		pass->fn(graph->device, graph, pass->userdata);
+		return;
+	}
+	for (uint32_t i = 0; i < GFX_RENDER_PASS_ATTACHMENTS; ++i)
+	{
+		load_actions[i] = GFX_LOAD_ACTION_LOAD;
+		store_actions[i] = GFX_STORE_ACTION_STORE;
+		memset(&clear_values[i], 0, sizeof(clear_values[i]));
+	}
+	for (uint32_t i = 0; i <= pass->colors_count; ++i)
+	{
+		const frame_attachment_t *attachment = i < pass->colors_count ? &pass->colors[i] : &pass->depth_stencil;
+		uint32_t index = i < pass->colors_count ? i : GFX_RENDER_PASS_DEPTH_STENCIL;
+		load_actions[index] = attachment->load_action;
+		store_actions[index] = attachment->store_action;
+		clear_values[index] = attachment->clear_value;
+		if (attachment->resolve != GFX_FRAME_GRAPH_NONE)
+			resolved = true;
+		if (i < pass->colors_count)
+		{
+			colors[i] = get_attachment_texture(graph, attachment->resource);
+			resolves[i] = get_attachment_texture(graph, attachment->resolve);
+		}
+	}
+	gfx_render_target_t *render_target = NULL;
+	gfx_render_target_t *resolve_target = NULL;
+	if (graph->resources[pass->colors_count ? pass->colors[0].resource : pass->depth_stencil.resource].type != FRAME_RESOURCE_BACKBUFFER)
+	{
+		render_target = get_render_target(graph, colors, pass->colors_count, get_attachment_texture(graph, pass->depth_stencil.resource));
+		if (!render_target)
+			return;
+		if (resolved)
+		{
+			resolve_target = get_render_target(graph, resolves, pass->colors_count, get_attachment_texture(graph, pass->depth_stencil.resolve));
+			if (!resolve_target)
+				return;
+		}
+	}
+	gfx_begin_render_pass(graph->device, render_target, load_actions, clear_values);
+	pass->fn(graph->device, graph, pass->userdata);
+	gfx_end_render_pass(graph->device, store_actions, resolve_target);
+}
+
+/* the backends order the rendering of a pass before the passes sampling its textures once it is ended */
+void gfx_frame_graph_execute(gfx_frame_graph_t *graph)
+{
+	if (!graph->compiled && !gfx_frame_graph_compile(graph))
+		return;
+	/* the render targets may reference the textures the pool deleted */
+	if (graph->pool_generation != gfx_texture_pool_generation(graph->pool))
+	{
+		delete_render_targets(graph);
+		graph->pool_generation = gfx_texture_pool_generation(graph->pool);
+	}
+	graph->render_targets_used = 0;
+	for (uint32_t i = 0; i < graph->passes_count; ++i)
+	{
+		if (graph->passes[i].kept)
+			execute_pass(graph, &graph->passes[i]);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef GFX_FRAME_GRAPH_H
+#define GFX_FRAME_GRAPH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "texture_pool.h"
+
+#define GFX_FRAME_GRAPH_NONE UINT32_MAX
+#define GFX_FRAME_GRAPH_COLORS 4
+
+typedef struct gfx_frame_graph_s gfx_frame_graph_t;
+
+typedef void (*gfx_frame_graph_pass_fn_t)(gfx_device_t *device, gfx_frame_graph_t *graph, void *userdata);
+
+/* the graph is declared every frame: resources, then passes with their reads and writes,
+ * compiled to cull the passes whose writes are never read, and executed in declaration order,
+ * the transient textures whose lifetimes don't overlap sharing the same texture of the pool,
+ * given back to the pool by the first compile not using it, without pool the graph creates one
+ * which it ticks on reset, else the pool is ticked by its owner
+ */
+gfx_frame_graph_t *gfx_frame_graph_new(gfx_device_t *device, gfx_texture_pool_t *pool);
+void gfx_frame_graph_delete(gfx_frame_graph_t *graph);
+void gfx_frame_graph_reset(gfx_frame_graph_t *graph);
+
+uint32_t gfx_frame_graph_texture(gfx_frame_graph_t *graph, const gfx_texture_desc_t *desc);
+uint32_t gfx_frame_graph_import_texture(gfx_frame_graph_t *graph, const gfx_texture_t *texture);
+uint32_t gfx_frame_graph_import_buffer(gfx_frame_graph_t *graph, const gfx_buffer_t *buffer);
+uint32_t gfx_frame_graph_backbuffer(gfx_frame_graph_t *graph);
+const gfx_texture_t *gfx_frame_graph_get_texture(const gfx_frame_graph_t *graph, uint32_t resource);
+
+/* the writes of imported resources and of the backbuffer are the outputs of the graph */
+uint32_t gfx_frame_graph_pass(gfx_frame_graph_t *graph, const char *name, gfx_frame_graph_pass_fn_t fn, void *userdata);
+bool gfx_frame_graph_write_color(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource, enum gfx_load_action load_action, const gfx_clear_value_t *clear_value);
+bool gfx_frame_graph_write_depth_stencil(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource, enum gfx_load_action load_action, const gfx_clear_value_t *clear_value);
+bool gfx_frame_graph_resolve(gfx_frame_graph_t *graph, uint32_t pass, uint32_t src, uint32_t dst);
+bool gfx_frame_graph_read(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource);
+bool gfx_frame_graph_write(gfx_frame_graph_t *graph, uint32_t pass, uint32_t resource);
+void gfx_frame_graph_keep(gfx_frame_graph_t *graph, uint32_t pass);
+
+bool gfx_frame_graph_compile(gfx_frame_graph_t *graph);
+void gfx_frame_graph_execute(gfx_frame_graph_t *graph);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
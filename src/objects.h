@@ -9,6 +9,7 @@ extern "C" {
 #include <stdint.h>
 
 typedef struct gfx_device_s gfx_device_t;
+typedef struct gfx_residency_s gfx_residency_t;
 
 enum gfx_buffer_type
 {
@@ -144,6 +145,7 @@ enum gfx_texture_addressing
 	GFX_TEXTURE_ADDRESSING_MIRRORONCE,
 };
 
+/* the values are stored by the clients, new formats are appended */
 enum gfx_format
 {
 	GFX_DEPTH24_STENCIL8,
@@ -160,6 +162,20 @@ enum gfx_format
 	GFX_BC1_RGBA,
 	GFX_BC2_RGBA,
 	GFX_BC3_RGBA,
+	GFX_BC4_R,
+	GFX_BC5_RG,
+	GFX_BC6H_RGB_UFLOAT,
+	GFX_BC7_RGBA,
+	GFX_ETC2_RGB,
+	GFX_ETC2_RGBA,
+	GFX_EAC_R,
+	GFX_EAC_RG,
+	GFX_R11G11B10F,
+	GFX_R16G16F,
+	GFX_R16F,
+	GFX_R32F,
+	GFX_D16,
+	GFX_D32F,
 };
 
 enum gfx_shader_type
@@ -169,6 +185,15 @@ enum gfx_shader_type
 	GFX_SHADER_GEOMETRY,
 };
 
+/* gl shaders are compiled on their first program cache miss, or asynchronously */
+enum gfx_shader_status
+{
+	GFX_SHADER_PENDING,
+	GFX_SHADER_COMPILING,
+	GFX_SHADER_COMPILED,
+	GFX_SHADER_FAILED,
+};
+
 enum gfx_buffer_bit
 {
 	GFX_BUFFER_COLOR_BIT = 0x1,
@@ -176,6 +201,32 @@ enum gfx_buffer_bit
 	GFX_BUFFER_STENCIL_BIT = 0x4,
 };
 
+enum gfx_load_action
+{
+	GFX_LOAD_ACTION_LOAD,
+	GFX_LOAD_ACTION_CLEAR,
+	GFX_LOAD_ACTION_DONT_CARE,
+};
+
+enum gfx_store_action
+{
+	GFX_STORE_ACTION_STORE,
+	GFX_STORE_ACTION_DONT_CARE,
+};
+
+enum gfx_memory_category
+{
+	GFX_MEMORY_BUFFER,
+	GFX_MEMORY_TEXTURE,
+	GFX_MEMORY_RENDER_TARGET, /* multisample and depth stencil textures */
+	GFX_MEMORY_ALLOCATION, /* device memory blocks of the backends allocating them, the resources above included */
+	GFX_MEMORY_CATEGORIES,
+};
+
+/* the actions of a render pass are indexed by draw buffer, the depth stencil one coming after them */
+#define GFX_RENDER_PASS_DEPTH_STENCIL 8
+#define GFX_RENDER_PASS_ATTACHMENTS 9
+
 enum gfx_primitive_type
 {
 	GFX_PRIMITIVE_TRIANGLES,
@@ -248,7 +299,10 @@ typedef struct gfx_buffer_s
 	enum gfx_buffer_usage usage;
 	enum gfx_buffer_type type;
 	uint32_t size;
-	void *map;
+	void *map; /* may move on gfx_set_buffer_data and eviction */
+	gfx_native_handle_t shadow; /* CPU copy kept by the backend */
+	uint32_t memory_tag;
+	gfx_residency_t *residency; /* only set for evictable buffers */
 } gfx_buffer_t;
 
 #define GFX_TEXTURE_INIT() (gfx_texture_t){.handle = GFX_HANDLE_INIT}
@@ -275,6 +329,8 @@ typedef struct gfx_texture_s
 	uint32_t max_level;
 	uint8_t lod;
 	uint8_t samples;
+	uint32_t memory_tag;
+	gfx_residency_t *residency; /* only set for evictable textures */
 } gfx_texture_t;
 
 #define GFX_BLEND_STATE_INIT() (gfx_blend_state_t){.handle = GFX_HANDLE_INIT}
@@ -339,6 +395,7 @@ typedef struct gfx_shader_s
 	gfx_device_t *device;
 	gfx_native_handle_t handle;
 	enum gfx_shader_type type;
+	enum gfx_shader_status status;
 	uint8_t *code;
 	uint32_t code_size;
 } gfx_shader_t;
@@ -437,6 +494,14 @@ typedef struct gfx_pipeline_state_s
 
 #define GFX_PIPELINE_STATE_INIT() (gfx_pipeline_state_t){.handle = GFX_HANDLE_INIT}
 
+typedef struct gfx_command_list_s
+{
+	gfx_device_t *device;
+	gfx_native_handle_t handle;
+} gfx_command_list_t;
+
+#define GFX_COMMAND_LIST_INIT() (gfx_command_list_t){.handle = GFX_HANDLE_INIT}
+
 #ifdef __cplusplus
 }
 #endif
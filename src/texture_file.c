@@ -0,0 +1,588 @@
+#include "texture_file.h"
+#include "config.h"
+#include "window.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#define FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define DDS_MAGIC FOURCC('D', 'D', 'S', ' ')
+#define DDS_HEADER_SIZE 128 /* magic included */
+#define DDS_DX10_HEADER_SIZE 20
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDPF_ALPHAPIXELS 0x1
+#define DDPF_FOURCC 0x4
+#define DDPF_RGB 0x40
+#define DDSCAPS2_CUBEMAP 0x200
+#define DDSCAPS2_VOLUME 0x200000
+#define DDS_DIMENSION_TEXTURE3D 4
+#define DDS_MISC_TEXTURECUBE 0x4
+
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_SIZE 24
+#define KTX2_BASISLZ 1
+
+static const uint8_t ktx2_identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+/* only the formats whose texel layout is the one of the gfx format */
+static const struct
+{
+	uint32_t dxgi_format;
+	enum gfx_format format;
+} dds_formats[] =
+{
+	{6,   GFX_RGB32F},
+	{26,  GFX_R11G11B10F},
+	{34,  GFX_R16G16F},
+	{40,  GFX_D32F},
+	{41,  GFX_R32F},
+	{49,  GFX_R8G8},
+	{54,  GFX_R16F},
+	{55,  GFX_D16},
+	{61,  GFX_R8},
+	{71,  GFX_BC1_RGBA},
+	{74,  GFX_BC2_RGBA},
+	{77,  GFX_BC3_RGBA},
+	{80,  GFX_BC4_R},
+	{83,  GFX_BC5_RG},
+	{86,  GFX_B5G5R5A1},
+	{87,  GFX_B8G8R8A8},
+	{95,  GFX_BC6H_RGB_UFLOAT},
+	{98,  GFX_BC7_RGBA},
+};
+
+static const struct
+{
+	uint32_t vk_format;
+	enum gfx_format format;
+} ktx2_formats[] =
+{
+	{5,   GFX_B5G6R5},
+	{8,   GFX_B5G5R5A1},
+	{9,   GFX_R8},
+	{16,  GFX_R8G8},
+	{44,  GFX_B8G8R8A8},
+	{76,  GFX_R16F},
+	{83,  GFX_R16G16F},
+	{100, GFX_R32F},
+	{106, GFX_RGB32F},
+	{122, GFX_R11G11B10F},
+	{124, GFX_D16},
+	{126, GFX_D32F},
+	{131, GFX_BC1_RGB},
+	{133, GFX_BC1_RGBA},
+	{135, GFX_BC2_RGBA},
+	{137, GFX_BC3_RGBA},
+	{139, GFX_BC4_R},
+	{141, GFX_BC5_RG},
+	{143, GFX_BC6H_RGB_UFLOAT},
+	{145, GFX_BC7_RGBA},
+	{147, GFX_ETC2_RGB},
+	{151, GFX_ETC2_RGBA},
+	{153, GFX_EAC_R},
+	{155, GFX_EAC_RG},
+};
+
+typedef struct file_map_s
+{
+	const uint8_t *data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+} file_map_t;
+
+/* the arguments of gfx_create_texture, the depth being the layers count of arrays */
+typedef struct texture_params_s
+{
+	enum gfx_texture_type type;
+	enum gfx_format format;
+	uint8_t lod;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+} texture_params_t;
+
+#ifdef _WIN32
+
+static bool map_file(file_map_t *map, const char *path)
+{
+	map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (map->file == INVALID_HANDLE_VALUE)
+	{
+		GFX_ERROR_CALLBACK("failed to open %s: %lu", path, (unsigned long)GetLastError());
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(map->file, &size) || !size.QuadPart)
+	{
+		GFX_ERROR_CALLBACK("failed to get %s size", path);
+		CloseHandle(map->file);
+		return false;
+	}
+	map->size = size.QuadPart;
+	map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!map->mapping)
+	{
+		GFX_ERROR_CALLBACK("failed to map %s: %lu", path, (unsigned long)GetLastError());
+		CloseHandle(map->file);
+		return false;
+	}
+	map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!map->data)
+	{
+		GFX_ERROR_CALLBACK("failed to map %s: %lu", path, (unsigned long)GetLastError());
+		CloseHandle(map->mapping);
+		CloseHandle(map->file);
+		return false;
+	}
+	return true;
+}
+
+static void unmap_file(file_map_t *map)
+{
+	UnmapViewOfFile(map->data);
+	CloseHandle(map->mapping);
+	CloseHandle(map->file);
+}
+
+#else
+
+static bool map_file(file_map_t *map, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		GFX_ERROR_CALLBACK("failed to open %s: %s (%d)", path, strerror(errno), errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+	{
+		GFX_ERROR_CALLBACK("failed to stat %s: %s (%d)", path, strerror(errno), errno);
+		close(fd);
+		return false;
+	}
+	if (!st.st_size)
+	{
+		GFX_ERROR_CALLBACK("empty texture file %s", path);
+		close(fd);
+		return false;
+	}
+	map->size = st.st_size;
+	void *data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		GFX_ERROR_CALLBACK("failed to map %s: %s (%d)", path, strerror(errno), errno);
+		return false;
+	}
+	/* the levels are read once, in file order */
+	posix_madvise(data, map->size, POSIX_MADV_SEQUENTIAL);
+	map->data = data;
+	return true;
+}
+
+static void unmap_file(file_map_t *map)
+{
+	munmap((void*)map->data, map->size);
+}
+
+#endif
+
+static uint32_t read_u32(const uint8_t *data)
+{
+	uint32_t v;
+	memcpy(&v, data, sizeof(v));
+	return v;
+}
+
+static uint64_t read_u64(const uint8_t *data)
+{
+	uint64_t v;
+	memcpy(&v, data, sizeof(v));
+	return v;
+}
+
+static uint32_t level_dim(uint32_t dim, uint8_t level)
+{
+	dim >>= level;
+	return dim ? dim : 1;
+}
+
+static uint32_t max_lod(const texture_params_t *params)
+{
+	uint32_t size = params->width > params->height ? params->width : params->height;
+	if (params->type == GFX_TEXTURE_3D && params->depth > size)
+		size = params->depth;
+	uint32_t lod = 1;
+	while (size >>= 1)
+		lod++;
+	return lod;
+}
+
+/* the header is untrusted, so its dimensions are bounded by the device limits before any level size is computed */
+static bool check_params(gfx_device_t *device, const texture_params_t *params, uint32_t lod)
+{
+	if (!params->width || !params->height || !params->depth || !lod)
+		return false;
+	if (params->type == GFX_TEXTURE_3D)
+	{
+		if (params->width > device->max_texture_3d_size
+		 || params->height > device->max_texture_3d_size
+		 || params->depth > device->max_texture_3d_size)
+			return false;
+	}
+	else if (params->width > device->max_texture_size
+	      || params->height > device->max_texture_size
+	      || params->depth > device->max_texture_layers)
+	{
+		return false;
+	}
+	return lod <= max_lod(params);
+}
+
+static bool create_texture(gfx_device_t *device, gfx_texture_t *texture, const texture_params_t *params)
+{
+	return gfx_create_texture(device, texture, params->type, params->format, params->lod, params->width, params->height, params->depth);
+}
+
+static bool dds_legacy_format(const uint8_t *header, enum gfx_format *format)
+{
+	uint32_t flags = read_u32(&header[80]);
+	if (flags & DDPF_FOURCC)
+	{
+		switch (read_u32(&header[84]))
+		{
+			case FOURCC('D', 'X', 'T', '1'):
+				*format = (flags & DDPF_ALPHAPIXELS) ? GFX_BC1_RGBA : GFX_BC1_RGB;
+				return true;
+			case FOURCC('D', 'X', 'T', '3'):
+				*format = GFX_BC2_RGBA;
+				return true;
+			case FOURCC('D', 'X', 'T', '5'):
+				*format = GFX_BC3_RGBA;
+				return true;
+			case FOURCC('A', 'T', 'I', '1'):
+			case FOURCC('B', 'C', '4', 'U'):
+				*format = GFX_BC4_R;
+				return true;
+			case FOURCC('A', 'T', 'I', '2'):
+			case FOURCC('B', 'C', '5', 'U'):
+				*format = GFX_BC5_RG;
+				return true;
+		}
+		return false;
+	}
+	if ((flags & DDPF_RGB)
+	 && read_u32(&header[88]) == 32
+	 && read_u32(&header[92]) == 0x00FF0000
+	 && read_u32(&header[96]) == 0x0000FF00
+	 && read_u32(&header[100]) == 0x000000FF
+	 && read_u32(&header[104]) == 0xFF000000)
+	{
+		*format = GFX_B8G8R8A8;
+		return true;
+	}
+	return false;
+}
+
+static bool dds_dxgi_format(uint32_t dxgi_format, enum gfx_format *format)
+{
+	for (size_t i = 0; i < sizeof(dds_formats) / sizeof(*dds_formats); ++i)
+	{
+		if (dds_formats[i].dxgi_format == dxgi_format)
+		{
+			*format = dds_formats[i].format;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* the levels of each layer follow each other, with the slices of 3d levels */
+static bool load_dds(gfx_device_t *device, gfx_texture_t *texture, const file_map_t *map, const char *path)
+{
+	const uint8_t *header = map->data;
+	if (map->size < DDS_HEADER_SIZE || read_u32(&header[4]) != DDS_HEADER_SIZE - 4)
+	{
+		GFX_ERROR_CALLBACK("invalid dds header in %s", path);
+		return false;
+	}
+	texture_params_t params;
+	params.width = read_u32(&header[16]);
+	params.height = read_u32(&header[12]);
+	params.depth = 1;
+	params.type = GFX_TEXTURE_2D;
+	uint32_t lod = (read_u32(&header[8]) & DDSD_MIPMAPCOUNT) ? read_u32(&header[28]) : 1;
+	if (!lod)
+		lod = 1;
+	uint32_t layers = 1;
+	uint32_t caps2 = read_u32(&header[112]);
+	size_t offset = DDS_HEADER_SIZE;
+	if (caps2 & DDSCAPS2_CUBEMAP)
+	{
+		GFX_ERROR_CALLBACK("unsupported dds cube map in %s", path);
+		return false;
+	}
+	if (caps2 & DDSCAPS2_VOLUME)
+	{
+		params.type = GFX_TEXTURE_3D;
+		params.depth = read_u32(&header[24]);
+	}
+	if ((read_u32(&header[80]) & DDPF_FOURCC) && read_u32(&header[84]) == FOURCC('D', 'X', '1', '0'))
+	{
+		if (map->size < DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE)
+		{
+			GFX_ERROR_CALLBACK("invalid dds header in %s", path);
+			return false;
+		}
+		const uint8_t *dx10 = &header[DDS_HEADER_SIZE];
+		if (read_u32(&dx10[8]) & DDS_MISC_TEXTURECUBE)
+		{
+			GFX_ERROR_CALLBACK("unsupported dds cube map in %s", path);
+			return false;
+		}
+		if (!dds_dxgi_format(read_u32(&dx10[0]), &params.format))
+		{
+			GFX_ERROR_CALLBACK("unsupported dds dxgi format %" PRIu32 " in %s", read_u32(&dx10[0]), path);
+			return false;
+		}
+		if (read_u32(&dx10[4]) == DDS_DIMENSION_TEXTURE3D)
+		{
+			params.type = GFX_TEXTURE_3D;
+			params.depth = read_u32(&header[24]);
+		}
+		else
+		{
+			layers = read_u32(&dx10[12]);
+			if (layers > 1)
+			{
+				params.type = GFX_TEXTURE_2D_ARRAY;
+				params.depth = layers;
+			}
+		}
+		offset += DDS_DX10_HEADER_SIZE;
+	}
+	else if (!dds_legacy_format(header, &params.format))
+	{
+		GFX_ERROR_CALLBACK("unsupported dds pixel format in %s", path);
+		return false;
+	}
+	if (!layers || !check_params(device, &params, lod))
+	{
+		GFX_ERROR_CALLBACK("invalid dds dimensions in %s", path);
+		return false;
+	}
+	params.lod = lod;
+	/* the first level is the largest, and is uploaded with a 32 bits size */
+	uint64_t chain = 0;
+	for (uint8_t level = 0; level < params.lod; ++level)
+		chain += gfx_texture_level_size(params.format, level_dim(params.width, level), level_dim(params.height, level), params.type == GFX_TEXTURE_3D ? level_dim(params.depth, level) : 1);
+	if (gfx_texture_level_size(params.format, params.width, params.height, params.type == GFX_TEXTURE_3D ? params.depth : 1) > UINT32_MAX
+	 || chain * layers > map->size - offset)
+	{
+		GFX_ERROR_CALLBACK("truncated dds file %s", path);
+		return false;
+	}
+	if (!create_texture(device, texture, &params))
+		return false;
+	for (uint32_t layer = 0; layer < layers; ++layer)
+	{
+		for (uint8_t level = 0; level < params.lod; ++level)
+		{
+			uint32_t width = level_dim(params.width, level);
+			uint32_t height = level_dim(params.height, level);
+			uint32_t depth = params.type == GFX_TEXTURE_3D ? level_dim(params.depth, level) : 1;
+			uint32_t size = gfx_texture_level_size(params.format, width, height, depth);
+			gfx_set_texture_data(texture, level, layer, width, height, depth, size, &map->data[offset]);
+			offset += size;
+		}
+	}
+	return true;
+}
+
+static bool ktx2_format(uint32_t vk_format, enum gfx_format *format)
+{
+	for (size_t i = 0; i < sizeof(ktx2_formats) / sizeof(*ktx2_formats); ++i)
+	{
+		if (ktx2_formats[i].vk_format == vk_format)
+		{
+			*format = ktx2_formats[i].format;
+			return true;
+		}
+	}
+	return false;
+}
+
+typedef struct ktx2_level_s
+{
+	uint64_t offset;
+	uint64_t length;
+	uint64_t uncompressed_length;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint64_t size;
+} ktx2_level_t;
+
+static bool read_ktx2_level(const file_map_t *map, const texture_params_t *params, uint32_t scheme, uint8_t level, ktx2_level_t *info)
+{
+	const uint8_t *index = &map->data[KTX2_HEADER_SIZE + level * KTX2_LEVEL_SIZE];
+	info->offset = read_u64(&index[0]);
+	info->length = read_u64(&index[8]);
+	info->uncompressed_length = scheme ? read_u64(&index[16]) : info->length;
+	info->width = level_dim(params->width, level);
+	info->height = level_dim(params->height, level);
+	info->depth = params->type == GFX_TEXTURE_3D ? level_dim(params->depth, level) : params->depth;
+	info->size = gfx_texture_level_size(params->format, info->width, info->height, info->depth);
+	return info->offset <= map->size
+	    && info->length <= map->size - info->offset
+	    && info->size <= UINT32_MAX
+	    && info->uncompressed_length >= info->size;
+}
+
+/* each level holds all its layers, and is decoded to a scratch buffer when supercompressed */
+static bool load_ktx2(gfx_device_t *device, gfx_texture_t *texture, const file_map_t *map, const char *path, gfx_texture_file_decode_fn_t decode, void *userdata)
+{
+	const uint8_t *header = map->data;
+	if (map->size < KTX2_HEADER_SIZE)
+	{
+		GFX_ERROR_CALLBACK("invalid ktx2 header in %s", path);
+		return false;
+	}
+	texture_params_t params;
+	if (!ktx2_format(read_u32(&header[12]), &params.format))
+	{
+		GFX_ERROR_CALLBACK("unsupported ktx2 vk format %" PRIu32 " in %s", read_u32(&header[12]), path);
+		return false;
+	}
+	params.width = read_u32(&header[20]);
+	params.height = read_u32(&header[24]);
+	uint32_t pixel_depth = read_u32(&header[28]);
+	uint32_t layers = read_u32(&header[32]);
+	uint32_t lod = read_u32(&header[40]);
+	uint32_t scheme = read_u32(&header[44]);
+	if (read_u32(&header[36]) != 1)
+	{
+		GFX_ERROR_CALLBACK("unsupported ktx2 cube map in %s", path);
+		return false;
+	}
+	if (scheme == KTX2_BASISLZ || (scheme && !decode))
+	{
+		GFX_ERROR_CALLBACK("unsupported ktx2 supercompression scheme %" PRIu32 " in %s", scheme, path);
+		return false;
+	}
+	if (pixel_depth)
+	{
+		params.type = GFX_TEXTURE_3D;
+		params.depth = pixel_depth;
+	}
+	else if (layers)
+	{
+		params.type = GFX_TEXTURE_2D_ARRAY;
+		params.depth = layers;
+	}
+	else
+	{
+		params.type = GFX_TEXTURE_2D;
+		params.depth = 1;
+	}
+	/* 1d textures have no height, and no level count asks for mipmaps to be generated, which isn't done */
+	if (!params.height)
+		params.height = 1;
+	if (!lod)
+		lod = 1;
+	if ((pixel_depth && layers) || !check_params(device, &params, lod))
+	{
+		GFX_ERROR_CALLBACK("invalid ktx2 dimensions in %s", path);
+		return false;
+	}
+	params.lod = lod;
+	if (map->size - KTX2_HEADER_SIZE < (size_t)lod * KTX2_LEVEL_SIZE)
+	{
+		GFX_ERROR_CALLBACK("invalid ktx2 level index in %s", path);
+		return false;
+	}
+	/* every level is checked before the first upload, the scratch buffer holding the largest decoded one */
+	uint64_t scratch_size = 0;
+	for (uint8_t level = 0; level < params.lod; ++level)
+	{
+		ktx2_level_t info;
+		if (!read_ktx2_level(map, &params, scheme, level, &info))
+		{
+			GFX_ERROR_CALLBACK("invalid ktx2 level %" PRIu8 " in %s", level, path);
+			return false;
+		}
+		if (scheme && info.uncompressed_length > scratch_size)
+			scratch_size = info.uncompressed_length;
+	}
+	void *scratch = NULL;
+	if (scheme && (scratch_size != (size_t)scratch_size || !(scratch = GFX_MALLOC(scratch_size))))
+	{
+		GFX_ERROR_CALLBACK("texture file allocation failed: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	if (!create_texture(device, texture, &params))
+	{
+		GFX_FREE(scratch);
+		return false;
+	}
+	for (uint8_t level = 0; level < params.lod; ++level)
+	{
+		ktx2_level_t info;
+		read_ktx2_level(map, &params, scheme, level, &info);
+		const void *data = &map->data[info.offset];
+		if (scheme)
+		{
+			if (!decode(userdata, scheme, data, info.length, scratch, info.uncompressed_length))
+			{
+				GFX_ERROR_CALLBACK("failed to decode ktx2 level %" PRIu8 " in %s", level, path);
+				goto err;
+			}
+			data = scratch;
+		}
+		gfx_set_texture_data(texture, level, 0, info.width, info.height, info.depth, info.size, data);
+	}
+	GFX_FREE(scratch);
+	return true;
+
+err:
+	gfx_delete_texture(device, texture);
+	GFX_FREE(scratch);
+	return false;
+}
+
+bool gfx_texture_load_file(gfx_device_t *device, gfx_texture_t *texture, const char *path, gfx_texture_file_decode_fn_t decode, void *userdata)
+{
+	file_map_t map;
+	if (!map_file(&map, path))
+		return false;
+	bool ret;
+	if (map.size >= 4 && read_u32(map.data) == DDS_MAGIC)
+	{
+		ret = load_dds(device, texture, &map, path);
+	}
+	else if (map.size >= sizeof(ktx2_identifier) && !memcmp(map.data, ktx2_identifier, sizeof(ktx2_identifier)))
+	{
+		ret = load_ktx2(device, texture, &map, path, decode, userdata);
+	}
+	else
+	{
+		GFX_ERROR_CALLBACK("unknown texture file format: %s", path);
+		ret = false;
+	}
+	unmap_file(&map);
+	return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef GFX_TEXTURE_FILE_H
+#define GFX_TEXTURE_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "device.h"
+
+#define GFX_TEXTURE_FILE_KTX2_ZSTD 2
+#define GFX_TEXTURE_FILE_KTX2_ZLIB 3
+
+/* decodes a supercompressed ktx2 level, of all its layers, to its uncompressed size */
+typedef bool (*gfx_texture_file_decode_fn_t)(void *userdata, uint32_t scheme, const void *src, size_t src_size, void *dst, size_t dst_size);
+
+/* the dds or ktx2 file is mapped and its levels uploaded from the mapping, only the supercompressed levels
+ * being decoded to memory, cube maps and basis supercompression aren't supported, and without decode function
+ * the supercompressed files fail to load, the files over the device texture limits or shorter than their levels
+ * are refused before the texture is created
+ */
+bool gfx_texture_load_file(gfx_device_t *device, gfx_texture_t *texture, const char *path, gfx_texture_file_decode_fn_t decode, void *userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,309 @@
+#include "texture_pool.h"
+#include "config.h"
+#include "window.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+/* the texture is the first member, so that the pointer handed out is the entry */
+typedef struct pool_texture_s
+{
+	gfx_texture_t texture;
+	gfx_texture_desc_t desc;
+	uint64_t release_frame;
+	bool used;
+} pool_texture_t;
+
+typedef struct pool_render_target_s
+{
+	gfx_render_target_t render_target;
+	const gfx_texture_t *colors[GFX_TEXTURE_POOL_COLORS];
+	uint32_t colors_count;
+	const gfx_texture_t *depth_stencil;
+	uint64_t release_frame;
+	bool used;
+} pool_render_target_t;
+
+struct gfx_texture_pool_s
+{
+	gfx_device_t *device;
+	uint64_t frame;
+	uint64_t generation;
+	pool_texture_t **textures;
+	uint32_t textures_count;
+	pool_render_target_t **render_targets;
+	uint32_t render_targets_count;
+};
+
+gfx_texture_pool_t *gfx_texture_pool_new(gfx_device_t *device)
+{
+	gfx_texture_pool_t *pool = GFX_MALLOC(sizeof(*pool));
+	if (!pool)
+	{
+		GFX_ERROR_CALLBACK("texture pool allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	pool->device = device;
+	pool->frame = 1;
+	pool->generation = 0;
+	pool->textures = NULL;
+	pool->textures_count = 0;
+	pool->render_targets = NULL;
+	pool->render_targets_count = 0;
+	return pool;
+}
+
+static void delete_render_target(gfx_texture_pool_t *pool, uint32_t index)
+{
+	pool_render_target_t *entry = pool->render_targets[index];
+	gfx_delete_render_target(pool->device, &entry->render_target);
+	GFX_FREE(entry);
+	pool->render_targets[index] = pool->render_targets[--pool->render_targets_count];
+}
+
+static void delete_texture(gfx_texture_pool_t *pool, uint32_t index)
+{
+	pool_texture_t *entry = pool->textures[index];
+	gfx_delete_texture(pool->device, &entry->texture);
+	GFX_FREE(entry);
+	pool->textures[index] = pool->textures[--pool->textures_count];
+	pool->generation++;
+}
+
+void gfx_texture_pool_delete(gfx_texture_pool_t *pool)
+{
+	if (!pool)
+		return;
+	while (pool->render_targets_count)
+		delete_render_target(pool, 0);
+	while (pool->textures_count)
+		delete_texture(pool, 0);
+	GFX_FREE(pool->render_targets);
+	GFX_FREE(pool->textures);
+	GFX_FREE(pool);
+}
+
+static bool references_texture(const pool_render_target_t *entry, const gfx_texture_t *texture)
+{
+	if (entry->depth_stencil == texture)
+		return true;
+	for (uint32_t i = 0; i < entry->colors_count; ++i)
+	{
+		if (entry->colors[i] == texture)
+			return true;
+	}
+	return false;
+}
+
+/* the render targets go before their textures, the deleted textures taking the render targets referencing them */
+void gfx_texture_pool_tick(gfx_texture_pool_t *pool)
+{
+	pool->frame++;
+	for (uint32_t i = 0; i < pool->render_targets_count;)
+	{
+		const pool_render_target_t *entry = pool->render_targets[i];
+		if (!entry->used && pool->frame - entry->release_frame > GFX_TEXTURE_POOL_FRAMES)
+			delete_render_target(pool, i);
+		else
+			++i;
+	}
+	for (uint32_t i = 0; i < pool->textures_count;)
+	{
+		const pool_texture_t *entry = pool->textures[i];
+		if (entry->used || pool->frame - entry->release_frame <= GFX_TEXTURE_POOL_FRAMES)
+		{
+			++i;
+			continue;
+		}
+		for (uint32_t j = 0; j < pool->render_targets_count;)
+		{
+			if (references_texture(pool->render_targets[j], &entry->texture))
+				delete_render_target(pool, j);
+			else
+				++j;
+		}
+		delete_texture(pool, i);
+	}
+}
+
+bool gfx_texture_desc_equal(const gfx_texture_desc_t *a, const gfx_texture_desc_t *b)
+{
+	return a->type == b->type
+	    && a->format == b->format
+	    && a->width == b->width
+	    && a->height == b->height
+	    && a->depth == b->depth
+	    && a->samples == b->samples
+	    && a->lod == b->lod;
+}
+
+static bool is_multisample(enum gfx_texture_type type)
+{
+	return type == GFX_TEXTURE_2D_MS || type == GFX_TEXTURE_2D_ARRAY_MS;
+}
+
+gfx_texture_t *gfx_texture_pool_acquire(gfx_texture_pool_t *pool, const gfx_texture_desc_t *desc)
+{
+	for (uint32_t i = 0; i < pool->textures_count; ++i)
+	{
+		pool_texture_t *entry = pool->textures[i];
+		if (entry->used || entry->release_frame >= pool->frame || !gfx_texture_desc_equal(&entry->desc, desc))
+			continue;
+		entry->used = true;
+		return &entry->texture;
+	}
+	pool_texture_t **textures = GFX_REALLOC(pool->textures, sizeof(*textures) * (pool->textures_count + 1));
+	if (!textures)
+	{
+		GFX_ERROR_CALLBACK("texture pool allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	pool->textures = textures;
+	pool_texture_t *entry = GFX_MALLOC(sizeof(*entry));
+	if (!entry)
+	{
+		GFX_ERROR_CALLBACK("texture pool allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	entry->texture = GFX_TEXTURE_INIT();
+	/* like gfx_create_texture, the lod of multisample textures is their samples count */
+	if (!gfx_create_texture(pool->device, &entry->texture, desc->type, desc->format, is_multisample(desc->type) ? desc->samples : desc->lod, desc->width, desc->height, desc->depth))
+	{
+		GFX_FREE(entry);
+		return NULL;
+	}
+	entry->desc = *desc;
+	entry->release_frame = 0;
+	entry->used = true;
+	pool->textures[pool->textures_count++] = entry;
+	return &entry->texture;
+}
+
+static pool_texture_t *find_texture(gfx_texture_pool_t *pool, const gfx_texture_t *texture)
+{
+	for (uint32_t i = 0; i < pool->textures_count; ++i)
+	{
+		if (&pool->textures[i]->texture == texture)
+			return pool->textures[i];
+	}
+	return NULL;
+}
+
+uint64_t gfx_texture_pool_generation(const gfx_texture_pool_t *pool)
+{
+	return pool->generation;
+}
+
+void gfx_texture_pool_release(gfx_texture_pool_t *pool, gfx_texture_t *texture)
+{
+	if (!texture)
+		return;
+	pool_texture_t *entry = find_texture(pool, texture);
+	if (!entry || !entry->used)
+	{
+		GFX_ERROR_CALLBACK("released texture isn't used from the pool");
+		return;
+	}
+	entry->used = false;
+	entry->release_frame = pool->frame;
+}
+
+static bool same_attachments(const pool_render_target_t *entry, const gfx_texture_t **colors, uint32_t colors_count, const gfx_texture_t *depth_stencil)
+{
+	if (entry->colors_count != colors_count || entry->depth_stencil != depth_stencil)
+		return false;
+	for (uint32_t i = 0; i < colors_count; ++i)
+	{
+		if (entry->colors[i] != colors[i])
+			return false;
+	}
+	return true;
+}
+
+static pool_render_target_t *create_render_target(gfx_texture_pool_t *pool, const gfx_texture_t **colors, uint32_t colors_count, const gfx_texture_t *depth_stencil)
+{
+	pool_render_target_t **render_targets = GFX_REALLOC(pool->render_targets, sizeof(*render_targets) * (pool->render_targets_count + 1));
+	if (!render_targets)
+	{
+		GFX_ERROR_CALLBACK("texture pool allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	pool->render_targets = render_targets;
+	pool_render_target_t *entry = GFX_MALLOC(sizeof(*entry));
+	if (!entry)
+	{
+		GFX_ERROR_CALLBACK("texture pool allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	entry->render_target = GFX_RENDER_TARGET_INIT();
+	if (!gfx_create_render_target(pool->device, &entry->render_target))
+	{
+		GFX_FREE(entry);
+		return NULL;
+	}
+	uint32_t draw_buffers[GFX_TEXTURE_POOL_COLORS];
+	for (uint32_t i = 0; i < colors_count; ++i)
+	{
+		entry->colors[i] = colors[i];
+		gfx_set_render_target_texture(&entry->render_target, GFX_RENDERTARGET_ATTACHMENT_COLOR0 + i, colors[i]);
+		draw_buffers[i] = GFX_RENDERTARGET_ATTACHMENT_COLOR0 + i;
+	}
+	entry->colors_count = colors_count;
+	entry->depth_stencil = depth_stencil;
+	if (depth_stencil)
+		gfx_set_render_target_texture(&entry->render_target, GFX_RENDERTARGET_ATTACHMENT_DEPTH_STENCIL, depth_stencil);
+	gfx_set_render_target_draw_buffers(&entry->render_target, draw_buffers, colors_count);
+	pool->render_targets[pool->render_targets_count++] = entry;
+	return entry;
+}
+
+/* a render target only renders to its textures, so it can be handed out again in the frame it is released */
+gfx_render_target_t *gfx_texture_pool_acquire_render_target(gfx_texture_pool_t *pool, const gfx_texture_t **colors, uint32_t colors_count, const gfx_texture_t *depth_stencil)
+{
+	if (colors_count > GFX_TEXTURE_POOL_COLORS)
+	{
+		GFX_ERROR_CALLBACK("too many render target colors: %" PRIu32, colors_count);
+		return NULL;
+	}
+	for (uint32_t i = 0; i <= colors_count; ++i)
+	{
+		const gfx_texture_t *texture = i < colors_count ? colors[i] : depth_stencil;
+		if ((i < colors_count || texture) && !find_texture(pool, texture))
+		{
+			GFX_ERROR_CALLBACK("render target texture isn't from the pool");
+			return NULL;
+		}
+	}
+	for (uint32_t i = 0; i < pool->render_targets_count; ++i)
+	{
+		pool_render_target_t *entry = pool->render_targets[i];
+		if (entry->used || !same_attachments(entry, colors, colors_count, depth_stencil))
+			continue;
+		entry->used = true;
+		return &entry->render_target;
+	}
+	pool_render_target_t *entry = create_render_target(pool, colors, colors_count, depth_stencil);
+	if (!entry)
+		return NULL;
+	entry->used = true;
+	return &entry->render_target;
+}
+
+void gfx_texture_pool_release_render_target(gfx_texture_pool_t *pool, gfx_render_target_t *render_target)
+{
+	if (!render_target)
+		return;
+	for (uint32_t i = 0; i < pool->render_targets_count; ++i)
+	{
+		pool_render_target_t *entry = pool->render_targets[i];
+		if (&entry->render_target != render_target)
+			continue;
+		if (!entry->used)
+			break;
+		entry->used = false;
+		entry->release_frame = pool->frame;
+		return;
+	}
+	GFX_ERROR_CALLBACK("released render target isn't used from the pool");
+}
@@ -0,0 +1,48 @@
+#ifndef GFX_TEXTURE_POOL_H
+#define GFX_TEXTURE_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "device.h"
+
+#define GFX_TEXTURE_POOL_COLORS 4
+#define GFX_TEXTURE_POOL_FRAMES 4 /* released entries unused for longer are deleted */
+
+typedef struct gfx_texture_pool_s gfx_texture_pool_t;
+
+typedef struct gfx_texture_desc_s
+{
+	enum gfx_texture_type type;
+	enum gfx_format format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint8_t samples; /* multisample types only */
+	uint8_t lod;
+} gfx_texture_desc_t;
+
+/* released textures are handed out again a frame later, once the gpu is done with them,
+ * and the render targets are kept by attachment set so that their framebuffers aren't built again
+ */
+gfx_texture_pool_t *gfx_texture_pool_new(gfx_device_t *device);
+void gfx_texture_pool_delete(gfx_texture_pool_t *pool);
+void gfx_texture_pool_tick(gfx_texture_pool_t *pool);
+
+gfx_texture_t *gfx_texture_pool_acquire(gfx_texture_pool_t *pool, const gfx_texture_desc_t *desc);
+void gfx_texture_pool_release(gfx_texture_pool_t *pool, gfx_texture_t *texture);
+bool gfx_texture_desc_equal(const gfx_texture_desc_t *a, const gfx_texture_desc_t *b);
+
+/* changes when the pool deletes textures, whose addresses may then be handed out again */
+uint64_t gfx_texture_pool_generation(const gfx_texture_pool_t *pool);
+
+/* the attachments must be textures of the pool */
+gfx_render_target_t *gfx_texture_pool_acquire_render_target(gfx_texture_pool_t *pool, const gfx_texture_t **colors, uint32_t colors_count, const gfx_texture_t *depth_stencil);
+void gfx_texture_pool_release_render_target(gfx_texture_pool_t *pool, gfx_render_target_t *render_target);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+#include "texture_streamer.h"
+#include "config.h"
+#include "window.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* the texture is the first member, so that the pointer handed out stays the entry */
+typedef struct stream_texture_s
+{
+	gfx_texture_t texture;
+	gfx_texture_stream_load_fn_t load;
+	void *userdata;
+	enum gfx_texture_type type;
+	enum gfx_format format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint8_t lod;
+	uint8_t tail; /* first level always resident */
+	uint8_t allocated; /* first level of the texture storage */
+	uint8_t resident; /* first uploaded level */
+	uint8_t wanted;
+	uint32_t drop_frames;
+	float screen_size;
+	float priority;
+	bool used;
+} stream_texture_t;
+
+struct gfx_texture_streamer_s
+{
+	gfx_device_t *device;
+	uint64_t budget;
+	uint64_t usage;
+	stream_texture_t **textures;
+	stream_texture_t **order; /* by priority, rebuilt every tick */
+	uint32_t textures_count;
+};
+
+gfx_texture_streamer_t *gfx_texture_streamer_new(gfx_device_t *device, uint64_t budget)
+{
+	gfx_texture_streamer_t *streamer = GFX_MALLOC(sizeof(*streamer));
+	if (!streamer)
+	{
+		GFX_ERROR_CALLBACK("texture streamer allocation failed: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+	streamer->device = device;
+	streamer->budget = budget;
+	streamer->usage = 0;
+	streamer->textures = NULL;
+	streamer->order = NULL;
+	streamer->textures_count = 0;
+	return streamer;
+}
+
+void gfx_texture_streamer_delete(gfx_texture_streamer_t *streamer)
+{
+	if (!streamer)
+		return;
+	for (uint32_t i = 0; i < streamer->textures_count; ++i)
+	{
+		gfx_delete_texture(streamer->device, &streamer->textures[i]->texture);
+		GFX_FREE(streamer->textures[i]);
+	}
+	GFX_FREE(streamer->textures);
+	GFX_FREE(streamer->order);
+	GFX_FREE(streamer);
+}
+
+void gfx_texture_streamer_set_budget(gfx_texture_streamer_t *streamer, uint64_t budget)
+{
+	streamer->budget = budget;
+}
+
+uint64_t gfx_texture_streamer_usage(const gfx_texture_streamer_t *streamer)
+{
+	return streamer->usage;
+}
+
+static uint32_t level_dim(uint32_t dim, uint8_t level)
+{
+	dim >>= level;
+	return dim ? dim : 1;
+}
+
+static uint64_t chain_size(const stream_texture_t *entry, uint8_t first)
+{
+	uint64_t size = 0;
+	for (uint8_t level = first; level < entry->lod; ++level)
+		size += gfx_texture_level_size(entry->format, level_dim(entry->width, level), level_dim(entry->height, level), entry->depth);
+	return size;
+}
+
+static bool upload_level(stream_texture_t *entry, gfx_texture_t *texture, uint8_t first, uint8_t level)
+{
+	uint32_t size;
+	const void *data = entry->load(entry->userdata, level, &size);
+	if (!data)
+	{
+		GFX_ERROR_CALLBACK("failed to load level %" PRIu8 " of streamed texture", level);
+		return false;
+	}
+	gfx_set_texture_data(texture, level - first, 0, level_dim(entry->width, level), level_dim(entry->height, level), entry->depth, size, data);
+	return true;
+}
+
+static void clamp_levels(stream_texture_t *entry)
+{
+	gfx_set_texture_levels(&entry->texture, entry->resident - entry->allocated, entry->lod - 1 - entry->allocated);
+}
+
+/* textures can't be resized, so the levels kept are uploaded again to a texture allocated from the first one */
+static bool allocate(gfx_texture_streamer_t *streamer, stream_texture_t *entry, uint8_t first)
+{
+	gfx_texture_t texture = GFX_TEXTURE_INIT();
+	if (!gfx_create_texture(streamer->device, &texture, entry->type, entry->format, entry->lod - first, level_dim(entry->width, first), level_dim(entry->height, first), entry->depth))
+		return false;
+	uint8_t resident = entry->resident > first ? entry->resident : first;
+	for (uint8_t level = entry->lod; level > resident; --level)
+	{
+		if (!upload_level(entry, &texture, first, level - 1))
+		{
+			gfx_delete_texture(streamer->device, &texture);
+			return false;
+		}
+	}
+	if (entry->texture.handle.u64)
+	{
+		gfx_set_texture_addressing(&texture, entry->texture.addressing_s, entry->texture.addressing_t, entry->texture.addressing_r);
+		gfx_set_texture_filtering(&texture, entry->texture.min_filtering, entry->texture.mag_filtering, entry->texture.mip_filtering);
+		gfx_set_texture_anisotropy(&texture, entry->texture.anisotropy);
+		gfx_delete_texture(streamer->device, &entry->texture);
+		streamer->usage -= chain_size(entry, entry->allocated);
+	}
+	entry->texture = texture;
+	entry->allocated = first;
+	entry->resident = resident;
+	streamer->usage += chain_size(entry, first);
+	clamp_levels(entry);
+	return true;
+}
+
+uint32_t gfx_texture_streamer_add(gfx_texture_streamer_t *streamer, enum gfx_texture_type type, enum gfx_format format, uint8_t lod, uint32_t width, uint32_t height, uint32_t depth, gfx_texture_stream_load_fn_t load, void *userdata)
+{
+	if (type != GFX_TEXTURE_2D && type != GFX_TEXTURE_2D_ARRAY)
+	{
+		GFX_ERROR_CALLBACK("unsupported streamed texture type: %d", (int)type);
+		return GFX_TEXTURE_STREAMER_NONE;
+	}
+	if (!lod)
+	{
+		GFX_ERROR_CALLBACK("streamed texture without levels");
+		return GFX_TEXTURE_STREAMER_NONE;
+	}
+	uint32_t id;
+	for (id = 0; id < streamer->textures_count; ++id)
+	{
+		if (!streamer->textures[id]->used)
+			break;
+	}
+	if (id == streamer->textures_count)
+	{
+		stream_texture_t **textures = GFX_REALLOC(streamer->textures, sizeof(*textures) * (streamer->textures_count + 1));
+		if (!textures)
+		{
+			GFX_ERROR_CALLBACK("texture streamer allocation failed: %s (%d)", strerror(errno), errno);
+			return GFX_TEXTURE_STREAMER_NONE;
+		}
+		streamer->textures = textures;
+		stream_texture_t **order = GFX_REALLOC(streamer->order, sizeof(*order) * (streamer->textures_count + 1));
+		if (!order)
+		{
+			GFX_ERROR_CALLBACK("texture streamer allocation failed: %s (%d)", strerror(errno), errno);
+			return GFX_TEXTURE_STREAMER_NONE;
+		}
+		streamer->order = order;
+		stream_texture_t *entry = GFX_MALLOC(sizeof(*entry));
+		if (!entry)
+		{
+			GFX_ERROR_CALLBACK("texture streamer allocation failed: %s (%d)", strerror(errno), errno);
+			return GFX_TEXTURE_STREAMER_NONE;
+		}
+		entry->used = false;
+		streamer->textures[streamer->textures_count++] = entry;
+	}
+	stream_texture_t *entry = streamer->textures[id];
+	entry->texture = GFX_TEXTURE_INIT();
+	entry->load = load;
+	entry->userdata = userdata;
+	entry->type = type;
+	entry->format = format;
+	entry->width = width;
+	entry->height = height;
+	entry->depth = depth;
+	entry->lod = lod;
+	entry->tail = 0;
+	while (entry->tail < lod - 1 && (level_dim(width, entry->tail) > GFX_TEXTURE_STREAMER_TAIL || level_dim(height, entry->tail) > GFX_TEXTURE_STREAMER_TAIL))
+		entry->tail++;
+	entry->allocated = entry->tail;
+	entry->resident = entry->tail;
+	entry->wanted = entry->tail;
+	entry->drop_frames = 0;
+	entry->screen_size = 0;
+	entry->priority = 0;
+	if (!allocate(streamer, entry, entry->tail))
+		return GFX_TEXTURE_STREAMER_NONE;
+	entry->used = true;
+	return id;
+}
+
+void gfx_texture_streamer_remove(gfx_texture_streamer_t *streamer, uint32_t id)
+{
+	if (id >= streamer->textures_count || !streamer->textures[id]->used)
+		return;
+	stream_texture_t *entry = streamer->textures[id];
+	streamer->usage -= chain_size(entry, entry->allocated);
+	gfx_delete_texture(streamer->device, &entry->texture);
+	entry->used = false;
+}
+
+gfx_texture_t *gfx_texture_streamer_get(gfx_texture_streamer_t *streamer, uint32_t id)
+{
+	if (id >= streamer->textures_count || !streamer->textures[id]->used)
+		return NULL;
+	return &streamer->textures[id]->texture;
+}
+
+void gfx_texture_streamer_feedback(gfx_texture_streamer_t *streamer, uint32_t id, float screen_size)
+{
+	if (id >= streamer->textures_count || !streamer->textures[id]->used)
+		return;
+	stream_texture_t *entry = streamer->textures[id];
+	if (screen_size > entry->screen_size)
+		entry->screen_size = screen_size;
+}
+
+static int priority_cmp(const void *a, const void *b)
+{
+	float pa = (*(const stream_texture_t**)a)->priority;
+	float pb = (*(const stream_texture_t**)b)->priority;
+	return (pa < pb) - (pa > pb);
+}
+
+/* the coarsest level still covering the screen size */
+static uint8_t wanted_level(const stream_texture_t *entry)
+{
+	uint32_t size = entry->width > entry->height ? entry->width : entry->height;
+	uint8_t level = 0;
+	while (level < entry->tail && level_dim(size, level + 1) >= entry->screen_size)
+		level++;
+	return level;
+}
+
+/* the tails are always granted, then the wanted levels by priority, held coarser while over the budget */
+static uint32_t grant_levels(gfx_texture_streamer_t *streamer)
+{
+	uint32_t count = 0;
+	uint64_t usage = 0;
+	for (uint32_t i = 0; i < streamer->textures_count; ++i)
+	{
+		stream_texture_t *entry = streamer->textures[i];
+		if (!entry->used)
+			continue;
+		entry->wanted = wanted_level(entry);
+		entry->priority = entry->screen_size;
+		entry->screen_size = 0;
+		usage += chain_size(entry, entry->tail);
+		streamer->order[count++] = entry;
+	}
+	qsort(streamer->order, count, sizeof(*streamer->order), priority_cmp);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		stream_texture_t *entry = streamer->order[i];
+		uint64_t tail = chain_size(entry, entry->tail);
+		while (entry->wanted < entry->tail && usage - tail + chain_size(entry, entry->wanted) > streamer->budget)
+			entry->wanted++;
+		usage += chain_size(entry, entry->wanted) - tail;
+	}
+	return count;
+}
+
+void gfx_texture_streamer_tick(gfx_texture_streamer_t *streamer)
+{
+	uint32_t count = grant_levels(streamer);
+	/* the drops go first to free the budget the grows may take */
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		stream_texture_t *entry = streamer->order[i];
+		if (entry->wanted <= entry->allocated)
+		{
+			entry->drop_frames = 0;
+			continue;
+		}
+		/* kept a while unless over the budget, not to reallocate textures going back and forth */
+		if (++entry->drop_frames < GFX_TEXTURE_STREAMER_DROP_FRAMES && streamer->usage <= streamer->budget)
+			continue;
+		entry->drop_frames = 0;
+		allocate(streamer, entry, entry->wanted);
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		stream_texture_t *entry = streamer->order[i];
+		if (entry->wanted < entry->allocated)
+			allocate(streamer, entry, entry->wanted);
+	}
+	uint64_t uploaded = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		stream_texture_t *entry = streamer->order[i];
+		while (entry->resident > entry->allocated)
+		{
+			uint8_t level = entry->resident - 1;
+			uint64_t size = gfx_texture_level_size(entry->format, level_dim(entry->width, level), level_dim(entry->height, level), entry->depth);
+			if (uploaded && uploaded + size > GFX_TEXTURE_STREAMER_UPLOAD)
+				return;
+			if (!upload_level(entry, &entry->texture, entry->allocated, level))
+				break;
+			uploaded += size;
+			entry->resident = level;
+			clamp_levels(entry);
+		}
+	}
+}
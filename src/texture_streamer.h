@@ -0,0 +1,46 @@
+#ifndef GFX_TEXTURE_STREAMER_H
+#define GFX_TEXTURE_STREAMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "device.h"
+
+#define GFX_TEXTURE_STREAMER_NONE UINT32_MAX
+#define GFX_TEXTURE_STREAMER_TAIL 64 /* levels this size or smaller are always resident */
+#define GFX_TEXTURE_STREAMER_UPLOAD 4194304 /* bytes of levels uploaded per tick, one level at least */
+#define GFX_TEXTURE_STREAMER_DROP_FRAMES 30 /* frames a texture must want less before its levels are dropped */
+
+typedef struct gfx_texture_streamer_s gfx_texture_streamer_t;
+
+/* returns the tightly packed data of a level, valid until the next call */
+typedef const void *(*gfx_texture_stream_load_fn_t)(void *userdata, uint8_t level, uint32_t *size);
+
+/* the streamed textures are allocated from their finest wanted level, and their levels uploaded coarse to fine,
+ * the sampled levels being clamped to the uploaded ones, the wanted level comes from the screen size fed back
+ * every frame, and the textures seen the smallest are the first to be held coarser under the memory budget
+ */
+gfx_texture_streamer_t *gfx_texture_streamer_new(gfx_device_t *device, uint64_t budget);
+void gfx_texture_streamer_delete(gfx_texture_streamer_t *streamer);
+void gfx_texture_streamer_set_budget(gfx_texture_streamer_t *streamer, uint64_t budget);
+uint64_t gfx_texture_streamer_usage(const gfx_texture_streamer_t *streamer);
+void gfx_texture_streamer_tick(gfx_texture_streamer_t *streamer);
+
+/* only 2d and 2d array textures are streamed, the tail levels being uploaded right away */
+uint32_t gfx_texture_streamer_add(gfx_texture_streamer_t *streamer, enum gfx_texture_type type, enum gfx_format format, uint8_t lod, uint32_t width, uint32_t height, uint32_t depth, gfx_texture_stream_load_fn_t load, void *userdata);
+void gfx_texture_streamer_remove(gfx_texture_streamer_t *streamer, uint32_t id);
+
+/* the pointer stays valid until the texture is removed, the texture behind it changes on ticks
+ * its addressing, filtering and anisotropy being kept
+ */
+gfx_texture_t *gfx_texture_streamer_get(gfx_texture_streamer_t *streamer, uint32_t id);
+
+/* the size in pixels the texture covers on screen, the largest of the frame being kept */
+void gfx_texture_streamer_feedback(gfx_texture_streamer_t *streamer, uint32_t id, float screen_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -40,6 +40,15 @@ static bool vk_wl_create_device(gfx_window_t *window)
 			VkInstance instance;
 			VkSurfaceKHR surface;
 			{
+				/* the device needs dynamic rendering, from the core 1.3 api or its extension */
+				VkApplicationInfo application_info;
+				application_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+				application_info.pNext = NULL;
+				application_info.pApplicationName = NULL;
+				application_info.applicationVersion = 0;
+				application_info.pEngineName = "gfx";
+				application_info.engineVersion = 0;
+				application_info.apiVersion = VK_API_VERSION_1_3;
 				VkInstanceCreateInfo create_info;
 				static const char *extensions[] =
 				{
@@ -49,7 +58,7 @@ static bool vk_wl_create_device(gfx_window_t *window)
 				create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 				create_info.pNext = NULL;
 				create_info.flags = 0;
-				create_info.pApplicationInfo = NULL;
+				create_info.pApplicationInfo = &application_info;
 				const char *layers[] =
 				{
 				};